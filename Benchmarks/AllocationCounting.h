@@ -0,0 +1,6 @@
+#pragma once
+#include <cstddef>
+
+// The heap allocations of the whole process so far. AllocationCounting.cpp replaces the global operator new and delete to count them,
+// in a translation unit of its own so the compiler never inlines the replacements into code that also sees the pointer's allocation
+size_t allocationCount();
@@ -0,0 +1,169 @@
+// Microbenchmarks of the client's hot kernels: cksum, AES encryption, request packing, response parsing, logging, Base64 and RSA key generation.
+// Every benchmark reports bytes per second where it makes sense and the heap allocations per operation.
+// Run with --benchmark_out=results.json --benchmark_out_format=json to keep results that can be diffed between releases
+// (Google Benchmark's tools/compare.py compares two such files).
+#include "cksum.h"
+#include "AESWrapper.h"
+#include "Base64Wrapper.h"
+#include "RSAWrapper.h"
+#include "Request.h"
+#include "Response.h"
+#include "Logger.h"
+#include "Constants.h"
+#include "AllocationCounting.h"
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <string>
+#include <vector>
+
+class AllocationCounter { // Counts the allocations of the process from its construction to report(), benchmarks report the ones made while they ran
+private:
+	size_t start;
+public:
+	AllocationCounter() : start(allocationCount()) {}
+	void report(benchmark::State& state) const {
+		state.counters["allocs_per_op"] = benchmark::Counter(static_cast<double>(allocationCount() - start), benchmark::Counter::kAvgIterations);
+	}
+};
+
+static std::string randomBytes(size_t length) {
+	std::string bytes(length, '\0');
+	uint32_t x = 2463534242u; // xorshift, the content doesn't matter but shouldn't be all zeros
+	for (char& c : bytes) {
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		c = static_cast<char>(x);
+	}
+	return bytes;
+}
+
+// Sizes from a small request to a large file, and the packet size the client actually cksums and encrypts
+#define BUFFER_SIZES ->RangeMultiplier(8)->Range(64, 1 << 20)->Arg(PACKET_SIZE)
+
+static void BM_Memcrc(benchmark::State& state) {
+	std::string data = randomBytes(state.range(0));
+	AllocationCounter counter;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(memcrc(data.data(), data.size()));
+	counter.report(state);
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Memcrc) BUFFER_SIZES;
+
+// The engines memcrc picks from, to see what the CPU dispatch is worth
+template <uint32_t (*Engine)(uint32_t, const void*, size_t)>
+static void BM_CrcEngine(benchmark::State& state) {
+	if (Engine == crc_update_clmul && !crc_has_clmul()) {
+		state.SkipWithError("CPU has no carry-less multiply");
+		return;
+	}
+	std::string data = randomBytes(state.range(0));
+	AllocationCounter counter;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(Engine(0, data.data(), data.size()));
+	counter.report(state);
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK_TEMPLATE(BM_CrcEngine, crc_update_sliced8) BUFFER_SIZES;
+BENCHMARK_TEMPLATE(BM_CrcEngine, crc_update_sliced16) BUFFER_SIZES;
+BENCHMARK_TEMPLATE(BM_CrcEngine, crc_update_clmul) BUFFER_SIZES;
+
+static void BM_AesEncrypt(benchmark::State& state) {
+	std::string key = randomBytes(AESWrapper::DEFAULT_KEYLENGTH);
+	AESWrapper aes(reinterpret_cast<const unsigned char*>(key.data()), AESWrapper::DEFAULT_KEYLENGTH);
+	std::string plain = randomBytes(state.range(0));
+	AllocationCounter counter;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(aes.encrypt(plain.data(), static_cast<unsigned int>(plain.size())));
+	counter.report(state);
+	state.SetBytesProcessed(state.iterations() * plain.size());
+}
+BENCHMARK(BM_AesEncrypt) BUFFER_SIZES;
+
+// Packing a packet of the given size into the connection's request buffer, which is all the client does per packet besides cksum and send
+static void BM_FilePacketRequest(benchmark::State& state) {
+	MessageBuffer buffer;
+	boost::uuids::uuid uuid{};
+	std::string content = randomBytes(state.range(0));
+	std::string fileName = "benchmark.bin";
+	AllocationCounter counter;
+	for (auto _ : state) {
+		FilePacketRequest request(buffer, uuid, 1 << 20, 1 << 20, 133, 7, 0x12345678, fileName, content.data(), content.size());
+		benchmark::DoNotOptimize(buffer.data());
+	}
+	counter.report(state);
+	state.SetBytesProcessed(state.iterations() * content.size());
+}
+BENCHMARK(BM_FilePacketRequest)->Arg(1024)->Arg(PACKET_SIZE);
+
+// Reading and unpacking the response to a packet (header and client id) from a loopback connection, so it includes the read
+static void BM_ReceivedMessageResponse(benchmark::State& state) {
+	using boost::asio::ip::tcp;
+	boost::asio::io_context ioContext;
+	tcp::acceptor acceptor(ioContext, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	tcp::socket client(ioContext), server(ioContext);
+	client.connect(acceptor.local_endpoint());
+	acceptor.accept(server);
+	std::vector<uint8_t> response(RESPONSE_HEADER_SIZE + UUID_SIZE, 0xab);
+	LayoutWriter<ResponseHeaderLayout>(response.data())
+		.set<ResponseHeaderLayout::VERSION_FIELD>(static_cast<uint8_t>(VERSION))
+		.set<ResponseHeaderLayout::CODE>(RECEIVED_MESSAGE_CODE)
+		.set<ResponseHeaderLayout::PAYLOAD_SIZE>(static_cast<uint32_t>(UUID_SIZE));
+	AllocationCounter counter;
+	for (auto _ : state) {
+		write(server, boost::asio::buffer(response));
+		ReceivedMessageResponse res(client, nullptr);
+		benchmark::DoNotOptimize(res.getUUID());
+	}
+	counter.report(state);
+	state.SetBytesProcessed(state.iterations() * response.size());
+}
+BENCHMARK(BM_ReceivedMessageResponse);
+
+// The line the client logs for every packet, through the ring (written out to /dev/null by the flusher)
+static void BM_LogMessage(benchmark::State& state) {
+	FILE* devNull = std::fopen("/dev/null", "w");
+	startLogging(LOG_INFO, devNull, devNull);
+	std::string fileName = "benchmark.bin";
+	uint32_t packetNumber = 0;
+	AllocationCounter counter;
+	for (auto _ : state)
+		logMessage(LOG_INFO, "Sent packet number %u for file %s", ++packetNumber, fileName.c_str());
+	counter.report(state);
+	stopLogging();
+	std::fclose(devNull);
+}
+BENCHMARK(BM_LogMessage);
+
+static void BM_Base64Encode(benchmark::State& state) {
+	std::string data = randomBytes(state.range(0));
+	AllocationCounter counter;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(Base64Wrapper::encode(data));
+	counter.report(state);
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Base64Encode)->RangeMultiplier(8)->Range(64, 64 << 10);
+
+static void BM_Base64Decode(benchmark::State& state) {
+	std::string encoded = Base64Wrapper::encode(randomBytes(state.range(0)));
+	AllocationCounter counter;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(Base64Wrapper::decode(encoded));
+	counter.report(state);
+	state.SetBytesProcessed(state.iterations() * encoded.size());
+}
+BENCHMARK(BM_Base64Decode)->RangeMultiplier(8)->Range(64, 64 << 10);
+
+// Generating the client's key pair and encoding the public key, as done once per sign up
+static void BM_RsaKeyGeneration(benchmark::State& state) {
+	AllocationCounter counter;
+	for (auto _ : state) {
+		RSAPrivateWrapper rsa;
+		benchmark::DoNotOptimize(rsa.getPublicKey());
+	}
+	counter.report(state);
+}
+BENCHMARK(BM_RsaKeyGeneration)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
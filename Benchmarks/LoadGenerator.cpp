@@ -0,0 +1,490 @@
+// Swarm load generator: simulates many concurrent clients against a running server, to size it, with the client's own Request and
+// Response classes. Sessions arrive open loop at --rate per second (a Poisson process) and are served by --clients simulated clients.
+// A session is a sign up, a reconnection, or a reconnection followed by an upload, picked by --mix, with an upload size from --sizes.
+// A session that finds every client busy waits for one and its latency counts from when it was due, so an overloaded server shows up
+// in the percentiles instead of slowing the arrivals down. --rate 0 runs the clients closed loop, each starting a session when its last one ends.
+//     load_generator [--address 127.0.0.1:1256] [--clients 64] [--rate 50] [--duration 30] [--mix signup=1,reconnect=2,upload=7]
+//                    [--sizes 64K,1M] [--identities 64] [--seed 1] [--json results.json]
+// Reports sessions and uploaded MB per second, latency percentiles for every kind of session, every response code the server answered
+// (errors the Response classes retried included) and why sessions failed. Each upload in flight holds its file encrypted in memory.
+#include "Request.h"
+#include "Response.h"
+#include "RSAWrapper.h"
+#include "AESWrapper.h"
+#include "Logger.h"
+#include "cksum.h"
+#include "Constants.h"
+#include <boost/asio.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+enum SessionKind { SIGNUP, RECONNECT, UPLOAD, SESSION_KINDS };
+static const char* const sessionNames[SESSION_KINDS] = { "signup", "reconnect", "upload" };
+
+struct Arrival { // A session of the schedule
+	Clock::duration due; // Since the start of the run
+	SessionKind kind;
+	uint64_t size; // Of the upload
+};
+
+struct Outcome {
+	SessionKind kind;
+	bool ok;
+	double latencyMs; // From when the session was due to its end
+	double waitMs; // From when it was due to when a client took it
+	uint64_t bytes; // Uploaded
+};
+
+struct Identity { // A client the server signed up. The server keeps one AES key per client, so a client is in one session at a time
+	boost::uuids::uuid uuid;
+	std::string name;
+	std::string privateKey;
+};
+
+struct KeyPair {
+	std::string privateKey, publicKey;
+};
+
+struct UploadFile { // Every upload of a size sends the same content, each under a name of its own
+	std::string content;
+	uint32_t cksum;
+};
+
+static uint64_t parseSize(const std::string& size) {
+	size_t end = 0;
+	uint64_t n = std::stoull(size, &end);
+	switch (end < size.size() ? std::toupper(size[end]) : 0) {
+	case 'K': return n << 10;
+	case 'M': return n << 20;
+	case 'G': return n << 30;
+	default: return n;
+	}
+}
+
+static double percentile(std::vector<double> values, double p) {
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+}
+
+// Every response code the server answered, counted by responseCodeObserver from all the clients' threads
+static std::array<std::atomic<uint64_t>, 32> responseCodes{}; // Codes from 1600
+static std::atomic<uint64_t> otherResponseCodes{ 0 };
+
+static void countResponseCode(uint16_t code) {
+	if (code >= REGISTRATION_SUCCEEDED_CODE && code < REGISTRATION_SUCCEEDED_CODE + responseCodes.size())
+		responseCodes[code - REGISTRATION_SUCCEEDED_CODE].fetch_add(1, std::memory_order_relaxed);
+	else
+		otherResponseCodes.fetch_add(1, std::memory_order_relaxed);
+}
+
+// The identities no session is using
+class IdentityPool {
+private:
+	std::mutex lock;
+	std::vector<Identity> idle;
+
+public:
+	void put(Identity identity) {
+		std::lock_guard<std::mutex> guard(lock);
+		idle.push_back(std::move(identity));
+	}
+
+	Identity take(std::mt19937_64& random) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (idle.empty()) // Can't happen while there are at least as many identities as clients
+			throw std::runtime_error("No idle identity");
+		std::swap(idle[std::uniform_int_distribution<size_t>(0, idle.size() - 1)(random)], idle.back());
+		Identity identity = std::move(idle.back());
+		idle.pop_back();
+		return identity;
+	}
+};
+
+struct Swarm { // What the simulated clients share
+	tcp::endpoint endpoint;
+	std::string runId; // Part of every name, the server refuses to sign a name up twice or to overwrite a file
+	std::vector<KeyPair> keys; // Key generation is the client's job, not the server's, so clients share a few pregenerated pairs
+	std::map<uint64_t, UploadFile> files;
+	IdentityPool identities;
+	std::atomic<uint64_t> names{ 0 };
+	std::atomic<uint64_t> uploads{ 0 };
+};
+
+// A client of the swarm, running one session at a time over a connection of its own, like the real client
+class SimulatedClient {
+private:
+	Swarm& swarm;
+	boost::asio::io_context ioContext;
+	MessageBuffer requestBuffer;
+	std::mt19937_64 random;
+
+	tcp::socket connect() {
+		tcp::socket socket(ioContext);
+		socket.connect(swarm.endpoint);
+		socket.set_option(tcp::no_delay(true));
+		return socket;
+	}
+
+	void signup(tcp::socket& socket) {
+		const KeyPair& keys = swarm.keys[std::uniform_int_distribution<size_t>(0, swarm.keys.size() - 1)(random)];
+		Identity identity{ {}, "load_" + swarm.runId + "_" + std::to_string(swarm.names++), keys.privateKey };
+		RegistrationRequest regReq(requestBuffer, identity.name);
+		regReq.send(socket);
+		RegistrationResponse regRes(socket, &regReq);
+		identity.uuid = regRes.getUUID();
+		PublicKeyRequest pubkReq(requestBuffer, identity.uuid, identity.name, keys.publicKey);
+		pubkReq.send(socket);
+		AesResponse aesRes(socket, &pubkReq, identity.privateKey);
+		if (aesRes.getUUID() != identity.uuid)
+			throw std::runtime_error("Server provided bad UUID");
+		swarm.identities.put(std::move(identity)); // Reconnections and uploads can use it from now on
+	}
+
+	std::string login(tcp::socket& socket, const Identity& identity) {
+		ReconnectionRequest reconReq(requestBuffer, identity.uuid, identity.name);
+		reconReq.send(socket);
+		AesResponse aesRes(socket, &reconReq, identity.privateKey);
+		if (aesRes.getCode() == RECONNECTION_FAILED_CODE)
+			throw std::runtime_error("Reconnection failed");
+		if (aesRes.getUUID() != identity.uuid)
+			throw std::runtime_error("Server provided bad UUID");
+		return aesRes.getAES();
+	}
+
+	// Sends the file the way Client::sendEncryptedFile does, a packet and its response at a time
+	void upload(tcp::socket& socket, const Identity& identity, const std::string& aes, const UploadFile& file) {
+		std::string fileName = "load_" + swarm.runId + "_" + std::to_string(swarm.uploads++) + ".bin";
+		AESWrapper aesWrapper(reinterpret_cast<const unsigned char*>(aes.data()), static_cast<unsigned int>(aes.size()));
+		std::string encrypted = aesWrapper.encrypt(file.content.data(), static_cast<unsigned int>(file.content.size()));
+		uint32_t encryptedSize = static_cast<uint32_t>(encrypted.size());
+		uint16_t totalPackets = static_cast<uint16_t>((encryptedSize + PACKET_SIZE - 1) / PACKET_SIZE);
+		for (uint32_t packetNumber = 1; packetNumber <= totalPackets; packetNumber++) {
+			size_t offset = static_cast<size_t>(packetNumber - 1) * PACKET_SIZE;
+			size_t bytesToSend = std::min(static_cast<size_t>(PACKET_SIZE), encryptedSize - offset);
+			const char* content = encrypted.data() + offset;
+			FilePacketRequest fpReq(requestBuffer, identity.uuid, encryptedSize, static_cast<uint32_t>(file.content.size()), totalPackets, static_cast<uint16_t>(packetNumber),
+				static_cast<uint32_t>(memcrc(content, bytesToSend)), fileName, content, bytesToSend);
+			fpReq.send(socket);
+			ReceivedMessageResponse fpRes(socket, &fpReq);
+		}
+		FileReceivedResponse fileRecRes(socket);
+		if (fileRecRes.getCode() == PACKETS_NACK_CODE)
+			throw std::runtime_error("Packets arrived corrupted");
+		if (fileRecRes.getContentSize() != encryptedSize || fileRecRes.getCRC() != file.cksum) {
+			AbortInvalidCRCRequest abortReq(requestBuffer, identity.uuid, fileName);
+			abortReq.send(socket);
+			ReceivedMessageResponse msgRes(socket, &abortReq);
+			throw std::runtime_error("Server received a different file");
+		}
+		DoneValidCRCRequest doneValidReq(requestBuffer, identity.uuid, fileName);
+		doneValidReq.send(socket);
+		ReceivedMessageResponse msgRes(socket, &doneValidReq);
+	}
+
+public:
+	std::map<std::string, uint64_t> failures; // By reason
+	std::vector<Outcome> outcomes;
+
+	SimulatedClient(Swarm& swarm, uint64_t seed) : swarm(swarm), requestBuffer{}, random(seed) {}
+
+	void run(const Arrival& arrival, Clock::time_point due) {
+		auto started = Clock::now();
+		Outcome outcome{ arrival.kind, false, 0, std::chrono::duration<double, std::milli>(started - due).count(), 0 };
+		try {
+			tcp::socket socket = connect();
+			if (arrival.kind == SIGNUP)
+				signup(socket);
+			else {
+				Identity identity = swarm.identities.take(random);
+				try {
+					std::string aes = login(socket, identity);
+					if (arrival.kind == UPLOAD) {
+						upload(socket, identity, aes, swarm.files.at(arrival.size));
+						outcome.bytes = arrival.size;
+					}
+				}
+				catch (...) {
+					swarm.identities.put(std::move(identity));
+					throw;
+				}
+				swarm.identities.put(std::move(identity));
+			}
+			outcome.ok = true;
+		}
+		catch (const ServerBusyError&) {
+			failures["Server busy"]++;
+		}
+		catch (const boost::system::system_error& e) { // Refused, reset, or closed by the server
+			failures[e.code().message()]++;
+		}
+		catch (const std::exception& e) {
+			std::string reason = e.what();
+			reason = reason.substr(0, reason.find('\n')); // Its first line, the reasons are printed one per line and written to JSON
+			std::replace(reason.begin(), reason.end(), '"', '\'');
+			failures[reason]++;
+		}
+		outcome.latencyMs = std::chrono::duration<double, std::milli>(Clock::now() - due).count();
+		outcomes.push_back(outcome);
+	}
+};
+
+static int usage(const char* program) {
+	std::cerr << "Usage: " << program << " [--address 127.0.0.1:1256] [--clients 64] [--rate 50] [--duration 30] [--identities N] [--seed 1]"
+		" [--mix signup=1,reconnect=2,upload=7] [--sizes 64K,1M] [--json results.json]" << std::endl;
+	return 2;
+}
+
+int main(int argc, char* argv[]) {
+	std::string address = "127.0.0.1:1256";
+	unsigned clients = 64, identityCount = 0;
+	double rate = 50, duration = 30;
+	std::array<double, SESSION_KINDS> mix = { 1, 2, 7 };
+	std::vector<uint64_t> sizes = { 64 << 10, 1 << 20 };
+	uint64_t seed = 1;
+	std::string jsonPath;
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (i + 1 == argc) {
+				std::cerr << option << " needs a value" << std::endl;
+				return usage(argv[0]);
+			}
+			std::string value = argv[++i];
+			if (option == "--address") address = value;
+			else if (option == "--clients") clients = std::max(1, std::stoi(value));
+			else if (option == "--rate") rate = std::stod(value);
+			else if (option == "--duration") duration = std::stod(value);
+			else if (option == "--identities") identityCount = static_cast<unsigned>(std::stoul(value));
+			else if (option == "--seed") seed = std::stoull(value);
+			else if (option == "--json") jsonPath = value;
+			else if (option == "--mix") {
+				mix.fill(0);
+				std::istringstream list(value);
+				for (std::string weight; std::getline(list, weight, ',');) {
+					size_t equals = weight.find('=');
+					auto name = std::find(std::begin(sessionNames), std::end(sessionNames), weight.substr(0, equals));
+					if (equals == std::string::npos || name == std::end(sessionNames)) {
+						std::cerr << "Mix entries are signup=, reconnect= or upload= followed by a weight" << std::endl;
+						return usage(argv[0]);
+					}
+					mix[name - std::begin(sessionNames)] = std::stod(weight.substr(equals + 1));
+				}
+			}
+			else if (option == "--sizes") {
+				sizes.clear();
+				std::istringstream list(value);
+				for (std::string size; std::getline(list, size, ',');)
+					sizes.push_back(parseSize(size));
+			}
+			else {
+				std::cerr << "Unknown option " << option << std::endl;
+				return usage(argv[0]);
+			}
+		}
+	}
+	catch (const std::exception& e) { // A number or size that doesn't parse
+		std::cerr << "Bad option value: " << e.what() << std::endl;
+		return usage(argv[0]);
+	}
+	if (sizes.empty() || std::all_of(mix.begin(), mix.end(), [](double weight) { return weight <= 0; })) {
+		std::cerr << "Nothing to run" << std::endl;
+		return 2;
+	}
+	for (uint64_t size : sizes)
+		if (size == 0 || size > static_cast<uint64_t>(UINT16_MAX) * PACKET_SIZE - 16) {
+			std::cerr << "Upload sizes go from 1 byte to " << static_cast<uint64_t>(UINT16_MAX) * PACKET_SIZE - 16 << " bytes" << std::endl;
+			return 2;
+		}
+	identityCount = std::max(identityCount, clients); // So a client always finds an idle identity
+
+	const char* level = std::getenv("CLIENT_LOG_LEVEL"); // Only the errors by default, the response codes already count the warnings
+	startLogging(level ? parseLogLevel(level) : LOG_ERROR, stderr);
+	responseCodeObserver = countResponseCode;
+	Swarm swarm;
+	try {
+		boost::asio::io_context ioContext;
+		size_t colon = address.rfind(':');
+		swarm.endpoint = *tcp::resolver(ioContext).resolve(address.substr(0, colon), colon == std::string::npos ? "1256" : address.substr(colon + 1)).begin();
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Cannot resolve " << address << ": " << e.what() << std::endl;
+		return 2;
+	}
+	std::mt19937_64 random(seed);
+	swarm.runId = std::to_string(std::random_device{}() & 0xffffff); // Random even with the same seed, names must differ from the last run's
+	for (int i = 0; i < 8; i++) {
+		RSAPrivateWrapper rsa;
+		swarm.keys.push_back({ rsa.getPrivateKey(), rsa.getPublicKey() });
+	}
+	for (uint64_t size : sizes) {
+		UploadFile& file = swarm.files[size];
+		file.content.resize(size);
+		std::generate(file.content.begin(), file.content.end(), [&] { return static_cast<char>(random()); });
+		file.cksum = static_cast<uint32_t>(memcrc(file.content.data(), file.content.size()));
+	}
+
+	// Signing the identities up beforehand, closed loop and outside the measurement
+	auto signupStart = Clock::now();
+	{
+		std::vector<std::unique_ptr<SimulatedClient>> signers;
+		for (unsigned i = 0; i < clients; i++)
+			signers.push_back(std::make_unique<SimulatedClient>(swarm, random()));
+		std::atomic<unsigned> next{ 0 };
+		std::vector<std::thread> threads;
+		for (auto& signer : signers)
+			threads.emplace_back([&, client = signer.get()] {
+				while (next++ < identityCount)
+					client->run({ {}, SIGNUP, 0 }, Clock::now());
+			});
+		for (std::thread& thread : threads)
+			thread.join();
+		for (auto& signer : signers)
+			if (!signer->failures.empty()) {
+				stopLogging();
+				std::cerr << "Signing up failed: " << signer->failures.begin()->first << std::endl;
+				return 1;
+			}
+	}
+	double signupSeconds = std::chrono::duration<double>(Clock::now() - signupStart).count();
+	for (auto& count : responseCodes) // Only the run's responses are reported
+		count = 0;
+	otherResponseCodes = 0;
+
+	// The schedule of an open loop run is drawn up front, so sessions arrive on time however the server keeps up
+	std::discrete_distribution<int> pickKind(mix.begin(), mix.end());
+	std::uniform_int_distribution<size_t> pickSize(0, sizes.size() - 1);
+	std::vector<Arrival> arrivals;
+	if (rate > 0) {
+		std::exponential_distribution<double> gap(rate);
+		for (double at = gap(random); at < duration; at += gap(random))
+			arrivals.push_back({ std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(at)), static_cast<SessionKind>(pickKind(random)), sizes[pickSize(random)] });
+	}
+	std::vector<std::unique_ptr<SimulatedClient>> swarmClients;
+	std::vector<uint64_t> closedLoopSeeds;
+	for (unsigned i = 0; i < clients; i++) {
+		swarmClients.push_back(std::make_unique<SimulatedClient>(swarm, random()));
+		closedLoopSeeds.push_back(random());
+	}
+	std::atomic<size_t> next{ 0 };
+	auto start = Clock::now();
+	auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(duration));
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < clients; i++)
+		threads.emplace_back([&, i] {
+			SimulatedClient& client = *swarmClients[i];
+			if (rate > 0) { // Each client takes the next session due, and waits for it if it isn't due yet
+				for (size_t n; (n = next++) < arrivals.size();) {
+					std::this_thread::sleep_until(start + arrivals[n].due);
+					client.run(arrivals[n], start + arrivals[n].due);
+				}
+				return;
+			}
+			std::mt19937_64 own(closedLoopSeeds[i]); // Closed loop, every client draws its own sessions
+			auto kinds = pickKind;
+			auto sizeIndexes = pickSize;
+			for (auto now = Clock::now(); now < end; now = Clock::now())
+				client.run({ now - start, static_cast<SessionKind>(kinds(own)), sizes[sizeIndexes(own)] }, now);
+		});
+	for (std::thread& thread : threads)
+		thread.join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	responseCodeObserver = nullptr;
+	stopLogging();
+
+	std::array<std::vector<double>, SESSION_KINDS> latencies, waits;
+	std::array<uint64_t, SESSION_KINDS> failed{};
+	std::map<std::string, uint64_t> failures;
+	uint64_t sessions = 0, bytes = 0;
+	for (auto& client : swarmClients) {
+		for (const Outcome& outcome : client->outcomes) {
+			sessions++;
+			waits[outcome.kind].push_back(outcome.waitMs);
+			if (!outcome.ok) {
+				failed[outcome.kind]++;
+				continue;
+			}
+			latencies[outcome.kind].push_back(outcome.latencyMs);
+			bytes += outcome.bytes;
+		}
+		for (auto& [reason, count] : client->failures)
+			failures[reason] += count;
+	}
+
+	std::cout << "Server " << address << ", " << clients << " clients, ";
+	if (rate > 0)
+		std::cout << "open loop at " << rate << " sessions/s for " << duration << " s (" << arrivals.size() << " sessions due)\n";
+	else
+		std::cout << "closed loop for " << duration << " s\n";
+	std::cout << std::fixed << std::setprecision(2) << "Signed up " << identityCount << " identities beforehand in " << signupSeconds << " s\n";
+	std::cout << "Ran " << sessions << " sessions in " << seconds << " s: " << sessions / seconds << " sessions/s, "
+		<< bytes / seconds / (1 << 20) << " MB/s uploaded\n\n";
+	std::cout << std::setw(10) << "session" << std::setw(8) << "ok" << std::setw(8) << "failed" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+		<< std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << std::setw(13) << "wait p99 ms" << "\n";
+	for (int kind = 0; kind < SESSION_KINDS; kind++) {
+		if (waits[kind].empty())
+			continue;
+		const std::vector<double>& l = latencies[kind];
+		std::cout << std::setw(10) << sessionNames[kind] << std::setw(8) << l.size() << std::setw(8) << failed[kind] << std::setw(10) << percentile(l, 0.5)
+			<< std::setw(10) << percentile(l, 0.9) << std::setw(10) << percentile(l, 0.99) << std::setw(10) << percentile(l, 1)
+			<< std::setw(13) << percentile(waits[kind], 0.99) << "\n";
+	}
+	std::cout << "(latency of the sessions that succeeded, from when each was due; wait is how long a session waited for a free client)\n\nResponse codes:";
+	for (size_t i = 0; i < responseCodes.size(); i++)
+		if (responseCodes[i])
+			std::cout << " " << REGISTRATION_SUCCEEDED_CODE + i << " x " << responseCodes[i];
+	if (otherResponseCodes)
+		std::cout << " other x " << otherResponseCodes;
+	std::cout << "\n";
+	for (auto& [reason, count] : failures)
+		std::cout << "Failed: " << reason << " x " << count << "\n";
+	std::cout << std::flush;
+
+	if (!jsonPath.empty()) {
+		std::ofstream json(jsonPath);
+		json << std::fixed << std::setprecision(3) << "{\"address\": \"" << address << "\", \"clients\": " << clients << ", \"rate\": " << rate
+			<< ", \"duration_s\": " << duration << ", \"seconds\": " << seconds << ", \"sessions\": " << sessions << ", \"sessions_per_s\": " << sessions / seconds
+			<< ", \"mb_per_s\": " << bytes / seconds / (1 << 20) << ", \"kinds\": {";
+		for (int kind = 0; kind < SESSION_KINDS; kind++) {
+			const std::vector<double>& l = latencies[kind];
+			json << (kind ? ", " : "") << "\"" << sessionNames[kind] << "\": {\"ok\": " << l.size() << ", \"failed\": " << failed[kind]
+				<< ", \"latency_ms\": {\"p50\": " << percentile(l, 0.5) << ", \"p90\": " << percentile(l, 0.9) << ", \"p99\": " << percentile(l, 0.99)
+				<< ", \"max\": " << percentile(l, 1) << "}, \"wait_ms_p99\": " << percentile(waits[kind], 0.99) << "}";
+		}
+		json << "}, \"response_codes\": {";
+		bool first = true;
+		for (size_t i = 0; i < responseCodes.size(); i++)
+			if (responseCodes[i]) {
+				json << (first ? "" : ", ") << "\"" << REGISTRATION_SUCCEEDED_CODE + i << "\": " << responseCodes[i];
+				first = false;
+			}
+		json << "}, \"failures\": {";
+		first = true;
+		for (auto& [reason, count] : failures) {
+			json << (first ? "" : ", ") << "\"" << reason << "\": " << count;
+			first = false;
+		}
+		json << "}}\n";
+	}
+	return 0;
+}
@@ -0,0 +1,298 @@
+// End-to-end upload benchmark over loopback: starts a local server (the Python server by default, or any command given with --server,
+// such as the native server), then drives the real Client through sign up, login and sendEncryptedFile for every file size of the matrix.
+// Reports throughput, packet round trip percentiles, handshake latency, and peak RSS and CPU time of both ends. Linux only (it reads /proc).
+//     loopback_benchmark [--sizes 64K,1M,16M] [--runs 3] [--server "python3 ../Server/main.py"] [--json results.json] [--trace trace.json]
+//         [--latency 40ms] [--jitter 5ms] [--bandwidth 1M]
+// The link options put an emulated WAN link (NetworkEmulator, latency and jitter one way, bandwidth in bytes per second each way)
+// between the client and the server, which loopback alone hides.
+// The client keeps transfer.info, me.info and priv.key next to its executable, so the benchmark writes its own there and removes them at the end.
+// What the client logs (a line per packet) goes to client.log in the benchmark's directory, which is kept when a run fails.
+#include "Client.h"
+#include "FileHelper.h"
+#include "Trace.h"
+#include "Logger.h"
+#include "NetworkEmulator.h"
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef REPO_DIR
+#define REPO_DIR ".."
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Usage { // Of one process, read from /proc
+	double cpuSeconds; // User and system time of all its threads
+	long peakRssKb; // Since the last resetPeakRss
+};
+
+static Usage readUsage(pid_t pid) {
+	std::string proc = "/proc/" + std::to_string(pid);
+	std::ifstream stat(proc + "/stat");
+	std::string line;
+	std::getline(stat, line);
+	std::istringstream fields(line.substr(line.rfind(')') + 2)); // The command name may hold spaces, the fields after it don't
+	std::string field;
+	unsigned long long utime = 0, stime = 0;
+	for (int i = 3; fields >> field; i++) {
+		if (i == 14) utime = std::stoull(field);
+		if (i == 15) { stime = std::stoull(field); break; }
+	}
+	Usage usage{ static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK), 0 };
+	std::ifstream status(proc + "/status");
+	while (std::getline(status, line))
+		if (line.rfind("VmHWM:", 0) == 0)
+			usage.peakRssKb = std::stol(line.substr(6));
+	return usage;
+}
+
+static void resetPeakRss(pid_t pid) { // Linux 4.0 and later, older kernels keep the peak of the whole process lifetime
+	std::ofstream("/proc/" + std::to_string(pid) + "/clear_refs") << "5";
+}
+
+static uint64_t parseSize(const std::string& size) {
+	size_t end = 0;
+	uint64_t n = std::stoull(size, &end);
+	switch (end < size.size() ? std::toupper(size[end]) : 0) {
+	case 'K': return n << 10;
+	case 'M': return n << 20;
+	case 'G': return n << 30;
+	default: return n;
+	}
+}
+
+static std::string formatSize(uint64_t size) {
+	if (size >= (1 << 20) && size % (1 << 20) == 0) return std::to_string(size >> 20) + "M";
+	if (size >= (1 << 10) && size % (1 << 10) == 0) return std::to_string(size >> 10) + "K";
+	return std::to_string(size);
+}
+
+static double percentile(std::vector<double> values, double p) {
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+}
+
+static uint16_t freePort() {
+	boost::asio::io_context ioContext;
+	boost::asio::ip::tcp::acceptor acceptor(ioContext, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	return acceptor.local_endpoint().port();
+}
+
+// Runs the server command from dir (where it keeps its databases and files), its output going to server.log there
+static pid_t startServer(const std::string& command, const fs::path& dir, uint16_t port) {
+	std::ofstream(dir / "port.info") << port;
+	pid_t pid = fork();
+	if (pid < 0)
+		throw std::runtime_error("Cannot start the server");
+	if (pid == 0) {
+		if (chdir(dir.c_str()) != 0)
+			_exit(127);
+		int log = open("server.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		dup2(log, STDOUT_FILENO);
+		dup2(log, STDERR_FILENO);
+		execl("/bin/sh", "sh", "-c", ("exec " + command).c_str(), static_cast<char*>(nullptr)); // exec, so pid is the server's own and /proc shows its usage
+		_exit(127);
+	}
+	boost::asio::io_context ioContext;
+	for (int i = 0; i < 200; i++) { // Up to 20 seconds for the server to listen
+		boost::asio::ip::tcp::socket probe(ioContext);
+		boost::system::error_code error;
+		probe.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), error);
+		if (!error)
+			return pid;
+		if (waitpid(pid, nullptr, WNOHANG) == pid)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	kill(pid, SIGTERM);
+	throw std::runtime_error("Server didn't start, see " + (dir / "server.log").string());
+}
+
+static void writeTransferFile(uint16_t port, const std::string& name, const fs::path& file) {
+	std::ofstream(getExecutablePath() / "transfer.info") << "127.0.0.1:" << port << "\n" << name << "\n" << file.string() << "\n";
+}
+
+struct Run {
+	uint64_t size;
+	int run;
+	double handshakeMs;
+	double seconds;
+	std::vector<double> roundTripsUs;
+	Usage client, server;
+};
+
+static int usage(const char* program) {
+	std::cerr << "Usage: " << program << " [--sizes 64K,1M,16M,64M] [--runs 3] [--server command] [--json results.json] [--trace trace.json]"
+		" [--latency 40ms] [--jitter 5ms] [--bandwidth 1M]" << std::endl;
+	return 2;
+}
+
+int main(int argc, char* argv[]) {
+	std::vector<uint64_t> sizes = { 64 << 10, 1 << 20, 16 << 20, 64 << 20 };
+	int runs = 3;
+	std::string serverCommand = "python3 -u " REPO_DIR "/Server/main.py";
+	std::string jsonPath;
+	LinkConditions link;
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (i + 1 == argc) {
+				std::cerr << option << " needs a value" << std::endl;
+				return usage(argv[0]);
+			}
+			std::string value = argv[++i];
+			if (option == "--sizes") {
+				sizes.clear();
+				std::istringstream list(value);
+				for (std::string size; std::getline(list, size, ',');)
+					sizes.push_back(parseSize(size));
+			}
+			else if (option == "--runs") runs = std::stoi(value);
+			else if (option == "--server") serverCommand = value;
+			else if (option == "--json") jsonPath = value;
+			else if (option == "--trace") startTracing(value); // The client's phases in every run, as Chrome trace events
+			else if (option == "--latency") link.latency = parseDuration(value);
+			else if (option == "--jitter") link.jitter = parseDuration(value);
+			else if (option == "--bandwidth") link.bandwidth = parseRate(value);
+			else {
+				std::cerr << "Unknown option " << option << std::endl;
+				return usage(argv[0]);
+			}
+		}
+	}
+	catch (const std::exception& e) { // A number, size, duration or rate that doesn't parse
+		std::cerr << "Bad option value: " << e.what() << std::endl;
+		return usage(argv[0]);
+	}
+	for (uint64_t size : sizes)
+		if (size > static_cast<uint64_t>(UINT16_MAX) * PACKET_SIZE - 16) {
+			std::cerr << "Files over " << formatSize(static_cast<uint64_t>(UINT16_MAX) * PACKET_SIZE) << " don't fit the packet numbers" << std::endl;
+			return 2;
+		}
+
+	fs::path work = fs::temp_directory_path() / ("loopback_benchmark_" + std::to_string(getpid()));
+	fs::create_directories(work / "server");
+	fs::create_directories(work / "files");
+	uint16_t port = freePort();
+	pid_t server = startServer(serverCommand, work / "server", port);
+	std::unique_ptr<NetworkEmulator> emulator;
+	bool emulated = link.latency.count() || link.jitter.count() || link.bandwidth;
+	if (emulated) { // The client connects to the emulated link, which connects to the server
+		boost::asio::ip::address loopback = boost::asio::ip::address_v4::loopback();
+		emulator = std::make_unique<NetworkEmulator>(boost::asio::ip::tcp::endpoint(loopback, 0), boost::asio::ip::tcp::endpoint(loopback, port), link, link);
+		emulator->start();
+	}
+	uint16_t clientPort = emulator ? emulator->port() : port;
+	FILE* clientLog = std::fopen((work / "client.log").c_str(), "w");
+	startLogging(LOG_INFO, clientLog, clientLog); // Retries and failures too, next to the lines they follow
+	std::string name = "bench" + std::to_string(getpid());
+	std::vector<Run> results;
+	double signupMs = 0;
+	int rc = 0;
+	try {
+		fs::path signupFile = work / "files" / "signup.bin"; // The client checks the file in transfer.info exists when it starts
+		std::ofstream(signupFile) << name;
+		writeTransferFile(clientPort, name, signupFile);
+		fs::remove(getExecutablePath() / "me.info"); // Signing up once, every run after it logs in with the keys it saved
+		fs::remove(getExecutablePath() / "priv.key");
+		auto start = Clock::now();
+		Client{};
+		signupMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		std::mt19937_64 random(42); // The same files every time, encryption makes their content irrelevant to the server anyway
+		for (uint64_t size : sizes)
+			for (int run = 1; run <= runs; run++) {
+				fs::path file = work / "files" / ("bench_" + formatSize(size) + "_" + std::to_string(run) + ".bin"); // A new name every run, the server refuses to overwrite a file
+				{
+					std::ofstream data(file, std::ios::binary);
+					std::vector<uint64_t> block(1 << 13);
+					for (uint64_t written = 0; written < size; written += block.size() * sizeof(uint64_t)) {
+						std::generate(block.begin(), block.end(), std::ref(random));
+						data.write(reinterpret_cast<const char*>(block.data()), std::min<uint64_t>(size - written, block.size() * sizeof(uint64_t)));
+					}
+				}
+				writeTransferFile(clientPort, name, file);
+				resetPeakRss(getpid());
+				resetPeakRss(server);
+				Usage clientBefore = readUsage(getpid()), serverBefore = readUsage(server);
+				auto start = Clock::now();
+				Client client;
+				auto connected = Clock::now();
+				client.sendEncryptedFile();
+				auto done = Clock::now();
+				Usage clientAfter = readUsage(getpid()), serverAfter = readUsage(server);
+				Run result{ size, run, std::chrono::duration<double, std::milli>(connected - start).count(), std::chrono::duration<double>(done - connected).count(), {},
+					{ clientAfter.cpuSeconds - clientBefore.cpuSeconds, clientAfter.peakRssKb },
+					{ serverAfter.cpuSeconds - serverBefore.cpuSeconds, serverAfter.peakRssKb } };
+				for (auto roundTrip : client.getPacketRoundTrips())
+					result.roundTripsUs.push_back(std::chrono::duration<double, std::micro>(roundTrip).count());
+				results.push_back(std::move(result));
+				fs::remove(file);
+			}
+	}
+	catch (std::exception& e) {
+		std::cerr << "Exception: " << e.what() << std::endl;
+		rc = 1;
+	}
+	emulator.reset();
+	kill(server, SIGTERM);
+	waitpid(server, nullptr, 0);
+	writeTrace();
+	stopLogging();
+	std::fclose(clientLog);
+	for (const char* file : { "transfer.info", "me.info", "priv.key" })
+		fs::remove(getExecutablePath() / file);
+	if (rc == 0)
+		fs::remove_all(work);
+	else
+		std::cerr << "Logs kept in " << work.string() << std::endl;
+
+	std::cout << "Server: " << serverCommand << std::fixed << std::setprecision(2);
+	if (emulated)
+		std::cout << "\nLink: " << link.latency.count() / 1000.0 << " ms +- " << link.jitter.count() / 1000.0 << " ms one way, "
+			<< (link.bandwidth ? formatSize(link.bandwidth) + "/s" : std::string("no bandwidth cap")) << " each way";
+	std::cout << "\nSign up handshake: " << signupMs << " ms\n\n";
+	std::cout << std::setw(6) << "size" << std::setw(5) << "run" << std::setw(10) << "MB/s" << std::setw(13) << "login ms"
+		<< std::setw(10) << "rtt p50" << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "max"
+		<< std::setw(11) << "cli cpu s" << std::setw(11) << "cli MB" << std::setw(11) << "srv cpu s" << std::setw(11) << "srv MB" << "\n";
+	for (const Run& r : results)
+		std::cout << std::setw(6) << formatSize(r.size) << std::setw(5) << r.run << std::setw(10) << r.size / r.seconds / (1 << 20) << std::setw(13) << r.handshakeMs
+			<< std::setw(10) << percentile(r.roundTripsUs, 0.5) << std::setw(10) << percentile(r.roundTripsUs, 0.9)
+			<< std::setw(10) << percentile(r.roundTripsUs, 0.99) << std::setw(10) << percentile(r.roundTripsUs, 1)
+			<< std::setw(11) << r.client.cpuSeconds << std::setw(11) << r.client.peakRssKb / 1024.0
+			<< std::setw(11) << r.server.cpuSeconds << std::setw(11) << r.server.peakRssKb / 1024.0 << "\n";
+	std::cout << "(round trips in microseconds, per packet of " << PACKET_SIZE << " bytes)" << std::endl;
+
+	if (!jsonPath.empty()) { // One object per run, to compare between releases
+		std::ofstream json(jsonPath);
+		json << std::fixed << std::setprecision(3) << "{\"server\": \"" << serverCommand << "\", \"link\": {\"latency_ms\": " << link.latency.count() / 1000.0
+			<< ", \"jitter_ms\": " << link.jitter.count() / 1000.0 << ", \"bandwidth\": " << link.bandwidth << "}, \"signup_ms\": " << signupMs << ", \"runs\": [";
+		for (size_t i = 0; i < results.size(); i++) {
+			const Run& r = results[i];
+			json << (i ? ",\n" : "\n") << "{\"size\": " << r.size << ", \"run\": " << r.run << ", \"mb_per_s\": " << r.size / r.seconds / (1 << 20)
+				<< ", \"login_ms\": " << r.handshakeMs << ", \"rtt_us\": {\"p50\": " << percentile(r.roundTripsUs, 0.5) << ", \"p90\": " << percentile(r.roundTripsUs, 0.9)
+				<< ", \"p99\": " << percentile(r.roundTripsUs, 0.99) << ", \"max\": " << percentile(r.roundTripsUs, 1) << "}"
+				<< ", \"client\": {\"cpu_s\": " << r.client.cpuSeconds << ", \"peak_rss_kb\": " << r.client.peakRssKb << "}"
+				<< ", \"server\": {\"cpu_s\": " << r.server.cpuSeconds << ", \"peak_rss_kb\": " << r.server.peakRssKb << "}}";
+		}
+		json << "\n]}\n";
+	}
+	return rc;
+}
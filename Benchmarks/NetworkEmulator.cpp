@@ -0,0 +1,212 @@
+#include "NetworkEmulator.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr size_t SEGMENT_SIZE = 1448; // A TCP segment's payload on an Ethernet path, the unit the link serializes and jitters
+constexpr size_t READ_SIZE = 64 << 10;
+
+// The two directions of one proxied connection. A direction has at most one read and one write (or wait for the next segment) pending,
+// and all of them run on the emulator's one thread
+class ProxyConnection : public std::enable_shared_from_this<ProxyConnection> {
+private:
+	struct Segment {
+		Clock::time_point arrival;
+		size_t size;
+	};
+
+	struct Direction { // Bytes read from one end, in flight to the other
+		tcp::socket& from;
+		tcp::socket& to;
+		LinkState& link;
+		boost::asio::steady_timer timer;
+		std::vector<uint8_t> readBuffer;
+		std::vector<uint8_t> inFlight; // The bytes of segments, from head on
+		size_t head = 0;
+		std::deque<Segment> segments;
+		std::vector<uint8_t> writeBuffer; // The due segments being written, copied out so reads can append to inFlight meanwhile
+		Clock::time_point lastArrival;
+		bool reading = false, writing = false, waiting = false;
+		bool ended = false; // The sender closed its end, it is closed on the receiver once the segments in flight are delivered
+		bool broken = false; // The receiver is gone, what the sender still sends is dropped
+
+		Direction(tcp::socket& from, tcp::socket& to, LinkState& link, boost::asio::io_context& ioContext)
+			: from(from), to(to), link(link), timer(ioContext), readBuffer(READ_SIZE) {}
+		size_t queued() const { return inFlight.size() - head; }
+	};
+
+	tcp::socket client, server;
+	std::mt19937_64& random;
+	Direction up, down;
+
+	void read(Direction& d) {
+		if (d.reading || d.ended || d.queued() >= d.link.conditions.queueLimit) // A full link stops reading, and TCP slows the sender down
+			return;
+		d.reading = true;
+		d.from.async_read_some(boost::asio::buffer(d.readBuffer), [this, &d, self = shared_from_this()](const boost::system::error_code& error, size_t size) {
+			d.reading = false;
+			if (error) { // Closed or reset, either way nothing more comes from this end
+				d.ended = true;
+				deliver(d);
+				return;
+			}
+			if (!d.broken) {
+				enqueue(d, size);
+				deliver(d);
+			}
+			read(d);
+		});
+	}
+
+	// Schedules the bytes read as segments: each is sent once the link finished sending the ones before it (of every connection),
+	// takes its size over the bandwidth to send, and arrives after the latency plus jitter
+	void enqueue(Direction& d, size_t size) {
+		if (d.head > 0 && d.head >= d.inFlight.size() / 2) {
+			d.inFlight.erase(d.inFlight.begin(), d.inFlight.begin() + d.head);
+			d.head = 0;
+		}
+		d.inFlight.insert(d.inFlight.end(), d.readBuffer.begin(), d.readBuffer.begin() + size);
+		const LinkConditions& c = d.link.conditions;
+		std::normal_distribution<double> jitter(0, static_cast<double>(c.jitter.count()));
+		auto now = Clock::now();
+		for (size_t offset = 0; offset < size; offset += SEGMENT_SIZE) {
+			size_t segment = std::min(SEGMENT_SIZE, size - offset);
+			auto sent = std::max(now, d.link.busyUntil);
+			if (c.bandwidth)
+				sent += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(static_cast<double>(segment) / c.bandwidth));
+			d.link.busyUntil = sent;
+			auto delay = c.latency + std::chrono::microseconds(c.jitter.count() ? std::llround(jitter(random)) : 0);
+			auto arrival = sent + std::max<Clock::duration>(delay, Clock::duration::zero());
+			arrival = std::max(arrival, d.lastArrival); // A segment delayed longer holds back the ones after it, TCP delivers in order
+			d.lastArrival = arrival;
+			d.segments.push_back({ arrival, segment });
+		}
+	}
+
+	// Writes out the segments that arrived, or waits for the next one to
+	void deliver(Direction& d) {
+		if (d.writing || d.waiting)
+			return;
+		if (d.segments.empty()) {
+			if (d.ended) {
+				boost::system::error_code ignored;
+				d.to.shutdown(tcp::socket::shutdown_send, ignored);
+			}
+			return;
+		}
+		auto now = Clock::now();
+		size_t due = 0, count = 0;
+		for (; count < d.segments.size() && d.segments[count].arrival <= now; count++)
+			due += d.segments[count].size;
+		if (count == 0) {
+			d.waiting = true;
+			d.timer.expires_at(d.segments.front().arrival);
+			d.timer.async_wait([this, &d, self = shared_from_this()](const boost::system::error_code& error) {
+				d.waiting = false;
+				if (!error)
+					deliver(d);
+			});
+			return;
+		}
+		d.writeBuffer.assign(d.inFlight.begin() + d.head, d.inFlight.begin() + d.head + due);
+		d.head += due;
+		d.segments.erase(d.segments.begin(), d.segments.begin() + count);
+		d.writing = true;
+		boost::asio::async_write(d.to, boost::asio::buffer(d.writeBuffer), [this, &d, self = shared_from_this()](const boost::system::error_code& error, size_t) {
+			d.writing = false;
+			if (error) { // The receiver closed or reset, the rest can't be delivered
+				d.broken = true;
+				d.segments.clear();
+				d.inFlight.clear();
+				d.head = 0;
+			}
+			read(d); // In case it stopped at the queue limit
+			deliver(d);
+		});
+	}
+
+public:
+	ProxyConnection(tcp::socket socket, boost::asio::io_context& ioContext, LinkState& upstream, LinkState& downstream, std::mt19937_64& random)
+		: client(std::move(socket)), server(ioContext), random(random), up(client, server, upstream, ioContext), down(server, client, downstream, ioContext) {}
+
+	// Connects to the target a round trip later, the time the handshake took on the emulated link
+	void start(const tcp::endpoint& target) {
+		up.timer.expires_after(up.link.conditions.latency + down.link.conditions.latency);
+		up.timer.async_wait([this, target, self = shared_from_this()](const boost::system::error_code& error) {
+			if (error)
+				return;
+			server.async_connect(target, [this, self](const boost::system::error_code& error) {
+				if (error) { // Refused, the client sees its connection closed
+					boost::system::error_code ignored;
+					client.close(ignored);
+					return;
+				}
+				client.set_option(tcp::no_delay(true)); // The link decides when bytes go out
+				server.set_option(tcp::no_delay(true));
+				read(up);
+				read(down);
+			});
+		});
+	}
+};
+
+}
+
+NetworkEmulator::NetworkEmulator(const tcp::endpoint& listen, const tcp::endpoint& target, const LinkConditions& upstream, const LinkConditions& downstream)
+	: acceptor(ioContext, listen), target(target), upstream{ upstream, {} }, downstream{ downstream, {} }, random(std::random_device{}()) {
+	accept();
+}
+
+NetworkEmulator::~NetworkEmulator() {
+	ioContext.stop();
+	if (thread.joinable())
+		thread.join();
+}
+
+void NetworkEmulator::accept() {
+	acceptor.async_accept([this](const boost::system::error_code& error, tcp::socket socket) {
+		if (error == boost::asio::error::operation_aborted)
+			return;
+		if (!error)
+			std::make_shared<ProxyConnection>(std::move(socket), ioContext, upstream, downstream, random)->start(target);
+		accept();
+	});
+}
+
+void NetworkEmulator::run() {
+	ioContext.run();
+}
+
+void NetworkEmulator::start() {
+	thread = std::thread([this] { ioContext.run(); });
+}
+
+std::chrono::microseconds parseDuration(const std::string& duration) {
+	size_t end = 0;
+	double n = std::stod(duration, &end);
+	std::string unit = duration.substr(end);
+	if (unit == "s") n *= 1e6;
+	else if (unit == "ms" || unit.empty()) n *= 1e3;
+	else if (unit != "us")
+		throw std::invalid_argument("Unknown unit in " + duration);
+	return std::chrono::microseconds(std::llround(n));
+}
+
+uint64_t parseRate(const std::string& rate) {
+	size_t end = 0;
+	uint64_t n = std::stoull(rate, &end);
+	switch (end < rate.size() ? std::toupper(rate[end]) : 0) {
+	case 'K': return n << 10;
+	case 'M': return n << 20;
+	case 'G': return n << 30;
+	default: return n;
+	}
+}
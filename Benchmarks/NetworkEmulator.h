@@ -0,0 +1,49 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <thread>
+using boost::asio::ip::tcp;
+
+// One direction of an emulated link
+struct LinkConditions {
+	std::chrono::microseconds latency{ 0 }; // One way, a round trip takes the latencies of both directions
+	std::chrono::microseconds jitter{ 0 }; // Standard deviation of the latency
+	uint64_t bandwidth = 0; // Bytes per second, shared by all the connections through the link. 0 for no cap
+	size_t queueLimit = 1 << 20; // Bytes a connection may have in flight on the link before the proxy stops reading from its sender
+};
+
+// The state of a link direction that all connections share: when it finishes sending what was queued on it
+struct LinkState {
+	LinkConditions conditions;
+	std::chrono::steady_clock::time_point busyUntil;
+};
+
+// A TCP proxy emulating a WAN link (netem in userspace): every byte from one end is delivered to the other end only after it was
+// serialized at the link's bandwidth and travelled for the link's latency plus jitter. The connection to the target is made a round trip
+// after accepting, for the handshake. Bytes are never reordered or lost, what the proxy emulates is what TCP hands the application.
+// One io_context on one thread serves every connection, so the link states need no locking
+class NetworkEmulator {
+private:
+	boost::asio::io_context ioContext;
+	tcp::acceptor acceptor;
+	tcp::endpoint target;
+	LinkState upstream, downstream; // Towards the target, and back
+	std::mt19937_64 random;
+	std::thread thread;
+	void accept();
+
+public:
+	NetworkEmulator(const tcp::endpoint& listen, const tcp::endpoint& target, const LinkConditions& upstream, const LinkConditions& downstream);
+	~NetworkEmulator();
+	unsigned short port() const { return acceptor.local_endpoint().port(); }
+	void run(); // Serves on the calling thread until stopped
+	void start(); // Serves on a thread of its own until destroyed
+};
+
+// "40ms", "1.5s" or "250us" (milliseconds without a unit)
+std::chrono::microseconds parseDuration(const std::string& duration);
+// Bytes per second, as "64K", "10M" or "1G"
+uint64_t parseRate(const std::string& rate);
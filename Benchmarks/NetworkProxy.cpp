@@ -0,0 +1,77 @@
+// Emulates a WAN link between clients and a server, for the benchmarks (or the real client) to run over it without kernel netem:
+//     network_proxy --target 127.0.0.1:1256 [--listen 127.0.0.1:9000] [--latency 40ms] [--jitter 5ms] [--bandwidth 1M] [--queue 1M]
+// --latency and --jitter are one way, in each direction. --bandwidth (bytes per second) caps both directions, --up-bandwidth and
+// --down-bandwidth cap the client to server and server to client directions alone. The link is shared by all connections through it.
+// Point the client's transfer.info, or load_generator and session_replay's --address, at the address it listens on.
+#include "NetworkEmulator.h"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+static tcp::endpoint resolve(boost::asio::io_context& ioContext, const std::string& address) {
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos)
+		return tcp::endpoint(boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(std::stoi(address))); // A port alone
+	return *tcp::resolver(ioContext).resolve(address.substr(0, colon), address.substr(colon + 1)).begin();
+}
+
+static std::string describe(const LinkConditions& link) {
+	std::ostringstream description;
+	description << link.latency.count() / 1000.0 << " ms +- " << link.jitter.count() / 1000.0 << " ms, ";
+	if (link.bandwidth)
+		description << link.bandwidth << " bytes/s";
+	else
+		description << "no bandwidth cap";
+	return description.str();
+}
+
+static int usage(const char* program) {
+	std::cerr << "Usage: " << program << " --target host:port [--listen host:port] [--latency 40ms] [--jitter 5ms] [--bandwidth 1M]"
+		" [--up-bandwidth 256K] [--down-bandwidth 4M] [--queue 1M]" << std::endl;
+	return 2;
+}
+
+int main(int argc, char* argv[]) {
+	std::string listenAddress = "127.0.0.1:0", targetAddress;
+	LinkConditions up, down;
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (i + 1 == argc) {
+				std::cerr << option << " needs a value" << std::endl;
+				return usage(argv[0]);
+			}
+			std::string value = argv[++i];
+			if (option == "--listen") listenAddress = value;
+			else if (option == "--target") targetAddress = value;
+			else if (option == "--latency") up.latency = down.latency = parseDuration(value);
+			else if (option == "--jitter") up.jitter = down.jitter = parseDuration(value);
+			else if (option == "--bandwidth") up.bandwidth = down.bandwidth = parseRate(value);
+			else if (option == "--up-bandwidth") up.bandwidth = parseRate(value);
+			else if (option == "--down-bandwidth") down.bandwidth = parseRate(value);
+			else if (option == "--queue") up.queueLimit = down.queueLimit = parseRate(value);
+			else {
+				std::cerr << "Unknown option " << option << std::endl;
+				return usage(argv[0]);
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Bad option value: " << e.what() << std::endl;
+		return usage(argv[0]);
+	}
+	if (targetAddress.empty())
+		return usage(argv[0]);
+	try {
+		boost::asio::io_context ioContext;
+		NetworkEmulator emulator(resolve(ioContext, listenAddress), resolve(ioContext, targetAddress), up, down);
+		std::cout << "Proxying port " << emulator.port() << " to " << targetAddress << "\nUp: " << describe(up) << "\nDown: " << describe(down) << std::endl;
+		emulator.run();
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Exception: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
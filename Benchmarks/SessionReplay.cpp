@@ -0,0 +1,913 @@
+// Replays the sessions a server captured (main.py --capture trace.bin) against a server, to compare server versions on the same workload.
+// Every captured connection is opened again when it was opened in the capture and sends its requests no earlier than they were sent,
+// at --speed times the original pace (--speed 0 sends everything as fast as the server answers), and stays open as long as it did.
+//     session_replay trace.bin [trace.bin.<pid> ...] [--address 127.0.0.1:1256] [--speed 1] [--clients 256] [--json results.json]
+// A client's sessions never overlap, each waits for the one before it. A trace holds no content, so payloads are synthesized: a new name
+// for every sign up, pregenerated RSA keys, and for every file content of the captured size, the same for the same client and file name
+// (for deduplicated uploads, the same for the same captured digest), encrypted with the AES key this replay got. Updates (delta packets)
+// change as many bytes of the replay's earlier version of the file as the captured delta carried, and deduplicated uploads send the
+// chunks this server asks for. The parts of a parallel upload are named after the file they're joined into, and joined from the
+// content the replay sent for them. Requests that don't apply to the replay (packets resent after corruption, chunks the server
+// doesn't ask for, joins of parts the replay didn't upload) are skipped and counted. Clients the trace uses but didn't sign up are signed up before the replay starts.
+// Reports latency percentiles by request code, sessions that failed and why, every response code and how late sessions started.
+#include "Request.h"
+#include "Response.h"
+#include "RSAWrapper.h"
+#include "AESWrapper.h"
+#include "Chunker.h"
+#include "Delta.h"
+#include "Logger.h"
+#include "cksum.h"
+#include "Codec.h"
+#include "Constants.h"
+#include <boost/asio.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+// The trace file, as Server/Capture.py writes it
+struct TraceHeaderLayout : Layout<BytesField<4>, U16Field, U16Field, NumberField<uint64_t>> {
+	enum { MAGIC, VERSION_FIELD, FLAGS, START };
+};
+
+struct TraceRecordLayout : Layout<U8Field, U32Field, U32Field, U16Field, BytesField<UUID_SIZE>, U32Field, U32Field, U32Field, U32Field, U32Field> {
+	enum { KIND, SESSION, DELTA, CODE, CLIENT_ID, PAYLOAD_SIZE, FIELD_0, FIELD_1, FIELD_2, FIELD_3 };
+};
+
+enum TraceConstants : uint16_t {
+	TRACE_VERSION = 1,
+	TRACE_OPEN = 1,
+	TRACE_REQUEST = 2,
+	TRACE_CLOSE = 3
+};
+
+constexpr uint32_t MAX_PARTS = 65536; // The servers' limit, a join of more was refused in the capture too
+
+using CapturedId = std::array<uint8_t, UUID_SIZE>; // A client id of the capture, the replay's clients get ids of their own
+
+struct TracedRequest {
+	Clock::duration at; // Since its session opened
+	uint16_t code;
+	CapturedId clientId;
+	uint32_t payloadSize;
+	std::array<uint32_t, 4> fields; // See request_fields in Capture.py. The last one is the file name's hash
+};
+
+struct TracedSession {
+	Clock::duration opened; // Since the capture started
+	Clock::duration length; // From opening to closing
+	std::vector<TracedRequest> requests;
+	std::optional<size_t> after; // The previous session of the same client, which ended before this one started in the capture
+};
+
+static std::ifstream openTrace(const std::string& path, uint64_t& start) {
+	std::ifstream trace(path, std::ios::binary);
+	std::array<uint8_t, TraceHeaderLayout::size> header{};
+	if (!trace.read(reinterpret_cast<char*>(header.data()), header.size()))
+		throw std::runtime_error("Cannot read trace " + path);
+	LayoutReader<TraceHeaderLayout> reader(header.data());
+	if (std::memcmp(reader.get<TraceHeaderLayout::MAGIC>(), "FTTR", 4) != 0 || reader.get<TraceHeaderLayout::VERSION_FIELD>() != TRACE_VERSION)
+		throw std::runtime_error(path + " is not a session trace of version " + std::to_string(TRACE_VERSION));
+	start = reader.get<TraceHeaderLayout::START>();
+	return trace;
+}
+
+// When the capture of a trace started, in microseconds since the epoch
+static uint64_t traceStart(const std::string& path) {
+	uint64_t start;
+	openTrace(path, start);
+	return start;
+}
+
+// Adds the sessions of a trace, their times shifted by offset (to merge the traces of several worker processes on one clock)
+static void readTrace(const std::string& path, std::chrono::microseconds offset, std::vector<TracedSession>& sessions) {
+	uint64_t start;
+	std::ifstream trace = openTrace(path, start);
+	std::map<uint32_t, size_t> open; // Session numbers of the trace to sessions
+	std::chrono::microseconds now = offset;
+	std::array<uint8_t, TraceRecordLayout::size> record;
+	while (trace.read(reinterpret_cast<char*>(record.data()), record.size())) {
+		LayoutReader<TraceRecordLayout> r(record.data());
+		now += std::chrono::microseconds(r.get<TraceRecordLayout::DELTA>());
+		uint32_t number = r.get<TraceRecordLayout::SESSION>();
+		uint8_t kind = r.get<TraceRecordLayout::KIND>();
+		if (kind == TRACE_OPEN) {
+			open[number] = sessions.size();
+			sessions.push_back({ now, {}, {}, std::nullopt });
+			continue;
+		}
+		auto session = open.find(number);
+		if (session == open.end())
+			continue;
+		TracedSession& s = sessions[session->second];
+		if (kind == TRACE_CLOSE) {
+			s.length = now - s.opened;
+			open.erase(session);
+		}
+		else if (kind == TRACE_REQUEST) {
+			TracedRequest request{ now - s.opened, r.get<TraceRecordLayout::CODE>(), {}, r.get<TraceRecordLayout::PAYLOAD_SIZE>(),
+				{ r.get<TraceRecordLayout::FIELD_0>(), r.get<TraceRecordLayout::FIELD_1>(), r.get<TraceRecordLayout::FIELD_2>(), r.get<TraceRecordLayout::FIELD_3>() } };
+			std::copy_n(r.get<TraceRecordLayout::CLIENT_ID>(), UUID_SIZE, request.clientId.begin());
+			s.requests.push_back(request);
+			s.length = request.at; // Until its close record, if the capture has it
+		}
+	}
+}
+
+// A version of a file the replay sent: content drawn from seed, and for an update, its first patched bytes drawn again
+struct FileVersion {
+	uint64_t seed;
+	uint32_t size;
+	uint32_t generation;
+	uint32_t patched;
+};
+
+static void fill(uint8_t* data, size_t length, uint64_t seed) {
+	uint64_t x = seed * 0x9E3779B97F4A7C15ull + 1; // xorshift, never seeded with 0
+	for (size_t i = 0; i < length; i += sizeof(x)) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		std::memcpy(data + i, &x, std::min(sizeof(x), length - i));
+	}
+}
+
+// The same for the same client and file name, so a file sent twice is the same file twice, like in the capture
+static uint64_t fileSeed(const CapturedId& clientId, uint32_t fileHash) {
+	uint64_t seed = 14695981039346656037ull; // FNV-1a
+	for (uint8_t b : clientId)
+		seed = (seed ^ b) * 1099511628211ull;
+	return seed ^ fileHash;
+}
+
+// zlib's crc32 of a captured file name followed by suffix, from the name's hash alone (name_hash in Capture.py)
+static uint32_t nameHash(uint32_t hash, const std::string& suffix) {
+	uint32_t crc = ~hash;
+	for (unsigned char c : suffix) {
+		crc ^= c;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+	}
+	return ~crc;
+}
+
+// The hash of the name of a part of a parallel upload, <file>.part<k>, from the hash of the file's name
+static uint32_t partHash(uint32_t fileHash, uint32_t part) {
+	return nameHash(fileHash, ".part" + std::to_string(part));
+}
+
+// For a deduplicated upload, from the captured file's digest, so identical files of the capture are identical in the replay too
+static uint64_t contentSeed(uint32_t digestPrefix, uint32_t size) {
+	return (static_cast<uint64_t>(digestPrefix) << 32 | size) * 0xBF58476D1CE4E5B9ull;
+}
+
+static std::vector<uint8_t> fileContent(const FileVersion& version) {
+	std::vector<uint8_t> data(version.size);
+	fill(data.data(), data.size(), version.seed);
+	fill(data.data(), std::min(version.patched, version.size), version.seed + version.generation);
+	return data;
+}
+
+struct Identity { // A client this replay signed up
+	boost::uuids::uuid uuid;
+	std::string name;
+	std::string privateKey;
+	std::string aes; // The key its last handshake got, the sessions of a parallel upload use it without a handshake of their own
+};
+
+struct KeyPair {
+	std::string privateKey, publicKey;
+};
+
+// The replay's clients by the ids they had in the capture, and the files the server holds for them
+class IdentityRegistry {
+private:
+	std::mutex lock;
+	std::condition_variable added;
+	std::map<CapturedId, Identity> identities;
+	std::map<std::pair<CapturedId, uint32_t>, FileVersion> files;
+
+public:
+	void add(const CapturedId& capturedId, Identity identity) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			identities[capturedId] = std::move(identity);
+		}
+		added.notify_all();
+	}
+
+	// A client signed up by another session of the trace may not be signed up yet, if the replay runs behind
+	Identity get(const CapturedId& capturedId) {
+		std::unique_lock<std::mutex> guard(lock);
+		if (!added.wait_for(guard, std::chrono::seconds(30), [&] { return identities.count(capturedId) > 0; }))
+			throw std::runtime_error("Client never signed up");
+		return identities[capturedId];
+	}
+
+	void storeFile(const CapturedId& capturedId, uint32_t fileHash, const FileVersion& version) {
+		std::lock_guard<std::mutex> guard(lock);
+		files[{ capturedId, fileHash }] = version;
+	}
+
+	std::optional<FileVersion> storedFile(const CapturedId& capturedId, uint32_t fileHash) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto file = files.find({ capturedId, fileHash });
+		return file == files.end() ? std::nullopt : std::optional<FileVersion>(file->second);
+	}
+};
+
+struct Replay { // What the replaying clients share
+	tcp::endpoint endpoint;
+	double speed;
+	std::string runId; // Part of every name, the server refuses to sign a name up twice or to overwrite a file
+	std::vector<KeyPair> keys;
+	IdentityRegistry registry;
+	std::map<std::pair<CapturedId, uint32_t>, std::pair<uint32_t, uint32_t>> parts; // Hashes of the parts the trace joins, to the file's hash and part number
+	std::atomic<uint64_t> names{ 0 };
+};
+
+static std::array<std::atomic<uint64_t>, 32> responseCodes{}; // Codes from 1600, counted by responseCodeObserver
+static std::atomic<uint64_t> otherResponseCodes{ 0 };
+
+static void countResponseCode(uint16_t code) {
+	if (code >= REGISTRATION_SUCCEEDED_CODE && code < REGISTRATION_SUCCEEDED_CODE + responseCodes.size())
+		responseCodes[code - REGISTRATION_SUCCEEDED_CODE].fetch_add(1, std::memory_order_relaxed);
+	else
+		otherResponseCodes.fetch_add(1, std::memory_order_relaxed);
+}
+
+static double percentile(std::vector<double> values, double p) {
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+}
+
+static const char* requestName(uint16_t code) {
+	switch (code) {
+	case REGISTRATION_CODE: return "registration";
+	case PUBLIC_KEY_CODE: return "public key";
+	case RECONNECTION_CODE: return "reconnection";
+	case SENDING_FILE_CODE: return "file packet";
+	case CHUNK_MANIFEST_CODE: return "manifest";
+	case CHUNK_DATA_CODE: return "chunk";
+	case SIGNATURE_CODE: return "signature";
+	case DELTA_FILE_CODE: return "delta packet";
+	case VALID_CRC_CODE: return "valid crc";
+	case INVALID_CRC_RESENDING_FILE_CODE: return "resending";
+	case INVALID_CRC_ABORT_CODE: return "abort";
+	case JOIN_PARTS_CODE: return "join";
+	default: return "unknown";
+	}
+}
+
+// The upload of one file on a connection, as this replay sends it
+struct Upload {
+	uint16_t code = 0; // SENDING_FILE_CODE, DELTA_FILE_CODE or CHUNK_MANIFEST_CODE
+	uint32_t fileHash = 0;
+	std::string fileName{};
+	FileVersion version{};
+	std::vector<uint8_t> content{};
+	std::string encrypted{}; // The file, or the delta, for packets
+	std::vector<bool> sent{}; // By packet number
+	std::vector<Chunk> chunks{}; // For a deduplicated upload
+	Digest digest{};
+	uint16_t totalBatches = 0, nextBatch = 1;
+	std::vector<uint32_t> missing{}; // Chunks the server asked for
+	size_t nextMissing = 0;
+	bool received = false; // The server said it has the whole file
+};
+
+// A client replaying one captured session at a time, over a connection of its own
+class ReplayClient {
+private:
+	Replay& replay;
+	boost::asio::io_context ioContext;
+	MessageBuffer requestBuffer;
+	std::mt19937_64 random;
+	std::optional<tcp::socket> socket;
+	std::optional<Identity> identity;
+	std::optional<KeyPair> pendingKeys; // Between a registration and its public key
+	std::string aes;
+	uint32_t blockSize = 0;
+	std::vector<BlockSignature> signatures;
+	std::optional<Upload> upload;
+
+	Clock::duration scaled(Clock::duration d) const {
+		return std::chrono::duration_cast<Clock::duration>(d / replay.speed);
+	}
+
+	void latency(uint16_t code, Clock::time_point sent) {
+		latencies[code].push_back(std::chrono::duration<double, std::milli>(Clock::now() - sent).count());
+	}
+
+	// A part of a parallel upload is named after the file it's joined into, like the client names it, for the server to find it
+	std::string fileName(const CapturedId& clientId, uint32_t fileHash) const {
+		auto part = replay.parts.find({ clientId, fileHash });
+		if (part != replay.parts.end())
+			return fileName(clientId, part->second.first) + ".part" + std::to_string(part->second.second);
+		return "replay_" + replay.runId + "_" + std::to_string(fileHash) + ".bin";
+	}
+
+	const Identity& loggedIn() const {
+		if (!identity)
+			throw std::runtime_error("Request before signing up or logging in");
+		return *identity;
+	}
+
+	AESWrapper cipher() const {
+		return AESWrapper(reinterpret_cast<const unsigned char*>(aes.data()), static_cast<unsigned int>(aes.size()));
+	}
+
+	const KeyPair& anyKeys() {
+		return replay.keys[std::uniform_int_distribution<size_t>(0, replay.keys.size() - 1)(random)];
+	}
+
+	void registration(const KeyPair& keys) {
+		identity = Identity{ {}, "replay_" + replay.runId + "_" + std::to_string(replay.names++), keys.privateKey, {} };
+		pendingKeys = keys;
+		RegistrationRequest regReq(requestBuffer, identity->name);
+		auto sent = Clock::now();
+		regReq.send(*socket);
+		RegistrationResponse regRes(*socket, &regReq);
+		latency(REGISTRATION_CODE, sent);
+		identity->uuid = regRes.getUUID();
+	}
+
+	void publicKey(const CapturedId* capturedId) {
+		if (!pendingKeys)
+			throw std::runtime_error("Public key without a registration on the connection");
+		PublicKeyRequest pubkReq(requestBuffer, identity->uuid, identity->name, pendingKeys->publicKey);
+		auto sent = Clock::now();
+		pubkReq.send(*socket);
+		AesResponse aesRes(*socket, &pubkReq, identity->privateKey);
+		latency(PUBLIC_KEY_CODE, sent);
+		aes = identity->aes = aesRes.getAES();
+		pendingKeys.reset();
+		if (capturedId != nullptr)
+			replay.registry.add(*capturedId, *identity);
+	}
+
+	void reconnect(const CapturedId& capturedId) {
+		identity = replay.registry.get(capturedId);
+		ReconnectionRequest reconReq(requestBuffer, identity->uuid, identity->name);
+		auto sent = Clock::now();
+		reconReq.send(*socket);
+		AesResponse aesRes(*socket, &reconReq, identity->privateKey);
+		latency(RECONNECTION_CODE, sent);
+		if (aesRes.getCode() == RECONNECTION_FAILED_CODE)
+			throw std::runtime_error("Reconnection failed");
+		aes = identity->aes = aesRes.getAES();
+		replay.registry.add(capturedId, *identity);
+	}
+
+	void signature(const TracedRequest& r) {
+		SignatureRequest sigReq(requestBuffer, loggedIn().uuid, fileName(r.clientId, r.fields[3]));
+		auto sent = Clock::now();
+		sigReq.send(*socket);
+		SignaturesResponse sigRes(*socket, &sigReq);
+		latency(SIGNATURE_CODE, sent);
+		blockSize = sigRes.getBlockSize();
+		signatures = sigRes.getSignatures();
+	}
+
+	// The file of a packet upload (or its delta against the replay's stored version), encrypted once for all its packets
+	void startPacketUpload(const TracedRequest& r) {
+		uint32_t contentSize = r.fields[0], origFileSize = r.fields[1], fileHash = r.fields[3];
+		Upload u{ r.code, fileHash, fileName(r.clientId, fileHash) };
+		u.version = { fileSeed(r.clientId, fileHash), origFileSize, 0, 0 };
+		if (r.code == DELTA_FILE_CODE) {
+			std::optional<FileVersion> stored = replay.registry.storedFile(r.clientId, fileHash);
+			if (!stored || blockSize == 0)
+				throw std::runtime_error("Delta without a stored version to replay it against");
+			u.version = { stored->seed, origFileSize, stored->generation + 1, std::min(contentSize, origFileSize) }; // About as many new bytes as the captured delta carried
+		}
+		u.content = fileContent(u.version);
+		AESWrapper aesWrapper = cipher();
+		if (r.code == DELTA_FILE_CODE) {
+			std::vector<uint8_t> delta = makeDelta(u.content, blockSize, signatures);
+			u.encrypted = aesWrapper.encrypt(reinterpret_cast<const char*>(delta.data()), static_cast<unsigned int>(delta.size()));
+		}
+		else
+			u.encrypted = aesWrapper.encrypt(reinterpret_cast<const char*>(u.content.data()), static_cast<unsigned int>(u.content.size()));
+		u.sent.assign((u.encrypted.size() + PACKET_SIZE - 1) / PACKET_SIZE + 1, false);
+		upload = std::move(u);
+	}
+
+	void sendPacket(uint32_t packetNumber) {
+		Upload& u = *upload;
+		size_t offset = static_cast<size_t>(packetNumber - 1) * PACKET_SIZE;
+		size_t bytesToSend = std::min(static_cast<size_t>(PACKET_SIZE), u.encrypted.size() - offset);
+		const char* content = u.encrypted.data() + offset;
+		FilePacketRequest fpReq(requestBuffer, loggedIn().uuid, static_cast<uint32_t>(u.encrypted.size()), u.version.size, static_cast<uint16_t>(u.sent.size() - 1),
+			static_cast<uint16_t>(packetNumber), static_cast<uint32_t>(memcrc(content, bytesToSend)), u.fileName, content, bytesToSend, u.code);
+		auto sent = Clock::now();
+		fpReq.send(*socket);
+		ReceivedMessageResponse fpRes(*socket, &fpReq);
+		latency(u.code, sent);
+		u.sent[packetNumber] = true;
+	}
+
+	void received(const FileReceivedResponse& res) {
+		Upload& u = *upload;
+		if (res.getCRC() != static_cast<uint32_t>(memcrc(reinterpret_cast<const char*>(u.content.data()), u.content.size())))
+			throw std::runtime_error("Server's cksum doesn't match the file");
+		u.received = true;
+	}
+
+	void filePacket(const TracedRequest& r, bool lastOfRun) {
+		if (!upload || upload->code != r.code || upload->fileHash != r.fields[3])
+			startPacketUpload(r);
+		Upload& u = *upload;
+		uint32_t packetNumber = r.fields[2] & 0xffff;
+		if (packetNumber > 0 && packetNumber < u.sent.size() && !u.sent[packetNumber])
+			sendPacket(packetNumber);
+		else
+			skipped++; // A packet resent after corruption, or past the end of a delta shorter than the captured one
+		if (!lastOfRun)
+			return;
+		for (uint32_t p = 1; p < u.sent.size(); p++) // The captured round ended, and so does the replay's
+			if (!u.sent[p])
+				sendPacket(p);
+		if (u.received)
+			return;
+		auto res = std::make_unique<FileReceivedResponse>(*socket);
+		for (int round = 0; res->getCode() == PACKETS_NACK_CODE && round < MAX_TRIES; round++) {
+			for (uint32_t p : res->getMissing())
+				sendPacket(p);
+			res = std::make_unique<FileReceivedResponse>(*socket);
+		}
+		if (res->getCode() != FILE_RECEIVED_CODE)
+			throw std::runtime_error("Packets keep arriving corrupted");
+		received(*res);
+	}
+
+	void manifest(const TracedRequest& r, bool lastOfRun) {
+		uint32_t fileHash = r.fields[3];
+		if (!upload || upload->code != CHUNK_MANIFEST_CODE || upload->fileHash != fileHash) {
+			Upload u{ CHUNK_MANIFEST_CODE, fileHash, fileName(r.clientId, fileHash) };
+			u.version = { contentSeed(r.fields[2], r.fields[0]), r.fields[0], 0, 0 }; // Other clients' copies of the file are the same content
+			u.content = fileContent(u.version);
+			u.chunks = chunkFile(u.content);
+			u.digest = sha256(u.content.data(), u.content.size());
+			u.totalBatches = static_cast<uint16_t>(std::max<size_t>(1, (u.chunks.size() + MANIFEST_BATCH_ENTRIES - 1) / MANIFEST_BATCH_ENTRIES));
+			upload = std::move(u);
+		}
+		Upload& u = *upload;
+		if (u.received || u.nextBatch > u.totalBatches) {
+			skipped++;
+			return;
+		}
+		do {
+			auto first = u.chunks.cbegin() + std::min(u.chunks.size(), static_cast<size_t>(u.nextBatch - 1) * MANIFEST_BATCH_ENTRIES);
+			auto last = u.chunks.cbegin() + std::min(u.chunks.size(), static_cast<size_t>(u.nextBatch) * MANIFEST_BATCH_ENTRIES);
+			ChunkManifestRequest manReq(requestBuffer, loggedIn().uuid, u.version.size, u.totalBatches, u.nextBatch++, u.digest, u.fileName, first, last);
+			auto sent = Clock::now();
+			manReq.send(*socket);
+			FileReceivedResponse res(*socket, &manReq);
+			latency(CHUNK_MANIFEST_CODE, sent);
+			if (res.getCode() == FILE_RECEIVED_CODE) // The chunk store has the whole file
+				received(res);
+			else if (res.getCode() == CHUNKS_MISSING_CODE) {
+				u.missing = res.getMissing();
+				u.nextMissing = 0;
+			}
+		} while (lastOfRun && !u.received && u.nextBatch <= u.totalBatches);
+	}
+
+	void chunk(bool lastOfRun) {
+		if (!upload || upload->code != CHUNK_MANIFEST_CODE || upload->nextMissing >= upload->missing.size()) {
+			skipped++; // The server didn't ask for as many chunks as in the capture
+			return;
+		}
+		Upload& u = *upload;
+		AESWrapper aesWrapper = cipher();
+		for (int round = 0; round < MAX_TRIES; round++) {
+			do {
+				const Chunk& c = u.chunks.at(u.missing[u.nextMissing]);
+				std::string encryptedChunk = aesWrapper.encrypt(reinterpret_cast<const char*>(u.content.data() + c.offset), c.size);
+				ChunkDataRequest chunkReq(requestBuffer, loggedIn().uuid, u.missing[u.nextMissing++], encryptedChunk);
+				auto sent = Clock::now();
+				chunkReq.send(*socket);
+				ReceivedMessageResponse chunkRes(*socket, &chunkReq);
+				latency(CHUNK_DATA_CODE, sent);
+			} while (lastOfRun && u.nextMissing < u.missing.size());
+			if (u.nextMissing < u.missing.size())
+				return;
+			FileReceivedResponse res(*socket);
+			if (res.getCode() == FILE_RECEIVED_CODE) {
+				received(res);
+				return;
+			}
+			u.missing = res.getMissing(); // Chunks left the store meanwhile
+			u.nextMissing = 0;
+			if (u.missing.empty())
+				break;
+		}
+		throw std::runtime_error("Server didn't receive the file chunks");
+	}
+
+	void crc(const TracedRequest& r) {
+		if (!upload || upload->fileHash != r.fields[3] || (r.code != INVALID_CRC_RESENDING_FILE_CODE && !upload->received)) { // Nothing to confirm or abort yet
+			skipped++;
+			return;
+		}
+		const std::string& name = upload->fileName;
+		if (r.code == VALID_CRC_CODE) {
+			DoneValidCRCRequest doneValidReq(requestBuffer, loggedIn().uuid, name);
+			auto sent = Clock::now();
+			doneValidReq.send(*socket);
+			ReceivedMessageResponse msgRes(*socket, &doneValidReq);
+			latency(r.code, sent);
+			replay.registry.storeFile(r.clientId, upload->fileHash, upload->version);
+			uploadedBytes += upload->version.size;
+			upload.reset();
+		}
+		else if (r.code == INVALID_CRC_RESENDING_FILE_CODE) { // No response, the file is sent again
+			ResendingFileInvalidCRCRequest resendingRequest(requestBuffer, loggedIn().uuid, name);
+			resendingRequest.send(*socket);
+			upload.reset();
+		}
+		else {
+			AbortInvalidCRCRequest abortReq(requestBuffer, loggedIn().uuid, name);
+			auto sent = Clock::now();
+			abortReq.send(*socket);
+			ReceivedMessageResponse msgRes(*socket, &abortReq);
+			latency(r.code, sent);
+			upload.reset();
+		}
+	}
+
+	// Joins the parts this replay sent, its cksum combined from theirs like the client does
+	void join(const TracedRequest& r) {
+		uint32_t totalParts = r.fields[0], fileHash = r.fields[3];
+		if (totalParts == 0 || totalParts > MAX_PARTS) {
+			skipped++; // Invalid in the capture too
+			return;
+		}
+		uint32_t crc = 0;
+		uint64_t totalSize = 0;
+		for (uint32_t part = 1; part <= totalParts; part++) {
+			std::optional<FileVersion> stored = replay.registry.storedFile(r.clientId, partHash(fileHash, part));
+			if (!stored) {
+				skipped++; // The part's session failed in the replay or in the capture, so did the join
+				return;
+			}
+			std::vector<uint8_t> content = fileContent(*stored);
+			crc = crc_combine(crc, crc_update(0, content.data(), content.size()), content.size());
+			totalSize += content.size();
+		}
+		JoinPartsRequest joinReq(requestBuffer, loggedIn().uuid, fileName(r.clientId, fileHash), totalParts, totalSize,
+			static_cast<uint32_t>(crc_finalize(crc, static_cast<size_t>(totalSize))));
+		auto sent = Clock::now();
+		joinReq.send(*socket);
+		ReceivedMessageResponse joinRes(*socket, &joinReq);
+		latency(JOIN_PARTS_CODE, sent);
+	}
+
+	void request(const TracedRequest& r, bool lastOfRun) {
+		if (!identity && r.code != REGISTRATION_CODE && r.code != PUBLIC_KEY_CODE && r.code != RECONNECTION_CODE) { // A session of a parallel upload
+			identity = replay.registry.get(r.clientId);
+			aes = identity->aes;
+		}
+		switch (r.code) {
+		case REGISTRATION_CODE:
+			registration(anyKeys());
+			break;
+		case PUBLIC_KEY_CODE:
+			publicKey(&r.clientId);
+			break;
+		case RECONNECTION_CODE:
+			reconnect(r.clientId);
+			break;
+		case SIGNATURE_CODE:
+			signature(r);
+			break;
+		case SENDING_FILE_CODE:
+		case DELTA_FILE_CODE:
+			filePacket(r, lastOfRun);
+			break;
+		case CHUNK_MANIFEST_CODE:
+			manifest(r, lastOfRun);
+			break;
+		case CHUNK_DATA_CODE:
+			chunk(lastOfRun);
+			break;
+		case VALID_CRC_CODE:
+		case INVALID_CRC_RESENDING_FILE_CODE:
+		case INVALID_CRC_ABORT_CODE:
+			crc(r);
+			break;
+		case JOIN_PARTS_CODE:
+			join(r);
+			break;
+		default:
+			skipped++; // Invalid in the capture too
+		}
+	}
+
+	void connect() {
+		socket.emplace(ioContext);
+		socket->connect(replay.endpoint);
+		socket->set_option(tcp::no_delay(true));
+		identity.reset();
+		pendingKeys.reset();
+		upload.reset();
+		blockSize = 0;
+	}
+
+public:
+	std::map<uint16_t, std::vector<double>> latencies; // By request code, from sending a request to its response
+	std::map<std::string, uint64_t> failures; // By reason
+	std::vector<double> startLagsMs; // How much later than due sessions started
+	uint64_t sessions = 0, failed = 0, requests = 0, skipped = 0, uploadedBytes = 0;
+
+	ReplayClient(Replay& replay, uint64_t seed) : replay(replay), requestBuffer{}, random(seed) {}
+
+	void signupBeforehand(const CapturedId& capturedId) {
+		connect();
+		registration(anyKeys());
+		publicKey(&capturedId);
+		socket.reset();
+	}
+
+	void run(const TracedSession& session, Clock::time_point opened) {
+		sessions++;
+		startLagsMs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - opened).count());
+		try {
+			connect();
+			for (size_t i = 0; i < session.requests.size(); i++) {
+				const TracedRequest& r = session.requests[i];
+				if (replay.speed > 0)
+					std::this_thread::sleep_until(opened + scaled(r.at));
+				// Whether the next request continues the same run of packets, batches or chunks
+				bool lastOfRun = i + 1 == session.requests.size() || session.requests[i + 1].code != r.code
+					|| (r.code != CHUNK_DATA_CODE && session.requests[i + 1].fields[3] != r.fields[3]);
+				requests++;
+				request(r, lastOfRun);
+			}
+			if (replay.speed > 0) // Held open as long as it was
+				std::this_thread::sleep_until(opened + scaled(session.length));
+		}
+		catch (const ServerBusyError&) {
+			failed++;
+			failures["Server busy"]++;
+		}
+		catch (const boost::system::system_error& e) { // Refused, reset, or closed by the server
+			failed++;
+			failures[e.code().message()]++;
+		}
+		catch (const std::exception& e) {
+			failed++;
+			std::string reason = e.what();
+			reason = reason.substr(0, reason.find('\n'));
+			std::replace(reason.begin(), reason.end(), '"', '\'');
+			failures[reason]++;
+		}
+		socket.reset();
+	}
+};
+
+int main(int argc, char* argv[]) {
+	std::vector<std::string> traces;
+	std::string address = "127.0.0.1:1256";
+	double speed = 1;
+	unsigned clients = 256;
+	std::string jsonPath;
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+		if (option.rfind("--", 0) != 0) {
+			traces.push_back(option);
+			continue;
+		}
+		if (i + 1 == argc) {
+			std::cerr << option << " needs a value" << std::endl;
+			return 2;
+		}
+		std::string value = argv[++i];
+		if (option == "--address") address = value;
+		else if (option == "--speed") speed = std::stod(value);
+		else if (option == "--clients") clients = std::max(1, std::stoi(value));
+		else if (option == "--json") jsonPath = value;
+		else {
+			std::cerr << "Unknown option " << option << std::endl;
+			return 2;
+		}
+	}
+	if (traces.empty()) {
+		std::cerr << "Usage: " << argv[0] << " trace.bin [trace.bin ...] [--address host:port] [--speed 1] [--clients 256] [--json results.json]" << std::endl;
+		return 2;
+	}
+
+	// The traces of a server's worker processes start at different times, their sessions are merged on one clock
+	std::vector<TracedSession> sessions;
+	try {
+		std::vector<uint64_t> starts;
+		for (const std::string& trace : traces)
+			starts.push_back(traceStart(trace));
+		uint64_t first = *std::min_element(starts.begin(), starts.end());
+		for (size_t i = 0; i < traces.size(); i++)
+			readTrace(traces[i], std::chrono::microseconds(starts[i] - first), sessions);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 2;
+	}
+	std::stable_sort(sessions.begin(), sessions.end(), [](const TracedSession& a, const TracedSession& b) { return a.opened < b.opened; });
+	// A client's sessions are replayed one after the other like they ran, even when the replay is faster or runs behind: the server
+	// holds one AES key per client, and an update needs the upload before it
+	std::map<CapturedId, size_t> lastSession;
+	for (size_t n = 0; n < sessions.size(); n++) {
+		if (sessions[n].requests.empty())
+			continue;
+		const CapturedId& clientId = sessions[n].requests.back().clientId; // A sign up's registration has no id yet
+		if (auto last = lastSession.find(clientId); last != lastSession.end())
+			sessions[n].after = last->second;
+		lastSession[clientId] = n;
+	}
+	Clock::duration captured{};
+	size_t tracedRequests = 0;
+	Replay replay;
+	for (const TracedSession& session : sessions)
+		for (const TracedRequest& r : session.requests)
+			if (r.code == JOIN_PARTS_CODE && r.fields[0] <= MAX_PARTS)
+				for (uint32_t part = 1; part <= r.fields[0]; part++)
+					replay.parts[{ r.clientId, partHash(r.fields[3], part) }] = { r.fields[3], part };
+	for (const TracedSession& session : sessions) {
+		captured = std::max(captured, session.opened + session.length);
+		tracedRequests += session.requests.size();
+	}
+
+	const char* level = std::getenv("CLIENT_LOG_LEVEL");
+	startLogging(level ? parseLogLevel(level) : LOG_ERROR, stderr);
+	replay.speed = speed;
+	try {
+		boost::asio::io_context ioContext;
+		size_t colon = address.rfind(':');
+		replay.endpoint = *tcp::resolver(ioContext).resolve(address.substr(0, colon), colon == std::string::npos ? "1256" : address.substr(colon + 1)).begin();
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Cannot resolve " << address << ": " << e.what() << std::endl;
+		return 2;
+	}
+	std::mt19937_64 random(1);
+	replay.runId = std::to_string(std::random_device{}() & 0xffffff);
+	for (int i = 0; i < 8; i++) {
+		RSAPrivateWrapper rsa;
+		replay.keys.push_back({ rsa.getPrivateKey(), rsa.getPublicKey() });
+	}
+	std::vector<std::unique_ptr<ReplayClient>> replayClients;
+	for (unsigned i = 0; i < clients; i++)
+		replayClients.push_back(std::make_unique<ReplayClient>(replay, random()));
+
+	// Clients the trace logs in with but never signs up signed up before the capture started, and are signed up here before the replay
+	std::set<CapturedId> signedUp, beforehand;
+	for (const TracedSession& session : sessions)
+		for (const TracedRequest& r : session.requests) {
+			if (r.code == PUBLIC_KEY_CODE)
+				signedUp.insert(r.clientId);
+			else if (r.code != REGISTRATION_CODE && !signedUp.count(r.clientId))
+				beforehand.insert(r.clientId);
+		}
+	std::vector<CapturedId> toSignUp(beforehand.begin(), beforehand.end());
+	auto signupStart = Clock::now();
+	{
+		std::atomic<size_t> next{ 0 };
+		std::vector<std::thread> threads;
+		for (auto& client : replayClients)
+			threads.emplace_back([&, c = client.get()] {
+				for (size_t n; (n = next++) < toSignUp.size();) {
+					try {
+						c->signupBeforehand(toSignUp[n]);
+					}
+					catch (const std::exception& e) {
+						c->failures[std::string("Signing up beforehand: ") + e.what()]++;
+					}
+				}
+			});
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+	double signupSeconds = std::chrono::duration<double>(Clock::now() - signupStart).count();
+	for (auto& count : responseCodes)
+		count = 0;
+	otherResponseCodes = 0;
+	for (auto& client : replayClients)
+		client->latencies.clear();
+	responseCodeObserver = countResponseCode;
+
+	// Each client takes the next session due, like the server's accept loop took the connections
+	std::atomic<size_t> next{ 0 };
+	std::vector<bool> ended(sessions.size(), false);
+	std::mutex endedLock;
+	std::condition_variable sessionEnded;
+	auto start = Clock::now();
+	std::vector<std::thread> threads;
+	for (auto& client : replayClients)
+		threads.emplace_back([&, c = client.get()] {
+			for (size_t n; (n = next++) < sessions.size();) {
+				auto opened = speed > 0 ? start + std::chrono::duration_cast<Clock::duration>(sessions[n].opened / speed) : Clock::now();
+				std::this_thread::sleep_until(opened);
+				if (sessions[n].after) { // Already taken by another client, which waits only on sessions before it
+					std::unique_lock<std::mutex> guard(endedLock);
+					sessionEnded.wait(guard, [&] { return ended[*sessions[n].after]; });
+				}
+				c->run(sessions[n], opened);
+				{
+					std::lock_guard<std::mutex> guard(endedLock);
+					ended[n] = true;
+				}
+				sessionEnded.notify_all();
+			}
+		});
+	for (std::thread& thread : threads)
+		thread.join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	responseCodeObserver = nullptr;
+	stopLogging();
+
+	std::map<uint16_t, std::vector<double>> latencies;
+	std::map<std::string, uint64_t> failures;
+	std::vector<double> startLags;
+	uint64_t replayed = 0, failed = 0, requests = 0, skipped = 0, bytes = 0;
+	for (auto& client : replayClients) {
+		for (auto& [code, values] : client->latencies)
+			latencies[code].insert(latencies[code].end(), values.begin(), values.end());
+		for (auto& [reason, count] : client->failures)
+			failures[reason] += count;
+		startLags.insert(startLags.end(), client->startLagsMs.begin(), client->startLagsMs.end());
+		replayed += client->sessions;
+		failed += client->failed;
+		requests += client->requests;
+		skipped += client->skipped;
+		bytes += client->uploadedBytes;
+	}
+
+	double capturedSeconds = std::chrono::duration<double>(captured).count();
+	std::cout << std::fixed << std::setprecision(2) << "Replayed " << sessions.size() << " sessions (" << tracedRequests << " requests) captured over "
+		<< capturedSeconds << " s against " << address << " at speed " << speed << ", in " << seconds << " s\n";
+	std::cout << "Signed up " << toSignUp.size() << " clients of the capture beforehand in " << signupSeconds << " s\n";
+	std::cout << replayed - failed << " sessions ok, " << failed << " failed, " << requests << " requests replayed (" << skipped << " skipped), "
+		<< bytes / seconds / (1 << 20) << " MB/s of files uploaded, session start lag p99 " << percentile(startLags, 0.99) << " ms\n\n";
+	std::cout << std::setw(6) << "code" << std::setw(14) << "request" << std::setw(10) << "sent" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+		<< std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << "\n";
+	for (auto& [code, values] : latencies)
+		std::cout << std::setw(6) << code << std::setw(14) << requestName(code) << std::setw(10) << values.size() << std::setw(10) << percentile(values, 0.5)
+			<< std::setw(10) << percentile(values, 0.9) << std::setw(10) << percentile(values, 0.99) << std::setw(10) << percentile(values, 1) << "\n";
+	std::cout << "(from sending a request to reading its response)\n\nResponse codes:";
+	for (size_t i = 0; i < responseCodes.size(); i++)
+		if (responseCodes[i])
+			std::cout << " " << REGISTRATION_SUCCEEDED_CODE + i << " x " << responseCodes[i];
+	if (otherResponseCodes)
+		std::cout << " other x " << otherResponseCodes;
+	std::cout << "\n";
+	for (auto& [reason, count] : failures)
+		std::cout << "Failed: " << reason << " x " << count << "\n";
+	std::cout << std::flush;
+
+	if (!jsonPath.empty()) { // To compare the replays of the same trace against two servers
+		std::ofstream json(jsonPath);
+		json << std::fixed << std::setprecision(3) << "{\"address\": \"" << address << "\", \"speed\": " << speed << ", \"captured_s\": " << capturedSeconds
+			<< ", \"seconds\": " << seconds << ", \"sessions\": " << replayed << ", \"failed\": " << failed << ", \"requests\": " << requests << ", \"skipped\": " << skipped
+			<< ", \"mb_per_s\": " << bytes / seconds / (1 << 20) << ", \"start_lag_ms_p99\": " << percentile(startLags, 0.99) << ", \"requests_by_code\": {";
+		bool first = true;
+		for (auto& [code, values] : latencies) {
+			json << (first ? "" : ", ") << "\"" << code << "\": {\"sent\": " << values.size() << ", \"p50\": " << percentile(values, 0.5) << ", \"p90\": "
+				<< percentile(values, 0.9) << ", \"p99\": " << percentile(values, 0.99) << ", \"max\": " << percentile(values, 1) << "}";
+			first = false;
+		}
+		json << "}, \"response_codes\": {";
+		first = true;
+		for (size_t i = 0; i < responseCodes.size(); i++)
+			if (responseCodes[i]) {
+				json << (first ? "" : ", ") << "\"" << REGISTRATION_SUCCEEDED_CODE + i << "\": " << responseCodes[i];
+				first = false;
+			}
+		json << "}, \"failures\": {";
+		first = true;
+		for (auto& [reason, count] : failures) {
+			json << (first ? "" : ", ") << "\"" << reason << "\": " << count;
+			first = false;
+		}
+		json << "}}\n";
+	}
+	return 0;
+}
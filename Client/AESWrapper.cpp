@@ -3,6 +3,7 @@
 #include <aes.h>
 #include <filters.h>
 #include <stdexcept>
+#include <cstring>
 #include <immintrin.h>	// _rdrand32_step
 
 
@@ -22,7 +23,7 @@ AESWrapper::AESWrapper(const unsigned char* key, unsigned int length)
 {
 	if (length != DEFAULT_KEYLENGTH)
 		throw std::length_error("key length must be 32 bytes");
-	memcpy_s(_key, DEFAULT_KEYLENGTH, key, length);
+	memcpy(_key, key, length); // length was checked above
 }
 
 AESWrapper::~AESWrapper() = default;
@@ -0,0 +1,19 @@
+#include "Backoff.h"
+#include "Constants.h"
+#include <algorithm>
+#include <random>
+#include <thread>
+
+
+std::chrono::milliseconds backoffDelay(int attempt, uint32_t floorMs) {
+	static thread_local std::mt19937 generator{ std::random_device{}() };
+	uint32_t ceiling = BACKOFF_MAX_MS;
+	if (attempt <= 16) // Beyond that the shift overflows, and the cap was reached long before anyway
+		ceiling = std::min<uint32_t>(BACKOFF_MAX_MS, BACKOFF_BASE_MS << std::max(attempt - 1, 0));
+	std::uniform_int_distribution<uint32_t> jitter(0, ceiling);
+	return std::chrono::milliseconds(static_cast<uint64_t>(floorMs) + jitter(generator));
+}
+
+void backoff(int attempt, uint32_t floorMs) {
+	std::this_thread::sleep_for(backoffDelay(attempt, floorMs));
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Exponential backoff with full jitter: a random wait of up to BACKOFF_BASE_MS * 2^(attempt - 1), capped at BACKOFF_MAX_MS,
+// on top of the wait the server asked for (floorMs). Clients turned away together spread out instead of all coming back at once
+std::chrono::milliseconds backoffDelay(int attempt, uint32_t floorMs = 0);
+void backoff(int attempt, uint32_t floorMs = 0);
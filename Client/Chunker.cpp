@@ -0,0 +1,63 @@
+#include "Chunker.h"
+#include <sha.h>
+#include <algorithm>
+
+
+namespace {
+	// Gear hash table, generated with splitmix64 from a fixed seed. It must never change, otherwise the cut points move and the server's chunk store stops matching
+	struct GearTable {
+		uint64_t t[256];
+		GearTable() {
+			uint64_t seed = 0x5346545f43444321; // "SFT_CDC!"
+			for (auto& entry : t) {
+				uint64_t z = (seed += 0x9e3779b97f4a7c15);
+				z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+				z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+				entry = z ^ (z >> 31);
+			}
+		}
+	};
+	const GearTable gear;
+
+	// Normalized chunking (FastCDC): a harder mask before the average size and an easier one after it keeps chunk sizes close to the average.
+	// The top bits of the gear hash are used because they depend on the last 64 bytes, while the low bits only depend on the last few.
+	constexpr uint64_t MASK_HARD = 0x3fffull << 50; // 14 bits
+	constexpr uint64_t MASK_EASY = 0x3ffull << 54; // 10 bits
+
+	size_t nextCut(const uint8_t* p, size_t n) {
+		if (n <= CHUNK_MIN_SIZE)
+			return n;
+		size_t normal = std::min(n, static_cast<size_t>(CHUNK_AVG_SIZE)), end = std::min(n, static_cast<size_t>(CHUNK_MAX_SIZE));
+		uint64_t h = 0;
+		size_t i = CHUNK_MIN_SIZE; // Cut points are never searched for below the minimum size
+		for (; i < normal; i++) {
+			h = (h << 1) + gear.t[p[i]];
+			if (!(h & MASK_HARD))
+				return i + 1;
+		}
+		for (; i < end; i++) {
+			h = (h << 1) + gear.t[p[i]];
+			if (!(h & MASK_EASY))
+				return i + 1;
+		}
+		return end;
+	}
+}
+
+Digest sha256(const uint8_t* data, size_t length) {
+	Digest digest;
+	CryptoPP::SHA256().CalculateDigest(digest.data(), data, length);
+	return digest;
+}
+
+// Since cut points depend only on the content around them, inserting or removing bytes only changes the chunks next to the edit
+std::vector<Chunk> chunkFile(const std::vector<uint8_t>& data) {
+	std::vector<Chunk> chunks;
+	chunks.reserve(data.size() / CHUNK_AVG_SIZE + 1);
+	for (size_t offset = 0; offset < data.size();) {
+		size_t size = nextCut(data.data() + offset, data.size() - offset);
+		chunks.push_back({ offset, static_cast<uint16_t>(size), sha256(data.data() + offset, size) });
+		offset += size;
+	}
+	return chunks;
+}
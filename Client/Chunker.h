@@ -0,0 +1,18 @@
+#pragma once
+#include "Constants.h"
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+using Digest = std::array<uint8_t, DIGEST_SIZE>;
+
+struct Chunk { // A content defined piece of a file, identified by the SHA-256 of its content
+	size_t offset;
+	uint16_t size;
+	Digest digest;
+};
+
+Digest sha256(const uint8_t* data, size_t length);
+std::vector<Chunk> chunkFile(const std::vector<uint8_t>& data);
@@ -6,8 +6,15 @@
 #include "AESWrapper.h"
 #include "Constants.h"
 #include "cksum.h"
+#include "Chunker.h"
+#include "Delta.h"
+#include "Backoff.h"
+#include "Trace.h"
+#include "Logger.h"
 #include <files.h>
-#include <cmath>
+#include <limits>
+#include <numeric>
+#include <thread>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 using namespace CryptoPP;
@@ -15,118 +22,303 @@ using namespace CryptoPP;
 
 Client::Client() {
 	auto [ip, port, name, fpath] = interpretTransferFile();
+	this->ip = ip;
+	this->port = port;
 	this->name = name;
 	this->fpath = fpath;
-	this->socket = std::make_unique<tcp::socket>(ioContext);
+	this->fileName = std::filesystem::path(fpath).filename().string();
+	connect(ip, port);
+}
+
+Client::Client(const Client& loggedIn, const std::string& path, const std::string& fileName, uint64_t offset, uint64_t length)
+	: ip(loggedIn.ip), port(loggedIn.port), uuid(loggedIn.uuid), name(loggedIn.name), decryptedAes(loggedIn.decryptedAes), fpath(path), fileName(fileName),
+	partOffset(offset), partLength(length) {
+	connect(ip, port, false);
+}
+
+// Connecting and signing up or logging in. A server that is busy (or down, or too overloaded to accept) is tried again
+// after a jittered backoff, up to MAX_CONNECT_TRIES times, instead of right away like every other client it turned away
+void Client::connect(const std::string& ip, const std::string& port, bool logIn) {
 	tcp::resolver resolver(this->ioContext);
-	boost::asio::connect(*socket, resolver.resolve(ip, port));
-	if (!fileExists((getExecutablePath() / "me.info").string())) // If me file doesn't exist client has to sign up
-		signup();
-	else
-		login();
+	for (int attempt = 1; ; attempt++) {
+		uint32_t retryAfter = 0;
+		try {
+			this->socket = std::make_unique<tcp::socket>(ioContext);
+			traced("connect", [&] { return boost::asio::connect(*socket, resolver.resolve(ip, port)); });
+			if (!logIn) // A session of a parallel upload, the server may still turn it away at its first request
+				return;
+			if (!fileExists((getExecutablePath() / "me.info").string())) // If me file doesn't exist client has to sign up
+				signup();
+			else
+				login();
+			return;
+		}
+		catch (const ServerBusyError& e) {
+			if (attempt == MAX_CONNECT_TRIES)
+				throw;
+			retryAfter = e.getRetryAfter();
+		}
+		catch (const boost::system::system_error& e) { // Refused or reset
+			if (attempt == MAX_CONNECT_TRIES)
+				throw;
+			logMessage(LOG_WARNING, "Connection failed: %s", e.what());
+		}
+		auto delay = backoffDelay(attempt, retryAfter);
+		logMessage(LOG_WARNING, "Server unavailable, connecting again in %lld ms", static_cast<long long>(delay.count()));
+		std::this_thread::sleep_for(delay);
+	}
+}
+
+// Closing the connection once logged in, when the sessions of a parallel upload send the files on connections of their own
+void Client::disconnect() {
+	boost::system::error_code ignored;
+	socket->close(ignored);
 }
 
 // Signing up/Registration
 void Client::signup() {
-	std::cout << "Signing up" << std::endl;
-	auto regReq = std::make_unique<RegistrationRequest>(name);
-	regReq->send(*socket);
-	std::cout << "Registration request sent" << std::endl;
-	RegistrationResponse regRes(*socket, regReq.get());
+	TraceSpan span("signup");
+	logMessage(LOG_INFO, "Signing up");
+	RegistrationRequest regReq(requestBuffer, name);
+	regReq.send(*socket);
+	logMessage(LOG_INFO, "Registration request sent");
+	RegistrationResponse regRes(*socket, &regReq);
 	uuid = regRes.getUUID();
-	std::cout << "UUID received: " << uuid << std::endl;
+	logMessage(LOG_INFO, "UUID received: %s", to_string(uuid).c_str());
 	generateAndSendRSA();
 	writeMePrivFiles(name, uuid, privateKey); // Saving name, uuid, RSA private key in me.info and priv.key files
 }
 
 // Following the protocol, generating asymmetric RSA key, sending the public one to server and receiving symmetric AES key from it
 void Client::generateAndSendRSA() {
-	std::cout << "Generating RSA keys" << std::endl;
-	RSAPrivateWrapper rsaWrapper;
-	privateKey = rsaWrapper.getPrivateKey();
-	auto pubkReq = std::make_unique<PublicKeyRequest>(uuid, name, rsaWrapper.getPublicKey());
-	pubkReq->send(*socket);
-	std::cout << "RSA Public key Sent: ";
-	printHex(rsaWrapper.getPublicKey());
-	std::cout<<std::endl;
-	AesResponse aesRes(*socket, pubkReq.get(), privateKey);
+	logMessage(LOG_INFO, "Generating RSA keys");
+	std::string publicKey;
+	{
+		TraceSpan span("rsa keygen");
+		RSAPrivateWrapper rsaWrapper;
+		privateKey = rsaWrapper.getPrivateKey();
+		publicKey = rsaWrapper.getPublicKey();
+	}
+	PublicKeyRequest pubkReq(requestBuffer, uuid, name, publicKey);
+	pubkReq.send(*socket);
+	logMessage(LOG_INFO, "RSA Public key Sent");
+	logMessage(LOG_DEBUG, "RSA Public key: %s", toHex(publicKey).c_str());
+	AesResponse aesRes(*socket, &pubkReq, privateKey);
 	if (uuid != aesRes.getUUID()) // Validating uuid received from server to our correct uuid
-		throw std::exception("Server provided bad UUID");
+		throw std::runtime_error("Server provided bad UUID");
 	decryptedAes = aesRes.getAES();
-	std::cout << "AES received: " << std::endl;
-	printHex(decryptedAes);
+	logMessage(LOG_INFO, "AES received");
+	logMessage(LOG_DEBUG, "AES: %s", toHex(decryptedAes).c_str());
 }
 
 // Logging in and receiving symmetric AES key from server (using the same RSA keys that were generated while singing up prior to logging)
 void Client::login() {
-	std::cout << "Logging in" << std::endl;
+	TraceSpan span("login");
+	logMessage(LOG_INFO, "Logging in");
 	uuid = getUUID();
-	std::cout << "UUID: " << uuid << std::endl;
-	auto reconReq = std::make_unique<ReconnectionRequest>(uuid, name);
-	reconReq->send(*socket);
-	std::cout << "Reconnection request sent" << std::endl;
-	AesResponse aesRes(*socket, reconReq.get(), getPrivKey());
+	logMessage(LOG_INFO, "UUID: %s", to_string(uuid).c_str());
+	ReconnectionRequest reconReq(requestBuffer, uuid, name);
+	reconReq.send(*socket);
+	logMessage(LOG_INFO, "Reconnection request sent");
+	AesResponse aesRes(*socket, &reconReq, getPrivKey());
 	if (aesRes.getCode() == RECONNECTION_FAILED_CODE) {
-		std::cout << "Reconnection failed" << std::endl;
+		logMessage(LOG_WARNING, "Reconnection failed");
 		signup();
 	}
 	if (uuid != aesRes.getUUID()) // Validating uuid received from server to our correct uuid
-		throw std::exception("Server provided bad UUID");
+		throw std::runtime_error("Server provided bad UUID");
 	decryptedAes = aesRes.getAES();
-	std::cout << "AES received: " << std::endl;
-	printHex(decryptedAes);
+	logMessage(LOG_INFO, "AES received");
+	logMessage(LOG_DEBUG, "AES: %s", toHex(decryptedAes).c_str());
+}
+
+// Sends the file as a delta against the server's copy when the server already has one, otherwise deduplicated
+void Client::sendFile() {
+	if (!sendUpdate())
+		sendDeduplicatedFile();
+}
+
+// Sends a part of a large file plainly, or as a delta against the server's copy of the part when an earlier upload of the file failed
+// after sending it. Uploading the file again then resumes rather than finding the part a duplicate
+void Client::sendPart() {
+	if (!sendUpdate())
+		sendEncryptedFile();
+}
+
+// Sends the content as a delta against the server's copy of the file. False, with nothing sent, when the server has no copy
+bool Client::sendUpdate() {
+	SignatureRequest sigReq(requestBuffer, uuid, fileName);
+	sigReq.send(*socket);
+	SignaturesResponse sigRes(*socket, &sigReq);
+	if (sigRes.getBlockSize() == 0)
+		return false;
+	logMessage(LOG_INFO, "Updating file %s", fileName.c_str());
+	std::vector<uint8_t> buffer = traced("read file", [&] { return readContent(); });
+	std::vector<uint8_t> delta = traced("delta", [&] { return makeDelta(buffer, sigRes.getBlockSize(), sigRes.getSignatures()); });
+	logMessage(LOG_INFO, "Delta of file %s is %zu bytes (file is %zu bytes)", fileName.c_str(), delta.size(), buffer.size());
+	AESWrapper aesWrapper(reinterpret_cast<const unsigned char*>(decryptedAes.data()), static_cast<unsigned int>(decryptedAes.size()));
+	std::string encryptedDelta = traced("aes encrypt", [&] { return aesWrapper.encrypt(reinterpret_cast<const char*>(delta.data()), static_cast<unsigned int>(delta.size())); });
+	sendEncrypted(fileName, buffer, encryptedDelta, DELTA_FILE_CODE);
+	return true;
 }
 
 // Encrypting file and sending it to server
 void Client::sendEncryptedFile() {
-	std::string fileName = std::filesystem::path(fpath).filename().string();
-	std::cout << "Encrypting and sending file " << fileName << std::endl;
-	std::ifstream file(fpath, std::ios::binary | std::ios::in | std::ios::ate); // Using ate flag to open file at the end to get its size
-	if (!file.is_open())
-		throw std::runtime_error("Error opening file " + fileName);
-	unsigned int origFileSize = file.tellg();
-	std::vector<uint8_t> buffer(origFileSize);
-	file.seekg(0, std::ios::beg); // Move to the beginning of file in order to read it
-	if (!file.read(reinterpret_cast<char*>(buffer.data()), origFileSize))
-		throw std::runtime_error("Error reading file " + fileName);
-	file.close();
+	logMessage(LOG_INFO, "Encrypting and sending file %s", fileName.c_str());
+	std::vector<uint8_t> buffer = traced("read file", [&] { return readContent(); });
+	AESWrapper aesWrapper(reinterpret_cast<const unsigned char*>(decryptedAes.data()), static_cast<unsigned int>(decryptedAes.size()));
+	std::string encryptedFile = traced("aes encrypt", [&] { return aesWrapper.encrypt(reinterpret_cast<const char*>(buffer.data()), static_cast<unsigned int>(buffer.size())); }); // Same key and iv on every attempt, so the file is encrypted once
+	sendEncrypted(fileName, buffer, encryptedFile, SENDING_FILE_CODE);
+}
+
+// Sends the encrypted content (the file itself, or a delta the server rebuilds the file from) and makes sure the server ended up with the original file
+void Client::sendEncrypted(const std::string& fileName, const std::vector<uint8_t>& buffer, const std::string& encrypted, uint16_t code) {
+	if ((encrypted.length() + PACKET_SIZE - 1) / PACKET_SIZE > std::numeric_limits<uint16_t>::max()) // Packet numbers are 16 bits in the protocol
+		throw std::runtime_error("File " + fileName + " is too large to send in packets (" + std::to_string(static_cast<uint64_t>(std::numeric_limits<uint16_t>::max()) * PACKET_SIZE) + " encrypted bytes at most)");
+	uint32_t origFileSize = static_cast<uint32_t>(buffer.size());
+	uint32_t encryptedSize = static_cast<uint32_t>(encrypted.length());
+	std::vector<uint32_t> allPackets((encryptedSize + PACKET_SIZE - 1) / PACKET_SIZE);
+	std::iota(allPackets.begin(), allPackets.end(), 1);
+	uint32_t crc = traced("crc file", [&] { return crc_update(0, buffer.data(), buffer.size()); });
 	for (int i = 0; i < MAX_TRIES; i++) {
-		AESWrapper aesWrapper(reinterpret_cast<const unsigned char*>(decryptedAes.data()), static_cast<unsigned int>(decryptedAes.size()));
-		std::string encryptedFile = aesWrapper.encrypt(reinterpret_cast<const char*>(buffer.data()), origFileSize);
-		uint32_t encryptedFileSize = static_cast<uint32_t>(encryptedFile.length());
-		size_t offset = 0;
-		uint16_t packetNumber = 1;
-		uint16_t totalPackets = static_cast<uint16_t>(std::ceil(static_cast<double>(encryptedFileSize / PACKET_SIZE)) + 1);
-		for (size_t i = 0; i < totalPackets; i++) {
-			size_t bytesToSend = std::min(static_cast<size_t>(PACKET_SIZE), encryptedFileSize - offset); // Choosing the minimum in case the last packet is smaller
-			auto fpReq = std::make_unique<FilePacketRequest>(uuid, encryptedFileSize, origFileSize, concatenateUint16ToUint32(packetNumber, totalPackets), fileName, encryptedFile.substr(offset, bytesToSend));
-			fpReq->send(*socket);
-			ReceivedMessageResponse fpRes(*socket, fpReq.get()); // The protocol doesn't require a response here, but I chose to use it here in case there's error during sending file, such as the file already existing for client
-			if (uuid != fpRes.getUUID()) // Validating uuid received from server to our correct uuid
-				throw std::exception("Server provided bad UUID");
-			std::cout << "Sent packet number " << packetNumber << " for file " << fileName << std::endl;
-			offset += bytesToSend;
-			packetNumber++;
+		sendPackets(fileName, encrypted, origFileSize, allPackets, code);
+		auto fileRecRes = std::make_unique<FileReceivedResponse>(*socket);
+		for (int round = 0; fileRecRes->getCode() == PACKETS_NACK_CODE && round < MAX_TRIES; round++) { // Only the packets that arrived corrupted are sent again
+			logMessage(LOG_WARNING, "Resending %zu corrupted packets for file %s", fileRecRes->getMissing().size(), fileName.c_str());
+			sendPackets(fileName, encrypted, origFileSize, fileRecRes->getMissing(), code);
+			fileRecRes = std::make_unique<FileReceivedResponse>(*socket);
+		}
+		if (fileRecRes->getCode() == PACKETS_NACK_CODE) { // Packets keep arriving corrupted, there's no point in resending the whole file
+			logMessage(LOG_WARNING, "Packets of file %s keep arriving corrupted, aborting", fileName.c_str());
+			abortFile(fileName); // In the middle of a round, so the server drops the packets it has and the file's row
 		}
-		FileReceivedResponse fileRecRes(*socket);
 		// Validating fields that server provided
-		if (fileRecRes.getContentSize() != encryptedFileSize) throw std::exception("Server provided faulty content size");
-		if (fileRecRes.getFileName() != fileName) throw std::exception("Server provided faulty file name");
-		if (to_string(fileRecRes.getUUID()) != to_string(uuid)) throw std::exception("Server provided faulty uuid");
-		std::string decryptedFile(buffer.begin(), buffer.end()); // crc has to be checked on original (decrypted file) in order to validate the encryption process
-		if (static_cast<unsigned long>(fileRecRes.getCRC()) == memcrc(const_cast<char*>(decryptedFile.c_str()), decryptedFile.size())) {
-			auto doneValidReq = std::make_unique<DoneValidCRCRequest>(uuid, fileName);
-			doneValidReq->send(*socket);
-			ReceivedMessageResponse msgRes(*socket, doneValidReq.get());
-			std::cout << "Sent file " << fileName << " successfully" << std::endl;
+		if (fileRecRes->getContentSize() != encryptedSize) throw std::runtime_error("Server provided faulty content size");
+		if (fileRecRes->getFileName().c_str() != fileName) throw std::runtime_error("Server provided faulty file name");
+		if (to_string(fileRecRes->getUUID()) != to_string(uuid)) throw std::runtime_error("Server provided faulty uuid");
+		// crc has to be checked on original (decrypted file) in order to validate the encryption process
+		if (static_cast<unsigned long>(fileRecRes->getCRC()) == crc_finalize(crc, buffer.size())) {
+			DoneValidCRCRequest doneValidReq(requestBuffer, uuid, fileName);
+			doneValidReq.send(*socket);
+			ReceivedMessageResponse msgRes(*socket, &doneValidReq);
+			contentCrc = crc;
+			logMessage(LOG_INFO, "Sent file %s successfully", fileName.c_str());
 			return;
 		}
-		std::cout << "Trying to send file " << fileName << " again" << std::endl; // Will attempt to resend the file 3 more times, according to protocol
-		auto resendingRequest = std::make_unique<ResendingFileInvalidCRCRequest>(uuid, fileName);
-		resendingRequest->send(*socket); // Notifying the server client attempts to encrypt and send the file again
+		logMessage(LOG_WARNING, "Trying to send file %s again", fileName.c_str()); // Will attempt to resend the file 3 more times, according to protocol
+		ResendingFileInvalidCRCRequest resendingRequest(requestBuffer, uuid, fileName);
+		resendingRequest.send(*socket); // Notifying the server client attempts to encrypt and send the file again
 	}
-	auto abortReq = std::make_unique<AbortInvalidCRCRequest>(uuid, fileName); // After 4 failed tries, client will abort
-	abortReq->send(*socket);
-	ReceivedMessageResponse msgRes(*socket, abortReq.get());
+	abortFile(fileName); // After 4 failed tries, client will abort
+}
+
+// Tells the server the file won't be sent, so it drops what it received of it, and gives up on the file
+void Client::abortFile(const std::string& fileName) {
+	AbortInvalidCRCRequest abortReq(requestBuffer, uuid, fileName);
+	abortReq.send(*socket);
+	ReceivedMessageResponse msgRes(*socket, &abortReq);
 	throw std::runtime_error("Fatal error. Cannot send file " + fileName);
 }
+
+// Chunking the file by content and sending only the chunks missing from the server's chunk store and the few it asks for as proof the client holds the file
+// (nothing at all if the client already stored the whole file under another name)
+void Client::sendDeduplicatedFile() {
+	logMessage(LOG_INFO, "Chunking and sending file %s", fileName.c_str());
+	std::vector<uint8_t> buffer = traced("read file", [&] { return readContent(); });
+	uint32_t origFileSize = static_cast<uint32_t>(buffer.size());
+	std::vector<Chunk> chunks = traced("chunking", [&] { return chunkFile(buffer); });
+	Digest fileDigest = traced("sha256 file", [&] { return sha256(buffer.data(), buffer.size()); });
+	uint16_t totalBatches = static_cast<uint16_t>(std::max<size_t>(1, (chunks.size() + MANIFEST_BATCH_ENTRIES - 1) / MANIFEST_BATCH_ENTRIES));
+	std::unique_ptr<FileReceivedResponse> res;
+	for (uint16_t batch = 1; batch <= totalBatches; batch++) {
+		auto first = chunks.cbegin() + std::min(chunks.size(), static_cast<size_t>(batch - 1) * MANIFEST_BATCH_ENTRIES);
+		auto last = chunks.cbegin() + std::min(chunks.size(), static_cast<size_t>(batch) * MANIFEST_BATCH_ENTRIES);
+		TraceSpan span("manifest batch", "batch", batch);
+		ChunkManifestRequest manReq(requestBuffer, uuid, origFileSize, totalBatches, batch, fileDigest, fileName, first, last);
+		manReq.send(*socket);
+		res = std::make_unique<FileReceivedResponse>(*socket, &manReq);
+		if (res->getCode() == FILE_RECEIVED_CODE) // The server recognized the whole file, no need to send the rest of the manifest
+			break;
+	}
+	AESWrapper aesWrapper(reinterpret_cast<const unsigned char*>(decryptedAes.data()), static_cast<unsigned int>(decryptedAes.size()));
+	size_t sentChunks = 0;
+	for (int round = 0; res->getCode() == CHUNKS_MISSING_CODE && round < MAX_TRIES; round++) { // Another round only happens if chunks left the store meanwhile
+		std::vector<uint32_t> missing = res->getMissing();
+		logMessage(LOG_INFO, "Sending %zu of %zu chunks for file %s", missing.size(), chunks.size(), fileName.c_str());
+		for (uint32_t chunkIndex : missing) {
+			const Chunk& chunk = chunks.at(chunkIndex);
+			TraceSpan span("chunk", "chunk", chunkIndex);
+			std::string encryptedChunk = traced("aes encrypt", [&] { return aesWrapper.encrypt(reinterpret_cast<const char*>(buffer.data() + chunk.offset), chunk.size); }); // Every chunk is encrypted on its own
+			ChunkDataRequest chunkReq(requestBuffer, uuid, chunkIndex, encryptedChunk);
+			chunkReq.send(*socket);
+			ReceivedMessageResponse chunkRes(*socket, &chunkReq);
+			if (uuid != chunkRes.getUUID()) // Validating uuid received from server to our correct uuid
+				throw std::runtime_error("Server provided bad UUID");
+			sentChunks++;
+		}
+		res = std::make_unique<FileReceivedResponse>(*socket);
+	}
+	// Validating fields that server provided (for a deduplicated file the content size is the size of the original file)
+	if (res->getCode() != FILE_RECEIVED_CODE) throw std::runtime_error("Server didn't receive the file chunks");
+	if (res->getContentSize() != origFileSize) throw std::runtime_error("Server provided faulty content size");
+	if (res->getFileName().c_str() != fileName) throw std::runtime_error("Server provided faulty file name");
+	if (to_string(res->getUUID()) != to_string(uuid)) throw std::runtime_error("Server provided faulty uuid");
+	if (static_cast<unsigned long>(res->getCRC()) == traced("crc file", [&] { return memcrc(reinterpret_cast<const char*>(buffer.data()), buffer.size()); })) {
+		DoneValidCRCRequest doneValidReq(requestBuffer, uuid, fileName);
+		doneValidReq.send(*socket);
+		ReceivedMessageResponse msgRes(*socket, &doneValidReq);
+		logMessage(LOG_INFO, "Sent file %s successfully (%zu of %zu chunks crossed the wire)", fileName.c_str(), sentChunks, chunks.size());
+		return;
+	}
+	logMessage(LOG_WARNING, "Chunk store doesn't match file %s, sending all of it", fileName.c_str()); // The server drops the file on resending, then it's sent as usual
+	ResendingFileInvalidCRCRequest resendingRequest(requestBuffer, uuid, fileName);
+	resendingRequest.send(*socket);
+	sendEncryptedFile();
+}
+
+// Sends the given packets of the encrypted content. Every packet carries the cksum of its own content, so the server can ask for just the corrupted ones
+void Client::sendPackets(const std::string& fileName, const std::string& encrypted, uint32_t origFileSize, const std::vector<uint32_t>& packetNumbers, uint16_t code) {
+	uint32_t encryptedFileSize = static_cast<uint32_t>(encrypted.length());
+	uint16_t totalPackets = static_cast<uint16_t>((encryptedFileSize + PACKET_SIZE - 1) / PACKET_SIZE);
+	packetRoundTrips.reserve(packetRoundTrips.size() + packetNumbers.size());
+	TraceSpan span("send packets", "packets", packetNumbers.size());
+	for (uint32_t packetNumber : packetNumbers) {
+		TraceSpan packetSpan("packet", "packet", packetNumber);
+		if (packetNumber == 0 || packetNumber > totalPackets)
+			throw std::runtime_error("Server asked for packet " + std::to_string(packetNumber) + " which doesn't exist");
+		size_t offset = static_cast<size_t>(packetNumber - 1) * PACKET_SIZE;
+		size_t bytesToSend = std::min(static_cast<size_t>(PACKET_SIZE), encryptedFileSize - offset); // Choosing the minimum in case the last packet is smaller
+		const char* content = encrypted.data() + offset; // Copied straight into the request, no copy of its own
+		uint32_t packetCksum = static_cast<uint32_t>(traced("crc packet", [&] { return memcrc(content, bytesToSend); }));
+		FilePacketRequest fpReq(requestBuffer, uuid, encryptedFileSize, origFileSize, totalPackets, static_cast<uint16_t>(packetNumber), packetCksum, fileName, content, bytesToSend, code);
+		auto sent = std::chrono::steady_clock::now();
+		fpReq.send(*socket);
+		ReceivedMessageResponse fpRes(*socket, &fpReq); // The protocol doesn't require a response here, but I chose to use it here in case there's error during sending file, such as the file already existing for client
+		packetRoundTrips.push_back(std::chrono::steady_clock::now() - sent);
+		if (uuid != fpRes.getUUID()) // Validating uuid received from server to our correct uuid
+			throw std::runtime_error("Server provided bad UUID");
+		logMessage(LOG_INFO, "Sent packet number %u for file %s", packetNumber, fileName.c_str());
+	}
+}
+
+// Joins the parts of a large file that the sessions of a parallel upload sent, on this session's connection (which the server closes after)
+void Client::joinParts(uint32_t totalParts, uint64_t totalSize, uint32_t fileCksum) {
+	TraceSpan span("join parts", "parts", totalParts);
+	JoinPartsRequest joinReq(requestBuffer, uuid, fileName, totalParts, totalSize, fileCksum);
+	joinReq.send(*socket);
+	ReceivedMessageResponse joinRes(*socket, &joinReq);
+	if (uuid != joinRes.getUUID()) // Validating uuid received from server to our correct uuid
+		throw std::runtime_error("Server provided bad UUID");
+	logMessage(LOG_INFO, "Joined %u parts of file %s", totalParts, fileName.c_str());
+}
+
+// The content this session sends: the whole file, or its part
+std::vector<uint8_t> Client::readContent() const {
+	return partLength ? readFileRange(fpath, partOffset, static_cast<size_t>(partLength)) : readFile(fpath);
+}
+
+const std::string& Client::getFilePath() const { return fpath; }
+
+uint32_t Client::getContentCrc() const { return contentCrc; }
+
+const std::vector<std::chrono::steady_clock::duration>& Client::getPacketRoundTrips() const { return packetRoundTrips; }
@@ -1,7 +1,10 @@
 #pragma once
+#include "Codec.h"
 #include <boost/uuid/uuid.hpp>
 #include <boost/asio.hpp>
+#include <chrono>
 #include <memory>
+#include <vector>
 using boost::asio::ip::tcp;
 
 class Client // Represents a client communicating with the server
@@ -9,16 +12,41 @@ class Client // Represents a client communicating with the server
 private:
 	boost::asio::io_context ioContext; // Keeping io_ctx and socket as fields so they won't get destructed when going back to main
 	std::unique_ptr<tcp::socket> socket;
+	std::string ip, port;
 	boost::uuids::uuid uuid;
 	std::string name;
 	std::string decryptedAes;
 	std::string fpath;
+	std::string fileName; // What the server stores the file as
+	uint64_t partOffset = 0, partLength = 0; // The part of fpath to send, for a part of a large file (0 bytes means the whole file)
 	std::string privateKey;
+	MessageBuffer requestBuffer; // Every request of the connection is encoded into it, one at a time
+	std::vector<std::chrono::steady_clock::duration> packetRoundTrips; // From sending each file packet to its response
+	uint32_t contentCrc = 0; // cksum state (before crc_finalize) of the content the server confirmed it stored, sent plainly or as a delta
 
 public:
 	Client();
+	// A session of a parallel upload: a connection of its own for the client loggedIn signed up or logged in as. The server keeps one
+	// AES key per client, so the sessions share it rather than each logging in. It sends length bytes of path from offset (or all of it) as fileName
+	Client(const Client& loggedIn, const std::string& path, const std::string& fileName, uint64_t offset = 0, uint64_t length = 0);
+	void connect(const std::string& ip, const std::string& port, bool logIn = true);
+	void disconnect();
 	void signup();
 	void generateAndSendRSA();
 	void login();
+	void sendFile();
+	void sendPart();
 	void sendEncryptedFile();
+	void sendDeduplicatedFile();
+	void joinParts(uint32_t totalParts, uint64_t totalSize, uint32_t fileCksum);
+	const std::string& getFilePath() const;
+	uint32_t getContentCrc() const;
+	const std::vector<std::chrono::steady_clock::duration>& getPacketRoundTrips() const;
+
+private:
+	std::vector<uint8_t> readContent() const;
+	bool sendUpdate();
+	void sendEncrypted(const std::string& fileName, const std::vector<uint8_t>& buffer, const std::string& encrypted, uint16_t code);
+	[[noreturn]] void abortFile(const std::string& fileName);
+	void sendPackets(const std::string& fileName, const std::string& encrypted, uint32_t origFileSize, const std::vector<uint32_t>& packetNumbers, uint16_t code);
 };
@@ -0,0 +1,192 @@
+#pragma once
+#include "Constants.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <boost/endian/conversion.hpp>
+
+
+// The message layouts of the protocol, described once at compile time. A layout lists its fields in wire order and every
+// field's offset is computed from the sizes of the fields before it, so no offset is written by hand.
+// Writing or reading a field the wrong way (text into a number, a number wider than its field, an id of the wrong size)
+// doesn't compile, and neither does a layout that doesn't fit the protocol's sizes (the static_asserts below).
+// Messages are encoded in place into a buffer the caller keeps and reuses, so encoding never allocates.
+
+template <size_t N> struct BytesField { static constexpr size_t size = N; }; // Copied as is (ids, digests, keys)
+template <size_t N> struct TextField { static constexpr size_t size = N; }; // Zero padded, cut to the field's size
+template <class T> struct NumberField { static constexpr size_t size = sizeof(T); using type = T; }; // Little endian
+using U8Field = NumberField<uint8_t>;
+using U16Field = NumberField<uint16_t>;
+using U32Field = NumberField<uint32_t>;
+
+template <class T> struct IsNumberField : std::false_type {};
+template <class T> struct IsNumberField<NumberField<T>> : std::true_type {};
+template <class T> struct IsTextField : std::false_type {};
+template <size_t N> struct IsTextField<TextField<N>> : std::true_type {};
+
+template <class... Fields>
+struct Layout {
+	static constexpr size_t size = (Fields::size + ... + 0);
+	template <size_t I> using Field = std::tuple_element_t<I, std::tuple<Fields...>>;
+	template <size_t I> static constexpr size_t offset() {
+		constexpr size_t sizes[] = { Fields::size... };
+		size_t offset = 0;
+		for (size_t i = 0; i < I; i++)
+			offset += sizes[i];
+		return offset;
+	}
+};
+
+// Writes the fields of layout L at p (the start of the message, or of an entry of a repeated layout)
+template <class L>
+class LayoutWriter {
+private:
+	uint8_t* p;
+
+public:
+	explicit LayoutWriter(uint8_t* p) : p(p) {}
+	uint8_t* end() const { return p + L::size; } // Where whatever follows the layout goes
+
+	template <size_t I, class V>
+	LayoutWriter& set(const V& value) {
+		using F = typename L::template Field<I>;
+		uint8_t* at = p + L::template offset<I>();
+		if constexpr (IsNumberField<F>::value) {
+			static_assert(std::is_enum_v<V> || (std::is_integral_v<V> && sizeof(V) <= F::size), "Number doesn't fit its field");
+			boost::endian::endian_store<typename F::type, F::size, boost::endian::order::little>(at, static_cast<typename F::type>(value));
+		}
+		else if constexpr (IsTextField<F>::value) {
+			static_assert(std::is_convertible_v<const V&, std::string_view>, "Text field needs text");
+			std::string_view text(value);
+			size_t length = std::min(text.size(), F::size);
+			std::memcpy(at, text.data(), length);
+			std::memset(at + length, NULLVAL, F::size - length);
+		}
+		else if constexpr (std::is_convertible_v<const V&, std::string_view>) { // Raw bytes held in a string (a key), must fill the field
+			std::string_view bytes(value);
+			if (bytes.size() != F::size)
+				throw std::runtime_error("Field needs " + std::to_string(F::size) + " bytes, got " + std::to_string(bytes.size()));
+			std::memcpy(at, bytes.data(), F::size);
+		}
+		else {
+			static_assert(sizeof(V) == F::size && std::is_trivially_copyable_v<V>, "Bytes field needs a value of exactly its size");
+			std::memcpy(at, &value, F::size);
+		}
+		return *this;
+	}
+};
+
+// Reads the fields of layout L at p. Text comes back with its zero padding, numbers in native order
+template <class L>
+class LayoutReader {
+private:
+	const uint8_t* p;
+
+public:
+	explicit LayoutReader(const uint8_t* p) : p(p) {}
+	const uint8_t* end() const { return p + L::size; }
+
+	template <size_t I>
+	auto get() const {
+		using F = typename L::template Field<I>;
+		const uint8_t* at = p + L::template offset<I>();
+		if constexpr (IsNumberField<F>::value)
+			return boost::endian::endian_load<typename F::type, F::size, boost::endian::order::little>(at);
+		else if constexpr (IsTextField<F>::value)
+			return std::string_view(reinterpret_cast<const char*>(at), F::size);
+		else
+			return at;
+	}
+};
+
+// Requests
+
+struct RequestHeaderLayout : Layout<BytesField<UUID_SIZE>, U8Field, U16Field, U32Field> {
+	enum { UUID, VERSION_FIELD, CODE, PAYLOAD_SIZE };
+};
+
+struct NameLayout : Layout<TextField<NAME_SIZE>> { // Registration and reconnection
+	enum { NAME };
+};
+
+struct PublicKeyLayout : Layout<TextField<NAME_SIZE>, BytesField<PUBLIC_KEY_SIZE>> {
+	enum { NAME, PUBLIC_KEY };
+};
+
+struct FileNameLayout : Layout<TextField<FILE_NAME_SIZE>> { // Signature and CRC requests
+	enum { FILE_NAME };
+};
+
+struct FilePacketLayout : Layout<U32Field, U32Field, U16Field, U16Field, U32Field, TextField<FILE_NAME_SIZE>> { // Followed by the packet's content
+	enum { CONTENT_SIZE, ORIG_FILE_SIZE, TOTAL_PACKETS, PACKET_NUMBER, CKSUM, FILE_NAME };
+};
+
+struct ChunkManifestLayout : Layout<U32Field, U16Field, U16Field, BytesField<DIGEST_SIZE>, TextField<FILE_NAME_SIZE>> { // Followed by the batch's entries
+	enum { ORIG_FILE_SIZE, TOTAL_BATCHES, BATCH_NUMBER, FILE_DIGEST, FILE_NAME };
+};
+
+struct ManifestEntryLayout : Layout<BytesField<DIGEST_SIZE>, U16Field> {
+	enum { DIGEST, SIZE };
+};
+
+struct ChunkDataLayout : Layout<U32Field> { // Followed by the encrypted chunk
+	enum { CHUNK_INDEX };
+};
+
+struct JoinPartsLayout : Layout<TextField<FILE_NAME_SIZE>, U32Field, NumberField<uint64_t>, U32Field> {
+	enum { FILE_NAME, TOTAL_PARTS, TOTAL_SIZE, CKSUM };
+};
+
+// Responses
+
+struct ResponseHeaderLayout : Layout<U8Field, U16Field, U32Field> {
+	enum { VERSION_FIELD, CODE, PAYLOAD_SIZE };
+};
+
+struct ClientIdLayout : Layout<BytesField<UUID_SIZE>> { // Registration, received message, and the start of every response about a client
+	enum { UUID };
+};
+
+struct FileReceivedLayout : Layout<BytesField<UUID_SIZE>, U32Field, TextField<FILE_NAME_SIZE>, U32Field> {
+	enum { UUID, CONTENT_SIZE, FILE_NAME, CKSUM };
+};
+
+struct PacketsNackLayout : Layout<BytesField<UUID_SIZE>, U16Field> { // Followed by the packet numbers
+	enum { UUID, COUNT };
+};
+
+struct ChunksMissingLayout : Layout<BytesField<UUID_SIZE>, U32Field> { // Followed by a bitmap over the manifest's chunks
+	enum { UUID, COUNT };
+};
+
+struct SignaturesLayout : Layout<BytesField<UUID_SIZE>, U32Field, U32Field> { // Followed by the block signatures
+	enum { UUID, BLOCK_SIZE, COUNT };
+};
+
+struct BlockSignatureLayout : Layout<U32Field, BytesField<STRONG_SUM_SIZE>> {
+	enum { WEAK, STRONG };
+};
+
+struct ServerBusyLayout : Layout<U32Field> {
+	enum { RETRY_AFTER };
+};
+
+// The largest request, header included. Every request of a connection is encoded into the same buffer of this size
+using MessageBuffer = std::array<uint8_t, REQUEST_HEADER_SIZE + SENDING_FILE_PAYLOAD_SIZE>;
+
+static_assert(RequestHeaderLayout::size == REQUEST_HEADER_SIZE, "Request header doesn't match the protocol");
+static_assert(ResponseHeaderLayout::size == RESPONSE_HEADER_SIZE, "Response header doesn't match the protocol");
+static_assert(PublicKeyLayout::size <= SENDING_FILE_PAYLOAD_SIZE, "Public key request doesn't fit a message");
+static_assert(FilePacketLayout::size + PACKET_SIZE <= SENDING_FILE_PAYLOAD_SIZE, "A full packet doesn't fit a message");
+static_assert(PACKET_SIZE % 16 == 0, "Packets must start on AES block boundaries");
+static_assert(ChunkManifestLayout::size + MANIFEST_BATCH_ENTRIES * ManifestEntryLayout::size <= SENDING_FILE_PAYLOAD_SIZE, "A full manifest batch doesn't fit a message");
+static_assert(ChunkDataLayout::size + (CHUNK_MAX_SIZE / 16 + 1) * 16 <= SENDING_FILE_PAYLOAD_SIZE, "The largest encrypted chunk doesn't fit a message");
+static_assert(JoinPartsLayout::size == FILE_NAME_SIZE + PART_COUNT_SIZE + TOTAL_SIZE_SIZE + CKSUM_SIZE, "Join request doesn't match the protocol");
+static_assert(ManifestEntryLayout::size == DIGEST_SIZE + CHUNK_SIZE_SIZE && BlockSignatureLayout::size == WEAK_SUM_SIZE + STRONG_SUM_SIZE, "Entry sizes don't match the protocol");
@@ -3,8 +3,11 @@
 
 enum Constants :std::uint16_t {
 	NULLVAL = 0,
-	VERSION = 3,
+	VERSION = 4, // Version 4 added a cksum to every file packet
 	MAX_TRIES = 4,
+	MAX_CONNECT_TRIES = 8, // Connecting (and the first request) again after the server was busy or unreachable
+	BACKOFF_BASE_MS = 100,
+	BACKOFF_MAX_MS = 10000,
 	NAME_MAX_LENGTH=100,
 	UUID_SIZE = 16,
 	REQUEST_HEADER_SIZE = 23,
@@ -13,19 +16,53 @@ enum Constants :std::uint16_t {
 	CONTENTSIZE_SIZE = 4,
 	VERSION_SIZE = 1,
 	CODE_SIZE = 2,
-	PACKET_SIZE = 7902, // 8KB - HEADER SIZE - CONTENT_SIZE SIZE - ORIG_FILE_SIZE SIZE - PACKET_NUM_TOTAL_PACKETS SIZE - FILE NAME SIZE = 8192-23-12-255
+	PACKET_SIZE = 7888, // 8KB - HEADER SIZE - CONTENT_SIZE SIZE - ORIG_FILE_SIZE SIZE - PACKET_NUM_TOTAL_PACKETS SIZE - PACKET CKSUM SIZE - FILE NAME SIZE = 8192-23-16-255 = 7898, rounded down to whole AES blocks so the server can decrypt every packet on its own
 	CKSUM_SIZE = 4,
+	NACK_COUNT_SIZE = 2,
+	PACKET_NUMBER_SIZE = 2,
+	DIGEST_SIZE = 32, // SHA-256
+	CHUNK_SIZE_SIZE = 2,
+	CHUNK_INDEX_SIZE = 4,
+	CHUNK_COUNT_SIZE = 4,
+	CHUNK_MIN_SIZE = 2048,
+	CHUNK_AVG_SIZE = 4096,
+	CHUNK_MAX_SIZE = 8144, // Largest chunk whose encryption (with padding) still fits in one request: 8169 - CHUNK INDEX SIZE = 8165 -> 8160 bytes of cipher
+	MANIFEST_BATCH_ENTRIES = 231, // (8169 - ORIG_FILE_SIZE SIZE - BATCH_NUM_TOTAL_BATCHES SIZE - DIGEST SIZE - FILE NAME SIZE) / (DIGEST SIZE + CHUNK SIZE SIZE) = 7874 / 34
+	STRONG_SUM_SIZE = 16,
+	WEAK_SUM_SIZE = 4,
+	BLOCK_SIZE_SIZE = 4,
+	BLOCK_COUNT_SIZE = 4,
+	DELTA_LENGTH_SIZE = 4,
+	DELTA_COPY_OP = 1, // Followed by the index of the first block and the number of blocks to copy from the server's copy
+	DELTA_LITERAL_OP = 2, // Followed by a length and that many bytes of new data
+	PART_COUNT_SIZE = 4,
+	TOTAL_SIZE_SIZE = 8,
 	PUBLIC_KEY_SIZE = 160,
 	NAME_SIZE = 255,
 	FILE_NAME_SIZE = 255,
 	FILE_PATH_SIZE = 255,
+	REGISTRATION_SUCCEEDED_CODE = 1600,
 	REGISTRATION_FAILED_CODE = 1601,
+	PUBLIC_KEY_RECEIVED_CODE = 1602, // Followed by the AES key, encrypted with the client's public key
+	RECONNECTION_SUCCEEDED_CODE = 1605,
 	RECONNECTION_FAILED_CODE = 1606,
 	GENERAL_ERROR_CODE = 1607,
+	FILE_RECEIVED_CODE = 1603,
+	RECEIVED_MESSAGE_CODE = 1604,
+	PACKETS_NACK_CODE = 1608,
+	CHUNKS_MISSING_CODE = 1609,
+	SIGNATURES_CODE = 1610,
+	SERVER_BUSY_CODE = 1611, // Followed by the milliseconds to wait before connecting again
+	RETRY_AFTER_SIZE = 4,
 	REGISTRATION_CODE = 825,
 	PUBLIC_KEY_CODE = 826,
 	RECONNECTION_CODE = 827,
 	SENDING_FILE_CODE = 828,
+	CHUNK_MANIFEST_CODE = 829,
+	CHUNK_DATA_CODE = 830,
+	SIGNATURE_CODE = 831,
+	DELTA_FILE_CODE = 832,
+	JOIN_PARTS_CODE = 833, // Joins the parts a large file was sent in (each a file of its own) into the file, by a parallel upload
 	VALID_CRC_CODE = 900,
 	INVALID_CRC_RESENDING_FILE_CODE = 901,
 	INVALID_CRC_ABORT_CODE = 902
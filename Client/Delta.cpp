@@ -0,0 +1,92 @@
+#include "Delta.h"
+#include "Chunker.h"
+#include <unordered_map>
+#include <algorithm>
+#include <boost/endian/conversion.hpp>
+
+
+namespace {
+	constexpr uint32_t ADLER_MOD = 65521;
+
+	inline uint16_t tag(uint32_t weak) { return static_cast<uint16_t>(weak ^ (weak >> 16)); } // Cheap pre-filter before looking up the hash map
+
+	void appendLiteral(std::vector<uint8_t>& delta, const uint8_t* data, size_t length) {
+		if (length == 0)
+			return;
+		size_t op = delta.size();
+		delta.resize(op + 1 + DELTA_LENGTH_SIZE);
+		delta[op] = DELTA_LITERAL_OP;
+		boost::endian::store_little_u32(delta.data() + op + 1, static_cast<uint32_t>(length));
+		delta.insert(delta.end(), data, data + length);
+	}
+}
+
+uint32_t adler32(const uint8_t* data, size_t length) {
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < length; i++) {
+		a = (a + data[i]) % ADLER_MOD;
+		b = (b + a) % ADLER_MOD;
+	}
+	return (b << 16) | a;
+}
+
+// rsync's algorithm: slide a window of blockSize over the new file, and wherever its rolling checksum (confirmed by the strong one) matches
+// a block of the server's copy, reference that block instead of sending its bytes. Consecutive blocks are merged into one copy op.
+std::vector<uint8_t> makeDelta(const std::vector<uint8_t>& data, uint32_t blockSize, const std::vector<BlockSignature>& signatures) {
+	std::unordered_multimap<uint32_t, uint32_t> blocks; // Weak checksum -> block index
+	std::vector<bool> tags(1 << 16);
+	blocks.reserve(signatures.size());
+	for (uint32_t i = 0; i < signatures.size(); i++) {
+		blocks.emplace(signatures[i].weak, i);
+		tags[tag(signatures[i].weak)] = true;
+	}
+	std::vector<uint8_t> delta;
+	size_t literalStart = 0, pos = 0, lastCopy = SIZE_MAX; // lastCopy is the position of the last op in delta, if it's a copy
+	uint32_t a = 0, b = 0;
+	bool windowValid = false;
+	while (!blocks.empty() && pos + blockSize <= data.size()) {
+		if (!windowValid) {
+			uint32_t weak = adler32(data.data() + pos, blockSize);
+			a = weak & 0xffff;
+			b = weak >> 16;
+			windowValid = true;
+		}
+		uint32_t weak = (b << 16) | a;
+		int64_t match = -1;
+		if (tags[tag(weak)]) {
+			auto [first, last] = blocks.equal_range(weak);
+			if (first != last) {
+				Digest strong = sha256(data.data() + pos, blockSize);
+				for (; first != last && match < 0; ++first)
+					if (std::equal(signatures[first->second].strong.begin(), signatures[first->second].strong.end(), strong.begin()))
+						match = first->second;
+			}
+		}
+		if (match >= 0) {
+			appendLiteral(delta, data.data() + literalStart, pos - literalStart);
+			if (pos != literalStart)
+				lastCopy = SIZE_MAX;
+			if (lastCopy != SIZE_MAX && boost::endian::load_little_u32(delta.data() + lastCopy + 1) + boost::endian::load_little_u32(delta.data() + lastCopy + 1 + DELTA_LENGTH_SIZE) == match)
+				boost::endian::store_little_u32(delta.data() + lastCopy + 1 + DELTA_LENGTH_SIZE, boost::endian::load_little_u32(delta.data() + lastCopy + 1 + DELTA_LENGTH_SIZE) + 1);
+			else { // Copy op: block index and number of consecutive blocks
+				lastCopy = delta.size();
+				delta.resize(lastCopy + 1 + DELTA_LENGTH_SIZE + DELTA_LENGTH_SIZE);
+				delta[lastCopy] = DELTA_COPY_OP;
+				boost::endian::store_little_u32(delta.data() + lastCopy + 1, static_cast<uint32_t>(match));
+				boost::endian::store_little_u32(delta.data() + lastCopy + 1 + DELTA_LENGTH_SIZE, 1);
+			}
+			pos += blockSize;
+			literalStart = pos;
+			windowValid = false;
+			continue;
+		}
+		if (pos + blockSize < data.size()) { // Rolling the window one byte forward
+			uint32_t out = data[pos], in = data[pos + blockSize];
+			a = (a + ADLER_MOD - out + in) % ADLER_MOD;
+			b = (b + ADLER_MOD - static_cast<uint32_t>((static_cast<uint64_t>(blockSize) * out) % ADLER_MOD) + a + ADLER_MOD - 1) % ADLER_MOD;
+		}
+		pos++;
+	}
+	appendLiteral(delta, data.data() + literalStart, data.size() - literalStart);
+	return delta;
+}
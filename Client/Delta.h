@@ -0,0 +1,15 @@
+#pragma once
+#include "Constants.h"
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+struct BlockSignature { // Signature of one block of the server's copy of a file
+	uint32_t weak; // Adler-32, cheap to roll one byte at a time
+	std::array<uint8_t, STRONG_SUM_SIZE> strong; // Truncated SHA-256, confirms a weak match
+};
+
+uint32_t adler32(const uint8_t* data, size_t length);
+std::vector<uint8_t> makeDelta(const std::vector<uint8_t>& data, uint32_t blockSize, const std::vector<BlockSignature>& signatures);
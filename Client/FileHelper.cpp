@@ -11,7 +11,10 @@
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/lexical_cast.hpp>
+#include <sstream>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 
 // Returns true if the file exists and is accessible
@@ -34,10 +37,10 @@ std::tuple<std::string, std::string, std::string, std::string> interpretTransfer
 	fs::path exeDir = getExecutablePath();
 	std::string transferPath = (exeDir / "transfer.info").string();
 	if (!fileExists(transferPath))
-		throw std::exception("Transfer file must exist for client");
+		throw std::runtime_error("Transfer file must exist for client");
 	std::ifstream transfer(transferPath);
 	if (!transfer.is_open())
-		throw std::exception("Error opening transfer file");
+		throw std::runtime_error("Error opening transfer file");
 	std::regex pattern(R"(\s*(\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3})\s*:\s*(\d+)\s*)"); // Pattern to check if string fits IP format
 	std::smatch match;
 	std::vector<std::string>res;
@@ -50,14 +53,14 @@ std::tuple<std::string, std::string, std::string, std::string> interpretTransfer
 				std::string ip = match[1];  // Extract IPv4 part
 				std::string port = match[2];  // Extract port part
 				if (!isValidIpv4(ip))
-					throw std::exception("Ipv4 format is incorrect");
+					throw std::runtime_error("Ipv4 format is incorrect");
 				if (!isValidPort(port))
-					throw std::exception("Port format is incorrect");
+					throw std::runtime_error("Port format is incorrect");
 				res.push_back(ip);
 				res.push_back(port);
 			}
 			else
-				throw std::exception("Format of first line in transfer file should be: 'ipv4 : port' such that whitespaces can be before ipv4, after port, between ipv4 and :, between : and port");
+				throw std::runtime_error("Format of first line in transfer file should be: 'ipv4 : port' such that whitespaces can be before ipv4, after port, between ipv4 and :, between : and port");
 			break;
 		case 1: // Name
 			line = rstrip(line);
@@ -66,9 +69,9 @@ std::tuple<std::string, std::string, std::string, std::string> interpretTransfer
 			else // In one place in the protocol it was mentioned the max length can be 255 and in another 100 was mentioned
 				throw std::runtime_error("Name can be up to " + std::to_string(NAME_MAX_LENGTH) + " characters long");
 			break;
-		case 2: // File path
+		case 2: // File path, or a directory whose files are uploaded in parallel
 			line = rstrip(line);
-			if (fileExists(line) && line.length() <= FILE_PATH_SIZE)
+			if ((fileExists(line) || fs::is_directory(line)) && line.length() <= FILE_PATH_SIZE)
 				res.push_back(line);
 			else
 				throw std::runtime_error("File doesn't exist or the path provided is too long (" + std::to_string(FILE_PATH_SIZE) + " characters max)");
@@ -77,15 +80,19 @@ std::tuple<std::string, std::string, std::string, std::string> interpretTransfer
 	}
 	transfer.close();
 	if (i != 3)
-		throw std::exception("Error reading transfer file");
+		throw std::runtime_error("Error reading transfer file");
 	return std::make_tuple(res[0], res[1], res[2], res[3]);
 }
 
-// Prints in hex format
-void printHex(const std::string& str) {
-	for (unsigned char byte : str) 
-		std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte) << " ";
-	std::cout << std::dec << std::endl; 
+// Formats bytes in hex, space separated (for logging keys)
+std::string toHex(const std::string& str) {
+	static const char digits[] = "0123456789abcdef";
+	std::string hex(str.size() * 3, ' ');
+	for (size_t i = 0; i < str.size(); i++) {
+		hex[i * 3] = digits[static_cast<unsigned char>(str[i]) >> 4];
+		hex[i * 3 + 1] = digits[static_cast<unsigned char>(str[i]) & 0xf];
+	}
+	return hex;
 }
 
 // Writes uuid in hex format to file
@@ -102,9 +109,9 @@ void writeMePrivFiles(const std::string& name, const boost::uuids::uuid& uuid, c
 	std::ofstream me(mePath);
 	std::ofstream priv(privPath);
 	if (!me.is_open())
-		throw std::exception("Error opening me file");
+		throw std::runtime_error("Error opening me file");
 	if (!priv.is_open())
-		throw std::exception("Error opening private key file");
+		throw std::runtime_error("Error opening private key file");
 	me << name << std::endl;
 	writeHex(me, uuid); // UUID should be written in hex format
 	Base64Wrapper base64Wrapper; // RSA private key should be written in BASE64 format
@@ -121,7 +128,7 @@ const std::string getPrivKey() {
 	std::string privPath = (exeDir / "priv.key").string();
 	std::ifstream priv(privPath);
 	if (!priv.is_open())
-		throw std::exception("Error opening private key file");
+		throw std::runtime_error("Error opening private key file");
 	std::stringstream buffer;
 	buffer << priv.rdbuf();
 	priv.close();
@@ -135,23 +142,48 @@ const boost::uuids::uuid getUUID() {
 	std::string mePath = (exeDir / "me.info").string();
 	std::ifstream me(mePath);
 	if (!me.is_open())
-		throw std::exception("Error opening me file");
+		throw std::runtime_error("Error opening me file");
 	std::string uuid;
 	for (size_t i = 0; i < 2; i++) // UUID is at the second line
 		if (!std::getline(me, uuid))
-			throw std::exception("Error reading me file");
+			throw std::runtime_error("Error reading me file");
 	me.close();
 	return boost::uuids::string_generator()(uuid);
 }
 
 fs::path getExecutablePath() {
+#ifdef _WIN32
 	char buffer[MAX_PATH]; // Buffer to store the path
 	GetModuleFileNameA(NULL, buffer, MAX_PATH);  // Retrieves the full path of the executable
 	fs::path exePath(buffer);  // Convert to fs::path
+#else
+	fs::path exePath = fs::read_symlink("/proc/self/exe"); // Linux, for the benchmarks that drive the client
+#endif
 	return exePath.parent_path();  // Return the directory of the executable
 }
 
-// Packet num and total packet fields were asked by the protocol to be in the same 4 byte unit
-uint32_t concatenateUint16ToUint32(uint16_t first, uint16_t second) {
-	return (static_cast<uint32_t>(first) << 16) | static_cast<uint32_t>(second);
-}
\ No newline at end of file
+// Reads a whole file to memory
+std::vector<uint8_t> readFile(const std::string& path) {
+	std::string fileName = fs::path(path).filename().string();
+	std::ifstream file(path, std::ios::binary | std::ios::in | std::ios::ate); // Using ate flag to open file at the end to get its size
+	if (!file.is_open())
+		throw std::runtime_error("Error opening file " + fileName);
+	std::vector<uint8_t> buffer(static_cast<size_t>(file.tellg()));
+	file.seekg(0, std::ios::beg); // Move to the beginning of file in order to read it
+	if (!file.read(reinterpret_cast<char*>(buffer.data()), buffer.size()))
+		throw std::runtime_error("Error reading file " + fileName);
+	return buffer;
+}
+
+// Reads length bytes of a file from offset (a part of a file too large to send whole)
+std::vector<uint8_t> readFileRange(const std::string& path, uint64_t offset, size_t length) {
+	std::string fileName = fs::path(path).filename().string();
+	std::ifstream file(path, std::ios::binary | std::ios::in);
+	if (!file.is_open())
+		throw std::runtime_error("Error opening file " + fileName);
+	std::vector<uint8_t> buffer(length);
+	file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+	if (!file.read(reinterpret_cast<char*>(buffer.data()), buffer.size()))
+		throw std::runtime_error("Error reading file " + fileName);
+	return buffer;
+}
@@ -0,0 +1,153 @@
+#include "Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+std::atomic<LogLevel> logLevel{ LOG_INFO };
+
+namespace {
+	// A bounded multi producer queue (Vyukov's): a slot's sequence says whose turn it is, producers claim a position with one compare and swap
+	struct LogSlot {
+		std::atomic<size_t> sequence;
+		LogLevel level;
+		size_t length;
+		char text[LOG_LINE_SIZE];
+	};
+
+	LogSlot ring[LOG_RING_SLOTS];
+	std::atomic<size_t> enqueuePosition{ 0 };
+	size_t dequeuePosition = 0; // Only the flusher moves it
+	std::atomic<size_t> dropped{ 0 };
+	std::atomic<bool> running{ false };
+	std::atomic<bool> stopping{ false };
+	std::thread flusher;
+	FILE* output = stdout;
+	FILE* errorOutput = stderr;
+
+	const char* const LEVEL_PREFIXES[] = { "", "", "Warning: ", "Error: " };
+
+	FILE* destination(LogLevel level) {
+		return level >= LOG_WARNING ? errorOutput : output;
+	}
+
+	size_t formatLine(char* text, LogLevel level, const char* format, va_list args) {
+		size_t prefix = std::strlen(LEVEL_PREFIXES[level]);
+		std::memcpy(text, LEVEL_PREFIXES[level], prefix);
+		int n = std::vsnprintf(text + prefix, LOG_LINE_SIZE - prefix - 1, format, args); // One byte is kept for the new line
+		size_t length = prefix + (n < 0 ? 0 : std::min<size_t>(n, LOG_LINE_SIZE - prefix - 2));
+		text[length++] = '\n';
+		return length;
+	}
+
+	// Writes out every message in the ring, in one write per run of messages to the same stream where they fit the batch
+	bool drain() {
+		static char batch[1 << 16];
+		size_t used = 0;
+		FILE* batchOutput = output;
+		bool any = false;
+		auto append = [&](FILE* to, const char* text, size_t length) {
+			if (used && (to != batchOutput || used + length > sizeof(batch))) {
+				std::fwrite(batch, 1, used, batchOutput);
+				used = 0;
+			}
+			batchOutput = to;
+			std::memcpy(batch + used, text, length);
+			used += length;
+		};
+		for (;;) {
+			LogSlot& slot = ring[dequeuePosition & (LOG_RING_SLOTS - 1)];
+			if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+				break;
+			append(destination(slot.level), slot.text, slot.length);
+			slot.sequence.store(dequeuePosition + LOG_RING_SLOTS, std::memory_order_release);
+			dequeuePosition++;
+			any = true;
+		}
+		if (size_t lost = dropped.exchange(0, std::memory_order_relaxed)) {
+			char text[96];
+			int length = std::snprintf(text, sizeof(text), "Warning: %zu log messages dropped, the ring was full\n", lost);
+			append(destination(LOG_WARNING), text, static_cast<size_t>(length));
+			any = true;
+		}
+		if (any) {
+			std::fwrite(batch, 1, used, batchOutput);
+			std::fflush(output);
+			std::fflush(errorOutput);
+		}
+		return any;
+	}
+
+	void flushLoop() {
+		while (!stopping.load(std::memory_order_acquire))
+			if (!drain())
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		drain();
+	}
+}
+
+void startLogging(LogLevel level, FILE* out, FILE* errors) {
+	if (running.exchange(true))
+		return;
+	logLevel.store(level, std::memory_order_relaxed);
+	output = out;
+	errorOutput = errors;
+	for (size_t i = 0; i < LOG_RING_SLOTS; i++)
+		ring[i].sequence.store(i, std::memory_order_relaxed);
+	enqueuePosition.store(0, std::memory_order_relaxed);
+	dequeuePosition = 0;
+	stopping.store(false, std::memory_order_release);
+	flusher = std::thread(flushLoop);
+}
+
+void stopLogging() {
+	if (!running.load())
+		return;
+	stopping.store(true, std::memory_order_release);
+	flusher.join();
+	running.store(false);
+}
+
+LogLevel parseLogLevel(const char* name) {
+	if (name == nullptr)
+		return LOG_INFO;
+	if (std::strcmp(name, "DEBUG") == 0) return LOG_DEBUG;
+	if (std::strcmp(name, "WARNING") == 0) return LOG_WARNING;
+	if (std::strcmp(name, "ERROR") == 0) return LOG_ERROR;
+	return LOG_INFO;
+}
+
+void logMessage(LogLevel level, const char* format, ...) {
+	if (level < logLevel.load(std::memory_order_relaxed))
+		return;
+	va_list args;
+	va_start(args, format);
+	if (!running.load(std::memory_order_acquire)) { // No flusher, written right away
+		char text[LOG_LINE_SIZE];
+		size_t length = formatLine(text, level, format, args);
+		va_end(args);
+		std::fwrite(text, 1, length, destination(level));
+		return;
+	}
+	size_t position = enqueuePosition.load(std::memory_order_relaxed);
+	LogSlot* slot;
+	for (;;) {
+		slot = &ring[position & (LOG_RING_SLOTS - 1)];
+		intptr_t turn = static_cast<intptr_t>(slot->sequence.load(std::memory_order_acquire)) - static_cast<intptr_t>(position);
+		if (turn == 0 && enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			break;
+		if (turn < 0) { // The flusher hasn't emptied this slot yet, the ring is full
+			va_end(args);
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		if (turn > 0)
+			position = enqueuePosition.load(std::memory_order_relaxed);
+	}
+	slot->level = level;
+	slot->length = formatLine(slot->text, level, format, args);
+	va_end(args);
+	slot->sequence.store(position + 1, std::memory_order_release);
+}
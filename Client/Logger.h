@@ -0,0 +1,31 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+
+// Leveled logging that keeps console output off the transfer path. A message is formatted into a slot of a lock free ring and a
+// background thread writes the ring out in batches, so a line per packet costs a format and no system call.
+// When the ring is full messages are dropped (and counted) rather than making the sender wait.
+// Before startLogging, and after stopLogging, messages are written right away like a plain printf.
+// Either way debug and info messages go to one stream (stdout by default) and warnings and errors to another (stderr by default).
+enum LogLevel {
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_WARNING,
+	LOG_ERROR
+};
+
+enum LoggerConstants : unsigned {
+	LOG_LINE_SIZE = 512, // Longer messages are cut
+	LOG_RING_SLOTS = 4096 // A power of 2
+};
+
+extern std::atomic<LogLevel> logLevel;
+void startLogging(LogLevel level, FILE* out = stdout, FILE* errors = stderr);
+void stopLogging(); // Writes out what is left in the ring and stops the background thread
+LogLevel parseLogLevel(const char* name); // DEBUG, INFO, WARNING or ERROR, INFO for anything else
+
+#if defined(__GNUC__)
+void logMessage(LogLevel level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+#else
+void logMessage(LogLevel level, const char* format, ...);
+#endif
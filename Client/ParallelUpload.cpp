@@ -0,0 +1,187 @@
+#include "ParallelUpload.h"
+#include "Response.h"
+#include "Constants.h"
+#include "cksum.h"
+#include "Backoff.h"
+#include "Logger.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct UploadFile { // A file of the directory, and the state the sessions sending its parts share
+	std::string path;
+	std::string name;
+	uint64_t size = 0;
+	uint32_t parts = 0; // 0 when it's sent whole
+	std::vector<uint32_t> partCrcs; // Combined in order into the cksum of the whole file, which the server checks the joined file against
+	std::atomic<uint32_t> remaining{ 0 }; // The session that sends the last part joins them
+	std::atomic<bool> failed{ false };
+};
+
+// Runs a session again after a jittered backoff when the server was busy or the connection failed, like connecting does.
+// The server drops what a failed connection left unverified, so the file or part starts over on the new connection.
+// Parts the server verified stay when the file fails, and the next upload of it sends them as deltas against them
+template <class F>
+void withRetries(F&& session) {
+	for (int attempt = 1; ; attempt++) {
+		uint32_t retryAfter = 0;
+		try {
+			session();
+			return;
+		}
+		catch (const ServerBusyError& e) {
+			if (attempt == MAX_CONNECT_TRIES)
+				throw;
+			retryAfter = e.getRetryAfter();
+		}
+		catch (const boost::system::system_error& e) {
+			if (attempt == MAX_CONNECT_TRIES)
+				throw;
+			logMessage(LOG_WARNING, "Session failed: %s", e.what());
+		}
+		std::this_thread::sleep_for(backoffDelay(attempt, retryAfter));
+	}
+}
+
+void joinParts(const Client& loggedIn, UploadFile& file) {
+	uint32_t crc = 0;
+	for (uint32_t part = 0; part < file.parts; part++) {
+		uint64_t length = std::min(PART_SIZE, file.size - part * PART_SIZE);
+		crc = part ? crc_combine(crc, file.partCrcs[part], static_cast<size_t>(length)) : file.partCrcs[part];
+	}
+	uint32_t fileCksum = static_cast<uint32_t>(crc_finalize(crc, static_cast<size_t>(file.size)));
+	withRetries([&] { Client(loggedIn, file.path, file.name).joinParts(file.parts, file.size, fileCksum); });
+}
+
+}
+
+WorkStealingQueue::WorkStealingQueue(size_t workers, std::vector<UploadTask> tasks) : workers(workers) {
+	std::stable_sort(tasks.begin(), tasks.end(), [](const UploadTask& a, const UploadTask& b) { return a.length > b.length; });
+	for (size_t i = 0; i < tasks.size(); i++)
+		this->workers[i % workers].tasks.push_back(tasks[i]);
+}
+
+bool WorkStealingQueue::pop(size_t worker, UploadTask& task) {
+	{
+		std::lock_guard<std::mutex> guard(workers[worker].lock);
+		if (!workers[worker].tasks.empty()) {
+			task = workers[worker].tasks.front();
+			workers[worker].tasks.pop_front();
+			return true;
+		}
+	}
+	for (size_t i = 1; i < workers.size(); i++) { // No task is ever added, so a worker that finds every deque empty is done
+		WorkerTasks& victim = workers[(worker + i) % workers.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.back();
+			victim.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+UploadReport uploadDirectory(const Client& loggedIn, const std::string& directory, size_t workers) {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::unique_ptr<UploadFile>> files;
+	std::vector<UploadTask> tasks;
+	UploadReport report;
+	for (const auto& entry : fs::directory_iterator(directory)) {
+		if (!entry.is_regular_file())
+			continue;
+		report.files++;
+		auto file = std::make_unique<UploadFile>();
+		file->path = entry.path().string();
+		file->name = entry.path().filename().string();
+		file->size = entry.file_size();
+		if (file->size > PART_SIZE) {
+			file->parts = static_cast<uint32_t>((file->size + PART_SIZE - 1) / PART_SIZE);
+			if (file->name.size() + std::string(".part").size() + std::to_string(file->parts).size() >= FILE_NAME_SIZE) {
+				logMessage(LOG_ERROR, "File name %s is too long to send the file in parts", file->name.c_str());
+				report.failed++;
+				continue;
+			}
+			file->partCrcs.resize(file->parts);
+			file->remaining = file->parts;
+			for (uint32_t part = 0; part < file->parts; part++)
+				tasks.push_back({ files.size(), part + 1, part * PART_SIZE, std::min(PART_SIZE, file->size - part * PART_SIZE) });
+		}
+		else
+			tasks.push_back({ files.size(), 0, 0, file->size });
+		files.push_back(std::move(file));
+	}
+	workers = std::max<size_t>(1, std::min(workers, tasks.size()));
+	logMessage(LOG_INFO, "Uploading %zu files of %s as %zu tasks over %zu sessions", files.size(), directory.c_str(), tasks.size(), workers);
+
+	WorkStealingQueue queue(workers, std::move(tasks));
+	std::atomic<size_t> parts{ 0 }, failed{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::vector<std::thread> threads;
+	for (size_t worker = 0; worker < workers; worker++) {
+		threads.emplace_back([&, worker] {
+			UploadTask task;
+			while (queue.pop(worker, task)) {
+				UploadFile& file = *files[task.file];
+				try {
+					if (task.part == 0) {
+						withRetries([&] { Client(loggedIn, file.path, file.name).sendFile(); });
+						bytes += task.length;
+						continue;
+					}
+					if (file.failed) { // Another part already failed, the file won't be joined
+						file.remaining--;
+						continue;
+					}
+					std::string partName = file.name + ".part" + std::to_string(task.part);
+					withRetries([&] {
+						Client session(loggedIn, file.path, partName, task.offset, task.length);
+						session.sendPart();
+						file.partCrcs[task.part - 1] = session.getContentCrc(); // Of the content the server confirmed, the part isn't read again
+					});
+					bytes += task.length;
+					parts++;
+				}
+				catch (const std::exception& e) {
+					logMessage(LOG_ERROR, "Failed to send file %s: %s", file.name.c_str(), e.what());
+					if (!file.failed.exchange(true))
+						failed++;
+				}
+				if (task.part && --file.remaining == 0 && !file.failed) {
+					try {
+						joinParts(loggedIn, file);
+					}
+					catch (const std::exception& e) {
+						logMessage(LOG_ERROR, "Failed to join the parts of file %s: %s", file.name.c_str(), e.what());
+						failed++;
+					}
+				}
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	report.parts = parts;
+	report.failed += failed;
+	report.bytes = bytes;
+	report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	logMessage(LOG_INFO, "Uploaded %zu files (%zu parts), %llu bytes in %.2f s, %.1f MB/s, %zu failed", report.files - report.failed, report.parts,
+		static_cast<unsigned long long>(report.bytes), report.seconds, report.seconds > 0 ? report.bytes / report.seconds / (1 << 20) : 0.0, report.failed);
+	return report;
+}
+
+size_t uploadWorkers() {
+	if (const char* workers = std::getenv("CLIENT_WORKERS"))
+		if (int n = std::atoi(workers); n > 0)
+			return static_cast<size_t>(n);
+	unsigned cores = std::thread::hardware_concurrency();
+	return cores ? cores : 4;
+}
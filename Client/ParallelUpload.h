@@ -0,0 +1,45 @@
+#pragma once
+#include "Client.h"
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+constexpr uint64_t PART_SIZE = 32ull << 20; // Files larger than this are sent as parts of this size, by as many sessions at once as are free
+
+// What one session of a parallel upload sends: a whole file, or a part of a large one
+struct UploadTask {
+	size_t file; // Index of the file in the upload
+	uint32_t part; // From 1, 0 for a whole file
+	uint64_t offset;
+	uint64_t length;
+};
+
+// A deque of tasks per worker. A worker takes its own tasks from the front and, once it ran out, steals from the back of another
+// worker's deque, so the workers that drew small files help with the parts of the large ones instead of idling at the end of a batch
+class WorkStealingQueue {
+private:
+	struct WorkerTasks {
+		std::mutex lock;
+		std::deque<UploadTask> tasks;
+	};
+	std::vector<WorkerTasks> workers;
+
+public:
+	WorkStealingQueue(size_t workers, std::vector<UploadTask> tasks); // Deals the tasks out largest first, round robin
+	bool pop(size_t worker, UploadTask& task); // False once every deque is empty
+};
+
+struct UploadReport {
+	size_t files = 0;
+	size_t parts = 0; // Parts of large files sent, each a session of its own
+	size_t failed = 0; // Files that didn't make it
+	uint64_t bytes = 0;
+	double seconds = 0;
+};
+
+// Uploads the regular files at the top of directory over workers sessions at once, each with a connection of its own,
+// as the client loggedIn signed up or logged in as
+UploadReport uploadDirectory(const Client& loggedIn, const std::string& directory, size_t workers);
+size_t uploadWorkers(); // CLIENT_WORKERS, or one per core
@@ -66,4 +66,35 @@ std::string RSAPrivateWrapper::decrypt(const char* cipher, unsigned int length)
 	CryptoPP::RSAES_OAEP_SHA_Decryptor d(_privateKey);
 	CryptoPP::StringSource ss_cipher(reinterpret_cast<const CryptoPP::byte*>(cipher), length, true, new CryptoPP::PK_DecryptorFilter(_rng, d, new CryptoPP::StringSink(decrypted)));
 	return decrypted;
+}
+
+
+RSAPublicWrapper::RSAPublicWrapper(const char* key, unsigned int length)
+{
+	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(key), length, true);
+	_publicKey.Load(ss);
+}
+
+RSAPublicWrapper::RSAPublicWrapper(const std::string& key)
+{
+	CryptoPP::StringSource ss(key, true);
+	_publicKey.Load(ss);
+}
+
+RSAPublicWrapper::~RSAPublicWrapper() = default;
+
+std::string RSAPublicWrapper::encrypt(const std::string& plain)
+{
+	std::string cipher;
+	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
+	CryptoPP::StringSource ss(plain, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
+	return cipher;
+}
+
+std::string RSAPublicWrapper::encrypt(const char* plain, unsigned int length)
+{
+	std::string cipher;
+	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
+	CryptoPP::StringSource ss(reinterpret_cast<const CryptoPP::byte*>(plain), length, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
+	return cipher;
 }
\ No newline at end of file
@@ -29,4 +29,21 @@ public:
 
 	std::string decrypt(const std::string& cipher);
 	std::string decrypt(const char* cipher, unsigned int length);
+};
+
+class RSAPublicWrapper // Encrypts with a public key another side sent (the server encrypting the AES key it gives a client)
+{
+private:
+	CryptoPP::AutoSeededRandomPool _rng;
+	CryptoPP::RSA::PublicKey _publicKey;
+
+	RSAPublicWrapper(const RSAPublicWrapper& rsapublic);
+
+public:
+	RSAPublicWrapper(const char* key, unsigned int length);
+	RSAPublicWrapper(const std::string& key);
+	~RSAPublicWrapper();
+
+	std::string encrypt(const std::string& plain);
+	std::string encrypt(const char* plain, unsigned int length);
 };
\ No newline at end of file
@@ -1,100 +1,174 @@
 #include "Request.h"
 #include "Constants.h"
+#include "Trace.h"
 #include <boost/uuid/uuid_generators.hpp>
-#include <boost/endian/conversion.hpp>
 
 
+Request::Request(MessageBuffer& buffer) : buffer(buffer), payloadSize(0) {}
+
+Request::~Request() = default;
+
+uint8_t* Request::payload() { return buffer.data() + REQUEST_HEADER_SIZE; }
+
+// Header and payload are next to each other in the buffer, so they go out in one write
 void Request::send(boost::asio::ip::tcp::socket& s) const {
+	TraceSpan span("send", "bytes", REQUEST_HEADER_SIZE + payloadSize);
 	try {
-		write(s, boost::asio::buffer(header.data(), header.size()));
-		write(s, boost::asio::buffer(payload.data(), payload.size()));
+		write(s, boost::asio::buffer(buffer.data(), REQUEST_HEADER_SIZE + payloadSize));
 	}
 	catch (...) {
 		throw; // Throwing it to the main try-catch block
 	}
 }
 
-void Request::packHeader(const boost::uuids::uuid& uuid, const uint16_t code, const uint32_t payloadSize) {
-	header.resize(REQUEST_HEADER_SIZE);
-	std::copy_n(uuid.begin(), UUID_SIZE, header.begin());
-	header[UUID_SIZE] = VERSION;
-	boost::endian::store_little_u16((header.data() + UUID_SIZE + VERSION_SIZE), code);
-	boost::endian::store_little_u32((header.data() + UUID_SIZE + VERSION_SIZE + CODE_SIZE), payloadSize);
+// Packed after the payload, whose size it carries
+void Request::packHeader(const boost::uuids::uuid& uuid, const uint16_t code) {
+	LayoutWriter<RequestHeaderLayout>(buffer.data())
+		.set<RequestHeaderLayout::UUID>(uuid)
+		.set<RequestHeaderLayout::VERSION_FIELD>(static_cast<uint8_t>(VERSION))
+		.set<RequestHeaderLayout::CODE>(code)
+		.set<RequestHeaderLayout::PAYLOAD_SIZE>(payloadSize);
 }
 
-Request::~Request() = default;
-
 void RegistrationRequest::packPayload(const std::string& name) {
-	payload.resize(NAME_SIZE, NULLVAL);
-	std::copy_n(name.begin(), std::min(name.size(), static_cast<size_t>(NAME_SIZE)), payload.begin());
+	LayoutWriter<NameLayout>(payload()).set<NameLayout::NAME>(name);
+	payloadSize = NameLayout::size;
 }
 
-RegistrationRequest::RegistrationRequest(const std::string& name) {
-	packHeader(boost::uuids::nil_uuid(), REGISTRATION_CODE, NAME_SIZE);
+RegistrationRequest::RegistrationRequest(MessageBuffer& buffer, const std::string& name) : Request(buffer) {
 	packPayload(name);
+	packHeader(boost::uuids::nil_uuid(), REGISTRATION_CODE);
 }
 
 void PublicKeyRequest::packPayload(const std::string& name, const std::string& publicKey) {
-	payload.resize(NAME_SIZE, NULLVAL);
-	std::copy_n(name.begin(), std::min(name.size(), static_cast<size_t>(NAME_SIZE)), payload.begin());
-	payload.insert(payload.end(), publicKey.begin(), publicKey.end());
+	LayoutWriter<PublicKeyLayout>(payload())
+		.set<PublicKeyLayout::NAME>(name)
+		.set<PublicKeyLayout::PUBLIC_KEY>(publicKey);
+	payloadSize = PublicKeyLayout::size;
 }
 
-PublicKeyRequest::PublicKeyRequest(const boost::uuids::uuid& uuid, const std::string& name, const std::string& publicKey) {
-	packHeader(uuid, PUBLIC_KEY_CODE, NAME_SIZE + PUBLIC_KEY_SIZE);
+PublicKeyRequest::PublicKeyRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& name, const std::string& publicKey) : Request(buffer) {
 	packPayload(name, publicKey);
+	packHeader(uuid, PUBLIC_KEY_CODE);
 }
 
 void ReconnectionRequest::packPayload(const std::string& name) {
-	payload.resize(NAME_SIZE, NULLVAL);
-	std::copy_n(name.begin(), std::min(name.size(), static_cast<size_t>(NAME_SIZE)), payload.begin());
+	LayoutWriter<NameLayout>(payload()).set<NameLayout::NAME>(name);
+	payloadSize = NameLayout::size;
 }
 
-ReconnectionRequest::ReconnectionRequest(const boost::uuids::uuid& uuid, const std::string& name) { 
-	packHeader(uuid, RECONNECTION_CODE, NAME_SIZE);
+ReconnectionRequest::ReconnectionRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& name) : Request(buffer) {
 	packPayload(name);
+	packHeader(uuid, RECONNECTION_CODE);
 }
 
-void FilePacketRequest::packPayload(const uint32_t contentSize, const uint32_t origFileSize, const uint32_t packetNumTotalPackets, std::string& fname, const std::string& content) {
-	payload.insert(payload.end(), reinterpret_cast<const uint8_t*>(&contentSize), reinterpret_cast<const uint8_t*>(&contentSize) + sizeof(contentSize));
-	payload.insert(payload.end(), reinterpret_cast<const uint8_t*>(&origFileSize), reinterpret_cast<const uint8_t*>(&origFileSize) + sizeof(origFileSize));
-	payload.insert(payload.end(), reinterpret_cast<const uint8_t*>(&packetNumTotalPackets), reinterpret_cast<const uint8_t*>(&packetNumTotalPackets) + sizeof(packetNumTotalPackets));
-	fname.resize(FILE_NAME_SIZE, NULLVAL);
-	payload.insert(payload.end(), fname.begin(), fname.end());
-	payload.insert(payload.end(), content.begin(), content.end());
+void FilePacketRequest::packPayload(const uint32_t contentSize, const uint32_t origFileSize, const uint16_t totalPackets, const uint16_t packetNumber, const uint32_t packetCksum, const std::string& fname, const char* content, const size_t length) {
+	if (length > PACKET_SIZE)
+		throw std::runtime_error("File packet of " + std::to_string(length) + " bytes doesn't fit a request");
+	uint8_t* end = LayoutWriter<FilePacketLayout>(payload())
+		.set<FilePacketLayout::CONTENT_SIZE>(contentSize)
+		.set<FilePacketLayout::ORIG_FILE_SIZE>(origFileSize)
+		.set<FilePacketLayout::TOTAL_PACKETS>(totalPackets)
+		.set<FilePacketLayout::PACKET_NUMBER>(packetNumber)
+		.set<FilePacketLayout::CKSUM>(packetCksum) // Lets the server detect a corrupted packet and ask for it alone
+		.set<FilePacketLayout::FILE_NAME>(fname)
+		.end();
+	std::memcpy(end, content, length);
+	payloadSize = static_cast<uint32_t>(FilePacketLayout::size + length); // The last packet is usually shorter than SENDING_FILE_PAYLOAD_SIZE
 }
 
-FilePacketRequest::FilePacketRequest(const boost::uuids::uuid& uuid, const uint32_t contentSize, const uint32_t origFileSize, const uint32_t packetNumTotalPackets, std::string& fname, const std::string& content) {
-	packHeader(uuid, SENDING_FILE_CODE, SENDING_FILE_PAYLOAD_SIZE);
-	packPayload(contentSize, origFileSize, packetNumTotalPackets, fname, content);
+// The same packets carry either the whole encrypted file (SENDING_FILE_CODE) or an encrypted delta of it (DELTA_FILE_CODE)
+FilePacketRequest::FilePacketRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const uint32_t contentSize, const uint32_t origFileSize, const uint16_t totalPackets, const uint16_t packetNumber, const uint32_t packetCksum, const std::string& fname, const char* content, const size_t length, const uint16_t code) : Request(buffer) {
+	packPayload(contentSize, origFileSize, totalPackets, packetNumber, packetCksum, fname, content, length);
+	packHeader(uuid, code);
+}
+
+void SignatureRequest::packPayload(const std::string& fname) {
+	LayoutWriter<FileNameLayout>(payload()).set<FileNameLayout::FILE_NAME>(fname);
+	payloadSize = FileNameLayout::size;
+}
+
+SignatureRequest::SignatureRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname) : Request(buffer) {
+	packPayload(fname);
+	packHeader(uuid, SIGNATURE_CODE);
+}
+
+void ChunkManifestRequest::packPayload(const uint32_t origFileSize, const uint16_t totalBatches, const uint16_t batchNumber, const Digest& fileDigest, const std::string& fname, std::vector<Chunk>::const_iterator first, std::vector<Chunk>::const_iterator last) {
+	if (last - first > MANIFEST_BATCH_ENTRIES)
+		throw std::runtime_error("Manifest batch of " + std::to_string(last - first) + " chunks doesn't fit a request");
+	uint8_t* p = LayoutWriter<ChunkManifestLayout>(payload())
+		.set<ChunkManifestLayout::ORIG_FILE_SIZE>(origFileSize)
+		.set<ChunkManifestLayout::TOTAL_BATCHES>(totalBatches)
+		.set<ChunkManifestLayout::BATCH_NUMBER>(batchNumber)
+		.set<ChunkManifestLayout::FILE_DIGEST>(fileDigest) // Lets the server recognize a file it already has after the first batch
+		.set<ChunkManifestLayout::FILE_NAME>(fname)
+		.end();
+	for (; first != last; ++first)
+		p = LayoutWriter<ManifestEntryLayout>(p)
+			.set<ManifestEntryLayout::DIGEST>(first->digest)
+			.set<ManifestEntryLayout::SIZE>(first->size)
+			.end();
+	payloadSize = static_cast<uint32_t>(p - payload());
+}
+
+ChunkManifestRequest::ChunkManifestRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const uint32_t origFileSize, const uint16_t totalBatches, const uint16_t batchNumber, const Digest& fileDigest, const std::string& fname, std::vector<Chunk>::const_iterator first, std::vector<Chunk>::const_iterator last) : Request(buffer) {
+	packPayload(origFileSize, totalBatches, batchNumber, fileDigest, fname, first, last);
+	packHeader(uuid, CHUNK_MANIFEST_CODE);
+}
+
+void ChunkDataRequest::packPayload(const uint32_t chunkIndex, const std::string& content) {
+	if (content.size() > SENDING_FILE_PAYLOAD_SIZE - ChunkDataLayout::size)
+		throw std::runtime_error("Chunk of " + std::to_string(content.size()) + " bytes doesn't fit a request");
+	uint8_t* end = LayoutWriter<ChunkDataLayout>(payload()).set<ChunkDataLayout::CHUNK_INDEX>(chunkIndex).end();
+	std::memcpy(end, content.data(), content.size());
+	payloadSize = static_cast<uint32_t>(ChunkDataLayout::size + content.size());
+}
+
+ChunkDataRequest::ChunkDataRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const uint32_t chunkIndex, const std::string& content) : Request(buffer) {
+	packPayload(chunkIndex, content);
+	packHeader(uuid, CHUNK_DATA_CODE);
 }
 
 void DoneValidCRCRequest::packPayload(const std::string& fname) { 
-	payload.resize(FILE_NAME_SIZE, NULLVAL);
-	std::copy_n(fname.begin(), std::min(fname.size(), static_cast<size_t>(FILE_NAME_SIZE)), payload.begin());
+	LayoutWriter<FileNameLayout>(payload()).set<FileNameLayout::FILE_NAME>(fname);
+	payloadSize = FileNameLayout::size;
 }
 
-DoneValidCRCRequest::DoneValidCRCRequest(const boost::uuids::uuid& uuid, const std::string& fname) { 
-	packHeader(uuid, VALID_CRC_CODE, FILE_NAME_SIZE);
+DoneValidCRCRequest::DoneValidCRCRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname) : Request(buffer) { 
 	packPayload(fname);
+	packHeader(uuid, VALID_CRC_CODE);
 }
 
 void ResendingFileInvalidCRCRequest::packPayload(const std::string& fname) { 
-	payload.resize(FILE_NAME_SIZE, NULLVAL);
-	std::copy_n(fname.begin(), std::min(fname.size(), static_cast<size_t>(FILE_NAME_SIZE)), payload.begin());
+	LayoutWriter<FileNameLayout>(payload()).set<FileNameLayout::FILE_NAME>(fname);
+	payloadSize = FileNameLayout::size;
 }
 
-ResendingFileInvalidCRCRequest::ResendingFileInvalidCRCRequest(const boost::uuids::uuid& uuid, const std::string& fname) { 
-	packHeader(uuid, INVALID_CRC_RESENDING_FILE_CODE, FILE_NAME_SIZE);
+ResendingFileInvalidCRCRequest::ResendingFileInvalidCRCRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname) : Request(buffer) { 
 	packPayload(fname);
+	packHeader(uuid, INVALID_CRC_RESENDING_FILE_CODE);
 }
 
 void AbortInvalidCRCRequest::packPayload(const std::string& fname) { 
-	payload.resize(FILE_NAME_SIZE, NULLVAL);
-	std::copy_n(fname.begin(), std::min(fname.size(), static_cast<size_t>(FILE_NAME_SIZE)), payload.begin());
+	LayoutWriter<FileNameLayout>(payload()).set<FileNameLayout::FILE_NAME>(fname);
+	payloadSize = FileNameLayout::size;
 }
 
-AbortInvalidCRCRequest::AbortInvalidCRCRequest(const boost::uuids::uuid& uuid, const std::string& fname) { 
-	packHeader(uuid, INVALID_CRC_ABORT_CODE, FILE_NAME_SIZE);
+AbortInvalidCRCRequest::AbortInvalidCRCRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname) : Request(buffer) { 
 	packPayload(fname);
+	packHeader(uuid, INVALID_CRC_ABORT_CODE);
+}
+
+void JoinPartsRequest::packPayload(const std::string& fname, const uint32_t totalParts, const uint64_t totalSize, const uint32_t fileCksum) {
+	LayoutWriter<JoinPartsLayout>(payload())
+		.set<JoinPartsLayout::FILE_NAME>(fname)
+		.set<JoinPartsLayout::TOTAL_PARTS>(totalParts)
+		.set<JoinPartsLayout::TOTAL_SIZE>(totalSize)
+		.set<JoinPartsLayout::CKSUM>(fileCksum); // Every part was checked on its own, this checks they were joined right
+	payloadSize = JoinPartsLayout::size;
+}
+
+JoinPartsRequest::JoinPartsRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname, const uint32_t totalParts, const uint64_t totalSize, const uint32_t fileCksum) : Request(buffer) {
+	packPayload(fname, totalParts, totalSize, fileCksum);
+	packHeader(uuid, JOIN_PARTS_CODE);
 }
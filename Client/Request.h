@@ -1,15 +1,23 @@
 #pragma once
+#include "Chunker.h"
+#include "Codec.h"
+#include "Constants.h"
 #include <boost/uuid/uuid.hpp>
 #include <boost/asio.hpp>
 #include <vector>
 #include <string>
 
 
-class Request { // Represents a request from client to server
+// Represents a request from client to server.
+// A request is encoded in place into a buffer the connection owns and reuses for every request, so building and sending one doesn't allocate.
+// It stays valid (and can be sent again) until the next request is built into the same buffer
+class Request {
 protected:
-	std::vector<uint8_t> header;
-	std::vector<uint8_t> payload;
-	void packHeader(const boost::uuids::uuid& uuid, const uint16_t code, const uint32_t payloadSize);
+	MessageBuffer& buffer;
+	uint32_t payloadSize;
+	Request(MessageBuffer& buffer);
+	uint8_t* payload();
+	void packHeader(const boost::uuids::uuid& uuid, const uint16_t code);
 
 public:
 	virtual ~Request();
@@ -21,7 +29,7 @@ private:
 	void packPayload(const std::string& name);
 
 public:
-	RegistrationRequest(const std::string& name);
+	RegistrationRequest(MessageBuffer& buffer, const std::string& name);
 };
 
 class PublicKeyRequest : public Request {
@@ -29,7 +37,7 @@ private:
 	void packPayload(const std::string& name, const std::string& publicKey);
 
 public:
-	PublicKeyRequest(const boost::uuids::uuid& uuid, const std::string& name, const std::string& publicKey);
+	PublicKeyRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& name, const std::string& publicKey);
 };
 
 class ReconnectionRequest : public Request {
@@ -37,15 +45,42 @@ private:
 	void packPayload(const std::string& name);
 
 public:
-	ReconnectionRequest(const boost::uuids::uuid& uuid, const std::string& name);
+	ReconnectionRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& name);
 };
 
 class FilePacketRequest : public Request {
 private:
-	void packPayload(const uint32_t contentSize, const uint32_t origFileSize, const uint32_t packetNumTotalPackets, std::string& fname, const std::string& content);
+	void packPayload(const uint32_t contentSize, const uint32_t origFileSize, const uint16_t totalPackets, const uint16_t packetNumber, const uint32_t packetCksum, const std::string& fname, const char* content, const size_t length);
 
 public:
-	FilePacketRequest(const boost::uuids::uuid& uuid, const uint32_t contentSize, const uint32_t origFileSize, const uint32_t packetNumTotalPackets, std::string& fname, const std::string& content);
+	FilePacketRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const uint32_t contentSize, const uint32_t origFileSize, const uint16_t totalPackets, const uint16_t packetNumber, const uint32_t packetCksum, const std::string& fname, const char* content, const size_t length, const uint16_t code = SENDING_FILE_CODE);
+};
+
+// Asks for the block signatures of the server's copy of the file, if it has one
+class SignatureRequest : public Request {
+private:
+	void packPayload(const std::string& fname);
+
+public:
+	SignatureRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname);
+};
+
+// Describes the file as a list of chunks, in batches of up to MANIFEST_BATCH_ENTRIES chunks
+class ChunkManifestRequest : public Request {
+private:
+	void packPayload(const uint32_t origFileSize, const uint16_t totalBatches, const uint16_t batchNumber, const Digest& fileDigest, const std::string& fname, std::vector<Chunk>::const_iterator first, std::vector<Chunk>::const_iterator last);
+
+public:
+	ChunkManifestRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const uint32_t origFileSize, const uint16_t totalBatches, const uint16_t batchNumber, const Digest& fileDigest, const std::string& fname, std::vector<Chunk>::const_iterator first, std::vector<Chunk>::const_iterator last);
+};
+
+// Carries one encrypted chunk the server asked for
+class ChunkDataRequest : public Request {
+private:
+	void packPayload(const uint32_t chunkIndex, const std::string& content);
+
+public:
+	ChunkDataRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const uint32_t chunkIndex, const std::string& content);
 };
 
 class DoneValidCRCRequest : public Request {
@@ -53,7 +88,7 @@ private:
 	void packPayload(const std::string& fname);
 
 public:
-	DoneValidCRCRequest(const boost::uuids::uuid& uuid, const std::string& fname);
+	DoneValidCRCRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname);
 };
 
 class ResendingFileInvalidCRCRequest : public Request {
@@ -61,7 +96,7 @@ private:
 	void packPayload(const std::string& fname);
 
 public:
-	ResendingFileInvalidCRCRequest(const boost::uuids::uuid& uuid, const std::string& fname);
+	ResendingFileInvalidCRCRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname);
 };
 
 class AbortInvalidCRCRequest : public Request {
@@ -69,5 +104,14 @@ private:
 	void packPayload(const std::string& fname);
 
 public:
-	AbortInvalidCRCRequest(const boost::uuids::uuid& uuid, const std::string& fname);
+	AbortInvalidCRCRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname);
+};
+
+// Asks the server to join the parts of a large file (stored as fname.part1 to fname.partN) into fname, checking the cksum of the whole
+class JoinPartsRequest : public Request {
+private:
+	void packPayload(const std::string& fname, const uint32_t totalParts, const uint64_t totalSize, const uint32_t fileCksum);
+
+public:
+	JoinPartsRequest(MessageBuffer& buffer, const boost::uuids::uuid& uuid, const std::string& fname, const uint32_t totalParts, const uint64_t totalSize, const uint32_t fileCksum);
 };
@@ -1,47 +1,68 @@
 #include "Response.h"
 #include "Constants.h"
+#include "Backoff.h"
+#include "Trace.h"
+#include "Logger.h"
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/endian/conversion.hpp>
 
-// With this logic, any request will be resent up to 3 *more* times if general error from server was received
+ServerBusyError::ServerBusyError(uint32_t retryAfter) : std::runtime_error("Server is busy"), retryAfter(retryAfter) {}
+
+uint32_t ServerBusyError::getRetryAfter() const { return retryAfter; }
+
+void (*responseCodeObserver)(uint16_t code) = nullptr;
+
+// With this logic, any request will be resent up to 3 *more* times if general error from server was received,
+// each time after a jittered backoff so clients failing together don't hit the server again together
 Response::Response(boost::asio::ip::tcp::socket& s, const Request* r) {
+	TraceSpan span("wait response"); // Mostly the server's time, until the header arrives
 	for (int i = 0; i < MAX_TRIES - 1; i++) { // MAX_TRIES - 1 because the first try was already done to get the error
-		std::vector<uint8_t> header(RESPONSE_HEADER_SIZE);
+		std::array<uint8_t, RESPONSE_HEADER_SIZE> header;
 		read(s, boost::asio::buffer(header));
 		unpackHeader(header);
 		if (code == REGISTRATION_FAILED_CODE)
-			throw std::exception("Registration failed"); // In this case there's no sense trying to register again for 3 more times
+			throw std::runtime_error("Registration failed"); // In this case there's no sense trying to register again for 3 more times
+		if (code == SERVER_BUSY_CODE) { // Only ever the response to the first request of a connection, which the server closes
+			std::array<uint8_t, ServerBusyLayout::size> payload{};
+			read(s, boost::asio::buffer(payload, std::min<size_t>(payloadSize, payload.size())));
+			throw ServerBusyError(payloadSize >= ServerBusyLayout::size ? LayoutReader<ServerBusyLayout>(payload.data()).get<ServerBusyLayout::RETRY_AFTER>() : 0);
+		}
 		if (code == GENERAL_ERROR_CODE) {
-			std::cerr << "server responded with an error" << std::endl;
-			if (r != nullptr)
+			logMessage(LOG_WARNING, "server responded with an error");
+			if (r != nullptr) {
+				backoff(i + 1);
 				r->send(s);
+			}
 			continue;
 		}
 		return;
 	}
-	std::cerr << "server responded with an error" << std::endl;
-	throw std::exception("Fatal error. Server responded with an error 4 times.\nPlease check your version and/or transfer.info file. You might have resent an existing file.");
+	logMessage(LOG_WARNING, "server responded with an error");
+	throw std::runtime_error("Fatal error. Server responded with an error 4 times.\nPlease check your version and/or transfer.info file. You might have resent an existing file.");
 	// The protocol didn't mention what to do in case a client resends an existing file which he already sent - I chose to return an error for this case and not allowing to overwrite.
 }
 
 Response::~Response() = default;
 
-// Payload has to be read separately from header, because first we need to get payload size field from the header
+// Payload has to be read separately from header, because first we need to get payload size field from the header.
+// It's read into a buffer kept for the thread, which only grows past its largest payload so far, so a response doesn't allocate
 void Response::initializePayload(boost::asio::ip::tcp::socket& s) {
-	std::vector<uint8_t> payload(payloadSize);
+	TraceSpan span("response payload", "bytes", payloadSize); // Reading and unpacking it
+	static thread_local std::vector<uint8_t> payload;
+	payload.resize(payloadSize);
 	read(s, boost::asio::buffer(payload));
 	unpackPayload(payload);
 }
 
-void Response::unpackHeader(const std::vector<uint8_t>& header) {
-	std::copy_n(header.begin(), sizeof(version), &version);
-	version = boost::endian::little_to_native(version);
+void Response::unpackHeader(const std::array<uint8_t, RESPONSE_HEADER_SIZE>& header) {
+	LayoutReader<ResponseHeaderLayout> reader(header.data());
+	version = reader.get<ResponseHeaderLayout::VERSION_FIELD>();
 	if (version != VERSION)
 		throw std::runtime_error("Server version must be " + std::to_string(VERSION));
-	std::copy_n(header.begin() + VERSION_SIZE, sizeof(code), reinterpret_cast<uint8_t*>(&code));
-	code = boost::endian::little_to_native(code);
-	std::copy_n(header.begin() + VERSION_SIZE + CODE_SIZE, sizeof(payloadSize), reinterpret_cast<uint8_t*>(&payloadSize));
-	payloadSize = boost::endian::little_to_native(payloadSize);
+	code = reader.get<ResponseHeaderLayout::CODE>();
+	if (responseCodeObserver != nullptr)
+		responseCodeObserver(code);
+	payloadSize = reader.get<ResponseHeaderLayout::PAYLOAD_SIZE>();
 }
 
 uint16_t Response::getCode() const { return code; }
@@ -69,6 +90,7 @@ void AesResponse::unpackPayload(const std::vector<uint8_t>& payload)
 	std::copy_n(payload.begin(), UUID_SIZE, uuid.begin());
 	std::string encryptedAES(payloadSize - UUID_SIZE, '\0');
 	std::copy_n(payload.begin() + UUID_SIZE, payloadSize - UUID_SIZE, encryptedAES.begin());
+	TraceSpan span("rsa decrypt");
 	RSAPrivateWrapper rsaWrapper(privateKey);
 	decryptedAES = rsaWrapper.decrypt(encryptedAES);
 }
@@ -84,9 +106,34 @@ FileReceivedResponse::FileReceivedResponse(boost::asio::ip::tcp::socket& s) :Res
 void FileReceivedResponse::unpackPayload(const std::vector<uint8_t>& payload)
 {
 	std::copy_n(payload.begin(), UUID_SIZE, uuid.begin());
-	std::copy_n(payload.begin() + UUID_SIZE, CONTENTSIZE_SIZE, reinterpret_cast<uint8_t*>(&contentSize));
-	fileName.assign(reinterpret_cast<const char*>(payload.data() + UUID_SIZE + CONTENTSIZE_SIZE), FILE_NAME_SIZE);
-	std::copy_n(payload.begin() + UUID_SIZE + CONTENTSIZE_SIZE + FILE_NAME_SIZE, CKSUM_SIZE, reinterpret_cast<uint8_t*>(&cksum));
+	if (code == RECEIVED_MESSAGE_CODE) // A chunk manifest batch was received and the server waits for the next one
+		return;
+	if (code == CHUNKS_MISSING_CODE) { // A bitmap over the manifest's chunks, with a set bit for every chunk the chunk store doesn't have
+		LayoutReader<ChunksMissingLayout> reader(payload.data());
+		uint32_t count = payload.size() < ChunksMissingLayout::size ? 0 : reader.get<ChunksMissingLayout::COUNT>();
+		if (payload.size() < ChunksMissingLayout::size + (static_cast<size_t>(count) + 7) / 8)
+			throw std::runtime_error("Server sent a truncated list of missing chunks");
+		const uint8_t* bitmap = reader.end();
+		for (uint32_t i = 0; i < count; i++)
+			if (bitmap[i / 8] & (1 << (i % 8)))
+				missing.push_back(i);
+		return;
+	}
+	if (code == PACKETS_NACK_CODE) { // Instead of the file details, the server lists the packets that arrived corrupted
+		LayoutReader<PacketsNackLayout> reader(payload.data());
+		uint16_t count = payload.size() < PacketsNackLayout::size ? 0 : reader.get<PacketsNackLayout::COUNT>();
+		if (payload.size() < PacketsNackLayout::size + static_cast<size_t>(count) * PACKET_NUMBER_SIZE)
+			throw std::runtime_error("Server sent a truncated list of packets to resend");
+		for (size_t i = 0; i < count; i++)
+			missing.push_back(boost::endian::load_little_u16(reader.end() + i * PACKET_NUMBER_SIZE));
+		return;
+	}
+	if (payload.size() < FileReceivedLayout::size)
+		throw std::runtime_error("Server sent a truncated file received response");
+	LayoutReader<FileReceivedLayout> reader(payload.data());
+	contentSize = reader.get<FileReceivedLayout::CONTENT_SIZE>();
+	fileName.assign(reader.get<FileReceivedLayout::FILE_NAME>());
+	cksum = reader.get<FileReceivedLayout::CKSUM>();
 }
 
 uint32_t FileReceivedResponse::getContentSize() const { return contentSize; }
@@ -95,6 +142,36 @@ uint32_t FileReceivedResponse::getCRC() const { return cksum; }
 
 std::string FileReceivedResponse::getFileName() const { return fileName; }
 
+const std::vector<uint32_t>& FileReceivedResponse::getMissing() const { return missing; }
+
+SignaturesResponse::SignaturesResponse(boost::asio::ip::tcp::socket& s, const Request* r) : Response(s, r), blockSize(0) {
+	initializePayload(s);
+}
+
+void SignaturesResponse::unpackPayload(const std::vector<uint8_t>& payload)
+{
+	if (payload.size() < SignaturesLayout::size)
+		throw std::runtime_error("Server sent a truncated list of block signatures");
+	LayoutReader<SignaturesLayout> reader(payload.data());
+	std::copy_n(reader.get<SignaturesLayout::UUID>(), UUID_SIZE, uuid.begin());
+	blockSize = reader.get<SignaturesLayout::BLOCK_SIZE>();
+	uint32_t count = reader.get<SignaturesLayout::COUNT>();
+	if (payload.size() < SignaturesLayout::size + static_cast<size_t>(count) * BlockSignatureLayout::size)
+		throw std::runtime_error("Server sent a truncated list of block signatures");
+	const uint8_t* p = reader.end();
+	signatures.resize(count);
+	for (BlockSignature& signature : signatures) {
+		LayoutReader<BlockSignatureLayout> entry(p);
+		signature.weak = entry.get<BlockSignatureLayout::WEAK>();
+		std::copy_n(entry.get<BlockSignatureLayout::STRONG>(), STRONG_SUM_SIZE, signature.strong.begin());
+		p = entry.end();
+	}
+}
+
+uint32_t SignaturesResponse::getBlockSize() const { return blockSize; }
+
+const std::vector<BlockSignature>& SignaturesResponse::getSignatures() const { return signatures; }
+
 ReceivedMessageResponse::ReceivedMessageResponse(boost::asio::ip::tcp::socket& s, const Request* r)
 	: Response(s, r) {
 	initializePayload(s);
@@ -2,10 +2,26 @@
 #include "Request.h"
 #include "RSAWrapper.h"
 #include "FileHelper.h"
+#include "Delta.h"
 #include <boost/uuid/uuid.hpp>
 #include <boost/asio.hpp>
+#include <array>
+#include <stdexcept>
 
 
+// The server had no room for this connection and closed it. It's worth connecting again, after getRetryAfter() milliseconds
+class ServerBusyError : public std::runtime_error {
+private:
+	uint32_t retryAfter;
+public:
+	ServerBusyError(uint32_t retryAfter);
+	uint32_t getRetryAfter() const;
+};
+
+// When set, called with the code of every response header read, errors the Response retried on its own included.
+// Lets a tool count what the server answered (the load generator does), a test of a pointer otherwise
+extern void (*responseCodeObserver)(uint16_t code);
+
 // I constructed the code in such way that doesn't require having an inheriting class for each type of response.
 // For instance, taking care of reconnection failed response is enough to do just at the unpackPayload function of AESResponse.
 class Response { // Represents a response from server to client
@@ -14,7 +30,7 @@ protected:
 	uint16_t code;
 	uint32_t payloadSize;
 	boost::uuids::uuid uuid;
-	void unpackHeader(const std::vector<uint8_t>& header);
+	void unpackHeader(const std::array<uint8_t, RESPONSE_HEADER_SIZE>& header);
 	virtual void unpackPayload(const std::vector<uint8_t>& payload) = 0;
 public:
 	virtual ~Response();
@@ -46,6 +62,7 @@ private:
 	uint32_t contentSize;
 	uint32_t cksum;
 	std::string fileName;
+	std::vector<uint32_t> missing; // Packet numbers (PACKETS_NACK_CODE) or chunk indexes (CHUNKS_MISSING_CODE) the server asks for
 	void unpackPayload(const std::vector<uint8_t>& payload) override;
 public:
 	FileReceivedResponse(boost::asio::ip::tcp::socket& s, const Request* r);
@@ -53,6 +70,19 @@ public:
 	uint32_t getContentSize() const;
 	uint32_t getCRC() const;
 	std::string getFileName() const;
+	const std::vector<uint32_t>& getMissing() const;
+};
+
+// Block signatures of the server's copy of a file. A block size of 0 means the server doesn't have the file
+class SignaturesResponse : public Response {
+private:
+	uint32_t blockSize;
+	std::vector<BlockSignature> signatures;
+	void unpackPayload(const std::vector<uint8_t>& payload) override;
+public:
+	SignaturesResponse(boost::asio::ip::tcp::socket& s, const Request* r);
+	uint32_t getBlockSize() const;
+	const std::vector<BlockSignature>& getSignatures() const;
 };
 
 class ReceivedMessageResponse : public Response {
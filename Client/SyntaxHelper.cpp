@@ -5,7 +5,7 @@ bool isValidPort(const std::string& port) {
 	try {
 		int p = std::stoi(port);
 		if (p < 0 && p > 65535 || port[0] == '0' && port.length() > 1)
-			throw std::exception("Port should be integer between 0 to 65535");
+			throw std::runtime_error("Port should be integer between 0 to 65535");
 		return true;
 	}
 	catch (...) {
@@ -41,5 +41,5 @@ bool isValidIpv4(const std::string& ipv4) {
 	}
 	if (validIPv4 && octetCount == 4)
 		return true;
-	throw std::exception("IPv4 should be in format of n1.n2.n3.n4 such that ni(4 >= i >= 1) is an integer between 0 to 255");
+	throw std::runtime_error("IPv4 should be in format of n1.n2.n3.n4 such that ni(4 >= i >= 1) is an integer between 0 to 255");
 }
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include "Trace.h"
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+bool tracingEnabled = false;
+
+namespace {
+	struct TraceEvent {
+		const char* name;
+		const char* argName;
+		uint64_t arg;
+		std::chrono::steady_clock::time_point start, end;
+		uint32_t thread;
+	};
+
+	std::mutex traceLock;
+	std::vector<TraceEvent> traceEvents;
+	std::string tracePath;
+	std::chrono::steady_clock::time_point traceStart;
+	std::atomic<uint32_t> traceThreads{ 0 };
+
+	double microseconds(std::chrono::steady_clock::duration d) {
+		return std::chrono::duration<double, std::micro>(d).count();
+	}
+}
+
+void startTracing(const std::string& path) {
+	std::lock_guard<std::mutex> guard(traceLock);
+	tracePath = path;
+	traceStart = std::chrono::steady_clock::now();
+	traceEvents.reserve(1 << 16); // Enough for a file of tens of thousands of packets before it grows
+	tracingEnabled = true;
+}
+
+void TraceSpan::record() const {
+	static thread_local uint32_t thread = ++traceThreads; // Small numbers read better in the viewer than thread ids
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> guard(traceLock);
+	traceEvents.push_back({ name, argName, arg, start, end, thread });
+}
+
+void writeTrace() {
+	std::lock_guard<std::mutex> guard(traceLock);
+	if (tracePath.empty())
+		return;
+	std::ofstream trace(tracePath);
+	if (!trace.is_open())
+		throw std::runtime_error("Error opening trace file " + tracePath);
+	trace << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	for (size_t i = 0; i < traceEvents.size(); i++) { // Complete events ("X"): a start and a duration each
+		const TraceEvent& e = traceEvents[i];
+		trace << (i ? ",\n" : "\n") << "{\"name\": \"" << e.name << "\", \"cat\": \"client\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread
+			<< ", \"ts\": " << microseconds(e.start - traceStart) << ", \"dur\": " << microseconds(e.end - e.start);
+		if (e.argName)
+			trace << ", \"args\": {\"" << e.argName << "\": " << e.arg << "}";
+		trace << "}";
+	}
+	trace << "\n]}\n";
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Scoped spans around the phases of a transfer, exported as Chrome trace event JSON (chrome://tracing or ui.perfetto.dev).
+// Tracing is off until startTracing is called (main calls it when CLIENT_TRACE names a file). While it's off a span costs a test of one flag
+extern bool tracingEnabled;
+void startTracing(const std::string& path);
+void writeTrace(); // Writes every span recorded so far to the file given to startTracing
+
+class TraceSpan { // Records the time from its construction to its destruction under name, which must be a string literal
+private:
+	const char* name;
+	const char* argName;
+	uint64_t arg;
+	std::chrono::steady_clock::time_point start;
+	void record() const;
+
+public:
+	explicit TraceSpan(const char* name, const char* argName = nullptr, uint64_t arg = 0)
+		: name(tracingEnabled ? name : nullptr), argName(argName), arg(arg) {
+		if (this->name)
+			start = std::chrono::steady_clock::now();
+	}
+	~TraceSpan() {
+		if (name)
+			record();
+	}
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+// Runs f inside a span, for a phase that is a single call: auto buffer = traced("read file", [&] { return readFile(path); });
+template <class F>
+auto traced(const char* name, F&& f) {
+	TraceSpan span(name);
+	return f();
+}
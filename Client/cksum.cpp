@@ -1,21 +1,174 @@
 #include "cksum.h"
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CKSUM_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CKSUM_CLMUL_TARGET
+#else
+#include <cpuid.h>
+#define CKSUM_CLMUL_TARGET __attribute__((target("pclmul,ssse3"))) // GCC/Clang only emit these instructions in functions that ask for them
+#endif
+#endif
 
 
-unsigned long memcrc(char* b, size_t n) {
-	unsigned int v = 0, c = 0;
-	unsigned long s = 0;
-	unsigned int tabidx;
+namespace {
+	constexpr uint32_t POLY = 0x04c11db7;
 
-	for (int i = 0; i < n; i++) {
-		tabidx = (s >> 24) ^ (unsigned char)b[i];
-		s = UNSIGNED((s << 8)) ^ crctab[0][tabidx];
+	// crctab holds the slicing-by-8 tables (row k is the crc of a byte followed by k zero bytes), the 8 extra rows for slicing-by-16 are derived from it
+	struct SliceTables {
+		uint32_t t[16][256];
+		SliceTables() {
+			for (int k = 0; k < 16; k++)
+				for (int i = 0; i < 256; i++)
+					t[k][i] = k < 8 ? static_cast<uint32_t>(crctab[k][i]) : (t[k - 1][i] << 8) ^ t[0][t[k - 1][i] >> 24];
+		}
+	};
+	const SliceTables slice;
+
+	inline uint32_t loadBigEndian32(const unsigned char* p) {
+		return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+	}
+
+	inline uint32_t crcBytes(uint32_t crc, const unsigned char* p, size_t n) {
+		while (n--)
+			crc = (crc << 8) ^ slice.t[0][(crc >> 24) ^ *p++];
+		return crc;
+	}
+
+	// x^n mod P, used for the folding constants
+	constexpr uint32_t xpowModP(unsigned int n) {
+		uint32_t r = 1;
+		while (n--)
+			r = (r & 0x80000000) ? (r << 1) ^ POLY : r << 1;
+		return r;
+	}
+
+	// a*b mod P over GF(2)
+	uint32_t multModP(uint32_t a, uint32_t b) {
+		uint32_t prod = 0;
+		for (int i = 31; i >= 0; i--) {
+			prod = (prod & 0x80000000) ? (prod << 1) ^ POLY : prod << 1;
+			if (a & (1u << i))
+				prod ^= b;
+		}
+		return prod;
+	}
+
+	// x^(8n) mod P by square and multiply, so combining costs O(log n) instead of feeding n zero bytes
+	uint32_t xpow8nModP(size_t n) {
+		uint32_t result = 1, power = xpowModP(8);
+		while (n) {
+			if (n & 1)
+				result = multModP(result, power);
+			power = multModP(power, power);
+			n >>= 1;
+		}
+		return result;
+	}
+}
+
+uint32_t crc_update_sliced8(uint32_t crc, const void* data, size_t n) {
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const auto& t = slice.t;
+	for (; n >= 8; p += 8, n -= 8) {
+		uint32_t a = crc ^ loadBigEndian32(p), b = loadBigEndian32(p + 4);
+		crc = t[7][a >> 24] ^ t[6][(a >> 16) & 0xff] ^ t[5][(a >> 8) & 0xff] ^ t[4][a & 0xff] ^
+			t[3][b >> 24] ^ t[2][(b >> 16) & 0xff] ^ t[1][(b >> 8) & 0xff] ^ t[0][b & 0xff];
+	}
+	return crcBytes(crc, p, n);
+}
+
+uint32_t crc_update_sliced16(uint32_t crc, const void* data, size_t n) {
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const auto& t = slice.t;
+	for (; n >= 16; p += 16, n -= 16) {
+		uint32_t a = crc ^ loadBigEndian32(p), b = loadBigEndian32(p + 4), c = loadBigEndian32(p + 8), d = loadBigEndian32(p + 12);
+		crc = t[15][a >> 24] ^ t[14][(a >> 16) & 0xff] ^ t[13][(a >> 8) & 0xff] ^ t[12][a & 0xff] ^
+			t[11][b >> 24] ^ t[10][(b >> 16) & 0xff] ^ t[9][(b >> 8) & 0xff] ^ t[8][b & 0xff] ^
+			t[7][c >> 24] ^ t[6][(c >> 16) & 0xff] ^ t[5][(c >> 8) & 0xff] ^ t[4][c & 0xff] ^
+			t[3][d >> 24] ^ t[2][(d >> 16) & 0xff] ^ t[1][(d >> 8) & 0xff] ^ t[0][d & 0xff];
 	}
+	return crcBytes(crc, p, n);
+}
+
+#ifdef CKSUM_X86
+bool crc_has_clmul() {
+	unsigned int ecx = 0;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	ecx = static_cast<unsigned int>(info[2]);
+#else
+	unsigned int eax, ebx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+#endif
+	return (ecx & (1u << 1)) && (ecx & (1u << 9)); // PCLMULQDQ and SSSE3 (for the byte swap)
+}
+
+namespace {
+	// Folds the 128 bit state x over the next 128 bit block d: x*x^D + d, with k holding x^(D+64) mod P (high lane) and x^D mod P (low lane)
+	CKSUM_CLMUL_TARGET inline __m128i fold(__m128i x, __m128i k, __m128i d) {
+		return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), d);
+	}
+
+	CKSUM_CLMUL_TARGET inline __m128i loadSwapped(const unsigned char* p, __m128i swap) {
+		return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), swap);
+	}
+}
+
+// The cksum CRC is not bit reflected, so every 16 bytes are byte swapped to make bit 127 of the register the first bit of the message.
+// Four independent accumulators are folded 512 bits ahead, then merged into one, and the last 128 bits are reduced with the table engine.
+CKSUM_CLMUL_TARGET uint32_t crc_update_clmul(uint32_t crc, const void* data, size_t n) {
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	if (n < 64)
+		return crc_update_sliced16(crc, p, n);
+	const __m128i swap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	const __m128i k512 = _mm_set_epi64x(xpowModP(512 + 64), xpowModP(512));
+	const __m128i k128 = _mm_set_epi64x(xpowModP(128 + 64), xpowModP(128));
+
+	__m128i x0 = _mm_xor_si128(loadSwapped(p, swap), _mm_set_epi32(static_cast<int>(crc), 0, 0, 0)); // The incoming state lines up with the first 4 bytes
+	__m128i x1 = loadSwapped(p + 16, swap), x2 = loadSwapped(p + 32, swap), x3 = loadSwapped(p + 48, swap);
+	for (p += 64, n -= 64; n >= 64; p += 64, n -= 64) {
+		x0 = fold(x0, k512, loadSwapped(p, swap));
+		x1 = fold(x1, k512, loadSwapped(p + 16, swap));
+		x2 = fold(x2, k512, loadSwapped(p + 32, swap));
+		x3 = fold(x3, k512, loadSwapped(p + 48, swap));
+	}
+	x1 = fold(x0, k128, x1);
+	x2 = fold(x1, k128, x2);
+	x3 = fold(x2, k128, x3);
+	for (; n >= 16; p += 16, n -= 16)
+		x3 = fold(x3, k128, loadSwapped(p, swap));
+
+	unsigned char folded[16];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(folded), _mm_shuffle_epi8(x3, swap));
+	return crc_update_sliced16(crc_update_sliced16(0, folded, sizeof(folded)), p, n);
+}
+#else
+bool crc_has_clmul() { return false; }
+
+uint32_t crc_update_clmul(uint32_t crc, const void* data, size_t n) { return crc_update_sliced16(crc, data, n); }
+#endif
+
+uint32_t crc_update(uint32_t crc, const void* data, size_t n) {
+	static const auto engine = crc_has_clmul() ? crc_update_clmul : crc_update_sliced16; // Runtime CPU dispatch, resolved once
+	return engine(crc, data, n);
+}
+
+uint32_t crc_combine(uint32_t crc1, uint32_t crc2, size_t len2) {
+	return multModP(crc1, xpow8nModP(len2)) ^ crc2;
+}
 
-	while (n) {
-		c = n & 0377;
+unsigned long crc_finalize(uint32_t crc, size_t n) {
+	while (n) { // Following POSIX, the length is appended least significant byte first, without trailing zero bytes
+		crc = (crc << 8) ^ slice.t[0][(crc >> 24) ^ (n & 0377)];
 		n = n >> 8;
-		s = UNSIGNED(s << 8) ^ crctab[0][(s >> 24) ^ c];
 	}
-	return (unsigned long)UNSIGNED(~s);
+	return (unsigned long)UNSIGNED(~crc);
+}
 
-}
\ No newline at end of file
+unsigned long memcrc(const char* b, size_t n) {
+	return crc_finalize(crc_update(0, b, n), n);
+}
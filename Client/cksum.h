@@ -1,6 +1,7 @@
 #pragma once
 #include <iostream>
 #include <cstdio>
+#include <cstdint>
 #include <filesystem>
 
 
@@ -441,4 +442,18 @@ uint_fast32_t const crctab[8][256] = {
 
 #define UNSIGNED(n) (n & 0xffffffff)
 
-unsigned long memcrc(char* b, size_t n);
\ No newline at end of file
+// POSIX cksum of a whole buffer (same value as the server's cksum.memcrc)
+unsigned long memcrc(const char* b, size_t n);
+
+// Streaming interface. The state starts at 0, is fed with crc_update (in any number of calls) and is turned into the cksum value with crc_finalize.
+// crc_update picks the fastest engine the CPU supports; the explicit engines are exposed for benchmarking and testing.
+uint32_t crc_update(uint32_t crc, const void* data, size_t n);
+uint32_t crc_update_sliced8(uint32_t crc, const void* data, size_t n);
+uint32_t crc_update_sliced16(uint32_t crc, const void* data, size_t n);
+uint32_t crc_update_clmul(uint32_t crc, const void* data, size_t n); // Only call it if crc_has_clmul() returns true
+bool crc_has_clmul();
+
+// Merges the states of two adjacent pieces A and B (each started at 0) into the state of A followed by B, where len2 is the length of B.
+// This way pieces CRC'd in parallel or out of order still produce the exact cksum of the whole file.
+uint32_t crc_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+unsigned long crc_finalize(uint32_t crc, size_t n); // n is the total length that was fed into the state
\ No newline at end of file
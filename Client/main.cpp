@@ -3,20 +3,39 @@
 
 
 #include "Client.h"
+#include "ParallelUpload.h"
+#include "Trace.h"
+#include "Logger.h"
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 
 
 int main()
 {
+	startLogging(parseLogLevel(std::getenv("CLIENT_LOG_LEVEL"))); // DEBUG adds the keys, WARNING leaves only what went wrong
+	if (const char* tracePath = std::getenv("CLIENT_TRACE")) // A file to write a trace of the transfer's phases to
+		startTracing(tracePath);
 	try
 	{
 		const auto client = std::make_unique<Client>();
-		client->sendEncryptedFile();
-		return 0;
+		int result = 0;
+		if (std::filesystem::is_directory(client->getFilePath())) { // Every file of the directory, CLIENT_WORKERS (one per core by default) at a time
+			client->disconnect();
+			if (uploadDirectory(*client, client->getFilePath(), uploadWorkers()).failed)
+				result = 1;
+		}
+		else
+			client->sendFile();
+		stopLogging();
+		writeTrace();
+		return result;
 	}
 	catch (std::exception& e)
 	{
+		stopLogging(); // What the client logged so far comes before the exception
 		std::cerr << "Exception: " << e.what() << std::endl;
+		writeTrace();
 		return 1;
 	}
 }
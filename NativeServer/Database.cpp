@@ -0,0 +1,112 @@
+#include "Database.h"
+#include "ServerConstants.h"
+
+
+DatabaseError::DatabaseError(sqlite3* db, int code) : std::runtime_error(sqlite3_errmsg(db)), code(code & 0xff) {}
+
+int DatabaseError::getCode() const { return code; }
+
+Statement::Statement(sqlite3_stmt* stmt) : stmt(stmt) {}
+
+Statement::~Statement() {
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
+void Statement::check(int rc) const {
+	if (rc != SQLITE_OK)
+		throw DatabaseError(sqlite3_db_handle(stmt), rc);
+}
+
+Statement& Statement::bind(int index, const void* blob, size_t length) {
+	check(sqlite3_bind_blob64(stmt, index, blob, length, SQLITE_TRANSIENT));
+	return *this;
+}
+
+Statement& Statement::bind(int index, const std::string& text) { // Names and paths are TEXT, like the Python server stores them, so both servers' rows compare equal
+	check(sqlite3_bind_text64(stmt, index, text.data(), text.size(), SQLITE_TRANSIENT, SQLITE_UTF8));
+	return *this;
+}
+
+Statement& Statement::bind(int index, int64_t value) {
+	check(sqlite3_bind_int64(stmt, index, value));
+	return *this;
+}
+
+Statement& Statement::bindNull(int index) {
+	check(sqlite3_bind_null(stmt, index));
+	return *this;
+}
+
+bool Statement::step() {
+	int rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW)
+		return true;
+	if (rc != SQLITE_DONE)
+		throw DatabaseError(sqlite3_db_handle(stmt), rc);
+	return false;
+}
+
+bool Statement::isNull(int column) const { return sqlite3_column_type(stmt, column) == SQLITE_NULL; }
+
+int64_t Statement::getInt(int column) const { return sqlite3_column_int64(stmt, column); }
+
+std::string Statement::getBytes(int column) const {
+	auto data = static_cast<const char*>(sqlite3_column_blob(stmt, column));
+	return std::string(data ? data : "", sqlite3_column_bytes(stmt, column));
+}
+
+Connection::Connection(const std::string& path) : db(nullptr) {
+	int rc = sqlite3_open(path.c_str(), &db);
+	if (rc != SQLITE_OK) {
+		DatabaseError error(db, rc);
+		sqlite3_close(db);
+		throw error;
+	}
+	sqlite3_busy_timeout(db, DB_TIMEOUT_MS); // Connections of other threads and processes wait for the write lock instead of failing
+	execute("PRAGMA journal_mode=WAL");
+}
+
+Connection::~Connection() {
+	for (auto& [sql, stmt] : statements)
+		sqlite3_finalize(stmt);
+	sqlite3_close(db);
+}
+
+Statement Connection::prepare(const char* sql) {
+	auto& stmt = statements[sql];
+	if (!stmt) {
+		int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+		if (rc != SQLITE_OK) {
+			statements.erase(sql);
+			throw DatabaseError(db, rc);
+		}
+	}
+	return Statement(stmt);
+}
+
+void Connection::execute(const char* sql) {
+	int rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+	if (rc != SQLITE_OK)
+		throw DatabaseError(db, rc);
+}
+
+int Connection::changes() const { return sqlite3_changes(db); }
+
+bool Connection::inTransaction() const { return !sqlite3_get_autocommit(db); }
+
+Transaction::Transaction(Connection& conn) : conn(conn), done(false) { conn.execute("BEGIN IMMEDIATE"); }
+
+Transaction::~Transaction() {
+	if (!done && conn.inTransaction()) {
+		try {
+			conn.execute("ROLLBACK");
+		}
+		catch (const DatabaseError&) {} // Nothing was committed either way
+	}
+}
+
+void Transaction::commit() {
+	conn.execute("COMMIT");
+	done = true;
+}
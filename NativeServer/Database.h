@@ -0,0 +1,63 @@
+#pragma once
+#include <sqlite3.h>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+
+class DatabaseError : public std::runtime_error {
+private:
+	int code;
+public:
+	DatabaseError(sqlite3* db, int code);
+	int getCode() const; // Primary result code, SQLITE_CONSTRAINT for a duplicate key
+};
+
+// A prepared statement of a Connection. It is reset when it goes out of scope, so the connection can run it again without preparing it
+class Statement {
+private:
+	sqlite3_stmt* stmt;
+	void check(int rc) const;
+public:
+	explicit Statement(sqlite3_stmt* stmt);
+	Statement(const Statement&) = delete;
+	~Statement();
+	Statement& bind(int index, const void* blob, size_t length);
+	Statement& bind(int index, const std::string& text);
+	Statement& bind(int index, int64_t value);
+	Statement& bindNull(int index);
+	bool step(); // True while there is a row to read
+	bool isNull(int column) const;
+	int64_t getInt(int column) const;
+	std::string getBytes(int column) const; // A BLOB or a TEXT column
+};
+
+// An SQLite connection, used by one thread only, with its prepared statements
+class Connection {
+private:
+	sqlite3* db;
+	std::unordered_map<const char*, sqlite3_stmt*> statements;
+public:
+	explicit Connection(const std::string& path);
+	Connection(const Connection&) = delete;
+	~Connection();
+	Statement prepare(const char* sql); // Statements are kept by the address of sql, so sql has to be a string literal
+	void execute(const char* sql);
+	int changes() const;
+	bool inTransaction() const;
+};
+
+// Runs a block as one write transaction, taking SQLite's write lock up front so a read-check-write can't interleave with another connection's.
+// Rolled back unless committed
+class Transaction {
+private:
+	Connection& conn;
+	bool done;
+public:
+	explicit Transaction(Connection& conn);
+	Transaction(const Transaction&) = delete;
+	~Transaction();
+	void commit();
+};
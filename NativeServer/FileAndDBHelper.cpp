@@ -0,0 +1,545 @@
+#include "FileAndDBHelper.h"
+#include "ServerConstants.h"
+#include "ServerExceptions.h"
+#include "cksum.h"
+#include <aes.h>
+#include <modes.h>
+#include <osrng.h>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <boost/endian/conversion.hpp>
+
+
+namespace {
+	// Creates the clients DB
+	std::unique_ptr<Connection> openClientsDb() {
+		auto conn = std::make_unique<Connection>("clients.db");
+		conn->execute(R"(CREATE TABLE IF NOT EXISTS ClientsTable(ID BLOB CHECK(length(ID) = 16) NOT NULL PRIMARY KEY,
+			Name VARCHAR(255), PublicKey BLOB CHECK(length(PublicKey) = 160), LastSeen DATETIME, AES BLOB CHECK(length(AES) = 32)))");
+		conn->execute("CREATE INDEX IF NOT EXISTS ClientsByName ON ClientsTable(Name)");
+		return conn;
+	}
+
+	// Creates the files DB
+	std::unique_ptr<Connection> openFilesDb() {
+		auto conn = std::make_unique<Connection>("files.db");
+		conn->execute(R"(CREATE TABLE IF NOT EXISTS FilesTable(ID BLOB CHECK(length(ID) = 16) NOT NULL,
+			"File Name" VARCHAR(255) NOT NULL, "Path Name" VARCHAR(255), Verified INTEGER, PRIMARY KEY(ID,"File Name")))");
+		conn->execute(R"(CREATE TABLE IF NOT EXISTS ChunksTable(Digest BLOB CHECK(length(Digest) = 32) NOT NULL PRIMARY KEY,
+			Size INTEGER, CRC INTEGER, RefCount INTEGER))");
+		conn->execute(R"(CREATE TABLE IF NOT EXISTS RecipesTable(Digest BLOB CHECK(length(Digest) = 32) NOT NULL PRIMARY KEY,
+			Size INTEGER, CRC INTEGER, RefCount INTEGER))");
+		conn->execute(R"(CREATE TABLE IF NOT EXISTS RecipeChunksTable(Recipe BLOB NOT NULL, "Chunk Index" INTEGER NOT NULL,
+			Chunk BLOB NOT NULL, PRIMARY KEY(Recipe,"Chunk Index")))");
+		conn->execute(R"(CREATE TABLE IF NOT EXISTS FileRecipesTable(ID BLOB CHECK(length(ID) = 16) NOT NULL,
+			"File Name" VARCHAR(255) NOT NULL, Recipe BLOB NOT NULL, PRIMARY KEY(ID,"File Name")))");
+		return conn;
+	}
+
+	Digest toDigest(const std::string& bytes) {
+		Digest digest{};
+		std::copy_n(bytes.begin(), std::min(bytes.size(), digest.size()), digest.begin());
+		return digest;
+	}
+
+	// Moves a plain file from where FilesTable says it is (the layout before the hashed fan-out) to its hashed path (requires locking the file)
+	std::string moveStoredFile(Connection& files, const ClientId& id, const std::string& fileName, const std::string& oldPath) {
+		std::string newPath = clientFilePath(id, fileName);
+		if (std::filesystem::exists(oldPath)) {
+			std::filesystem::create_directories(std::filesystem::path(newPath).parent_path());
+			std::filesystem::rename(oldPath, newPath);
+			std::error_code ignored;
+			std::filesystem::remove(std::filesystem::path(oldPath).parent_path(), ignored); // The client's old directory goes with its last file
+		}
+		files.prepare(R"(UPDATE FilesTable SET "Path Name" = ? WHERE ID = ? AND "File Name" = ? AND "Path Name" = ?)")
+			.bind(1, newPath).bind(2, id.data(), id.size()).bind(3, fileName).bind(4, oldPath).step();
+		return newPath;
+	}
+
+	uint64_t isqrt(uint64_t n) {
+		uint64_t root = static_cast<uint64_t>(std::sqrt(static_cast<double>(n)));
+		while (root * root > n)
+			root--;
+		while ((root + 1) * (root + 1) <= n)
+			root++;
+		return root;
+	}
+}
+
+// Retrieves port from port file
+unsigned short getPort() {
+	std::ifstream portFile("port.info");
+	unsigned long port = 0;
+	if (portFile >> port && port > 0 && port <= MAX_PORT)
+		return static_cast<unsigned short>(port);
+	std::cout << "Error opening port file. Using default port " << DEFAULT_PORT << std::endl;
+	return DEFAULT_PORT;
+}
+
+std::string toHex(const uint8_t* data, size_t length) {
+	static const char digits[] = "0123456789abcdef";
+	std::string hex(length * 2, '0');
+	for (size_t i = 0; i < length; i++) {
+		hex[2 * i] = digits[data[i] >> 4];
+		hex[2 * i + 1] = digits[data[i] & 0xf];
+	}
+	return hex;
+}
+
+std::string toHex(const ClientId& id) { return toHex(id.data(), id.size()); }
+
+Connection& clientsDb() {
+	thread_local std::unique_ptr<Connection> conn;
+	if (!conn)
+		conn = openClientsDb();
+	return *conn;
+}
+
+Connection& filesDb() {
+	thread_local std::unique_ptr<Connection> conn;
+	if (!conn)
+		conn = openFilesDb();
+	return *conn;
+}
+
+// Record of a client (none if the client isn't registered)
+std::optional<ClientRecord> clientRecord(Connection& clients, const ClientId& id) {
+	auto stmt = clients.prepare("SELECT Name, PublicKey, AES FROM ClientsTable WHERE ID = ?");
+	stmt.bind(1, id.data(), id.size());
+	if (!stmt.step())
+		return std::nullopt;
+	return ClientRecord{ stmt.getBytes(0), stmt.getBytes(1), stmt.getBytes(2) };
+}
+
+// Validates that a client signing up doesn't exist in DB
+void validateClient(Connection& clients, const std::string& name) {
+	auto stmt = clients.prepare("SELECT ID FROM ClientsTable WHERE Name = ?");
+	stmt.bind(1, name);
+	if (stmt.step()) {
+		std::string id = stmt.getBytes(0);
+		throw DuplicateClientError("Client with id " + toHex(reinterpret_cast<const uint8_t*>(id.data()), id.size()) + " already registered");
+	}
+}
+
+// Validates that an existing client provides correct name according to id in DB
+void validateNameAndId(Connection& clients, const ClientId& id, const std::string& name) {
+	auto record = clientRecord(clients, id);
+	if (!record || record->name != name)
+		throw UnregisteredClientError("Client with id " + toHex(id) + " does not exist");
+}
+
+// Inserts client to DB
+void insertClient(Connection& clients, const ClientId& id, const std::string& name) {
+	clients.prepare("INSERT INTO ClientsTable (ID, Name, LastSeen) VALUES (?, ?, CURRENT_TIMESTAMP)").bind(1, id.data(), id.size()).bind(2, name).step();
+}
+
+void updateAes(Connection& clients, const ClientId& id, const std::string& aes, const std::string& publicKey) {
+	clients.prepare("UPDATE ClientsTable SET AES = ?, PublicKey = ?, LastSeen = CURRENT_TIMESTAMP WHERE ID = ?")
+		.bind(1, aes.data(), aes.size()).bind(2, publicKey.data(), publicKey.size()).bind(3, id.data(), id.size()).step();
+}
+
+// Records that a client was seen now
+void touchClient(Connection& clients, const ClientId& id) {
+	clients.prepare("UPDATE ClientsTable SET LastSeen = CURRENT_TIMESTAMP WHERE ID = ?").bind(1, id.data(), id.size()).step();
+}
+
+// Checks if a file for client exists in DB
+bool fileExists(Connection& files, const ClientId& id, const std::string& fileName) {
+	return files.prepare(R"(SELECT 1 FROM FilesTable WHERE ID = ? AND "File Name" = ?)").bind(1, id.data(), id.size()).bind(2, fileName).step();
+}
+
+// Inserts file of client to DB
+void insertFile(Connection& files, const ClientId& id, const std::string& fileName, const std::string& filePath) {
+	auto stmt = files.prepare(R"(INSERT INTO FilesTable (ID, "File Name", "Path Name", Verified) VALUES (?, ?, ?, 0))");
+	stmt.bind(1, id.data(), id.size()).bind(2, fileName);
+	if (filePath.empty())
+		stmt.bindNull(3);
+	else
+		stmt.bind(3, filePath);
+	try {
+		stmt.step();
+	}
+	catch (const DatabaseError& e) {
+		if (e.getCode() != SQLITE_CONSTRAINT)
+			throw;
+		// Another connection of the same client started sending this file after fileExists checked
+		throw DuplicateFileError("File " + fileName + " for client with id " + toHex(id) + " already exists");
+	}
+}
+
+// Verify file of client - 1 means verified, 0 means not verified
+void verifyFile(Connection& files, const ClientId& id, const std::string& fileName) {
+	files.prepare(R"(UPDATE FilesTable SET Verified = 1 WHERE ID = ? AND "File Name" = ?)").bind(1, id.data(), id.size()).bind(2, fileName).step();
+}
+
+// Remove file of client (in case of invalid crc)
+void removeFile(Connection& files, const ClientId& id, const std::string& fileName) {
+	files.prepare(R"(DELETE FROM FilesTable WHERE ID = ? AND "File Name" = ?)").bind(1, id.data(), id.size()).bind(2, fileName).step();
+}
+
+// Updates where a file of client is stored
+void updateFilePath(Connection& files, const ClientId& id, const std::string& fileName, const std::string& filePath) {
+	files.prepare(R"(UPDATE FilesTable SET "Path Name" = ? WHERE ID = ? AND "File Name" = ?)")
+		.bind(1, filePath).bind(2, id.data(), id.size()).bind(3, fileName).step();
+}
+
+// Path of a plain (not deduplicated) file of client, fanned out by the SHA-256 of its client id and name over two levels of 256 directories
+std::string clientFilePath(const ClientId& id, const std::string& fileName) {
+	std::vector<uint8_t> key(id.begin(), id.end());
+	key.insert(key.end(), fileName.begin(), fileName.end());
+	Digest digest = sha256(key.data(), key.size());
+	std::string hex = toHex(digest.data(), digest.size());
+	return (std::filesystem::path("client_files") / hex.substr(0, 2) / hex.substr(2, 2) / hex).string();
+}
+
+// Opens the verified stored copy of a file of client for reading, assembling it from the chunk store if it was deduplicated.
+// Returns nullptr if the client has no verified file by that name (requires locking the file)
+std::unique_ptr<std::fstream> openStoredFile(Connection& files, const ClientId& id, const std::string& fileName) {
+	std::optional<std::string> path;
+	{
+		auto stmt = files.prepare(R"(SELECT "Path Name" FROM FilesTable WHERE ID = ? AND "File Name" = ? AND Verified = 1)");
+		stmt.bind(1, id.data(), id.size()).bind(2, fileName);
+		if (!stmt.step())
+			return nullptr;
+		if (!stmt.isNull(0))
+			path = stmt.getBytes(0);
+	}
+	if (path) {
+		if (*path != clientFilePath(id, fileName)) // Not migrated yet, moved now so an update replaces it in place
+			path = moveStoredFile(files, id, fileName, *path);
+		auto source = std::make_unique<std::fstream>(*path, std::ios::in | std::ios::binary);
+		if (!*source)
+			throw std::runtime_error("Error opening stored file " + *path);
+		return source;
+	}
+	// An unnamed temporary file: removed right away, it lives as long as it's open
+	std::array<uint8_t, 16> name;
+	CryptoPP::AutoSeededRandomPool().GenerateBlock(name.data(), name.size());
+	auto tmpPath = std::filesystem::temp_directory_path() / ("source-" + toHex(name.data(), name.size()) + ".tmp");
+	auto source = std::make_unique<std::fstream>(tmpPath, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!*source)
+		throw std::runtime_error("Error creating a temporary file");
+	std::error_code ignored;
+	std::filesystem::remove(tmpPath, ignored);
+	auto stmt = files.prepare(R"(SELECT Chunk FROM RecipeChunksTable JOIN FileRecipesTable ON RecipeChunksTable.Recipe = FileRecipesTable.Recipe
+		WHERE ID = ? AND "File Name" = ? ORDER BY "Chunk Index")");
+	stmt.bind(1, id.data(), id.size()).bind(2, fileName);
+	while (stmt.step()) {
+		std::ifstream chunk(chunkPath(toDigest(stmt.getBytes(0))), std::ios::binary);
+		*source << chunk.rdbuf();
+	}
+	source->seekg(0);
+	return source;
+}
+
+// Path of a chunk in the chunk store, fanned out by the first byte of its digest
+std::string chunkPath(const Digest& digest) {
+	return (std::filesystem::path("chunk_store") / toHex(digest.data(), 1) / toHex(digest.data(), digest.size())).string();
+}
+
+// Retrieves size and cksum of a whole file with this SHA-256 digest, if the same client already stored it under some name.
+// Only the client's own files: naming another client's file by its digest proves nothing, it has to go through commitRecipe's challenge
+std::optional<RecipeInfo> findRecipe(Connection& files, const ClientId& id, const Digest& digest) {
+	auto stmt = files.prepare("SELECT Size, CRC FROM RecipesTable JOIN FileRecipesTable ON Recipe = Digest WHERE Digest = ? AND ID = ? LIMIT 1");
+	stmt.bind(1, digest.data(), digest.size()).bind(2, id.data(), id.size());
+	if (!stmt.step())
+		return std::nullopt;
+	return RecipeInfo{ static_cast<uint32_t>(stmt.getInt(0)), static_cast<uint32_t>(stmt.getInt(1)) };
+}
+
+// Writes a chunk to the chunk store, once no matter how many files contain it (requires locking the chunk's digest)
+void storeChunk(Connection& files, const Digest& digest, const std::vector<uint8_t>& chunk, uint32_t crc) {
+	std::string path = chunkPath(digest);
+	if (!std::filesystem::exists(path)) {
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+		std::string tmpPath = path + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+		{
+			std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+			if (!out)
+				throw std::runtime_error("Error writing chunk " + toHex(digest.data(), digest.size()));
+		}
+		std::filesystem::rename(tmpPath, path); // A chunk is never visible half written
+	}
+	files.prepare("INSERT OR IGNORE INTO ChunksTable (Digest, Size, CRC, RefCount) VALUES (?, ?, ?, 0)")
+		.bind(1, digest.data(), digest.size()).bind(2, static_cast<int64_t>(chunk.size())).bind(3, static_cast<int64_t>(crc)).step();
+}
+
+// Removes chunks nothing references anymore from the chunk store. Every chunk is checked again under its own lock,
+// since another client may have stored the same chunk after unlinkRecipe dropped it from DB
+void removeChunks(Connection& files, const std::vector<Digest>& digests, StripedLock& chunkLocks) {
+	for (const auto& digest : digests) {
+		std::lock_guard<std::mutex> lock(chunkLocks(std::string(digest.begin(), digest.end())));
+		if (!files.prepare("SELECT 1 FROM ChunksTable WHERE Digest = ?").bind(1, digest.data(), digest.size()).step()) {
+			std::error_code ignored;
+			std::filesystem::remove(chunkPath(digest), ignored);
+		}
+	}
+}
+
+// Drops the chunks a session stored for a deduplicated file whose recipe it never committed (the client went away before sending them all),
+// unless a recipe referenced them meanwhile. Another session still sending the same file is asked for them again when it commits
+void removeUncommittedChunks(Connection& files, const std::set<Digest>& digests, StripedLock& chunkLocks) {
+	std::vector<Digest> orphanChunks;
+	{
+		Transaction transaction(files);
+		for (const auto& digest : digests) {
+			files.prepare("DELETE FROM ChunksTable WHERE Digest = ? AND RefCount = 0").bind(1, digest.data(), digest.size()).step();
+			if (files.changes())
+				orphanChunks.push_back(digest);
+		}
+		transaction.commit();
+	}
+	removeChunks(files, orphanChunks, chunkLocks);
+}
+
+// Drops every chunk no recipe references, left behind by sessions the server was stopped in the middle of.
+// Runs before any client is served, so no session can be sending them. Returns the number of chunks removed
+size_t sweepUnreferencedChunks() {
+	Connection& files = filesDb();
+	std::vector<Digest> orphanChunks;
+	{
+		Transaction transaction(files);
+		auto stmt = files.prepare("SELECT Digest FROM ChunksTable WHERE RefCount = 0");
+		while (stmt.step())
+			orphanChunks.push_back(toDigest(stmt.getBytes(0)));
+		files.execute("DELETE FROM ChunksTable WHERE RefCount = 0");
+		transaction.commit();
+	}
+	for (const auto& digest : orphanChunks) {
+		std::error_code ignored;
+		std::filesystem::remove(chunkPath(digest), ignored);
+	}
+	return orphanChunks.size();
+}
+
+// Links a file of client to a recipe
+void linkRecipe(Connection& files, const ClientId& id, const std::string& fileName, const Digest& recipe) {
+	files.prepare(R"(INSERT INTO FileRecipesTable (ID, "File Name", Recipe) VALUES (?, ?, ?))")
+		.bind(1, id.data(), id.size()).bind(2, fileName).bind(3, recipe.data(), recipe.size()).step();
+	files.prepare("UPDATE RecipesTable SET RefCount = RefCount + 1 WHERE Digest = ?").bind(1, recipe.data(), recipe.size()).step();
+}
+
+// Creates the recipe of a deduplicated file from the client's manifest and links the file to it.
+// Returns the file's cksum, combined from the cksums of its chunks without reading them, or nothing and the indexes of the chunks the client has to send:
+// the ones the chunk store doesn't have, and up to challenge random ones it has but the session didn't send (sent), for the client to prove it holds them
+std::optional<uint32_t> commitRecipe(Connection& files, const ClientId& id, const std::string& fileName, const Digest& fileDigest, uint32_t origFileSize,
+	const std::vector<ManifestEntry>& manifest, const std::set<Digest>& sent, uint32_t challenge, std::vector<uint32_t>& missing) {
+	Transaction transaction(files); // Chunks can't lose their last reference between checking them and referencing them
+	std::vector<std::optional<RecipeInfo>> stored;
+	std::vector<uint32_t> known;
+	stored.reserve(manifest.size());
+	for (uint32_t i = 0; i < manifest.size(); i++) {
+		auto stmt = files.prepare("SELECT Size, CRC FROM ChunksTable WHERE Digest = ?");
+		stmt.bind(1, manifest[i].digest.data(), manifest[i].digest.size());
+		if (stmt.step()) {
+			stored.push_back(RecipeInfo{ static_cast<uint32_t>(stmt.getInt(0)), static_cast<uint32_t>(stmt.getInt(1)) });
+			if (!sent.count(manifest[i].digest))
+				known.push_back(i);
+		}
+		else {
+			stored.push_back(std::nullopt);
+			missing.push_back(i);
+		}
+	}
+	CryptoPP::AutoSeededRandomPool random;
+	for (uint32_t picked = 0; picked < challenge && picked < known.size(); picked++) { // A partial shuffle, the first picks are the challenge
+		uint32_t r;
+		random.GenerateBlock(reinterpret_cast<CryptoPP::byte*>(&r), sizeof(r));
+		std::swap(known[picked], known[picked + r % (known.size() - picked)]);
+		missing.push_back(known[picked]);
+	}
+	if (!missing.empty()) {
+		std::sort(missing.begin(), missing.end());
+		return std::nullopt;
+	}
+	uint32_t crc = 0;
+	uint64_t totalSize = 0;
+	for (uint32_t i = 0; i < manifest.size(); i++) {
+		if (stored[i]->size != manifest[i].size)
+			throw std::runtime_error("Chunk " + toHex(manifest[i].digest.data(), manifest[i].digest.size()) + " from client with id " + toHex(id) + " has a wrong size");
+		crc = crc_combine(crc, stored[i]->crc, manifest[i].size);
+		totalSize += manifest[i].size;
+	}
+	if (totalSize != origFileSize)
+		throw std::runtime_error("Invalid original size from client with id " + toHex(id));
+	uint32_t fileCrc = static_cast<uint32_t>(crc_finalize(crc, totalSize));
+	files.prepare("INSERT OR IGNORE INTO RecipesTable (Digest, Size, CRC, RefCount) VALUES (?, ?, ?, 0)")
+		.bind(1, fileDigest.data(), fileDigest.size()).bind(2, static_cast<int64_t>(totalSize)).bind(3, static_cast<int64_t>(fileCrc)).step();
+	if (files.changes()) { // A new recipe references its chunks (otherwise the same file was committed before)
+		for (uint32_t i = 0; i < manifest.size(); i++) {
+			files.prepare(R"(INSERT INTO RecipeChunksTable (Recipe, "Chunk Index", Chunk) VALUES (?, ?, ?))")
+				.bind(1, fileDigest.data(), fileDigest.size()).bind(2, static_cast<int64_t>(i)).bind(3, manifest[i].digest.data(), manifest[i].digest.size()).step();
+			files.prepare("UPDATE ChunksTable SET RefCount = RefCount + 1 WHERE Digest = ?").bind(1, manifest[i].digest.data(), manifest[i].digest.size()).step();
+		}
+	}
+	else { // Linking an existing recipe takes the chunks it's made of, not just its digest
+		auto stmt = files.prepare(R"(SELECT Chunk FROM RecipeChunksTable WHERE Recipe = ? ORDER BY "Chunk Index")");
+		stmt.bind(1, fileDigest.data(), fileDigest.size());
+		std::vector<Digest> chunks;
+		while (stmt.step())
+			chunks.push_back(toDigest(stmt.getBytes(0)));
+		if (!std::equal(chunks.begin(), chunks.end(), manifest.begin(), manifest.end(), [](const Digest& chunk, const ManifestEntry& entry) { return chunk == entry.digest; }))
+			throw std::runtime_error("Manifest of file " + fileName + " from client with id " + toHex(id) + " does not match its recipe");
+	}
+	linkRecipe(files, id, fileName, fileDigest);
+	transaction.commit();
+	return fileCrc;
+}
+
+// The body of unlinkRecipe, inside the caller's transaction
+static std::optional<std::vector<Digest>> unlinkRecipeLocked(Connection& files, const ClientId& id, const std::string& fileName) {
+	Digest recipe;
+	{
+		auto stmt = files.prepare(R"(SELECT Recipe FROM FileRecipesTable WHERE ID = ? AND "File Name" = ?)");
+		stmt.bind(1, id.data(), id.size()).bind(2, fileName);
+		if (!stmt.step())
+			return std::nullopt;
+		recipe = toDigest(stmt.getBytes(0));
+	}
+	std::vector<Digest> orphanChunks;
+	files.prepare(R"(DELETE FROM FileRecipesTable WHERE ID = ? AND "File Name" = ?)").bind(1, id.data(), id.size()).bind(2, fileName).step();
+	files.prepare("UPDATE RecipesTable SET RefCount = RefCount - 1 WHERE Digest = ?").bind(1, recipe.data(), recipe.size()).step();
+	bool unreferenced;
+	{
+		auto stmt = files.prepare("SELECT RefCount FROM RecipesTable WHERE Digest = ?");
+		stmt.bind(1, recipe.data(), recipe.size());
+		unreferenced = stmt.step() && stmt.getInt(0) == 0;
+	}
+	if (unreferenced) {
+		std::vector<Digest> chunks;
+		{
+			auto stmt = files.prepare("SELECT Chunk FROM RecipeChunksTable WHERE Recipe = ?");
+			stmt.bind(1, recipe.data(), recipe.size());
+			while (stmt.step())
+				chunks.push_back(toDigest(stmt.getBytes(0)));
+		}
+		for (const auto& digest : chunks)
+			files.prepare("UPDATE ChunksTable SET RefCount = RefCount - 1 WHERE Digest = ?").bind(1, digest.data(), digest.size()).step();
+		files.prepare("DELETE FROM RecipeChunksTable WHERE Recipe = ?").bind(1, recipe.data(), recipe.size()).step();
+		files.prepare("DELETE FROM RecipesTable WHERE Digest = ?").bind(1, recipe.data(), recipe.size()).step();
+		for (const auto& digest : std::set<Digest>(chunks.begin(), chunks.end())) {
+			bool orphan;
+			{
+				auto stmt = files.prepare("SELECT RefCount FROM ChunksTable WHERE Digest = ?");
+				stmt.bind(1, digest.data(), digest.size());
+				orphan = stmt.step() && stmt.getInt(0) == 0;
+			}
+			if (orphan) {
+				files.prepare("DELETE FROM ChunksTable WHERE Digest = ?").bind(1, digest.data(), digest.size()).step();
+				orphanChunks.push_back(digest);
+			}
+		}
+	}
+	return orphanChunks;
+}
+
+// Unlinks a deduplicated file of client from its recipe, dropping the recipe once no file points to it.
+// Returns nothing if the file isn't deduplicated, otherwise the digests of the chunks nothing references anymore
+std::optional<std::vector<Digest>> unlinkRecipe(Connection& files, const ClientId& id, const std::string& fileName) {
+	Transaction transaction(files);
+	auto orphanChunks = unlinkRecipeLocked(files, id, fileName);
+	transaction.commit();
+	return orphanChunks;
+}
+
+// Points a file of client at the plain file at filePath instead of its recipe, if it had one, in one transaction,
+// so the file is never left without either. Returns what unlinkRecipe does
+std::optional<std::vector<Digest>> replaceWithPlainFile(Connection& files, const ClientId& id, const std::string& fileName, const std::string& filePath) {
+	Transaction transaction(files);
+	auto orphanChunks = unlinkRecipeLocked(files, id, fileName);
+	updateFilePath(files, id, fileName, filePath);
+	transaction.commit();
+	return orphanChunks;
+}
+
+// Block size and (rolling Adler-32, truncated SHA-256) signatures of every whole block of a file, rsync style.
+// Blocks grow with the square root of the file size, which balances the size of the signatures against the literal data sent around each change
+std::pair<uint32_t, std::vector<BlockSignature>> blockSignatures(std::istream& source) {
+	source.seekg(0, std::ios::end);
+	uint64_t size = static_cast<uint64_t>(source.tellg());
+	uint32_t blockSize = static_cast<uint32_t>(std::clamp<uint64_t>(isqrt(size), DELTA_MIN_BLOCK_SIZE, DELTA_MAX_BLOCK_SIZE));
+	source.seekg(0);
+	std::vector<BlockSignature> signatures;
+	signatures.reserve(size / blockSize);
+	std::vector<uint8_t> block(blockSize);
+	while (source.read(reinterpret_cast<char*>(block.data()), blockSize)) {
+		BlockSignature signature;
+		signature.weak = adler32(block.data(), blockSize);
+		Digest strong = sha256(block.data(), blockSize);
+		std::copy_n(strong.begin(), signature.strong.size(), signature.strong.begin());
+		signatures.push_back(signature);
+	}
+	source.clear();
+	return { blockSize, signatures };
+}
+
+// Rebuilds the new version of a file from a delta: copy ops reference whole blocks of the stored copy, literal ops carry new data.
+// Returns the cksum and size of the new version
+std::pair<unsigned long, uint64_t> applyDelta(const std::vector<uint8_t>& delta, std::istream& source, std::ostream& target, uint32_t blockSize) {
+	uint32_t crc = 0;
+	uint64_t size = 0;
+	std::vector<uint8_t> block(blockSize);
+	for (size_t pos = 0; pos < delta.size();) {
+		if (delta[pos] == DELTA_COPY_OP) {
+			if (pos + 1 + 2 * DELTA_LENGTH_SIZE > delta.size())
+				throw std::runtime_error("Delta ends in the middle of a copy op");
+			uint32_t firstBlock = boost::endian::load_little_u32(delta.data() + pos + 1);
+			uint32_t blockCount = boost::endian::load_little_u32(delta.data() + pos + 1 + DELTA_LENGTH_SIZE);
+			pos += 1 + 2 * DELTA_LENGTH_SIZE;
+			source.clear();
+			source.seekg(static_cast<std::streamoff>(firstBlock) * blockSize);
+			for (uint32_t i = 0; i < blockCount; i++) {
+				if (!source.read(reinterpret_cast<char*>(block.data()), blockSize))
+					throw std::runtime_error("Delta references a block beyond the stored file");
+				target.write(reinterpret_cast<const char*>(block.data()), blockSize);
+				crc = crc_update(crc, block.data(), blockSize);
+				size += blockSize;
+			}
+		}
+		else if (delta[pos] == DELTA_LITERAL_OP) {
+			if (pos + 1 + DELTA_LENGTH_SIZE > delta.size())
+				throw std::runtime_error("Delta ends in the middle of a literal op");
+			uint32_t length = boost::endian::load_little_u32(delta.data() + pos + 1);
+			pos += 1 + DELTA_LENGTH_SIZE;
+			if (length > delta.size() - pos)
+				throw std::runtime_error("Delta ends in the middle of literal data");
+			target.write(reinterpret_cast<const char*>(delta.data() + pos), length);
+			crc = crc_update(crc, delta.data() + pos, length);
+			size += length;
+			pos += length;
+		}
+		else
+			throw std::runtime_error("Invalid delta op " + std::to_string(delta[pos]));
+	}
+	if (!target)
+		throw std::runtime_error("Error writing the new version of a file");
+	return { crc_finalize(crc, size), size };
+}
+
+std::string generateAesKey() {
+	std::string key(AES_KEY_SIZE, '\0');
+	CryptoPP::AutoSeededRandomPool().GenerateBlock(reinterpret_cast<CryptoPP::byte*>(key.data()), key.size());
+	return key;
+}
+
+// Decrypts content the client encrypted with its AESWrapper (AES-CBC with a zero iv and PKCS#7 padding).
+// A piece from the middle of the content is decrypted with the cipher block before it as iv, and without unpadding
+std::vector<uint8_t> aesDecrypt(const std::string& key, const uint8_t* data, size_t length, const uint8_t* iv, bool unpad) {
+	if (length % AES_BLOCK_SIZE != 0 || (unpad && length == 0))
+		throw std::runtime_error("Data must be padded to the AES block size");
+	std::vector<uint8_t> plain(length);
+	CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption(reinterpret_cast<const CryptoPP::byte*>(key.data()), key.size(), iv);
+	decryption.ProcessData(plain.data(), data, length);
+	if (unpad) {
+		uint8_t padding = plain.back();
+		if (padding < 1 || padding > AES_BLOCK_SIZE || !std::all_of(plain.end() - padding, plain.end(), [padding](uint8_t b) { return b == padding; }))
+			throw std::runtime_error("Padding is incorrect.");
+		plain.resize(length - padding);
+	}
+	return plain;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "Database.h"
+#include "StripedLock.h"
+#include "Constants.h"
+#include "Chunker.h"
+#include "Delta.h"
+#include <array>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+// The same DB schema and file layout as the Python server's FileAndDBHelper, so both servers can serve the same clients.db, files.db and files
+using ClientId = std::array<uint8_t, UUID_SIZE>;
+
+struct ClientRecord {
+	std::string name;
+	std::string publicKey;
+	std::string aes;
+};
+
+struct ManifestEntry { // A chunk of a deduplicated file, in file order
+	Digest digest;
+	uint16_t size;
+};
+
+struct RecipeInfo { // Size and cksum of a whole file in the chunk store
+	uint32_t size;
+	uint32_t crc;
+};
+
+unsigned short getPort();
+std::string toHex(const uint8_t* data, size_t length);
+std::string toHex(const ClientId& id);
+
+// The connections of the calling thread, opened (and the tables created) on its first request. An SQLite connection stays on one thread
+Connection& clientsDb();
+Connection& filesDb();
+
+// Clients
+std::optional<ClientRecord> clientRecord(Connection& clients, const ClientId& id);
+void validateClient(Connection& clients, const std::string& name);
+void validateNameAndId(Connection& clients, const ClientId& id, const std::string& name);
+void insertClient(Connection& clients, const ClientId& id, const std::string& name);
+void updateAes(Connection& clients, const ClientId& id, const std::string& aes, const std::string& publicKey);
+void touchClient(Connection& clients, const ClientId& id);
+
+// Files
+bool fileExists(Connection& files, const ClientId& id, const std::string& fileName);
+void insertFile(Connection& files, const ClientId& id, const std::string& fileName, const std::string& filePath); // An empty path for a deduplicated file
+void verifyFile(Connection& files, const ClientId& id, const std::string& fileName);
+void removeFile(Connection& files, const ClientId& id, const std::string& fileName);
+void updateFilePath(Connection& files, const ClientId& id, const std::string& fileName, const std::string& filePath);
+std::string clientFilePath(const ClientId& id, const std::string& fileName);
+std::unique_ptr<std::fstream> openStoredFile(Connection& files, const ClientId& id, const std::string& fileName);
+
+// Chunk store
+std::string chunkPath(const Digest& digest);
+std::optional<RecipeInfo> findRecipe(Connection& files, const ClientId& id, const Digest& digest);
+void storeChunk(Connection& files, const Digest& digest, const std::vector<uint8_t>& chunk, uint32_t crc);
+void removeChunks(Connection& files, const std::vector<Digest>& digests, StripedLock& chunkLocks);
+void removeUncommittedChunks(Connection& files, const std::set<Digest>& digests, StripedLock& chunkLocks);
+size_t sweepUnreferencedChunks();
+void linkRecipe(Connection& files, const ClientId& id, const std::string& fileName, const Digest& recipe);
+std::optional<uint32_t> commitRecipe(Connection& files, const ClientId& id, const std::string& fileName, const Digest& fileDigest, uint32_t origFileSize,
+	const std::vector<ManifestEntry>& manifest, const std::set<Digest>& sent, uint32_t challenge, std::vector<uint32_t>& missing);
+std::optional<std::vector<Digest>> unlinkRecipe(Connection& files, const ClientId& id, const std::string& fileName);
+std::optional<std::vector<Digest>> replaceWithPlainFile(Connection& files, const ClientId& id, const std::string& fileName, const std::string& filePath);
+
+// Delta updates
+std::pair<uint32_t, std::vector<BlockSignature>> blockSignatures(std::istream& source);
+std::pair<unsigned long, uint64_t> applyDelta(const std::vector<uint8_t>& delta, std::istream& source, std::ostream& target, uint32_t blockSize);
+
+// Keys
+std::string generateAesKey();
+std::vector<uint8_t> aesDecrypt(const std::string& key, const uint8_t* data, size_t length, const uint8_t* iv, bool unpad);
@@ -0,0 +1,74 @@
+#include "PacketDecryptor.h"
+#include "FileAndDBHelper.h"
+#include "ServerConstants.h"
+#include "Constants.h"
+#include "cksum.h"
+#include <algorithm>
+#include <stdexcept>
+
+
+PacketDecryptor::PacketDecryptor(const std::string& aes, uint32_t contentSize, uint16_t totalPackets, WriteAt writeAt)
+	: aes(aes), contentSize(contentSize), totalPackets(totalPackets), writeAt(std::move(writeAt)) {
+	if (contentSize % AES_BLOCK_SIZE != 0 || contentSize == 0 || totalPackets != (contentSize + PACKET_SIZE - 1) / PACKET_SIZE)
+		throw std::runtime_error("Invalid content size for an AES encrypted file");
+}
+
+uint32_t PacketDecryptor::packetSize(uint16_t packetNum) const {
+	return std::min<uint32_t>(PACKET_SIZE, contentSize - (packetNum - 1) * PACKET_SIZE);
+}
+
+void PacketDecryptor::add(uint16_t packetNum, const uint8_t* encrypted, size_t length) {
+	if (length != packetSize(packetNum))
+		throw std::runtime_error("Packet " + std::to_string(packetNum) + " has " + std::to_string(length) + " bytes instead of " + std::to_string(packetSize(packetNum)));
+	static const uint8_t zeroIv[AES_BLOCK_SIZE] = {};
+	auto previous = tails.find(packetNum - 1);
+	bool ivKnown = packetNum == 1 || previous != tails.end();
+	std::vector<uint8_t> plain = aesDecrypt(aes, encrypted, length, packetNum != 1 && ivKnown ? previous->second.data() : zeroIv, false);
+	tails[packetNum].assign(encrypted + length - AES_BLOCK_SIZE, encrypted + length);
+	std::vector<uint8_t> rest(plain.begin() + AES_BLOCK_SIZE, plain.end());
+	if (packetNum == totalPackets && !rest.empty()) // The padding lies in the last block, which is part of the rest
+		unpad(rest);
+	writeAt(static_cast<uint64_t>(packetNum - 1) * PACKET_SIZE + AES_BLOCK_SIZE, rest.data(), rest.size());
+	rests[packetNum] = { crc_update(0, rest.data(), rest.size()), rest.size() };
+	std::vector<uint8_t> head(plain.begin(), plain.begin() + AES_BLOCK_SIZE);
+	if (ivKnown)
+		resolve(packetNum, std::move(head));
+	else
+		heads[packetNum] = std::move(head);
+	auto next = heads.find(packetNum + 1);
+	if (next != heads.end()) { // The next packet was waiting for this one's last cipher block
+		std::vector<uint8_t> nextHead = std::move(next->second);
+		heads.erase(next);
+		for (size_t i = 0; i < AES_BLOCK_SIZE; i++)
+			nextHead[i] ^= encrypted[length - AES_BLOCK_SIZE + i];
+		resolve(packetNum + 1, std::move(nextHead));
+	}
+}
+
+std::pair<unsigned long, uint64_t> PacketDecryptor::finish() const {
+	if (crcs.size() != totalPackets)
+		throw std::runtime_error("Only " + std::to_string(crcs.size()) + " of " + std::to_string(totalPackets) + " packets were decrypted");
+	uint32_t crc = 0;
+	uint64_t size = 0;
+	for (uint16_t packetNum = 1; packetNum <= totalPackets; packetNum++) {
+		const PieceCrc& piece = crcs.at(packetNum);
+		crc = crc_combine(crc, piece.crc, piece.size);
+		size += piece.size;
+	}
+	return { crc_finalize(crc, size), size };
+}
+
+void PacketDecryptor::resolve(uint16_t packetNum, std::vector<uint8_t> head) {
+	PieceCrc rest = rests.at(packetNum);
+	if (packetNum == totalPackets && packetSize(packetNum) == AES_BLOCK_SIZE) // A last packet of a single block holds the padding in its head
+		unpad(head);
+	writeAt(static_cast<uint64_t>(packetNum - 1) * PACKET_SIZE, head.data(), head.size());
+	crcs[packetNum] = { crc_combine(crc_update(0, head.data(), head.size()), rest.crc, rest.size), head.size() + rest.size };
+}
+
+void PacketDecryptor::unpad(std::vector<uint8_t>& last) {
+	uint8_t padding = last.back();
+	if (padding < 1 || padding > AES_BLOCK_SIZE || padding > last.size() || !std::all_of(last.end() - padding, last.end(), [padding](uint8_t b) { return b == padding; }))
+		throw std::runtime_error("Padding is incorrect.");
+	last.resize(last.size() - padding);
+}
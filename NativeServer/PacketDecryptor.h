@@ -0,0 +1,39 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+// Decrypts and cksums the packets of an AES-CBC encrypted file as they arrive, in any order (the Python server's PacketDecryptor).
+// Packets start on AES block boundaries, so every packet is decrypted on its own with the last cipher block of the packet before it as iv.
+// When that packet hasn't arrived yet (it was corrupted and will be resent), only the first block of the packet has to wait:
+// it is decrypted with a zero iv and fixed up by XOR once the iv is known.
+class PacketDecryptor {
+public:
+	using WriteAt = std::function<void(uint64_t offset, const uint8_t* data, size_t length)>;
+
+private:
+	struct PieceCrc { // Raw cksum state and length of a piece of plaintext
+		uint32_t crc;
+		uint64_t size;
+	};
+	std::string aes;
+	uint32_t contentSize;
+	uint16_t totalPackets;
+	WriteAt writeAt;
+	std::unordered_map<uint16_t, std::vector<uint8_t>> tails; // Last cipher block of every received packet, the iv of the packet after it
+	std::unordered_map<uint16_t, std::vector<uint8_t>> heads; // First block of packets decrypted with a zero iv, waiting for the packet before them
+	std::unordered_map<uint16_t, PieceCrc> rests; // The plaintext after the first block of every received packet
+	std::unordered_map<uint16_t, PieceCrc> crcs; // The plaintext of every packet that is final
+	uint32_t packetSize(uint16_t packetNum) const;
+	void resolve(uint16_t packetNum, std::vector<uint8_t> head);
+	static void unpad(std::vector<uint8_t>& last);
+
+public:
+	PacketDecryptor(const std::string& aes, uint32_t contentSize, uint16_t totalPackets, WriteAt writeAt);
+	void add(uint16_t packetNum, const uint8_t* encrypted, size_t length);
+	std::pair<unsigned long, uint64_t> finish() const; // Cksum and size of the whole plaintext, once every packet is final
+};
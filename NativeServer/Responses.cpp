@@ -0,0 +1,107 @@
+#include "Responses.h"
+#include "Constants.h"
+#include <algorithm>
+#include <boost/endian/conversion.hpp>
+
+
+Response::~Response() = default;
+
+void Response::packHeader(uint16_t code, uint32_t payloadSize) {
+	message.reserve(RESPONSE_HEADER_SIZE + payloadSize);
+	message.push_back(VERSION);
+	appendU16(code);
+	appendU32(payloadSize);
+}
+
+void Response::append(const void* data, size_t length) {
+	auto bytes = static_cast<const uint8_t*>(data);
+	message.insert(message.end(), bytes, bytes + length);
+}
+
+void Response::appendU16(uint16_t value) {
+	uint8_t bytes[sizeof(value)];
+	boost::endian::store_little_u16(bytes, value);
+	append(bytes, sizeof(bytes));
+}
+
+void Response::appendU32(uint32_t value) {
+	uint8_t bytes[sizeof(value)];
+	boost::endian::store_little_u32(bytes, value);
+	append(bytes, sizeof(bytes));
+}
+
+void Response::appendPadded(const std::string& text, size_t size) {
+	size_t length = std::min(text.size(), size);
+	append(text.data(), length);
+	message.resize(message.size() + size - length, NULLVAL);
+}
+
+void Response::send(std::vector<uint8_t>& out) const {
+	out.insert(out.end(), message.begin(), message.end());
+}
+
+SuccessfulRegistrationResponse::SuccessfulRegistrationResponse(const ClientId& id) {
+	packHeader(REGISTRATION_SUCCEEDED_CODE, UUID_SIZE);
+	append(id.data(), id.size());
+}
+
+FailedRegistrationResponse::FailedRegistrationResponse() {
+	packHeader(REGISTRATION_FAILED_CODE, 0);
+}
+
+AesResponse::AesResponse(const ClientId& id, const std::string& encryptedAes, uint16_t code) {
+	packHeader(code, static_cast<uint32_t>(UUID_SIZE + encryptedAes.size()));
+	append(id.data(), id.size());
+	append(encryptedAes.data(), encryptedAes.size());
+}
+
+FileReceivedResponse::FileReceivedResponse(const ClientId& id, uint32_t contentSize, const std::string& fileName, uint32_t cksum) {
+	packHeader(FILE_RECEIVED_CODE, UUID_SIZE + CONTENTSIZE_SIZE + FILE_NAME_SIZE + CKSUM_SIZE);
+	append(id.data(), id.size());
+	appendU32(contentSize);
+	appendPadded(fileName, FILE_NAME_SIZE);
+	appendU32(cksum);
+}
+
+ReceivedMessageResponse::ReceivedMessageResponse(const ClientId& id) {
+	packHeader(RECEIVED_MESSAGE_CODE, UUID_SIZE);
+	append(id.data(), id.size());
+}
+
+PacketsNackResponse::PacketsNackResponse(const ClientId& id, const std::vector<uint16_t>& packetNumbers) {
+	packHeader(PACKETS_NACK_CODE, static_cast<uint32_t>(UUID_SIZE + NACK_COUNT_SIZE + PACKET_NUMBER_SIZE * packetNumbers.size()));
+	append(id.data(), id.size());
+	appendU16(static_cast<uint16_t>(packetNumbers.size()));
+	for (uint16_t packetNum : packetNumbers)
+		appendU16(packetNum);
+}
+
+ChunksMissingResponse::ChunksMissingResponse(const ClientId& id, uint32_t chunkCount, const std::vector<uint32_t>& missingChunks) {
+	std::vector<uint8_t> bitmap((chunkCount + 7) / 8);
+	for (uint32_t chunkIndex : missingChunks)
+		bitmap[chunkIndex / 8] |= 1 << (chunkIndex % 8);
+	packHeader(CHUNKS_MISSING_CODE, static_cast<uint32_t>(UUID_SIZE + CHUNK_COUNT_SIZE + bitmap.size()));
+	append(id.data(), id.size());
+	appendU32(chunkCount);
+	append(bitmap.data(), bitmap.size());
+}
+
+SignaturesResponse::SignaturesResponse(const ClientId& id, uint32_t blockSize, const std::vector<BlockSignature>& signatures) {
+	packHeader(SIGNATURES_CODE, static_cast<uint32_t>(UUID_SIZE + BLOCK_SIZE_SIZE + BLOCK_COUNT_SIZE + (WEAK_SUM_SIZE + STRONG_SUM_SIZE) * signatures.size()));
+	append(id.data(), id.size());
+	appendU32(blockSize);
+	appendU32(static_cast<uint32_t>(signatures.size()));
+	for (const auto& signature : signatures) {
+		appendU32(signature.weak);
+		append(signature.strong.data(), signature.strong.size());
+	}
+}
+
+FailedReconnectionResponse::FailedReconnectionResponse(const ClientId& id) {
+	packHeader(RECONNECTION_FAILED_CODE, UUID_SIZE);
+	append(id.data(), id.size());
+}
+
+GeneralFailureResponse::GeneralFailureResponse() {
+	packHeader(GENERAL_ERROR_CODE, 0);
+}
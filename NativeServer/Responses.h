@@ -0,0 +1,75 @@
+#pragma once
+#include "FileAndDBHelper.h"
+#include "Delta.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+class Response { // Creates response for client, in the protocol's little endian layout
+protected:
+	std::vector<uint8_t> message; // Header followed by payload
+	void packHeader(uint16_t code, uint32_t payloadSize);
+	void append(const void* data, size_t length);
+	void appendU16(uint16_t value);
+	void appendU32(uint32_t value);
+	void appendPadded(const std::string& text, size_t size); // Zero padded to a fixed size field
+
+public:
+	virtual ~Response();
+	void send(std::vector<uint8_t>& out) const; // Appended to the responses the session writes out once the request is handled
+};
+
+class SuccessfulRegistrationResponse : public Response {
+public:
+	SuccessfulRegistrationResponse(const ClientId& id);
+};
+
+class FailedRegistrationResponse : public Response {
+public:
+	FailedRegistrationResponse();
+};
+
+// For public key and reconnection client requests (response codes are either 1602 or 1605)
+class AesResponse : public Response {
+public:
+	AesResponse(const ClientId& id, const std::string& encryptedAes, uint16_t code);
+};
+
+class FileReceivedResponse : public Response {
+public:
+	FileReceivedResponse(const ClientId& id, uint32_t contentSize, const std::string& fileName, uint32_t cksum);
+};
+
+class ReceivedMessageResponse : public Response {
+public:
+	ReceivedMessageResponse(const ClientId& id);
+};
+
+// Lists the packets whose cksum didn't match, so the client resends only them
+class PacketsNackResponse : public Response {
+public:
+	PacketsNackResponse(const ClientId& id, const std::vector<uint16_t>& packetNumbers);
+};
+
+// Bitmap over the chunks of a manifest, with a set bit for every chunk the chunk store doesn't have
+class ChunksMissingResponse : public Response {
+public:
+	ChunksMissingResponse(const ClientId& id, uint32_t chunkCount, const std::vector<uint32_t>& missingChunks);
+};
+
+// Block signatures of the stored copy of a file. A block size of 0 tells the client there is no stored copy
+class SignaturesResponse : public Response {
+public:
+	SignaturesResponse(const ClientId& id, uint32_t blockSize, const std::vector<BlockSignature>& signatures);
+};
+
+class FailedReconnectionResponse : public Response {
+public:
+	FailedReconnectionResponse(const ClientId& id);
+};
+
+class GeneralFailureResponse : public Response {
+public:
+	GeneralFailureResponse();
+};
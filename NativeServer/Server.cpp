@@ -0,0 +1,44 @@
+#include "Server.h"
+#include "Session.h"
+#include "ServerConstants.h"
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+Server::Server(unsigned short port, unsigned threads, bool logEveryPacket) : acceptor(context), threads(threads ? threads : 1), logEveryPacket(logEveryPacket) {
+	tcp::endpoint endpoint(tcp::v4(), port); // IPV4, TCP
+	acceptor.open(endpoint.protocol());
+	acceptor.set_option(tcp::acceptor::reuse_address(true));
+	acceptor.bind(endpoint);
+	acceptor.listen(LISTEN_BACKLOG);
+}
+
+void Server::accept() {
+	acceptor.async_accept([this](const boost::system::error_code& error, tcp::socket socket) {
+		if (!error) {
+			socket.set_option(tcp::no_delay(true)); // Every response is written out whole, waiting for more data only delays the client
+			std::make_shared<Session>(std::move(socket), *this)->start();
+		}
+		else if (error == boost::asio::error::operation_aborted)
+			return; // The server is stopping
+		else
+			std::cout << "Exception: " << error.message() << std::endl;
+		accept();
+	});
+}
+
+// Runs the io_context on every thread of the pool until the server is interrupted
+void Server::run() {
+	std::cout << "Server listening on port " << acceptor.local_endpoint().port() << " (native, " << threads << " threads)" << std::endl;
+	boost::asio::signal_set signals(context, SIGINT, SIGTERM);
+	signals.async_wait([this](const boost::system::error_code&, int) { context.stop(); });
+	accept();
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; i++)
+		pool.emplace_back([this] { context.run(); });
+	context.run();
+	for (auto& thread : pool)
+		thread.join();
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "StripedLock.h"
+#include <boost/asio.hpp>
+using boost::asio::ip::tcp;
+
+
+// Serves every connection from one io_context run by a pool of threads (the Python server's AsyncServer, with the handlers running on all cores).
+// A session's handlers run on whichever thread completed its read, and block on SQLite and the file system like the Python thread pool's do
+class Server {
+private:
+	boost::asio::io_context context;
+	tcp::acceptor acceptor;
+	unsigned threads;
+	bool logEveryPacket;
+	// SQLite transactions guard DB, these guard the file system: a file is locked by its path and a chunk by its digest.
+	// They only lock within this process, so the native server can't share its directory with running Python workers
+	StripedLock fileLocks;
+	StripedLock chunkLocks;
+	void accept();
+
+public:
+	Server(unsigned short port, unsigned threads, bool logEveryPacket);
+	void run();
+	StripedLock& getFileLocks() { return fileLocks; }
+	StripedLock& getChunkLocks() { return chunkLocks; }
+	bool getLogEveryPacket() const { return logEveryPacket; }
+};
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+// Sizes and limits of the server only. The protocol itself is in the client's Constants.h, shared by both sides
+enum ServerConstants :std::uint32_t {
+	DEFAULT_PORT = 1256,
+	MAX_PORT = 65535,
+	LISTEN_BACKLOG = 1024,
+	MAX_PAYLOAD_SIZE = 8169, // SENDING_FILE_PAYLOAD_SIZE, the largest request the protocol allows
+	AES_KEY_SIZE = 32,
+	AES_BLOCK_SIZE = 16,
+	ORIG_FILE_SIZE_SIZE = 4,
+	PACKET_HEADER_SIZE = 271, // CONTENT SIZE + ORIG FILE SIZE + TOTAL PACKETS + PACKET NUM + PACKET CKSUM + FILE NAME = 4+4+2+2+4+255
+	MANIFEST_HEADER_SIZE = 295, // ORIG FILE SIZE + TOTAL BATCHES + BATCH NUM + FILE DIGEST + FILE NAME = 4+2+2+32+255
+	JOIN_PARTS_PAYLOAD_SIZE = 271, // FILE NAME + TOTAL PARTS + TOTAL SIZE + FILE CKSUM = 255+4+8+4
+	MAX_PARTS = 65536, // Parts a file is joined from at most (a 2 TB file in the client's 32 MB parts)
+	DELTA_MIN_BLOCK_SIZE = 2048,
+	DELTA_MAX_BLOCK_SIZE = 65536,
+	LOCK_STRIPES = 64,
+	PACKET_LOG_INTERVAL = 100, // One received packet in every this many is logged, unless every packet is (--log-level DEBUG)
+	CHALLENGE_CHUNKS = 2, // Chunks the store already has that a client is asked for anyway, to prove it holds the file it describes
+	DB_TIMEOUT_MS = 30000
+};
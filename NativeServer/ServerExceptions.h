@@ -0,0 +1,23 @@
+#pragma once
+#include <stdexcept>
+
+// The errors the protocol answers with a specific response (the rest are answered with a general failure)
+class UnregisteredClientError : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+class DuplicateClientError : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+class DuplicateFileError : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+class InexistentFileError : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
@@ -0,0 +1,637 @@
+#include "Session.h"
+#include "Server.h"
+#include "Responses.h"
+#include "ServerConstants.h"
+#include "ServerExceptions.h"
+#include "RSAWrapper.h"
+#include "Constants.h"
+#include "cksum.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <boost/endian/conversion.hpp>
+#include <boost/uuid/random_generator.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+
+namespace {
+	// The text of a zero padded fixed size field
+	std::string paddedText(const uint8_t* data, size_t size) {
+		std::string text(reinterpret_cast<const char*>(data), size);
+		text.erase(text.find_last_not_of('\0') + 1);
+		return text;
+	}
+
+	// Removes directories such as ../ from a file name the client sent, to prevent directory traversal attack
+	std::string baseName(const std::string& fileName) {
+		return std::filesystem::path(fileName).filename().string();
+	}
+
+	void requireSize(size_t payloadSize, size_t size) {
+		if (payloadSize < size)
+			throw std::runtime_error("Request payload of " + std::to_string(payloadSize) + " bytes is shorter than " + std::to_string(size));
+	}
+}
+
+Session::Session(tcp::socket socket, Server& server)
+	: socket(std::move(socket)), server(server), buffer(2 * (REQUEST_HEADER_SIZE + MAX_PAYLOAD_SIZE)), head(0), tail(0),
+	startTime(std::chrono::steady_clock::now()), clientId{}, roundRemaining(0), fileDigest{}, origFileSize(0), updateBlockSize(0) {}
+
+// Releases the files the client left open and drops what the client went away in the middle of sending,
+// so sending it again on another connection (like a parallel upload retrying a part) doesn't find a duplicate
+Session::~Session() {
+	decryptor.reset();
+	closeFile();
+	try {
+		if (unverifiedFile) {
+			removeUnverifiedFile(*unverifiedFile);
+			std::cout << "Removed unverified file " << *unverifiedFile << " of client with id " << toHex(clientId) << std::endl;
+		}
+		if (updateSource) // An update that didn't finish keeps the stored copy
+			removeUpdateFiles();
+		if (!storedChunks.empty()) // The client went away before the recipe of its deduplicated file was committed
+			removeUncommittedChunks(filesDb(), storedChunks, server.getChunkLocks());
+	}
+	catch (const std::exception& e) {
+		std::cout << "Error cleaning up after client with id " << toHex(clientId) << ": " << e.what() << std::endl;
+	}
+	endUpdate();
+}
+
+void Session::start() {
+	boost::system::error_code error;
+	std::cout << "Connected by " << socket.remote_endpoint(error) << std::endl;
+	receive();
+}
+
+// Bytes of the request at the start of the buffer: the header, and once it's received the payload as well
+size_t Session::neededBytes() const {
+	if (tail - head < REQUEST_HEADER_SIZE)
+		return REQUEST_HEADER_SIZE;
+	return REQUEST_HEADER_SIZE + boost::endian::load_little_u32(buffer.data() + head + UUID_SIZE + VERSION_SIZE + CODE_SIZE);
+}
+
+// Handles the next request once it's whole, otherwise receives more of it
+void Session::receive() {
+	if (head == tail)
+		head = tail = 0;
+	size_t needed = neededBytes();
+	if (needed > REQUEST_HEADER_SIZE + MAX_PAYLOAD_SIZE) { // Nothing after it could be parsed, the connection can't be used anymore
+		boost::system::error_code error;
+		std::cout << "Closing connection with " << socket.remote_endpoint(error) << ": request payload of " << needed - REQUEST_HEADER_SIZE << " bytes is larger than " << MAX_PAYLOAD_SIZE << std::endl;
+		return;
+	}
+	if (tail - head >= needed) {
+		const uint8_t* request = buffer.data() + head;
+		head += needed; // The request stays in place until the next receive
+		writeResponses(handle(request, request + REQUEST_HEADER_SIZE, needed - REQUEST_HEADER_SIZE));
+		return;
+	}
+	if (head + needed > buffer.size()) { // The rest of the request doesn't fit behind it
+		std::memmove(buffer.data(), buffer.data() + head, tail - head);
+		tail -= head;
+		head = 0;
+	}
+	socket.async_read_some(boost::asio::buffer(buffer.data() + tail, buffer.size() - tail),
+		[this, self = shared_from_this()](const boost::system::error_code& error, size_t size) {
+			if (error) {
+				if (error != boost::asio::error::eof)
+					std::cout << "Connection with client has been aborted: " << error.message() << std::endl;
+				else if (tail > head)
+					std::cout << "Connection with client has been aborted in the middle of a request" << std::endl;
+				return;
+			}
+			tail += size;
+			receive();
+		});
+}
+
+void Session::writeResponses(bool keepOpen) {
+	boost::asio::async_write(socket, boost::asio::buffer(responses),
+		[this, keepOpen, self = shared_from_this()](const boost::system::error_code& error, size_t) {
+			responses.clear();
+			if (error)
+				std::cout << "Connection with client has been aborted: " << error.message() << std::endl;
+			else if (keepOpen)
+				receive();
+		});
+}
+
+// Handles one request. Returns false once the connection should be closed
+bool Session::handle(const uint8_t* header, const uint8_t* payload, size_t payloadSize) {
+	std::copy_n(header, UUID_SIZE, clientId.begin());
+	uint8_t version = header[UUID_SIZE];
+	uint16_t code = boost::endian::load_little_u16(header + UUID_SIZE + VERSION_SIZE);
+	try {
+		if (version != VERSION)
+			throw std::runtime_error("Version of all clients must be " + std::to_string(VERSION));
+		switch (code) {
+		case REGISTRATION_CODE:
+			handleRegistration(payload, payloadSize);
+			break;
+		case PUBLIC_KEY_CODE:
+			handlePublicKey(payload, payloadSize);
+			break;
+		case RECONNECTION_CODE:
+			handleReconnection(payload, payloadSize);
+			break;
+		case SIGNATURE_CODE:
+			handleSignature(payload, payloadSize);
+			break;
+		case SENDING_FILE_CODE:
+		case DELTA_FILE_CODE:
+			handleFilePacket(code, payload, payloadSize);
+			break;
+		case CHUNK_MANIFEST_CODE:
+			handleChunkManifest(payload, payloadSize);
+			break;
+		case CHUNK_DATA_CODE:
+			handleChunkData(payload, payloadSize);
+			break;
+		case VALID_CRC_CODE:
+			handleValidCrc(payload, payloadSize);
+			return false; // Taking care of client finished because file received successfully
+		case JOIN_PARTS_CODE:
+			handleJoinParts(payload, payloadSize);
+			return false;
+		case INVALID_CRC_RESENDING_FILE_CODE:
+		case INVALID_CRC_ABORT_CODE:
+			return handleInvalidCrc(code, payload, payloadSize);
+		default:
+			throw std::runtime_error("Invalid request code " + std::to_string(code));
+		}
+	}
+	catch (const UnregisteredClientError& e) {
+		std::cout << "Client has to sign up exception: " << e.what() << std::endl;
+		FailedReconnectionResponse(clientId).send(responses);
+	}
+	catch (const DuplicateClientError& e) {
+		std::cout << "Client already signed up exception: " << e.what() << std::endl;
+		FailedRegistrationResponse().send(responses);
+	}
+	catch (const std::filesystem::filesystem_error& e) { // Like an OSError in the Python server, the connection is dropped
+		std::cout << "Exception: " << e.what() << std::endl;
+		return false;
+	}
+	catch (const std::exception& e) { // By the protocol, duplicate and inexistent files have no specific responses either, so general failure is sent
+		std::cout << "Exception: " << e.what() << std::endl;
+		GeneralFailureResponse().send(responses);
+	}
+	return true;
+}
+
+// Client registration (one transaction, so two clients can't register the same name)
+void Session::handleRegistration(const uint8_t* payload, size_t payloadSize) {
+	name = paddedText(payload, std::min<size_t>(payloadSize, NAME_SIZE));
+	Connection& clients = clientsDb();
+	{
+		Transaction transaction(clients);
+		validateClient(clients, name); // Make sure client didn't already register
+		boost::uuids::uuid id = boost::uuids::random_generator()();
+		std::copy(id.begin(), id.end(), clientId.begin());
+		insertClient(clients, clientId, name);
+		transaction.commit();
+	}
+	SuccessfulRegistrationResponse(clientId).send(responses);
+	std::cout << "Client with id " << toHex(clientId) << " has signed up" << std::endl;
+}
+
+// Public key exchange
+void Session::handlePublicKey(const uint8_t* payload, size_t payloadSize) {
+	requireSize(payloadSize, NAME_SIZE + PUBLIC_KEY_SIZE);
+	name = paddedText(payload, NAME_SIZE);
+	validateNameAndId(clientsDb(), clientId, name); // Make sure client is registered in DB and that the name client provided is fitting the name in DB
+	std::string publicKey(reinterpret_cast<const char*>(payload + NAME_SIZE), payloadSize - NAME_SIZE);
+	sendAndUpdateAes(PUBLIC_KEY_RECEIVED_CODE, publicKey);
+	std::cout << "Client with id " << toHex(clientId) << " has sent public key: " << toHex(reinterpret_cast<const uint8_t*>(publicKey.data()), publicKey.size()) << std::endl;
+}
+
+// AES key resend
+void Session::handleReconnection(const uint8_t* payload, size_t payloadSize) {
+	name = paddedText(payload, std::min<size_t>(payloadSize, NAME_SIZE));
+	validateNameAndId(clientsDb(), clientId, name);
+	sendAndUpdateAes(RECONNECTION_SUCCEEDED_CODE, "");
+	std::cout << "Client with id " << toHex(clientId) << " has logged in" << std::endl;
+}
+
+// Update mode: signatures of the stored copy of a file, so the client sends only what changed (block size 0 means the file is new)
+void Session::handleSignature(const uint8_t* payload, size_t payloadSize) {
+	setAesName();
+	fileName = baseName(paddedText(payload, payloadSize));
+	endUpdate();
+	std::unique_ptr<std::fstream> source;
+	{
+		std::lock_guard<std::mutex> lock(server.getFileLocks()(clientFilePath(clientId, fileName)));
+		source = openStoredFile(filesDb(), clientId, fileName);
+	}
+	if (!source) {
+		SignaturesResponse(clientId, 0, {}).send(responses);
+		return;
+	}
+	auto [blockSize, signatures] = blockSignatures(*source);
+	updateBlockSize = blockSize;
+	updateSource = std::move(source);
+	SignaturesResponse(clientId, blockSize, signatures).send(responses);
+	std::cout << "Sent " << signatures.size() << " block signatures of file " << fileName << " to client with id " << toHex(clientId) << std::endl;
+}
+
+// File transfer (requires locking the file). A delta travels the same way, then the new version is rebuilt from it and the stored copy
+void Session::handleFilePacket(uint16_t code, const uint8_t* payload, size_t payloadSize) {
+	requireSize(payloadSize, PACKET_HEADER_SIZE);
+	uint32_t contentSize = boost::endian::load_little_u32(payload);
+	uint32_t origSize = boost::endian::load_little_u32(payload + CONTENTSIZE_SIZE);
+	uint16_t totalPackets = boost::endian::load_little_u16(payload + CONTENTSIZE_SIZE + ORIG_FILE_SIZE_SIZE);
+	uint16_t packetNum = boost::endian::load_little_u16(payload + CONTENTSIZE_SIZE + ORIG_FILE_SIZE_SIZE + PACKET_NUMBER_SIZE);
+	uint32_t packetCksum = boost::endian::load_little_u32(payload + CONTENTSIZE_SIZE + ORIG_FILE_SIZE_SIZE + 2 * PACKET_NUMBER_SIZE);
+	std::string packetFileName = paddedText(payload + PACKET_HEADER_SIZE - FILE_NAME_SIZE, FILE_NAME_SIZE);
+	bool newTransfer = roundRemaining == 0; // Otherwise it's a packet of the current round or a resent corrupted packet
+	Connection& files = filesDb();
+
+	if (newTransfer) {
+		if (packetNum != 1)
+			throw std::runtime_error("Packets sent in wrong order from client with id " + toHex(clientId));
+		setAesName(); // Retrieve AES to client from DB (for decrypting file)
+		packetFileName = baseName(packetFileName);
+	}
+	if (newTransfer && code == DELTA_FILE_CODE) {
+		if (!updateSource || packetFileName != fileName)
+			throw std::runtime_error("Delta for file " + packetFileName + " without its signatures from client with id " + toHex(clientId));
+		filePath = clientFilePath(clientId, fileName) + ".delta.tmp"; // The stored copy stays in place until the client confirms the new version
+	}
+	else if (newTransfer) {
+		endUpdate();
+		fileName = packetFileName;
+		if (fileExists(files, clientId, fileName)) // The protocol didn't mention but overwriting existing files isn't allowed
+			throw DuplicateFileError("File " + fileName + " for client with id " + toHex(clientId) + " already exists");
+		filePath = clientFilePath(clientId, fileName);
+		insertFile(files, clientId, fileName, filePath);
+		unverifiedFile = fileName;
+	}
+
+	// Locking the file (the stored copy of an update and its temporary files share the lock of the stored copy's path)
+	std::lock_guard<std::mutex> lock(server.getFileLocks()(clientFilePath(clientId, fileName)));
+	if (newTransfer) {
+		std::filesystem::create_directories(std::filesystem::path(filePath).parent_path()); // Make the file's fan-out directory
+		closeFile();
+		file.open(filePath, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!file)
+			throw std::runtime_error("Error creating file " + filePath);
+		std::filesystem::resize_file(filePath, contentSize); // Preallocated, every packet's plaintext is written in place as it arrives
+		decryptor = std::make_unique<PacketDecryptor>(aes, contentSize, totalPackets, [this](uint64_t offset, const uint8_t* data, size_t length) {
+			file.seekp(static_cast<std::streamoff>(offset));
+			file.write(reinterpret_cast<const char*>(data), length);
+		});
+		roundRemaining = totalPackets;
+		corruptedPackets.clear();
+	}
+	else if (packetNum < 1 || packetNum > totalPackets)
+		throw std::runtime_error("Invalid packet number " + std::to_string(packetNum) + " from client with id " + toHex(clientId));
+
+	const uint8_t* encrypted = payload + PACKET_HEADER_SIZE;
+	size_t encryptedSize = payloadSize - PACKET_HEADER_SIZE;
+	if (memcrc(reinterpret_cast<const char*>(encrypted), encryptedSize) != packetCksum) { // Keeping the rest of the file, only this packet will be requested again
+		corruptedPackets.insert(packetNum);
+		std::cout << "Received corrupted packet number " << packetNum << " for file " << fileName << " from client with id " << toHex(clientId) << '\n';
+	}
+	else {
+		corruptedPackets.erase(packetNum);
+		decryptor->add(packetNum, encrypted, encryptedSize);
+		// Every packet at DEBUG, one in every PACKET_LOG_INTERVAL otherwise: a line per packet costs more than the packet at high rates, flushing it even more
+		if (server.getLogEveryPacket() || packetNum % PACKET_LOG_INTERVAL == 1)
+			std::cout << "Received packet number " << packetNum << " of " << totalPackets << " for file " << fileName << " from client with id " << toHex(clientId) << '\n';
+	}
+	ReceivedMessageResponse(clientId).send(responses); // To indicate there was no problem receiving the packet
+	roundRemaining--;
+
+	if (roundRemaining == 0 && !corruptedPackets.empty()) { // End of round, asking for the corrupted packets only
+		std::vector<uint16_t> packets(corruptedPackets.begin(), corruptedPackets.end());
+		roundRemaining = static_cast<uint16_t>(packets.size());
+		PacketsNackResponse(clientId, packets).send(responses);
+		std::cout << "Asked client with id " << toHex(clientId) << " to resend " << packets.size() << " corrupted packets" << std::endl;
+	}
+	else if (roundRemaining == 0) { // Every packet is already decrypted and cksummed, only the padding is cut off
+		auto [crc, decryptedSize] = decryptor->finish();
+		decryptor.reset();
+		closeFile();
+		std::filesystem::resize_file(filePath, decryptedSize);
+		if (code == DELTA_FILE_CODE) {
+			std::vector<uint8_t> delta;
+			{
+				std::ifstream deltaFile(filePath, std::ios::binary);
+				delta.assign(std::istreambuf_iterator<char>(deltaFile), std::istreambuf_iterator<char>());
+			}
+			std::filesystem::remove(filePath); // The delta is only needed to rebuild the new version next to the stored copy
+			std::ofstream newVersion(clientFilePath(clientId, fileName) + ".new.tmp", std::ios::binary | std::ios::trunc);
+			std::tie(crc, decryptedSize) = applyDelta(delta, *updateSource, newVersion, updateBlockSize);
+		}
+		if (decryptedSize != origSize)
+			throw std::runtime_error("Invalid original size from client with id " + toHex(clientId));
+		FileReceivedResponse(clientId, contentSize, fileName, static_cast<uint32_t>(crc)).send(responses);
+	}
+}
+
+// Deduplicated file transfer: the client describes the file as content defined chunks, in batches, and sends only the chunks the chunk store doesn't have
+// (and a few it has, as proof it holds the file rather than just its digest)
+void Session::handleChunkManifest(const uint8_t* payload, size_t payloadSize) {
+	requireSize(payloadSize, MANIFEST_HEADER_SIZE);
+	uint32_t origSize = boost::endian::load_little_u32(payload);
+	uint16_t totalBatches = boost::endian::load_little_u16(payload + ORIG_FILE_SIZE_SIZE);
+	uint16_t batchNum = boost::endian::load_little_u16(payload + ORIG_FILE_SIZE_SIZE + PACKET_NUMBER_SIZE);
+	Digest digest;
+	std::copy_n(payload + ORIG_FILE_SIZE_SIZE + 2 * PACKET_NUMBER_SIZE, DIGEST_SIZE, digest.begin());
+	Connection& files = filesDb();
+
+	if (batchNum == 1) {
+		setAesName(); // Retrieve AES to client from DB (for decrypting chunks)
+		fileName = baseName(paddedText(payload + MANIFEST_HEADER_SIZE - FILE_NAME_SIZE, FILE_NAME_SIZE));
+		if (fileExists(files, clientId, fileName))
+			throw DuplicateFileError("File " + fileName + " for client with id " + toHex(clientId) + " already exists");
+		filePath.clear(); // The file lives in the chunk store
+		insertFile(files, clientId, fileName, filePath);
+		unverifiedFile = fileName;
+		fileDigest = digest;
+		origFileSize = origSize;
+		manifest.clear();
+		missingChunks.clear();
+		std::optional<RecipeInfo> recipe;
+		{
+			Transaction transaction(files); // The recipe can't be dropped between finding and linking it
+			recipe = findRecipe(files, clientId, digest);
+			if (recipe && recipe->size == origSize) // The client already sent this exact file under another name
+				linkRecipe(files, clientId, fileName, digest);
+			transaction.commit();
+		}
+		if (recipe && recipe->size == origSize) {
+			FileReceivedResponse(clientId, origSize, fileName, recipe->crc).send(responses);
+			std::cout << "File " << fileName << " from client with id " << toHex(clientId) << " is already in the chunk store as another file of the client" << std::endl;
+			return;
+		}
+	}
+	else if (digest != fileDigest)
+		throw std::runtime_error("Manifest batches of different files from client with id " + toHex(clientId));
+
+	for (size_t i = MANIFEST_HEADER_SIZE; i + DIGEST_SIZE + CHUNK_SIZE_SIZE <= payloadSize; i += DIGEST_SIZE + CHUNK_SIZE_SIZE) {
+		ManifestEntry entry;
+		std::copy_n(payload + i, DIGEST_SIZE, entry.digest.begin());
+		entry.size = boost::endian::load_little_u16(payload + i + DIGEST_SIZE);
+		manifest.push_back(entry);
+	}
+	if (batchNum < totalBatches)
+		ReceivedMessageResponse(clientId).send(responses); // Waiting for the next batch
+	else
+		completeManifest(CHALLENGE_CHUNKS);
+}
+
+// A chunk of a deduplicated file the chunk store didn't have
+void Session::handleChunkData(const uint8_t* payload, size_t payloadSize) {
+	requireSize(payloadSize, CHUNK_INDEX_SIZE);
+	uint32_t chunkIndex = boost::endian::load_little_u32(payload);
+	if (!missingChunks.count(chunkIndex))
+		throw std::runtime_error("Chunk " + std::to_string(chunkIndex) + " was not requested from client with id " + toHex(clientId));
+	const ManifestEntry& entry = manifest[chunkIndex];
+	static const uint8_t zeroIv[AES_BLOCK_SIZE] = {};
+	std::vector<uint8_t> chunk = aesDecrypt(aes, payload + CHUNK_INDEX_SIZE, payloadSize - CHUNK_INDEX_SIZE, zeroIv, true); // Every chunk is encrypted on its own
+	if (chunk.size() != entry.size || sha256(chunk.data(), chunk.size()) != entry.digest) // Never letting a chunk in the store under a wrong digest
+		throw std::runtime_error("Chunk " + std::to_string(chunkIndex) + " from client with id " + toHex(clientId) + " does not match its digest");
+	{
+		std::lock_guard<std::mutex> lock(server.getChunkLocks()(std::string(entry.digest.begin(), entry.digest.end()))); // removeChunks checks DB under the same lock
+		storeChunk(filesDb(), entry.digest, chunk, crc_update(0, chunk.data(), chunk.size()));
+	}
+	storedChunks.insert(entry.digest);
+	missingChunks.erase(chunkIndex);
+	ReceivedMessageResponse(clientId).send(responses);
+	if (missingChunks.empty())
+		completeManifest(0); // The chunks just sent answered the challenge
+}
+
+// File verification
+void Session::handleValidCrc(const uint8_t* payload, size_t payloadSize) {
+	fileName = paddedText(payload, payloadSize);
+	Connection& files = filesDb();
+	if (!fileExists(files, clientId, fileName))
+		throw InexistentFileError("File " + fileName + " does not exist in DB. Therefore there is no file to verify.");
+	if (updateSource) { // Swapping the rebuilt version in for the stored copy
+		endUpdate();
+		filePath = clientFilePath(clientId, fileName);
+		auto orphanChunks = replaceWithPlainFile(files, clientId, fileName, filePath); // A deduplicated copy is replaced by a plain file
+		{
+			std::lock_guard<std::mutex> lock(server.getFileLocks()(filePath));
+			std::filesystem::rename(filePath + ".new.tmp", filePath);
+		}
+		if (orphanChunks && !orphanChunks->empty())
+			removeChunks(files, *orphanChunks, server.getChunkLocks());
+	}
+	verifyFile(files, clientId, fileName); // Verifying file after receiving valid crc
+	unverifiedFile.reset();
+	ReceivedMessageResponse(clientId).send(responses);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+	std::cout << "Successfully received file " << fileName << " from client " << toHex(clientId) << " in " << elapsed.count() << " seconds" << std::endl;
+}
+
+// A parallel upload sends a large file in parts, each stored as a file of its own, and joins them once the last part is verified
+void Session::handleJoinParts(const uint8_t* payload, size_t payloadSize) {
+	requireSize(payloadSize, JOIN_PARTS_PAYLOAD_SIZE);
+	setAesName(); // Only a registered client's parts are joined, like any file it sends
+	fileName = baseName(paddedText(payload, FILE_NAME_SIZE));
+	uint32_t totalParts = boost::endian::load_little_u32(payload + FILE_NAME_SIZE);
+	uint64_t totalSize = boost::endian::load_little_u64(payload + FILE_NAME_SIZE + PART_COUNT_SIZE);
+	uint32_t fileCksum = boost::endian::load_little_u32(payload + FILE_NAME_SIZE + PART_COUNT_SIZE + TOTAL_SIZE_SIZE);
+	if (totalParts == 0 || totalParts > MAX_PARTS) // The count comes from the wire, and every part is looked up in turn
+		throw std::runtime_error("Invalid number of parts " + std::to_string(totalParts) + " of file " + fileName + " from client with id " + toHex(clientId));
+	filePath = clientFilePath(clientId, fileName);
+	std::string joinedPath = filePath + "." + boost::uuids::to_string(boost::uuids::random_generator()()) + ".join.tmp"; // Two joins of the same file don't write over each other
+	auto [crc, size] = joinParts(totalParts, joinedPath);
+	Connection& files = filesDb();
+	std::optional<std::vector<Digest>> orphanChunks;
+	try {
+		if (size != totalSize || crc_finalize(crc, static_cast<size_t>(size)) != fileCksum)
+			throw std::runtime_error("Parts of file " + fileName + " from client with id " + toHex(clientId) + " don't add up to the file");
+		std::lock_guard<std::mutex> lock(server.getFileLocks()(filePath)); // Another join or an update of the file waits until the stored copy and its row agree
+		if (fileExists(files, clientId, fileName)) // Replacing the stored copy, like an update
+			orphanChunks = replaceWithPlainFile(files, clientId, fileName, filePath);
+		else
+			insertFile(files, clientId, fileName, filePath);
+		std::filesystem::rename(joinedPath, filePath);
+		verifyFile(files, clientId, fileName);
+	}
+	catch (...) {
+		std::error_code ignored;
+		std::filesystem::remove(joinedPath, ignored);
+		throw;
+	}
+	if (orphanChunks && !orphanChunks->empty())
+		removeChunks(files, *orphanChunks, server.getChunkLocks());
+	removeParts(totalParts);
+	ReceivedMessageResponse(clientId).send(responses);
+	std::cout << "Joined " << totalParts << " parts of file " << fileName << " from client " << toHex(clientId) << std::endl;
+}
+
+bool Session::handleInvalidCrc(uint16_t code, const uint8_t* payload, size_t payloadSize) {
+	fileName = paddedText(payload, payloadSize);
+	roundRemaining = 0; // The client may also abort in the middle of a round, after too many corrupted packets
+	decryptor.reset();
+	closeFile();
+	Connection& files = filesDb();
+	if (!fileExists(files, clientId, fileName))
+		throw InexistentFileError("File " + fileName + " does not exist in DB. Therefore there is no file to attempt sending again or abort.");
+	if (updateSource) { // An update that failed keeps the stored copy, only the rebuilt version is dropped
+		removeUpdateFiles();
+		if (code == INVALID_CRC_ABORT_CODE)
+			endUpdate();
+	}
+	else {
+		// Removing file from DB in order to be able re-adding it during the next attempt, or removing it to abort after 4 attempts
+		removeUnverifiedFile(fileName); // The protocol did not mention a response to send in the case of resending
+		unverifiedFile.reset();
+	}
+	if (code == INVALID_CRC_ABORT_CODE) {
+		ReceivedMessageResponse(clientId).send(responses); // In this case of abort sending this response following the protocol
+		std::cout << "Abort. Cannot receive file " << fileName << " from client " << toHex(clientId) << std::endl;
+		return false; // Taking care of client finished because file cannot be sent after 4 attempts
+	}
+	return true;
+}
+
+// Generates AES symmetric key, stores it in DB and sends it to client (with the stored public key when publicKey is empty).
+// The RSA encryption runs before touching DB, so other clients' handshakes never wait for it
+void Session::sendAndUpdateAes(uint16_t code, const std::string& publicKey) {
+	Connection& clients = clientsDb();
+	auto record = clientRecord(clients, clientId);
+	if (!record)
+		throw UnregisteredClientError("Client with id " + toHex(clientId) + " does not exist");
+	const std::string& key = publicKey.empty() ? record->publicKey : publicKey;
+	std::string newAes = generateAesKey();
+	std::string encryptedAes;
+	try {
+		RSAPublicWrapper rsa(key);
+		encryptedAes = rsa.encrypt(newAes);
+	}
+	catch (const std::exception&) {
+		std::cout << "Public key of client with id " << toHex(clientId) << " is corrupted" << std::endl;
+		throw;
+	}
+	updateAes(clients, clientId, newAes, key);
+	aes = newAes;
+	AesResponse(clientId, encryptedAes, code).send(responses); // Only once the key is stored, so the client never uses a key the server doesn't know
+	std::cout << "Generated AES for client with id " << toHex(clientId) << ": " << toHex(reinterpret_cast<const uint8_t*>(aes.data()), aes.size()) << std::endl;
+}
+
+// Retrieves AES symmetric key and name from DB
+void Session::setAesName() {
+	Connection& clients = clientsDb();
+	auto record = clientRecord(clients, clientId);
+	if (!record)
+		throw std::runtime_error("No such client with id " + toHex(clientId));
+	aes = record->aes;
+	name = record->name;
+	touchClient(clients, clientId); // Every file start counts as the client being seen
+}
+
+// Commits a deduplicated file once the chunk store has all of its chunks and the client proved it holds the file,
+// otherwise asks the client for the missing ones and up to challenge of the others
+void Session::completeManifest(uint32_t challenge) {
+	std::vector<uint32_t> missing;
+	auto crc = commitRecipe(filesDb(), clientId, fileName, fileDigest, origFileSize, manifest, storedChunks, challenge, missing);
+	if (!crc) {
+		missingChunks.insert(missing.begin(), missing.end());
+		ChunksMissingResponse(clientId, static_cast<uint32_t>(manifest.size()), missing).send(responses);
+		std::cout << "Asked client with id " << toHex(clientId) << " for " << missing.size() << " of " << manifest.size() << " chunks" << std::endl;
+	}
+	else {
+		storedChunks.clear(); // The recipe references them now
+		FileReceivedResponse(clientId, origFileSize, fileName, *crc).send(responses);
+	}
+}
+
+// Name of a part of the file, made as the part is looked up
+std::string Session::partFileName(uint32_t part) const {
+	return fileName + ".part" + std::to_string(part);
+}
+
+// Copies the verified parts of the file into joinedPath, in order. Returns the cksum state and size of the joined file
+std::pair<uint32_t, uint64_t> Session::joinParts(uint32_t totalParts, const std::string& joinedPath) {
+	uint32_t crc = 0;
+	uint64_t size = 0;
+	std::filesystem::create_directories(std::filesystem::path(joinedPath).parent_path());
+	try {
+		std::ofstream joined(joinedPath, std::ios::binary | std::ios::trunc);
+		std::vector<char> data(1 << 20);
+		for (uint32_t part = 1; part <= totalParts; part++) {
+			std::string partName = partFileName(part);
+			std::unique_ptr<std::fstream> source;
+			{
+				std::lock_guard<std::mutex> lock(server.getFileLocks()(clientFilePath(clientId, partName)));
+				source = openStoredFile(filesDb(), clientId, partName);
+			}
+			if (!source)
+				throw InexistentFileError("Part " + partName + " from client with id " + toHex(clientId) + " was not received");
+			while (source->read(data.data(), data.size()) || source->gcount() > 0) {
+				joined.write(data.data(), source->gcount());
+				crc = crc_update(crc, data.data(), static_cast<size_t>(source->gcount()));
+				size += static_cast<uint64_t>(source->gcount());
+			}
+		}
+		if (!joined.flush())
+			throw std::runtime_error("Error writing file " + joinedPath);
+	}
+	catch (...) {
+		std::error_code ignored;
+		std::filesystem::remove(joinedPath, ignored);
+		throw;
+	}
+	return { crc, size };
+}
+
+// Removes the parts of a file once they're joined, from DB and from the file system or chunk store
+void Session::removeParts(uint32_t totalParts) {
+	Connection& files = filesDb();
+	for (uint32_t part = 1; part <= totalParts; part++) {
+		std::string partName = partFileName(part);
+		removeFile(files, clientId, partName);
+		auto orphanChunks = unlinkRecipe(files, clientId, partName); // Nothing unless the part was deduplicated
+		if (orphanChunks)
+			removeChunks(files, *orphanChunks, server.getChunkLocks());
+		else {
+			std::string path = clientFilePath(clientId, partName);
+			std::lock_guard<std::mutex> lock(server.getFileLocks()(path));
+			std::error_code ignored;
+			std::filesystem::remove(path, ignored);
+		}
+	}
+}
+
+// Removes a file of the client that wasn't verified, from DB and from the file system or chunk store
+void Session::removeUnverifiedFile(const std::string& unverifiedName) {
+	Connection& files = filesDb();
+	removeFile(files, clientId, unverifiedName);
+	auto orphanChunks = unlinkRecipe(files, clientId, unverifiedName); // Nothing unless the file was deduplicated
+	if (orphanChunks)
+		removeChunks(files, *orphanChunks, server.getChunkLocks());
+	else {
+		std::string path = clientFilePath(clientId, unverifiedName);
+		std::lock_guard<std::mutex> lock(server.getFileLocks()(path)); // Removing file from file system as well (a deduplicated file that wasn't committed has none)
+		std::error_code ignored;
+		std::filesystem::remove(path, ignored);
+	}
+}
+
+// Removes the rebuilt version of an update and the delta it was rebuilt from, the stored copy stays as it is
+void Session::removeUpdateFiles() {
+	std::string path = clientFilePath(clientId, fileName);
+	std::lock_guard<std::mutex> lock(server.getFileLocks()(path));
+	std::error_code ignored;
+	std::filesystem::remove(path + ".delta.tmp", ignored);
+	std::filesystem::remove(path + ".new.tmp", ignored);
+}
+
+void Session::closeFile() {
+	if (file.is_open())
+		file.close();
+}
+
+void Session::endUpdate() {
+	updateSource.reset();
+	updateBlockSize = 0;
+}
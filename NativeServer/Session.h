@@ -0,0 +1,78 @@
+#pragma once
+#include "FileAndDBHelper.h"
+#include "PacketDecryptor.h"
+#include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+using boost::asio::ip::tcp;
+
+class Server;
+
+// The state of one client connection (the Python server's Session and Client together).
+// Requests are received into one buffer per connection and handled in place, on whichever io_context thread completed the read.
+// A session has at most one operation pending at a time (a read, or the write of the responses to a request), so its state needs no locking
+class Session : public std::enable_shared_from_this<Session> {
+private:
+	tcp::socket socket;
+	Server& server;
+	std::vector<uint8_t> buffer; // Received bytes, holding two requests of the largest size so a request in progress only ever moves to the front
+	size_t head, tail; // The received bytes not handled yet
+	std::vector<uint8_t> responses; // Responses to the request being handled, written out together
+	std::chrono::steady_clock::time_point startTime; // For tracking file sending time
+
+	ClientId clientId;
+	std::string name;
+	std::string aes;
+	std::string fileName;
+	std::string filePath;
+	std::fstream file;
+	uint16_t roundRemaining; // Packets still expected in the current sending round (0 means no file transfer is in progress)
+	std::set<uint16_t> corruptedPackets; // Packets whose cksum didn't match, they will be requested again at the end of the round
+	std::unique_ptr<PacketDecryptor> decryptor;
+	std::vector<ManifestEntry> manifest;
+	Digest fileDigest;
+	uint32_t origFileSize;
+	std::set<uint32_t> missingChunks; // Indexes of manifest chunks the chunk store doesn't have yet
+	std::set<Digest> storedChunks; // Chunks this session stored that no committed recipe references yet
+	uint32_t updateBlockSize;
+	std::unique_ptr<std::fstream> updateSource; // Stored copy of a file being updated from a delta
+	std::optional<std::string> unverifiedFile; // Name of the file this session inserted to DB that the client hasn't verified yet
+
+	void receive();
+	size_t neededBytes() const;
+	void writeResponses(bool keepOpen);
+	bool handle(const uint8_t* header, const uint8_t* payload, size_t payloadSize);
+
+	void handleRegistration(const uint8_t* payload, size_t payloadSize);
+	void handlePublicKey(const uint8_t* payload, size_t payloadSize);
+	void handleReconnection(const uint8_t* payload, size_t payloadSize);
+	void handleSignature(const uint8_t* payload, size_t payloadSize);
+	void handleFilePacket(uint16_t code, const uint8_t* payload, size_t payloadSize);
+	void handleChunkManifest(const uint8_t* payload, size_t payloadSize);
+	void handleChunkData(const uint8_t* payload, size_t payloadSize);
+	void handleValidCrc(const uint8_t* payload, size_t payloadSize);
+	void handleJoinParts(const uint8_t* payload, size_t payloadSize);
+	bool handleInvalidCrc(uint16_t code, const uint8_t* payload, size_t payloadSize);
+
+	void sendAndUpdateAes(uint16_t code, const std::string& publicKey);
+	void setAesName();
+	void completeManifest(uint32_t challenge);
+	std::string partFileName(uint32_t part) const;
+	std::pair<uint32_t, uint64_t> joinParts(uint32_t totalParts, const std::string& joinedPath);
+	void removeParts(uint32_t totalParts);
+	void removeUnverifiedFile(const std::string& unverifiedName);
+	void removeUpdateFiles();
+	void closeFile();
+	void endUpdate();
+
+public:
+	Session(tcp::socket socket, Server& server);
+	~Session();
+	void start();
+};
@@ -0,0 +1,17 @@
+#pragma once
+#include "ServerConstants.h"
+#include <array>
+#include <mutex>
+#include <string>
+#include <functional>
+
+
+// A fixed pool of mutexes that keys are hashed over, so every file or chunk effectively gets its own lock without keeping a lock per key.
+// Callers never hold two stripes at once, so two keys sharing a stripe can't deadlock
+class StripedLock {
+private:
+	std::array<std::mutex, LOCK_STRIPES> stripes;
+
+public:
+	std::mutex& operator()(const std::string& key) { return stripes[std::hash<std::string>{}(key) % stripes.size()]; }
+};
@@ -0,0 +1,35 @@
+// Native server for RSA encrypted file transfer system, serving the same protocol, DB and files as the Python server
+
+
+#include "Server.h"
+#include "FileAndDBHelper.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+
+int main(int argc, char* argv[]) {
+	unsigned threads = std::thread::hardware_concurrency(); // --threads N sets the size of the pool running the io_context
+	bool logEveryPacket = false; // --log-level DEBUG logs every received packet, INFO (the default) one in every PACKET_LOG_INTERVAL
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = static_cast<unsigned>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--log-level") && i + 1 < argc && (!std::strcmp(argv[i + 1], "DEBUG") || !std::strcmp(argv[i + 1], "INFO")))
+			logEveryPacket = !std::strcmp(argv[++i], "DEBUG");
+		else {
+			std::cout << "Usage: " << argv[0] << " [--threads N] [--log-level DEBUG|INFO]" << std::endl;
+			return 1;
+		}
+	}
+	try {
+		if (size_t removed = sweepUnreferencedChunks()) // Before any session serves clients
+			std::cout << "Removed " << removed << " chunks left unreferenced by interrupted uploads" << std::endl;
+		Server(getPort(), threads, logEveryPacket).run();
+	}
+	catch (const std::exception& e) {
+		std::cout << "Exception: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
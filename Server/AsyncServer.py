@@ -0,0 +1,94 @@
+import asyncio
+from concurrent.futures import ThreadPoolExecutor
+from Server import *
+from Response import ResponseBuffer
+
+
+class AsyncServer(Server):  # Represents a server hosting all of its clients on one event loop, with a thread pool for the work of each request
+
+    """
+
+    Runs the server on an asyncio event loop with non-blocking sockets.
+    Every connection is a coroutine that receives into its own FrameReader buffer, waits for whole requests
+    and hands each one to its Session on a worker thread, so a connection only takes a thread while one of its requests is being handled (RSA, decryption, cksums, DB and file I/O).
+    Idle and slow clients cost nothing but their socket, and a long upload no longer keeps the next clients waiting
+    for a free thread: the pool is shared request by request, not connection by connection.
+
+    """
+
+    async def handle_connection(self, conn, addr):
+        loop = asyncio.get_running_loop()
+        if self.overloaded():  # Checked when the connection arrives: clients already being served keep their place
+            await self.reject_async(loop, conn, addr)
+            return
+        print(f'Connected by {addr}')
+        metrics.gauge('server_connections', 1)
+        responses = ResponseBuffer()
+        session = Session(self, responses)
+        reader = FrameReader()
+        try:
+            keep_open = True
+            while keep_open:
+                while (request := reader.next_request()) is None:
+                    size = await loop.sock_recv_into(conn, reader.free_space())
+                    if not size:
+                        if reader.has_partial_request():  # Otherwise the client just closed the connection between requests
+                            print("Connection with client has been aborted in the middle of a request")
+                        return
+                    reader.received(size)
+                keep_open = await loop.run_in_executor(self.executor, self.handle_queued, session, self.enqueued(), *request)  # Requests of one session never overlap
+                await loop.sock_sendall(conn, responses.take())
+        except InvalidRequestError as e:
+            print(f"Closing connection with {addr}: {e}")
+        except ConnectionError as e:
+            print(f"Connection with client has been aborted: {e}")
+        finally:
+            conn.close()
+            session.close()
+            metrics.gauge('server_connections', -1)
+
+    # The event loop's reject: the first request is awaited like any other, so a slow client doesn't hold up accepting
+    async def reject_async(self, loop, conn, addr):
+        metrics.count('server_rejected_connections_total')
+        reader = FrameReader()
+        try:
+            async with asyncio.timeout(Other.BUSY_READ_TIMEOUT):
+                while reader.next_request() is None:
+                    size = await loop.sock_recv_into(conn, reader.free_space())
+                    if not size:
+                        return
+                    reader.received(size)
+            responses = ResponseBuffer()
+            BusyResponse(self.retry_after()).send(responses)
+            await loop.sock_sendall(conn, responses.take())
+            print(f"Server busy, turned away {addr}")
+        except (OSError, InvalidRequestError, TimeoutError):
+            pass
+        finally:
+            conn.close()
+
+    def handle_queued(self, session, queued_at, header, payload):
+        self.dequeued(queued_at)
+        return session.handle(header, payload)
+
+    async def serve(self):
+        loop = asyncio.get_running_loop()
+        port = get_port()
+        connections = set()  # The event loop only keeps weak references to its tasks
+        with self.listening_socket(port) as s:
+            s.setblocking(False)
+            print(f"Server listening on port {port} (event loop)")
+            self.print_implementations()
+            while True:
+                conn, addr = await loop.sock_accept(s)
+                conn.setblocking(False)
+                task = loop.create_task(self.handle_connection(conn, addr))
+                connections.add(task)
+                task.add_done_callback(connections.discard)
+
+    def run(self):
+        try:
+            with ThreadPoolExecutor(max_workers=Other.MAX_WORKERS) as self.executor:  # Max workers is the maximum amount of requests handled simultaneously
+                asyncio.run(self.serve())
+        except Exception as e:
+            print(f"Exception: {e}")
@@ -0,0 +1,91 @@
+import struct
+import threading
+import time
+import zlib
+from Constants import Other, RequestCodes
+
+# The trace file: a header, then fixed size little endian records, one per connection opened or closed and per request.
+# Benchmarks/SessionReplay.cpp reads it, with the same layouts
+TRACE_MAGIC = b'FTTR'
+TRACE_VERSION = 1
+TRACE_HEADER = struct.Struct('<4sHHQ')  # Magic, version, flags (none yet), capture start in microseconds since the epoch
+TRACE_RECORD = struct.Struct(f'<BIIH{Other.UUID_SIZE}sI4I')  # Kind, session, microseconds since the previous record, code, client id, payload size, fields
+
+
+class RecordKind:
+    OPEN = 1
+    REQUEST = 2
+    CLOSE = 3
+
+
+# What a request carried besides its header, as four numbers: sizes, counts and positions, and a hash standing for the file name.
+# Payloads themselves are never captured, the replay synthesizes them (encrypted content couldn't be replayed anyway, the server
+# hands out a new AES key on every login) so a trace holds nothing of the clients' files and stays small
+def request_fields(code, payload):
+    match code:
+        case RequestCodes.SENDING_FILE | RequestCodes.DELTA_FILE:
+            content_size, orig_file_size, total_packets, packet_num, _, file_name = struct.unpack_from(f'<IIHHI{Other.FILE_NAME_SIZE}s', payload)
+            return content_size, orig_file_size, total_packets << 16 | packet_num, name_hash(file_name)
+        case RequestCodes.CHUNK_MANIFEST:
+            orig_file_size, total_batches, batch_num, digest, file_name = struct.unpack_from(f'<IHH{Other.DIGEST_SIZE}s{Other.FILE_NAME_SIZE}s', payload)
+            # The first bytes of the file's digest: the same file uploaded by several clients is replayed as the same file, and deduplicated
+            return orig_file_size, total_batches << 16 | batch_num, struct.unpack_from('<I', digest)[0], name_hash(file_name)
+        case RequestCodes.CHUNK_DATA:
+            return struct.unpack_from('<I', payload)[0], 0, 0, 0
+        case RequestCodes.SIGNATURE | RequestCodes.VALID_CRC | RequestCodes.INVALID_CRC_RESENDING | RequestCodes.INVALID_CRC_ABORT:
+            return 0, 0, 0, name_hash(payload[:Other.FILE_NAME_SIZE])
+        case RequestCodes.JOIN_PARTS:
+            # The parts were sent as files named <file>.part<k>, the replay finds their hashes by continuing the file's over the suffix
+            file_name, total_parts = struct.unpack_from(f'<{Other.FILE_NAME_SIZE}sI', payload)
+            return total_parts, 0, 0, name_hash(file_name)
+    return 0, 0, 0, 0
+
+
+def name_hash(file_name):
+    return zlib.crc32(bytes(file_name).rstrip(b'\0'))
+
+
+class Capture:  # Records the protocol sessions a server handles into a trace file, to replay them against another server later
+
+    """
+
+    Every connection is a session of the trace, and its requests are recorded with their timing as they arrive, before they're handled.
+    Sessions of a threaded or event loop server record concurrently, a lock keeps their records whole.
+    Records are buffered and written out whenever a session closes, so a capture costs a struct.pack per request.
+
+    """
+
+    def __init__(self, path):
+        self.__file = open(path, 'wb')
+        self.__lock = threading.Lock()
+        self.__sessions = 0
+        self.__last = time.perf_counter_ns() // 1000
+        self.__file.write(TRACE_HEADER.pack(TRACE_MAGIC, TRACE_VERSION, 0, time.time_ns() // 1000))
+        print(f"Capturing sessions to {path}")
+
+    def open_session(self):
+        with self.__lock:
+            self.__sessions += 1
+            session = self.__sessions
+        self.__record(RecordKind.OPEN, session)
+        return session
+
+    def request(self, session, header, payload):
+        client_id, _, code, payload_size = struct.unpack(f'<{Other.UUID_SIZE}sBHI', header)
+        try:
+            fields = request_fields(code, payload)
+        except struct.error:  # Too short for its code, the session will fail on it and the replay too
+            fields = (0, 0, 0, 0)
+        self.__record(RecordKind.REQUEST, session, code, client_id, payload_size, fields)
+
+    def close_session(self, session):
+        self.__record(RecordKind.CLOSE, session, flush=True)
+
+    def __record(self, kind, session, code=0, client_id=bytes(Other.UUID_SIZE), payload_size=0, fields=(0, 0, 0, 0), flush=False):
+        with self.__lock:
+            now = time.perf_counter_ns() // 1000
+            delta = min(now - self.__last, 0xFFFFFFFF)  # A gap of over an hour is cut short, nothing is lost by replaying it faster
+            self.__last = now
+            self.__file.write(TRACE_RECORD.pack(kind, session, delta, code, client_id, payload_size, *fields))
+            if flush:
+                self.__file.flush()
@@ -2,6 +2,14 @@ class Client: # Represents a client communicating with the server
 
     def __init__(self):
         self.__aes = self.__name = self.__client_id = self.__file_path = self.__file_name = self.__file = None
+        self.__round_remaining = 0 # Packets still expected in the current sending round (0 means no file transfer is in progress)
+        self.__corrupted_packets = set() # Packets whose cksum didn't match, they will be requested again at the end of the round
+        self.__manifest = [] # (digest, size) of every chunk of a deduplicated file, in file order
+        self.__file_digest = self.__orig_file_size = None
+        self.__missing_chunks = set() # Indexes of manifest chunks the chunk store doesn't have yet
+        self.__stored_chunks = set() # Digests of chunks this session stored that no committed recipe references yet
+        self.__update_block_size = self.__update_source = None # Block size and open stored copy of a file being updated from a delta
+        self.__decryptor = None # Decrypts the packets of the file being sent as they arrive
 
     def set_aes(self, aes):
         self.__aes = aes
@@ -33,6 +41,56 @@ class Client: # Represents a client communicating with the server
     def get_client_id(self):
         return self.__client_id
 
+    def set_round_remaining(self, round_remaining):
+        self.__round_remaining = round_remaining
+
+    def get_round_remaining(self):
+        return self.__round_remaining
+
+    def get_corrupted_packets(self):
+        return self.__corrupted_packets
+
+    def start_manifest(self, file_digest, orig_file_size):
+        self.__file_digest, self.__orig_file_size = file_digest, orig_file_size
+        self.__manifest = []
+        self.__missing_chunks = set()
+
+    def get_manifest(self):
+        return self.__manifest
+
+    def get_file_digest(self):
+        return self.__file_digest
+
+    def get_orig_file_size(self):
+        return self.__orig_file_size
+
+    def get_missing_chunks(self):
+        return self.__missing_chunks
+
+    def get_stored_chunks(self):
+        return self.__stored_chunks
+
+    def start_update(self, block_size, source):
+        self.end_update()
+        self.__update_block_size, self.__update_source = block_size, source
+
+    def get_update_block_size(self):
+        return self.__update_block_size
+
+    def get_update_source(self):
+        return self.__update_source
+
+    def end_update(self):
+        if self.__update_source:
+            self.__update_source.close()
+        self.__update_block_size = self.__update_source = None
+
+    def set_decryptor(self, decryptor):
+        self.__decryptor = decryptor
+
+    def get_decryptor(self):
+        return self.__decryptor
+
     def open_file(self,flag):
         self.__file = open(str(self.__file_path),flag)
 
@@ -47,3 +105,12 @@ class Client: # Represents a client communicating with the server
     def write_to_file(self,content):
         if self.__file:
             self.__file.write(content)
+
+    def truncate_file(self,size):
+        if self.__file:
+            self.__file.truncate(size)
+
+    def write_to_file_at(self,offset,content): # Resent packets arrive out of order so every packet is written at its own position
+        if self.__file:
+            self.__file.seek(offset)
+            self.__file.write(content)
@@ -0,0 +1,50 @@
+import threading
+from collections import OrderedDict, namedtuple
+from Constants import Other
+
+ClientRecord = namedtuple('ClientRecord', ['name', 'public_key', 'aes'])
+
+
+class ClientCache: # The records of recently seen clients, so handshakes and file starts don't query ClientsTable
+
+    """
+
+    The helpers in FileAndDBHelper read through the cache and invalidate a client's record right after every commit that
+    changes it, so within a process the next lookup reads DB again. Least recently used records are dropped beyond max_clients.
+    IDs and names never change, so a cached name is registered for sure. The keys do change, on every handshake, and
+    when the server runs as several worker processes a handshake served by another worker leaves this worker's cached key stale.
+    So a cached key is never trusted for a transfer: set_aes_name reads the key from DB when a file starts and refreshes the record.
+
+    """
+
+    def __init__(self, max_clients=Other.CLIENT_CACHE_SIZE):
+        self.__lock = threading.Lock()
+        self.__records = OrderedDict() # By client id, least recently used first
+        self.__ids = {} # Client id by name
+        self.__max_clients = max_clients
+
+    def get(self, client_id):
+        with self.__lock:
+            record = self.__records.get(client_id)
+            if record:
+                self.__records.move_to_end(client_id)
+            return record
+
+    def find_id(self, name):
+        with self.__lock:
+            return self.__ids.get(name)
+
+    def put(self, client_id, record):
+        with self.__lock:
+            self.__records[client_id] = record
+            self.__records.move_to_end(client_id)
+            self.__ids[record.name] = client_id
+            while len(self.__records) > self.__max_clients:
+                _, dropped = self.__records.popitem(last=False)
+                self.__ids.pop(dropped.name, None)
+
+    def invalidate(self, client_id):
+        with self.__lock:
+            record = self.__records.pop(client_id, None)
+            if record:
+                self.__ids.pop(record.name, None)
@@ -5,6 +5,11 @@ class RequestCodes(IntEnum):
   PUBLIC_KEY = 826
   RECONNECTION = 827
   SENDING_FILE = 828
+  CHUNK_MANIFEST = 829
+  CHUNK_DATA = 830
+  SIGNATURE = 831
+  DELTA_FILE = 832
+  JOIN_PARTS = 833
   VALID_CRC = 900
   INVALID_CRC_RESENDING = 901
   INVALID_CRC_ABORT = 902
@@ -18,6 +23,10 @@ class ResponseCodes(IntEnum):
   RECONNECTION_SUCCEEDED_SENDING_AES=1605
   RECONNECTION_FAILED=1606
   GENERAL_FAILURE=1607
+  PACKETS_NACK=1608
+  CHUNKS_MISSING=1609
+  SIGNATURES=1610
+  SERVER_BUSY=1611
 
 class Other(IntEnum):
   CONTENTSIZE_SIZE=4
@@ -27,10 +36,37 @@ class Other(IntEnum):
   FILE_NAME_SIZE=255
   NAME_SIZE=255
   UUID_SIZE=16
+  DIGEST_SIZE=32
+  CHUNK_SIZE_SIZE=2
+  CHUNK_INDEX_SIZE=4
+  STRONG_SUM_SIZE=16
+  DELTA_MIN_BLOCK_SIZE=2048
+  DELTA_MAX_BLOCK_SIZE=65536
+  DELTA_COPY_OP=1
+  DELTA_LITERAL_OP=2
+  PART_COUNT_SIZE=4
+  MAX_PARTS=65536
+  TOTAL_SIZE_SIZE=8
   IV_SIZE = 16
   REQUEST_HEADER_SIZE=23
-  VERSION=3
+  PACKET_SIZE=7888
+  VERSION=4
   DEFAULT_PORT=1256
   MAX_PORT=65535
   CONNECTION_ABORTED_ERROR=10053
   MAX_WORKERS=10
+  LISTEN_BACKLOG=1024
+  WORKER_RESTART_DELAY=1
+  LOCK_STRIPES=64
+  DB_TIMEOUT=30
+  CLIENT_CACHE_SIZE=100000
+  GROUP_COMMIT_MAX_STATEMENTS=256
+  MAX_PAYLOAD_SIZE=8169
+  FRAME_BUFFER_SIZE=16384
+  MIGRATION_BATCH_SIZE=500
+  PACKET_LOG_INTERVAL=100
+  CHALLENGE_CHUNKS=2
+  MAX_QUEUED=100
+  BUSY_RETRY_AFTER=500
+  BUSY_READ_TIMEOUT=1
+  RETRY_AFTER_SIZE=4
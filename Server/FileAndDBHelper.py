@@ -1,11 +1,31 @@
 from Crypto.PublicKey import RSA
-from Crypto.Cipher import PKCS1_OAEP
+from Crypto.Cipher import PKCS1_OAEP, AES
+from Crypto.Util import Padding
 import Crypto.Random
 from MyExceptions import *
 from Response import *
+from ClientCache import *
+from GroupCommitWriter import *
+from Metrics import metrics
 import sqlite3
+import os
+import random
+import threading
+import hashlib
+import math
+import shutil
+import struct
+import tempfile
+import zlib
+import cksum
+from contextlib import contextmanager
 from Constants import Other
 
+try: # The native module built by setup.py decrypts without holding the GIL, so other clients' threads keep running
+    from _native import aes_cbc_decrypt
+except ImportError:
+    aes_cbc_decrypt = None
+
 # Retrieves port from port file
 def get_port():
     try:
@@ -25,53 +45,119 @@ def get_port():
 
 # Creates the clients DB
 def clients_db():
-    clients_db_conn = sqlite3.connect('clients.db')
+    clients_db_conn = sqlite3.connect('clients.db', timeout=Other.DB_TIMEOUT)  # Connections of other threads wait for the write lock instead of failing
     clients_db_conn.text_factory = bytes
+    clients_db_conn.execute('PRAGMA journal_mode=WAL')  # Readers never wait for the writer, and a commit appends to the log instead of rewriting pages
     clients_db_conn.cursor().execute('''CREATE TABLE IF NOT EXISTS ClientsTable(ID BLOB CHECK(length(ID) = 16) NOT NULL PRIMARY KEY, 
                                     Name VARCHAR(255), PublicKey BLOB CHECK(length(PublicKey) = 160), LastSeen DATETIME, AES BLOB CHECK(length(AES) = 32))''')
+    clients_db_conn.cursor().execute('''CREATE INDEX IF NOT EXISTS ClientsByName ON ClientsTable(Name)''')  # Signups look clients up by name
     clients_db_conn.commit()
     return clients_db_conn
 
 # Creates the files DB
 def files_db():
-    files_db_conn = sqlite3.connect('files.db')
+    files_db_conn = sqlite3.connect('files.db', timeout=Other.DB_TIMEOUT)
     files_db_conn.text_factory = bytes
+    files_db_conn.execute('PRAGMA journal_mode=WAL')
     files_db_conn.cursor().execute('''CREATE TABLE IF NOT EXISTS FilesTable(ID BLOB CHECK(length(ID) = 16) NOT NULL, 
                                     "File Name" VARCHAR(255) NOT NULL, "Path Name" VARCHAR(255), Verified INTEGER, PRIMARY KEY(ID,"File Name"))''')
+    # Chunk store of deduplicated files: a recipe (keyed by the SHA-256 of a whole file) lists its chunks, files point to recipes, and both recipes and chunks are reference counted
+    files_db_conn.cursor().execute('''CREATE TABLE IF NOT EXISTS ChunksTable(Digest BLOB CHECK(length(Digest) = 32) NOT NULL PRIMARY KEY, 
+                                    Size INTEGER, CRC INTEGER, RefCount INTEGER)''')
+    files_db_conn.cursor().execute('''CREATE TABLE IF NOT EXISTS RecipesTable(Digest BLOB CHECK(length(Digest) = 32) NOT NULL PRIMARY KEY, 
+                                    Size INTEGER, CRC INTEGER, RefCount INTEGER)''')
+    files_db_conn.cursor().execute('''CREATE TABLE IF NOT EXISTS RecipeChunksTable(Recipe BLOB NOT NULL, "Chunk Index" INTEGER NOT NULL, 
+                                    Chunk BLOB NOT NULL, PRIMARY KEY(Recipe,"Chunk Index"))''')
+    files_db_conn.cursor().execute('''CREATE TABLE IF NOT EXISTS FileRecipesTable(ID BLOB CHECK(length(ID) = 16) NOT NULL, 
+                                    "File Name" VARCHAR(255) NOT NULL, Recipe BLOB NOT NULL, PRIMARY KEY(ID,"File Name"))''')
     files_db_conn.commit()
     return files_db_conn
 
-# Generates AES symmetric key, sends it to client and stores in DB
+# The pool of DB connections: every worker thread opens its own on its first request and keeps them for its lifetime.
+# Sessions run on whichever worker thread is free, and an SQLite connection has to stay on the thread that opened it
+thread_db_conns = threading.local()
+
+def thread_db():
+    if not hasattr(thread_db_conns, 'conns'):
+        thread_db_conns.conns = clients_db(), files_db()
+    return thread_db_conns.conns
+
+# Records of recently seen clients, shared by all threads of the process
+client_cache = ClientCache()
+
+# Writers of the small updates every file transfer makes (FilesTable rows, LastSeen), committed in groups
+clients_writer, files_writer = GroupCommitWriter(clients_db), GroupCommitWriter(files_db)
+
+# Runs the block as one write transaction, taking SQLite's write lock up front so a read-check-write can't interleave with another connection's.
+# This replaces a global lock in the server: only writers of the same database wait for each other, and only for the transaction itself
+@contextmanager
+def write_transaction(db_conn):
+    with metrics.timed('server_lock_wait_seconds', lock='db'):  # Taking the write lock, other connections' transactions hold it until they commit
+        db_conn.execute('BEGIN IMMEDIATE')
+    try:
+        yield db_conn.cursor()
+        db_conn.commit()
+    except BaseException:
+        db_conn.rollback()
+        raise
+
+# Decrypts content the client encrypted with its AESWrapper (AES-CBC with a zero iv and PKCS#7 padding).
+# A piece from the middle of the content is decrypted with the cipher block before it as iv, and without unpadding
+def aes_decrypt(aes, encrypted, iv=bytes(Other.IV_SIZE), unpad=True):
+    if aes_cbc_decrypt:
+        return aes_cbc_decrypt(aes, iv, encrypted, unpad)
+    decrypted = AES.new(aes, AES.MODE_CBC, iv=iv).decrypt(encrypted)
+    return Padding.unpad(decrypted, AES.block_size) if unpad else decrypted
+
+# Generates AES symmetric key, stores it in DB and sends it to client.
+# The RSA encryption runs before touching DB, so other clients' handshakes never wait for it
 def send_and_update_aes(clients_db_conn, client_id, code, conn, public_key=None):
     cursor = clients_db_conn.cursor()
+    record = client_record(cursor, client_id)
     if not public_key:
-        cursor.execute('''SELECT PublicKey FROM ClientsTable WHERE ID = ?''', (client_id,))
-        public_key = cursor.fetchone()[0]
+        public_key = record.public_key
     aes = Crypto.Random.get_random_bytes(32)
     try:
-        cipher_rsa = PKCS1_OAEP.new(RSA.import_key(public_key))
-        encrypted_aes = cipher_rsa.encrypt(aes)
-        AESResponse(client_id, encrypted_aes, code).send(conn)
-        print(f"Generated AES for client with id {client_id.hex()}: {aes.hex()}")
+        with metrics.timed('server_phase_seconds', phase='rsa'):
+            cipher_rsa = PKCS1_OAEP.new(RSA.import_key(public_key))
+            encrypted_aes = cipher_rsa.encrypt(aes)
     except Exception:
         print(f"Public key of client with id {client_id.hex()} is corrupted")
         raise
 
-    cursor.execute('''UPDATE ClientsTable SET AES = ?, PublicKey = ? WHERE ID = ?''', (aes, public_key, client_id))
+    cursor.execute('''UPDATE ClientsTable SET AES = ?, PublicKey = ?, LastSeen = CURRENT_TIMESTAMP WHERE ID = ?''', (aes, public_key, client_id))
     clients_db_conn.commit()
+    client_cache.invalidate(client_id)
+    AESResponse(client_id, encrypted_aes, code).send(conn)  # Only once the key is stored, so the client never uses a key the server doesn't know
+    print(f"Generated AES for client with id {client_id.hex()}: {aes.hex()}")
+
+# Record of a client, from the cache or else from DB (None if the client isn't registered)
+def client_record(clients_cursor, client_id):
+    record = client_cache.get(client_id)
+    if record is None:
+        clients_cursor.execute('''SELECT Name, PublicKey, AES FROM ClientsTable WHERE ID = ?''', (client_id,))
+        result = clients_cursor.fetchone()
+        if not result:
+            return None
+        record = ClientRecord(result[0].decode('utf-8'), result[1], result[2])
+        client_cache.put(client_id, record)
+    return record
 
 # Validates that a client signing up doesn't exist in DB
 def validate_client(clients_cursor, name):
-    clients_cursor.execute('''SELECT ID FROM ClientsTable WHERE Name = ?''', (name,))
-    client_id = clients_cursor.fetchone()
+    client_id = client_cache.find_id(name)  # Only a miss has to be confirmed in DB
+    if client_id is None:
+        clients_cursor.execute('''SELECT ID FROM ClientsTable WHERE Name = ?''', (name,))
+        result = clients_cursor.fetchone()
+        client_id = result[0] if result else None
     if client_id:  
-        raise DuplicateClientError(f'Client with id {client_id[0].hex()} already registered')
+        raise DuplicateClientError(f'Client with id {client_id.hex()} already registered')
 
 # Validates that an existing client provides correct name according to id in DB
 def validate_name_and_id(clients_cursor, client_id, name):
-    clients_cursor.execute('''SELECT Name FROM ClientsTable WHERE ID = ?''', (client_id,))
+    record = client_record(clients_cursor, client_id)
     try:
-        real_name = clients_cursor.fetchone()[0].decode('utf-8')
+        real_name = record.name
         if real_name != name:
             raise Exception(f"Client with id {client_id.hex()} provided wrong name")
     except Exception:
@@ -82,34 +168,301 @@ def insert_client(clients_db_conn, client):
     clients_db_conn.cursor().execute('''INSERT INTO ClientsTable (ID, Name, LastSeen) VALUES (?, ?, CURRENT_TIMESTAMP)''',
                                       (client.get_client_id(), client.get_name()))
     clients_db_conn.commit()
+    client_cache.invalidate(client.get_client_id())
 
-# Checks if a file for client exists in DB
+# Checks if a file for client exists in DB (a lookup in the primary key's index)
 def file_exists(files_cursor, client_id, file_name):
     files_cursor.execute('''SELECT 1 FROM FilesTable WHERE ID = ? AND "File Name" = ?''', (client_id, file_name))
     return files_cursor.fetchone()
 
 # Inserts file of client to DB
-def insert_file(files_db_conn, client):
-    files_db_conn.cursor().execute('''INSERT INTO FilesTable (ID, "File Name", "Path Name", Verified) VALUES (?, ?, ?, 0)''',
-                                    (client.get_client_id(), client.get_file_name(), client.get_file_path()))
-    files_db_conn.commit()
+def insert_file(client):
+    try:
+        files_writer.execute('''INSERT INTO FilesTable (ID, "File Name", "Path Name", Verified) VALUES (?, ?, ?, 0)''',
+                             (client.get_client_id(), client.get_file_name(), client.get_file_path()))
+    except sqlite3.IntegrityError:  # Another connection of the same client started sending this file after file_exists checked
+        raise DuplicateFileError(f'File {client.get_file_name()} for client with id {client.get_client_id().hex()} already exists')
 
 # Verify file of client - # 1 means verified, 0 means not verified
-def verify_file(files_db_conn, client):
-    files_db_conn.cursor().execute('''UPDATE FilesTable SET Verified = ? WHERE ID = ? AND "File Name" = ?''', 
-                                    (1, client.get_client_id(), client.get_file_name(),))
-    files_db_conn.commit()
+def verify_file(client):
+    files_writer.execute('''UPDATE FilesTable SET Verified = ? WHERE ID = ? AND "File Name" = ?''', 
+                         (1, client.get_client_id(), client.get_file_name(),))
 
 # Remove file of client (in case of invalid crc)
-def remove_file(files_db_conn, client):
-    files_db_conn.cursor().execute('''DELETE FROM FilesTable WHERE ID = ? AND "File Name" = ?''', (client.get_client_id(), client.get_file_name(),))
-    files_db_conn.commit()
+def remove_file(client):
+    files_writer.execute('''DELETE FROM FilesTable WHERE ID = ? AND "File Name" = ?''', (client.get_client_id(), client.get_file_name(),))
+
+# Records that a client was seen now. Nothing waits for it, it just rides along with the next group commit
+def touch_client(client_id):
+    clients_writer.execute('''UPDATE ClientsTable SET LastSeen = CURRENT_TIMESTAMP WHERE ID = ?''', (client_id,), wait=False)
 
-# Retrieves AES symmetric key and name from DB and sets it to client object
+# Updates where a file of client is stored (None for a deduplicated file)
+def update_file_path(files_cursor, client):
+    files_cursor.execute('''UPDATE FilesTable SET "Path Name" = ? WHERE ID = ? AND "File Name" = ?''',
+                         (client.get_file_path(), client.get_client_id(), client.get_file_name()))
+
+# Retrieves AES symmetric key and name from DB and sets it to client object.
+# Always from DB rather than the cache, since another worker process may have replaced the key since this one cached it
 def set_aes_name(clients_cursor, client):
-    clients_cursor.execute('''SELECT AES, NAME FROM ClientsTable WHERE ID = ?''', (client.get_client_id(),))
+    clients_cursor.execute('''SELECT Name, PublicKey, AES FROM ClientsTable WHERE ID = ?''', (client.get_client_id(),))
     result = clients_cursor.fetchone()
     if not result:
         raise Exception(f"No such client with id {client.get_client_id().hex()}")
-    client.set_aes(result[0])
-    client.set_name((result[1].decode('utf-8')).rstrip('\0'))
+    record = ClientRecord(result[0].decode('utf-8'), result[1], result[2])
+    client_cache.put(client.get_client_id(), record)
+    client.set_aes(record.aes)
+    client.set_name(record.name.rstrip('\0'))
+    touch_client(client.get_client_id())  # Every file start counts as the client being seen
+
+# Path of a chunk in the chunk store, fanned out by the first byte of its digest
+def chunk_path(digest):
+    return os.path.join('chunk_store', digest[:1].hex(), digest.hex())
+
+# Runs a SELECT ... IN query over many digests, keeping under SQLite's limit of variables per statement
+def select_digests(cursor, query, digests):
+    digests, rows = list(digests), []
+    for i in range(0, len(digests), 500):
+        batch = digests[i:i + 500]
+        cursor.execute(query.format(','.join('?' * len(batch))), batch)
+        rows.extend(cursor.fetchall())
+    return rows
+
+# Retrieves size and cksum of a whole file with this SHA-256 digest, if the same client already stored it under some name.
+# Only the client's own files: naming another client's file by its digest proves nothing, it has to go through commit_recipe's challenge
+def find_recipe(files_cursor, client_id, digest):
+    files_cursor.execute('''SELECT Size, CRC FROM RecipesTable JOIN FileRecipesTable ON Recipe = Digest WHERE Digest = ? AND ID = ? LIMIT 1''',
+                         (digest, client_id))
+    return files_cursor.fetchone()
+
+# Writes a chunk to the chunk store, once no matter how many files contain it (requires locking the chunk's digest)
+def store_chunk(files_db_conn, digest, chunk, crc):
+    path = chunk_path(digest)
+    if not os.path.exists(path):
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        tmp_path = f'{path}.{threading.get_ident()}.tmp'
+        with open(tmp_path, 'wb') as f:
+            f.write(chunk)
+        os.replace(tmp_path, path)  # A chunk is never visible half written
+    files_db_conn.cursor().execute('''INSERT OR IGNORE INTO ChunksTable (Digest, Size, CRC, RefCount) VALUES (?, ?, ?, 0)''',
+                                    (digest, len(chunk), crc))
+    files_db_conn.commit()
+
+# Removes chunks nothing references anymore from the chunk store. Every chunk is checked again under its own lock,
+# since another client may have stored the same chunk after unlink_recipe dropped it from DB
+def remove_chunks(files_cursor, digests, chunk_locks):
+    for digest in digests:
+        with chunk_locks(digest):
+            files_cursor.execute('''SELECT 1 FROM ChunksTable WHERE Digest = ?''', (digest,))
+            if not files_cursor.fetchone() and os.path.exists(chunk_path(digest)):
+                os.remove(chunk_path(digest))
+
+# Drops the chunks a session stored for a deduplicated file whose recipe it never committed (the client went away before sending them all),
+# unless a recipe referenced them meanwhile. Another session still sending the same file is asked for them again when it commits
+def remove_uncommitted_chunks(files_db_conn, digests, chunk_locks):
+    with write_transaction(files_db_conn) as cursor:
+        orphan_chunks = [row[0] for row in select_digests(cursor, '''SELECT Digest FROM ChunksTable WHERE RefCount = 0 AND Digest IN ({})''', digests)]
+        cursor.executemany('''DELETE FROM ChunksTable WHERE Digest = ?''', ((digest,) for digest in orphan_chunks))
+    remove_chunks(files_db_conn.cursor(), orphan_chunks, chunk_locks)
+
+# Drops every chunk no recipe references, left behind by sessions the server was stopped in the middle of.
+# Runs before any client is served, so no session can be sending them. Returns the number of chunks removed
+def sweep_unreferenced_chunks():
+    files_db_conn = files_db()
+    with write_transaction(files_db_conn) as cursor:
+        cursor.execute('''SELECT Digest FROM ChunksTable WHERE RefCount = 0''')
+        orphan_chunks = [row[0] for row in cursor.fetchall()]
+        cursor.execute('''DELETE FROM ChunksTable WHERE RefCount = 0''')
+    files_db_conn.close()
+    for digest in orphan_chunks:
+        if os.path.exists(chunk_path(digest)):
+            os.remove(chunk_path(digest))
+    return len(orphan_chunks)
+
+# Links a file of client to a recipe (inside the caller's write transaction)
+def link_recipe(cursor, client, recipe):
+    cursor.execute('''INSERT INTO FileRecipesTable (ID, "File Name", Recipe) VALUES (?, ?, ?)''', (client.get_client_id(), client.get_file_name(), recipe))
+    cursor.execute('''UPDATE RecipesTable SET RefCount = RefCount + 1 WHERE Digest = ?''', (recipe,))
+
+# Creates the recipe of a deduplicated file from the client's manifest and links the file to it.
+# Returns the file's cksum, combined from the cksums of its chunks without reading them, or the indexes of the chunks the client has to send:
+# the ones the chunk store doesn't have, and up to challenge random ones it has but this session didn't send, for the client to prove it holds them
+def commit_recipe(files_db_conn, client, challenge=0):
+    with write_transaction(files_db_conn) as cursor:  # Chunks can't lose their last reference between checking them and referencing them
+        return commit_recipe_locked(cursor, client, challenge)
+
+def commit_recipe_locked(cursor, client, challenge):
+    manifest = client.get_manifest()
+    stored = {digest: (size, crc) for digest, size, crc in
+              select_digests(cursor, '''SELECT Digest, Size, CRC FROM ChunksTable WHERE Digest IN ({})''', {digest for digest, _ in manifest})}
+    missing = [i for i, (digest, _) in enumerate(manifest) if digest not in stored]
+    known = [i for i, (digest, _) in enumerate(manifest) if digest in stored and digest not in client.get_stored_chunks()]
+    if challenge and known:
+        missing += random.sample(known, min(challenge, len(known)))
+    if missing:
+        return None, sorted(missing)
+    crc = total_size = 0
+    for digest, size in manifest:
+        if stored[digest][0] != size:
+            raise Exception(f"Chunk {digest.hex()} from client with id {client.get_client_id().hex()} has a wrong size")
+        crc = cksum.crc_combine(crc, stored[digest][1], size)
+        total_size += size
+    if total_size != client.get_orig_file_size():
+        raise Exception(f"Invalid original size from client with id {client.get_client_id().hex()}")
+    crc = cksum.crc_finalize(crc, total_size)
+    cursor.execute('''INSERT OR IGNORE INTO RecipesTable (Digest, Size, CRC, RefCount) VALUES (?, ?, ?, 0)''',
+                   (client.get_file_digest(), total_size, crc))
+    if cursor.rowcount:  # A new recipe references its chunks (otherwise the same file was committed before)
+        cursor.executemany('''INSERT INTO RecipeChunksTable (Recipe, "Chunk Index", Chunk) VALUES (?, ?, ?)''',
+                           ((client.get_file_digest(), i, digest) for i, (digest, _) in enumerate(manifest)))
+        cursor.executemany('''UPDATE ChunksTable SET RefCount = RefCount + 1 WHERE Digest = ?''', ((digest,) for digest, _ in manifest))
+    else:  # Linking an existing recipe takes the chunks it's made of, not just its digest
+        cursor.execute('''SELECT Chunk FROM RecipeChunksTable WHERE Recipe = ? ORDER BY "Chunk Index"''', (client.get_file_digest(),))
+        if [row[0] for row in cursor.fetchall()] != [digest for digest, _ in manifest]:
+            raise Exception(f"Manifest of file {client.get_file_name()} from client with id {client.get_client_id().hex()} does not match its recipe")
+    link_recipe(cursor, client, client.get_file_digest())
+    return crc, []
+
+# Unlinks a deduplicated file of client from its recipe, dropping the recipe once no file points to it.
+# Returns None if the file isn't deduplicated, otherwise the digests of the chunks nothing references anymore
+def unlink_recipe(files_db_conn, client):
+    with write_transaction(files_db_conn) as cursor:
+        return unlink_recipe_locked(cursor, client)
+
+def unlink_recipe_locked(cursor, client):
+    cursor.execute('''SELECT Recipe FROM FileRecipesTable WHERE ID = ? AND "File Name" = ?''', (client.get_client_id(), client.get_file_name()))
+    result = cursor.fetchone()
+    if not result:
+        return None
+    recipe, orphan_chunks = result[0], []
+    cursor.execute('''DELETE FROM FileRecipesTable WHERE ID = ? AND "File Name" = ?''', (client.get_client_id(), client.get_file_name()))
+    cursor.execute('''UPDATE RecipesTable SET RefCount = RefCount - 1 WHERE Digest = ?''', (recipe,))
+    cursor.execute('''SELECT RefCount FROM RecipesTable WHERE Digest = ?''', (recipe,))
+    if cursor.fetchone()[0] == 0:
+        cursor.execute('''SELECT Chunk FROM RecipeChunksTable WHERE Recipe = ?''', (recipe,))
+        chunks = [row[0] for row in cursor.fetchall()]
+        cursor.executemany('''UPDATE ChunksTable SET RefCount = RefCount - 1 WHERE Digest = ?''', ((digest,) for digest in chunks))
+        cursor.execute('''DELETE FROM RecipeChunksTable WHERE Recipe = ?''', (recipe,))
+        cursor.execute('''DELETE FROM RecipesTable WHERE Digest = ?''', (recipe,))
+        orphan_chunks = [row[0] for row in select_digests(cursor, '''SELECT Digest FROM ChunksTable WHERE RefCount = 0 AND Digest IN ({})''', set(chunks))]
+        cursor.executemany('''DELETE FROM ChunksTable WHERE Digest = ?''', ((digest,) for digest in orphan_chunks))
+    return orphan_chunks
+
+# Points a file of client at the plain file at its path instead of its recipe, if it had one, in one transaction,
+# so the file is never left without either. Returns what unlink_recipe does
+def replace_with_plain_file(files_db_conn, client):
+    with write_transaction(files_db_conn) as cursor:
+        orphan_chunks = unlink_recipe_locked(cursor, client)
+        update_file_path(cursor, client)
+        return orphan_chunks
+
+# Path of a plain (not deduplicated) file of client, fanned out by the SHA-256 of its client id and name over two levels of 256 directories,
+# so no directory grows past a few dozen files even at millions of files, however many a single client stores
+def client_file_path(client):
+    return hashed_file_path(client.get_client_id(), client.get_file_name())
+
+def hashed_file_path(client_id, file_name):
+    digest = hashlib.sha256(client_id + file_name.encode('utf-8')).hexdigest()  # IDs are 16 bytes, so no two (id, name) pairs hash the same input
+    return os.path.join('client_files', digest[:2], digest[2:4], digest)
+
+# Moves a plain file of client from where FilesTable says it is (client_files/<name>_files/<file name> before the fan-out) to its hashed path.
+# Safe to repeat: a move that was done but not recorded in DB is recorded the next time (requires locking the file)
+def move_stored_file(client_id, file_name, old_path):
+    new_path = hashed_file_path(client_id, file_name)
+    if os.path.exists(old_path):
+        os.makedirs(os.path.dirname(new_path), exist_ok=True)
+        os.replace(old_path, new_path)
+        try:
+            os.rmdir(os.path.dirname(old_path))  # The client's old directory goes with its last file
+        except OSError:
+            pass
+    files_writer.execute('''UPDATE FilesTable SET "Path Name" = ? WHERE ID = ? AND "File Name" = ? AND "Path Name" = ?''',
+                         (new_path, client_id, file_name, old_path))
+    return new_path
+
+# Moves every plain file that isn't at its hashed path yet, in the background while clients are served. FilesTable is the index of
+# what is stored where, so it is walked (in rowid order, a batch at a time) instead of listing the directories.
+# Every file is checked again under its lock, as clients may open or remove it meanwhile, and other worker processes may be migrating too
+def migrate_client_files(file_locks):
+    files_db_conn = files_db()
+    cursor = files_db_conn.cursor()
+    last_rowid = moved = 0
+    while True:
+        cursor.execute('''SELECT rowid, ID, "File Name", "Path Name" FROM FilesTable WHERE rowid > ? AND "Path Name" IS NOT NULL
+                          ORDER BY rowid LIMIT ?''', (last_rowid, Other.MIGRATION_BATCH_SIZE))
+        rows = cursor.fetchall()
+        if not rows:
+            break
+        last_rowid = rows[-1][0]
+        for _, client_id, file_name, path_name in rows:
+            file_name, path_name = file_name.decode('utf-8'), path_name.decode('utf-8')
+            if path_name == hashed_file_path(client_id, file_name):
+                continue
+            with file_locks(hashed_file_path(client_id, file_name)):
+                cursor.execute('''SELECT "Path Name" FROM FilesTable WHERE ID = ? AND "File Name" = ?''', (client_id, file_name))
+                result = cursor.fetchone()
+                if result and result[0] == path_name.encode('utf-8'):
+                    move_stored_file(client_id, file_name, path_name)
+                    moved += 1
+    files_db_conn.close()
+    if moved:
+        print(f"Moved {moved} stored files to the hashed layout")
+
+# Opens the verified stored copy of a file of client for reading, assembling it from the chunk store if it was deduplicated.
+# Returns None if the client has no verified file by that name (requires locking the file)
+def open_stored_file(files_cursor, client):
+    files_cursor.execute('''SELECT "Path Name" FROM FilesTable WHERE ID = ? AND "File Name" = ? AND Verified = 1''', (client.get_client_id(), client.get_file_name()))
+    result = files_cursor.fetchone()
+    if not result:
+        return None
+    if result[0] is not None:
+        path = result[0].decode('utf-8')
+        if path != client_file_path(client):  # Not migrated yet, moved now so an update replaces it in place
+            path = move_stored_file(client.get_client_id(), client.get_file_name(), path)
+        return open(path, 'rb')
+    files_cursor.execute('''SELECT Chunk FROM RecipeChunksTable JOIN FileRecipesTable ON RecipeChunksTable.Recipe = FileRecipesTable.Recipe
+                            WHERE ID = ? AND "File Name" = ? ORDER BY "Chunk Index"''', (client.get_client_id(), client.get_file_name()))
+    source = tempfile.TemporaryFile()
+    for (digest,) in files_cursor.fetchall():
+        with open(chunk_path(digest), 'rb') as chunk:
+            shutil.copyfileobj(chunk, source)
+    return source
+
+# Block size and (rolling Adler-32, truncated SHA-256) signatures of every whole block of a file, rsync style.
+# Blocks grow with the square root of the file size, which balances the size of the signatures against the literal data sent around each change
+def block_signatures(source):
+    size = source.seek(0, os.SEEK_END)
+    block_size = min(max(math.isqrt(size), Other.DELTA_MIN_BLOCK_SIZE), Other.DELTA_MAX_BLOCK_SIZE)
+    source.seek(0)
+    signatures = []
+    while len(block := source.read(block_size)) == block_size:
+        signatures.append((zlib.adler32(block), hashlib.sha256(block).digest()[:Other.STRONG_SUM_SIZE]))
+    return block_size, signatures
+
+# Rebuilds the new version of a file from a delta: copy ops reference whole blocks of the stored copy, literal ops carry new data.
+# Returns the cksum and size of the new version
+def apply_delta(delta, source, target, block_size):
+    crc = size = pos = 0
+    while pos < len(delta):
+        if delta[pos] == Other.DELTA_COPY_OP:
+            first_block, block_count = struct.unpack_from('<II', delta, pos + 1)
+            pos += 9
+            source.seek(first_block * block_size)
+            for _ in range(block_count):
+                data = source.read(block_size)
+                if len(data) != block_size:
+                    raise Exception("Delta references a block beyond the stored file")
+                target.write(data)
+                crc = cksum.crc_update(crc, data)
+                size += block_size
+        elif delta[pos] == Other.DELTA_LITERAL_OP:
+            length = struct.unpack_from('<I', delta, pos + 1)[0]
+            data = delta[pos + 5:pos + 5 + length]
+            pos += 5 + length
+            if len(data) != length:
+                raise Exception("Delta ends in the middle of literal data")
+            target.write(data)
+            crc = cksum.crc_update(crc, data)
+            size += length
+        else:
+            raise Exception(f"Invalid delta op {delta[pos]}")
+    return cksum.crc_finalize(crc, size), size
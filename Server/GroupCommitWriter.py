@@ -0,0 +1,70 @@
+import queue
+import threading
+from concurrent.futures import Future
+from Metrics import metrics
+from Constants import Other
+
+
+class GroupCommitWriter: # The one thread writing a database's small metadata updates, committing all the updates queued meanwhile at once
+
+    """
+
+    Every statement used to be its own transaction, and so its own fsync. Here the writer takes whatever statements
+    piled up while it was committing the last batch and runs them in one transaction: under load many clients'
+    updates share one commit, and a lone update is committed as soon as it arrives (no waiting for a batch to fill).
+    Every statement runs in a savepoint, so a statement that fails (a duplicate file) fails alone, not its whole batch.
+    The thread starts on the first statement, so processes that never write (the supervisor) don't open the database.
+
+    """
+
+    def __init__(self, connect):
+        self.__connect = connect
+        self.__queue = queue.Queue()
+        self.__thread = None
+        self.__start_lock = threading.Lock()
+
+    # Runs a statement in the next batch. Waits for its commit and returns its row count, or raises its error, unless wait is False
+    def execute(self, sql, params=(), wait=True):
+        with self.__start_lock:
+            if not self.__thread:
+                self.__thread = threading.Thread(target=self.__run, daemon=True)
+                self.__thread.start()
+        done = Future()
+        self.__queue.put((sql, params, done))
+        if wait:
+            return done.result()
+
+    def __run(self):
+        db_conn = self.__connect()
+        db_conn.isolation_level = None  # Transactions and savepoints are managed here
+        while True:
+            batch = [self.__queue.get()]
+            while len(batch) < Other.GROUP_COMMIT_MAX_STATEMENTS and not self.__queue.empty():
+                batch.append(self.__queue.get_nowait())
+            metrics.observe('server_group_commit_statements', len(batch))
+            try:
+                with metrics.timed('server_lock_wait_seconds', lock='db'):
+                    db_conn.execute('BEGIN IMMEDIATE')
+                results = [self.__execute(db_conn, sql, params) for sql, params, _ in batch]
+                db_conn.execute('COMMIT')
+            except Exception as e:  # Nothing of the batch was committed (the write lock timed out, the disk is full...)
+                if db_conn.in_transaction:
+                    db_conn.execute('ROLLBACK')
+                results = [(None, e)] * len(batch)
+            for (_, _, done), (rowcount, error) in zip(batch, results):
+                if error:
+                    done.set_exception(error)
+                else:
+                    done.set_result(rowcount)
+
+    @staticmethod
+    def __execute(db_conn, sql, params):
+        db_conn.execute('SAVEPOINT statement')
+        try:
+            rowcount = db_conn.execute(sql, params).rowcount
+        except Exception as e:
+            db_conn.execute('ROLLBACK TO statement')
+            return None, e
+        finally:
+            db_conn.execute('RELEASE statement')
+        return rowcount, None
@@ -0,0 +1,141 @@
+import bisect
+import logging
+import sys
+import threading
+import time
+from contextlib import contextmanager
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
+
+LATENCY_BUCKETS = (0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10)  # Seconds
+THROUGHPUT_BUCKETS = tuple(2 ** i * 1024 for i in range(0, 21, 2))  # Bytes per second, 1KB/s to 1GB/s
+BATCH_BUCKETS = (1, 2, 4, 8, 16, 32, 64, 128, 256)
+
+# Every metric the server records: its type, help line and histogram buckets
+METRICS = {
+    'server_connections': ('gauge', 'Open client connections', None),
+    'server_requests_total': ('counter', 'Requests handled, by request code', None),
+    'server_request_failures_total': ('counter', 'Requests answered with a failure response or a closed connection, by request code', None),
+    'server_received_bytes_total': ('counter', 'Bytes of requests received, headers included', None),
+    'server_request_seconds': ('histogram', 'Time handling a request, by request code', LATENCY_BUCKETS),
+    'server_phase_seconds': ('histogram', 'Time spent in a phase of handling requests (decrypt, crc, rsa, delta, file_io)', LATENCY_BUCKETS),
+    'server_lock_wait_seconds': ('histogram', 'Time waiting to take a lock (file and chunk stripes, the SQLite write lock)', LATENCY_BUCKETS),
+    'server_rejected_connections_total': ('counter', 'Connections turned away with a busy response because the pool\'s queue was full', None),
+    'server_executor_queue_depth': ('gauge', 'Requests waiting for a thread of the pool', None),
+    'server_executor_wait_seconds': ('histogram', 'Time a request waited for a thread of the pool', LATENCY_BUCKETS),
+    'server_group_commit_statements': ('histogram', 'Statements committed together by a group commit writer', BATCH_BUCKETS),
+    'server_session_throughput_bytes_per_second': ('histogram', 'Bytes received per second over a connection that sent a file', THROUGHPUT_BUCKETS),
+}
+
+
+class Histogram:  # Cumulative buckets in the Prometheus layout: a value counts in every bucket whose upper bound is at least the value
+    def __init__(self, buckets):
+        self.buckets = buckets
+        self.counts = [0] * (len(buckets) + 1)  # The last one is +Inf
+        self.sum = 0.0
+
+    def observe(self, value):
+        self.counts[bisect.bisect_left(self.buckets, value)] += 1
+        self.sum += value
+
+
+class Metrics:  # Counters, gauges and histograms of one server process, rendered in the Prometheus text format
+
+    """
+
+    Every series is keyed by its metric name and labels. Recording takes one lock, held for a dict lookup and an addition,
+    so worker threads recording per packet don't contend for long. Label values are request codes, phases and lock names,
+    never client ids or file names, so the number of series stays small however many clients connect.
+    A server running as several worker processes has a Metrics per worker, each served on its own port.
+
+    """
+
+    def __init__(self):
+        self.__lock = threading.Lock()
+        self.__values = {}  # (name, labels) -> value, for counters and gauges
+        self.__histograms = {}  # (name, labels) -> Histogram
+
+    def count(self, name, value=1, **labels):
+        key = (name, tuple(sorted(labels.items())))
+        with self.__lock:
+            self.__values[key] = self.__values.get(key, 0) + value
+
+    def gauge(self, name, delta, **labels):  # Gauges move both ways, by delta
+        self.count(name, delta, **labels)
+
+    def observe(self, name, value, **labels):
+        key = (name, tuple(sorted(labels.items())))
+        with self.__lock:
+            histogram = self.__histograms.get(key)
+            if histogram is None:
+                histogram = self.__histograms[key] = Histogram(METRICS[name][2])
+            histogram.observe(value)
+
+    @contextmanager
+    def timed(self, name, **labels):
+        start = time.perf_counter()
+        try:
+            yield
+        finally:
+            self.observe(name, time.perf_counter() - start, **labels)
+
+    def render(self):
+        with self.__lock:
+            values = dict(self.__values)
+            histograms = {key: (list(h.counts), h.sum) for key, h in self.__histograms.items()}
+        lines = []
+        for name, (kind, help_text, buckets) in METRICS.items():
+            series = [(labels, value) for (series_name, labels), value in (histograms if kind == 'histogram' else values).items() if series_name == name]
+            if not series:
+                continue
+            lines.append(f'# HELP {name} {help_text}')
+            lines.append(f'# TYPE {name} {kind}')
+            for labels, value in sorted(series):
+                if kind != 'histogram':
+                    lines.append(f'{name}{format_labels(labels)} {value}')
+                    continue
+                counts, total = value
+                cumulative = 0
+                for bound, count in zip(buckets + (float('inf'),), counts):
+                    cumulative += count
+                    le = '+Inf' if bound == float('inf') else repr(float(bound))
+                    lines.append(f'{name}_bucket{format_labels(labels + (("le", le),))} {cumulative}')
+                lines.append(f'{name}_sum{format_labels(labels)} {total}')
+                lines.append(f'{name}_count{format_labels(labels)} {cumulative}')
+        return '\n'.join(lines) + '\n'
+
+
+def format_labels(labels):
+    if not labels:
+        return ''
+    return '{' + ','.join(f'{key}="{value}"' for key, value in labels) + '}'
+
+
+metrics = Metrics()  # The metrics of this process
+
+
+class MetricsHandler(BaseHTTPRequestHandler):
+    def do_GET(self):
+        if self.path.split('?')[0] != '/metrics':
+            self.send_error(404)
+            return
+        body = metrics.render().encode('utf-8')
+        self.send_response(200)
+        self.send_header('Content-Type', 'text/plain; version=0.0.4')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):  # Scrapes are not worth a line in the server's log
+        pass
+
+
+# Serves the metrics at http://<host>:port/metrics, on a thread of its own
+def serve_metrics(port):
+    http_server = ThreadingHTTPServer(('', port), MetricsHandler)
+    threading.Thread(target=http_server.serve_forever, daemon=True).start()
+    print(f"Metrics on port {port} (/metrics)")
+
+
+# The server's log: lines of every request stay prints, per packet lines go through logging so they can be sampled and leveled
+def configure_logging(level):
+    logging.basicConfig(stream=sys.stdout, level=level, format='%(message)s')
@@ -13,3 +13,7 @@ class DuplicateFileError(Exception):
 class InexistentFileError(Exception):
     def __init__(self, message):
         super().__init__(message)
+
+class InvalidRequestError(Exception):
+    def __init__(self, message):
+        super().__init__(message)
@@ -0,0 +1,74 @@
+import cksum
+from FileAndDBHelper import aes_decrypt
+from Constants import Other
+
+AES_BLOCK_SIZE = 16
+
+
+class PacketDecryptor: # Decrypts and cksums the packets of an AES-CBC encrypted file as they arrive, in any order
+
+    """
+
+    Packets start on AES block boundaries (PACKET_SIZE is a multiple of 16), so in CBC every packet can be decrypted on its own,
+    with the last cipher block of the packet before it as iv. When that packet hasn't arrived yet (it was corrupted and will be resent),
+    only the first block of the packet has to wait: it is decrypted with a zero iv and fixed up by XOR once the iv is known.
+    Every packet's plaintext is written in place and cksummed by itself, and the cksums are combined in file order at the end,
+    so the file is never re-read.
+
+    """
+
+    def __init__(self, aes, content_size, total_packets, write_at):
+        if content_size % AES_BLOCK_SIZE or content_size == 0 or total_packets != (content_size + Other.PACKET_SIZE - 1) // Other.PACKET_SIZE:
+            raise Exception("Invalid content size for an AES encrypted file")
+        self.__aes, self.__content_size, self.__total_packets, self.__write_at = aes, content_size, total_packets, write_at
+        self.__tails = {} # Last cipher block of every received packet, the iv of the packet after it
+        self.__heads = {} # First block of packets decrypted with a zero iv, waiting for the packet before them
+        self.__rests = {} # (raw cksum, length) of the plaintext after the first block of every received packet
+        self.__crcs = {} # (raw cksum, length) of the plaintext of every packet that is final
+
+    def add(self, packet_num, encrypted):
+        if len(encrypted) != self.__packet_size(packet_num):
+            raise Exception(f"Packet {packet_num} has {len(encrypted)} bytes instead of {self.__packet_size(packet_num)}")
+        iv = bytes(Other.IV_SIZE) if packet_num == 1 else self.__tails.get(packet_num - 1)
+        plain = aes_decrypt(self.__aes, encrypted, iv or bytes(Other.IV_SIZE), False)
+        self.__tails[packet_num] = bytes(encrypted[-AES_BLOCK_SIZE:])  # Copied, encrypted may be a view of a receive buffer that is reused
+        rest = plain[AES_BLOCK_SIZE:]
+        if packet_num == self.__total_packets and rest:  # The padding lies in the last block, which is part of the rest
+            rest = self.__unpad(rest)
+        self.__write_at((packet_num - 1) * Other.PACKET_SIZE + AES_BLOCK_SIZE, rest)
+        self.__rests[packet_num] = (cksum.crc_update(0, rest), len(rest))
+        if iv:
+            self.__resolve(packet_num, plain[:AES_BLOCK_SIZE])
+        else:
+            self.__heads[packet_num] = plain[:AES_BLOCK_SIZE]
+        if packet_num + 1 in self.__heads:  # The next packet was waiting for this one's last cipher block
+            head = self.__heads.pop(packet_num + 1)
+            self.__resolve(packet_num + 1, bytes(a ^ b for a, b in zip(head, encrypted[-AES_BLOCK_SIZE:])))
+
+    # Cksum and size of the whole plaintext, once every packet is final
+    def finish(self):
+        if len(self.__crcs) != self.__total_packets:
+            raise Exception(f"Only {len(self.__crcs)} of {self.__total_packets} packets were decrypted")
+        crc = size = 0
+        for packet_num in range(1, self.__total_packets + 1):
+            packet_crc, packet_size = self.__crcs[packet_num]
+            crc = cksum.crc_combine(crc, packet_crc, packet_size)
+            size += packet_size
+        return cksum.crc_finalize(crc, size), size
+
+    def __resolve(self, packet_num, head):
+        rest_crc, rest_size = self.__rests[packet_num]
+        if packet_num == self.__total_packets and self.__packet_size(packet_num) == AES_BLOCK_SIZE:  # A last packet of a single block holds the padding in its head
+            head = self.__unpad(head)
+        self.__write_at((packet_num - 1) * Other.PACKET_SIZE, head)
+        self.__crcs[packet_num] = (cksum.crc_combine(cksum.crc_update(0, head), rest_crc, rest_size), len(head) + rest_size)
+
+    def __packet_size(self, packet_num):
+        return min(Other.PACKET_SIZE, self.__content_size - (packet_num - 1) * Other.PACKET_SIZE)
+
+    @staticmethod
+    def __unpad(last):
+        padding = last[-1]
+        if not 1 <= padding <= AES_BLOCK_SIZE or last[-padding:] != bytes([padding]) * padding:
+            raise Exception("Padding is incorrect.")
+        return last[:-padding]
@@ -1,24 +1,84 @@
 import struct
-from Constants import Other
+from Constants import Other, RequestCodes
+from MyExceptions import InvalidRequestError
 
-class Request: # Retrieves request from client
+class Request: # Parses a request the server read from client
 
-    def __init__(self,client,conn):
-        self.conn=conn
+    def __init__(self,client,header,payload):
+        self.header=header
+        self.payload=payload
         self.client=client
 
     def unpack_header(self):
-        header = self.conn.recv(Other.REQUEST_HEADER_SIZE)
-        if not header:
-            raise ConnectionAbortedError # Connection with client has been disconnected
-        client_id, version, code, payload_size = struct.unpack(f'<{Other.UUID_SIZE}sBHI', header) # < is for little endian following the protocol
-        self.payload_size = payload_size
+        client_id, version, code, payload_size = struct.unpack(f'<{Other.UUID_SIZE}sBHI', self.header) # < is for little endian following the protocol
         if version != Other.VERSION:
             raise Exception(f"Version of all clients must be {Other.VERSION}")
         self.client.set_client_id(client_id)
+        self.code = code
         return client_id,code
         
 
-    def unpack_payload(self):
-        return self.conn.recv(self.payload_size)
-    
\ No newline at end of file
+    def unpack_payload(self): # Payloads of file data stay views of the receive buffer, the short ones are copied so handlers can treat them as bytes
+        if self.code in (RequestCodes.SENDING_FILE, RequestCodes.DELTA_FILE, RequestCodes.CHUNK_MANIFEST, RequestCodes.CHUNK_DATA):
+            return self.payload
+        return bytes(self.payload)
+
+class FrameReader: # Splits the byte stream of a connection into requests, received into one preallocated buffer
+
+    """
+
+    Every recv_into fills the free end of the buffer with whatever the socket has, which may be part of a request
+    or several of them, and requests are cut out of it as (header, payload) memoryviews without copying.
+    A view is valid until the next request is asked for: only then is the buffer reused. The buffer holds two
+    requests of the largest size the protocol allows, so a request in progress only ever has to be moved to the front.
+
+    """
+
+    def __init__(self):
+        self.__buffer = bytearray(Other.FRAME_BUFFER_SIZE)
+        self.__view = memoryview(self.__buffer)
+        self.__start = self.__end = 0 # The received bytes not handed out yet
+
+    # The next whole request, or None until more of it is received
+    def next_request(self):
+        if self.__start == self.__end:
+            self.__start = self.__end = 0
+        needed = self.__needed()
+        if self.__end - self.__start < needed:
+            return None
+        header = self.__view[self.__start:self.__start + Other.REQUEST_HEADER_SIZE]
+        payload = self.__view[self.__start + Other.REQUEST_HEADER_SIZE:self.__start + needed]
+        self.__start += needed
+        return header, payload
+
+    # Where the socket should receive into, once next_request returned None
+    def free_space(self):
+        if self.__start + self.__needed() > len(self.__buffer):  # The rest of the request doesn't fit behind it
+            pending = self.__end - self.__start
+            self.__view[:pending] = self.__view[self.__start:self.__end]
+            self.__start, self.__end = 0, pending
+        return self.__view[self.__end:]
+
+    def received(self, size):
+        self.__end += size
+
+    def has_partial_request(self):
+        return self.__end > self.__start
+
+    # Bytes of the request at the start of the buffer: the header, and once it's received the payload as well
+    def __needed(self):
+        if self.__end - self.__start < Other.REQUEST_HEADER_SIZE:
+            return Other.REQUEST_HEADER_SIZE
+        payload_size = struct.unpack_from('<I', self.__buffer, self.__start + Other.REQUEST_HEADER_SIZE - 4)[0]
+        if payload_size > Other.MAX_PAYLOAD_SIZE:  # Nothing after it could be parsed, the connection can't be used anymore
+            raise InvalidRequestError(f"Request payload of {payload_size} bytes is larger than {Other.MAX_PAYLOAD_SIZE}")
+        return Other.REQUEST_HEADER_SIZE + payload_size
+
+# Reads the next request from a blocking socket, as (header, payload)
+def recv_request(reader, conn):
+    while (request := reader.next_request()) is None:
+        size = conn.recv_into(reader.free_space())
+        if not size:
+            raise ConnectionAbortedError # Connection with client has been disconnected
+        reader.received(size)
+    return request
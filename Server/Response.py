@@ -13,6 +13,18 @@ class Response(ABC): # Creates response for client
         except: # Exception will be printed in the try-except block of handle_client function
             pass
 
+# Stands in for the socket where a server writes the responses out itself (the event loop server sends them once the request is handled)
+class ResponseBuffer:
+    def __init__(self):
+        self.buffer = bytearray()
+
+    def sendall(self, data):
+        self.buffer += data
+
+    def take(self):
+        data, self.buffer = bytes(self.buffer), bytearray()
+        return data
+
 class SuccessfulRegistrationResponse(Response):
     def __init__(self, client_id:bytes):
         self.pack_header(ResponseCodes.REGISTRATION_SUCCEEDED,Other.UUID_SIZE)
@@ -55,6 +67,37 @@ class ReceivedMessageResponse(Response):
     def pack_payload(self, client_id:bytes):
         self.payload = struct.pack(f'{Other.UUID_SIZE}s',client_id)
 
+# Lists the packets whose cksum didn't match, so the client resends only them
+class PacketsNackResponse(Response):
+    def __init__(self, client_id:bytes, packet_numbers:list):
+        self.pack_header(ResponseCodes.PACKETS_NACK,Other.UUID_SIZE+2+2*len(packet_numbers))
+        self.pack_payload(client_id,packet_numbers)
+
+    def pack_payload(self, client_id:bytes, packet_numbers:list):
+        self.payload = struct.pack(f'<{Other.UUID_SIZE}sH{len(packet_numbers)}H', client_id, len(packet_numbers), *packet_numbers)
+
+# Bitmap over the chunks of a manifest, with a set bit for every chunk the chunk store doesn't have
+class ChunksMissingResponse(Response):
+    def __init__(self, client_id:bytes, chunk_count:int, missing_chunks:list):
+        self.pack_header(ResponseCodes.CHUNKS_MISSING,Other.UUID_SIZE+4+(chunk_count+7)//8)
+        self.pack_payload(client_id,chunk_count,missing_chunks)
+
+    def pack_payload(self, client_id:bytes, chunk_count:int, missing_chunks:list):
+        bitmap = bytearray((chunk_count+7)//8)
+        for chunk_index in missing_chunks:
+            bitmap[chunk_index//8] |= 1 << (chunk_index%8)
+        self.payload = struct.pack(f'<{Other.UUID_SIZE}sI', client_id, chunk_count) + bytes(bitmap)
+
+# Block signatures (rolling Adler-32 and truncated SHA-256) of the stored copy of a file. A block size of 0 tells the client there is no stored copy
+class SignaturesResponse(Response):
+    def __init__(self, client_id:bytes, block_size:int, signatures:list):
+        self.pack_header(ResponseCodes.SIGNATURES,Other.UUID_SIZE+4+4+(4+Other.STRONG_SUM_SIZE)*len(signatures))
+        self.pack_payload(client_id,block_size,signatures)
+
+    def pack_payload(self, client_id:bytes, block_size:int, signatures:list):
+        self.payload = struct.pack(f'<{Other.UUID_SIZE}sII', client_id, block_size, len(signatures)) + \
+            b''.join(struct.pack(f'<I{Other.STRONG_SUM_SIZE}s', weak, strong) for weak, strong in signatures)
+
 class FailedReconnectionResponse(Response):
     def __init__(self, client_id:bytes):
         self.pack_header(ResponseCodes.RECONNECTION_FAILED,Other.UUID_SIZE)
@@ -70,3 +113,12 @@ class GeneralFailureResponse(Response):
 
     def pack_payload(self):
         self.payload = struct.pack('0s',b"")
+
+# Sent instead of handling the first request of a connection while the server is overloaded. The client reconnects after retry_after milliseconds (plus jitter)
+class BusyResponse(Response):
+    def __init__(self, retry_after:int):
+        self.pack_header(ResponseCodes.SERVER_BUSY,Other.RETRY_AFTER_SIZE)
+        self.pack_payload(retry_after)
+
+    def pack_payload(self, retry_after:int):
+        self.payload = struct.pack('<I', retry_after)
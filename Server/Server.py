@@ -1,181 +1,163 @@
 import socket
-import struct
-import uuid
 import os
-import cksum
-import time
+import queue
+import selectors
 import threading
+import time
+import cksum
 from concurrent.futures import ThreadPoolExecutor
-from Crypto.Cipher import AES
-from Crypto.Util import Padding
-from Client import *
+from Session import *
+from StripedLock import *
+from Metrics import metrics, serve_metrics
+from Capture import Capture
 from Request import *
 from FileAndDBHelper import *
 from Constants import *
 
 
-class Server:  # Represents a server hosting multiple clients by generating a thread for each of them
+class ConnectionDrainer:  # Closes the connections the server turned away, on a thread of its own, once their clients stopped sending
 
-    def __init__(self):
-        self.file_lock, self.db_lock = threading.Lock(), threading.Lock()
+    """
 
-    def handle_client(self, conn, addr):
-        print(f'Connected by {addr}')
-        client = Client()
-        clients_db_conn = clients_db()  # Each thread should open its own database connection
-        files_db_conn = files_db()
-        start_time, packet_counter = time.time(), 0  # For tracking file sending time
+    Closing a socket with unread data resets the connection, and the client would lose the busy response before reading it.
+    So a turned away connection is answered right away and shut down for writing, then handed over here: one thread reads
+    and drops whatever its client sends until the client closes it or BUSY_READ_TIMEOUT passes, for every such connection at once.
+    The accepting thread never waits for a client it has no room for.
+
+    """
+
+    def __init__(self):
+        self.selector = selectors.DefaultSelector()
+        self.added = queue.SimpleQueue()
+        self.wakeup, self.wakeup_sender = socket.socketpair()  # Wakes the thread up for a connection added while it waits
+        self.wakeup.setblocking(False)
+        self.selector.register(self.wakeup, selectors.EVENT_READ)
+        threading.Thread(target=self.run, daemon=True).start()
+
+    def add(self, conn):
+        self.added.put((conn, time.monotonic() + Other.BUSY_READ_TIMEOUT))
+        try:
+            self.wakeup_sender.send(b'\0')
+        except BlockingIOError:  # The thread has wake ups pending already
+            pass
 
+    def run(self):
+        deadlines = {}
         while True:
-            try:
-                request = Request(client, conn)
-                client_id, code = request.unpack_header()
-                payload = request.unpack_payload()
-                match code:
-                    case RequestCodes.REGISTRATION:
-                        # Client registration (requires locking database)
-                        client.set_name(payload.rstrip(b'\0').decode('utf-8'))
-                        with self.db_lock:
-                            validate_client(clients_db_conn.cursor(), client.get_name())  # Make sure client didn't already register       
-                            client.set_client_id(uuid.uuid4().bytes)
-                            SuccessfulRegistrationResponse(client.get_client_id()).send(conn)
-                            insert_client(clients_db_conn, client)
-                        print(f"Client with id {client.get_client_id().hex()} has signed up")
-
-                    case RequestCodes.PUBLIC_KEY:
-                        # Public key exchange (requires locking database)
-                        client.set_name(payload[:Other.NAME_SIZE].rstrip(b'\0').decode('utf-8'))
-                        with self.db_lock:
-                            validate_name_and_id(clients_db_conn.cursor(), client.get_client_id(),
-                                                 client.get_name())  # Make sure client is registered in DB and that the name client provided is fitting the name in DB
-                            public_key = payload[Other.NAME_SIZE:]  # Make sure client is registered in DB and that the name client provided is fitting the name in DB         
-                            send_and_update_aes(clients_db_conn, client.get_client_id(),
-                                                ResponseCodes.RECEIVED_PUBKEY_SENDING_AES, conn, public_key)
-                            # Generate AES symmetric key, sends it to client and stores in DB
-                            print(f"Client with id {client.get_client_id().hex()} has sent public key: {public_key.hex()}")
-                                
-                    case RequestCodes.RECONNECTION:
-                        # AES key resend (requires locking database)
-                        client.set_name(payload.rstrip(b'\0').decode('utf-8'))
-                        with self.db_lock:
-                            validate_name_and_id(clients_db_conn.cursor(), client.get_client_id(),
-                                                 client.get_name())  # Make sure client is registered in DB and that the name client provided is fitting the name in DB
-                            send_and_update_aes(clients_db_conn, client.get_client_id(),
-                                                ResponseCodes.RECONNECTION_SUCCEEDED_SENDING_AES, conn)
-                            # Generate AES symmetric key, sends it to client and stores in DB
-                        print(f"Client with id {client.get_client_id().hex()} has logged in")
-
-                    case RequestCodes.SENDING_FILE:
-                        # File transfer (requires locking both file I/O and database)
-                        offset = Other.CONTENTSIZE_SIZE + Other.FILE_NAME_SIZE + Other.ORIG_FILE_SIZE + Other.PACKET_NUM_TOTAL_PACKETS_SIZE
-                        content_size, orig_file_size, total_packets, packet_num, file_name = struct.unpack(
-                            f'<IIHH{Other.FILE_NAME_SIZE}s', payload[:offset])
-
-                        # Locking database access
-                        with self.db_lock:
-                            if packet_num == 1:
-                                set_aes_name(clients_db_conn.cursor(), client)  # Retrieve AES and name to client from DB (name for file path, aes for decrypting file)
-                                client.set_file_name(os.path.basename(
-                                    file_name.rstrip(b'\0').decode('utf-8')))  # Basename removes characters such as ../ to prevent directory traversal attack
-                                if file_exists(files_db_conn.cursor(), client.get_client_id(), 
-                                               client.get_file_name()):  # Check that a client's file doesn't already exist in DB 
-                                                                         # (the protocol didn't mention but I chose to not allow overwriting existing files)  
-                                    raise DuplicateFileError(f'File {client.get_file_name()} for client with id {client.get_client_id().hex()} already exists') 
-                                client.set_file_path(os.path.join('client_files', client.get_name() + '_files', client.get_file_name()))
-                                insert_file(files_db_conn, client)  # Insert client's file to DB
-
-                        # Locking file access
-                        with self.file_lock:
-
-                            if packet_num == 1:
-                                os.makedirs(os.path.join('client_files', client.get_name() + '_files'),
-                                            exist_ok=True)  # Make directory for client's files
-                                client.open_file('wb')  # Open file to write to it and copy client's file
-
-                            offset = Other.CONTENTSIZE_SIZE + Other.FILE_NAME_SIZE + Other.ORIG_FILE_SIZE + Other.PACKET_NUM_TOTAL_PACKETS_SIZE
-                            encrypted_content = payload[offset:]
-                            packet_counter += 1
-                            if packet_counter != packet_num:
-                                raise Exception(f"Packets sent in wrong order from client with id {client.get_client_id().hex()}")
-                            client.write_to_file(encrypted_content)
-                            print(f"Received packet number {packet_num} for file {client.get_file_name()} from client with id {client.get_client_id().hex()}")
-                            ReceivedMessageResponse(client.get_client_id()).send(conn)  # To indicate there was no problem receiving the packet
-
-                            if packet_num == total_packets:  # After writing all encrypted packets, re-read the whole encryped file and decrypt it
-                                client.close_file()
-                                client.open_file('rb')
-                                encrypted_file = client.read_from_file()
-                                if len(encrypted_file) != content_size:
-                                    raise Exception(f"Invalid content size from client with id {client.get_client_id().hex()}")
-                                cipher = AES.new(client.get_aes(), AES.MODE_CBC, iv=bytes(Other.IV_SIZE))
-                                decrypted_file = Padding.unpad(cipher.decrypt(encrypted_file), AES.block_size)  # Decrypt all file                   
-                                if len(decrypted_file) != orig_file_size:
-                                    raise Exception(f"Invalid original size from client with id {client.get_client_id().hex()}")
-                                client.close_file()
-                                client.open_file('wb')
-                                client.write_to_file(decrypted_file)  # Re-writing the decrypted verison of file
-                                client.close_file()
-                                crc = cksum.memcrc(decrypted_file)  # Calculating cksum
-                                FileReceivedResponse(client.get_client_id(), content_size,
-                                                     client.get_file_name().encode('utf-8'), crc).send(conn)
-
-                    case RequestCodes.VALID_CRC:
-                        # File verification (requires locking database)
-                        client.set_file_name(payload.rstrip(b'\0').decode('utf-8'))
-                        if not file_exists(files_db_conn.cursor(), client.get_client_id(), client.get_file_name()):
-                            raise InexistentFileError(
-                                f'File {client.get_file_name()} does not exist in DB. Therefore there is no file to verify.')
-                        with self.db_lock:  # Verifying file after receiving valid crc
-                            verify_file(files_db_conn, client)
-                        ReceivedMessageResponse(client.get_client_id()).send(conn)
-                        end_time = time.time()
-                        print(f'Successfully received file {client.get_file_name()} from client {client.get_client_id().hex()} in {end_time - start_time} seconds')
-                        conn.close()
-                        clients_db_conn.close()
-                        files_db_conn.close()
-                        break  # Taking care of client finished because file received successfully
-
-                    case RequestCodes.INVALID_CRC_RESENDING | RequestCodes.INVALID_CRC_ABORT:
-                        client.set_file_name(payload.rstrip(b'\0').decode('utf-8'))
-                        if not file_exists(files_db_conn.cursor(), client.get_client_id(), client.get_file_name()):
-                            raise InexistentFileError(
-                                f'File {client.get_file_name()} does not exist in DB. Therefore there is no file to attempt sending again or abort.')
-                        with self.db_lock:  # Removing file from DB in order to be able re-adding it during the next attempt, or removing it to abort after 4 attempts
-                            remove_file(files_db_conn,
-                                        client)  # The protocol did not mention a response to send in the case of resending
-                        with self.file_lock:  # Removing file from file system as well
-                            os.remove(os.path.join('client_files', client.get_name() + '_files', os.path.basename(
-                                client.get_file_name())))  # Basename removes characters such as ../ to prevent directory traversal attack
-                        if code == RequestCodes.INVALID_CRC_ABORT:
-                            ReceivedMessageResponse(client.get_client_id()).send(
-                                conn)  # In this case of abort sending this response following the protocol
-                            print(f'Abort. Cannot receive file {file_name} from client {client_id.hex()}')
-                            conn.close()
-                            clients_db_conn.close()
-                            files_db_conn.close()
-                            break  # Taking care of client finished because file cannot be sent after 4 attempts
-                        
-            except UnregisteredClientError as e:
-                print(f"Client has to sign up exception: {e}")
-                FailedReconnectionResponse(client.get_client_id()).send(conn)
-            except DuplicateClientError as e:
-                print(f"Client already signed up exception: {e}")
-                FailedRegistrationResponse().send(conn)
-            except (DuplicateFileError,
-                    InexistentFileError) as e:  # By the protocol, there are no specific responses for these errors so general failure will be sent
-                print(f"Exception: {e}")
-                GeneralFailureResponse().send(conn)
-            except (OSError, # Will usually occur after 4 attempts that client sends request after getting error code 1607 from server (following the protocol)
-                    ConnectionAbortedError) as e:  
-                if e.errno == Other.CONNECTION_ABORTED_ERROR:
-                    print(f"Connection with client has been aborted: {e}")  # In this case there no connection therefore no response to client
-                conn.close()
-                clients_db_conn.close()
-                files_db_conn.close()
-                break
-            except Exception as e:
-                print(f"Exception: {e}")
-                GeneralFailureResponse().send(conn)
+            timeout = max(0, min(deadlines.values()) - time.monotonic()) if deadlines else None
+            for key, _ in self.selector.select(timeout):
+                if key.fileobj is self.wakeup:
+                    self.wakeup.recv(4096)
+                    continue
+                try:
+                    data = key.fileobj.recv(4096)
+                except OSError:
+                    data = b''
+                if not data:
+                    self.close(key.fileobj, deadlines)
+            while not self.added.empty():
+                conn, deadline = self.added.get()
+                self.selector.register(conn, selectors.EVENT_READ)
+                deadlines[conn] = deadline
+            now = time.monotonic()
+            for conn in [conn for conn, deadline in deadlines.items() if deadline <= now]:
+                self.close(conn, deadlines)
+
+    def close(self, conn, deadlines):
+        self.selector.unregister(conn)
+        del deadlines[conn]
+        conn.close()
+
+
+class Server:  # Represents a server hosting multiple clients by generating a thread for each of them
+
+    def __init__(self, shared_port=False, metrics_port=None, max_queued=Other.MAX_QUEUED, capture=None):
+        # SQLite transactions guard DB, these guard the file system: a file is locked by its path and a chunk by its digest,
+        # so clients only wait for each other when they touch the same file or chunk. A thread never holds two stripes at once.
+        # A server sharing its port with other worker processes (shared_port) locks the stripes across processes as well
+        self.shared_port = shared_port
+        self.file_locks = StripedLock('file', directory=os.path.join('locks', 'files') if shared_port else None)
+        self.chunk_locks = StripedLock('chunk', directory=os.path.join('locks', 'chunks') if shared_port else None)
+        if metrics_port:
+            serve_metrics(metrics_port)
+        self.capture = Capture(capture) if capture else None  # Records every session to the trace file capture, for Benchmarks/session_replay
+        # Admission control: work waiting for a thread of the pool (connections here, requests in the event loop server) is capped,
+        # new clients beyond the cap are told to come back later instead of waiting until their connections time out
+        self.max_queued, self.queued, self.queued_lock = max_queued, 0, threading.Lock()
+        self.drainer = None  # Started by run, only the threaded server turns connections away on the accepting thread
+        # Files stored before the hashed layout move to it while clients are already being served
+        threading.Thread(target=migrate_client_files, args=(self.file_locks,), daemon=True).start()
+
+    def handle_client(self, conn, addr, queued_at):
+        self.dequeued(queued_at)
+        print(f'Connected by {addr}')
+        metrics.gauge('server_connections', 1)
+        session = Session(self, conn)
+        reader = FrameReader()
+        try:
+            while session.handle(*recv_request(reader, conn)):
+                pass
+        except InvalidRequestError as e:
+            print(f"Closing connection with {addr}: {e}")
+        except (OSError, # Will usually occur after 4 attempts that client sends request after getting error code 1607 from server (following the protocol)
+                ConnectionAbortedError) as e:
+            if e.errno == Other.CONNECTION_ABORTED_ERROR:
+                print(f"Connection with client has been aborted: {e}")  # In this case there no connection therefore no response to client
+        finally:
+            conn.close()
+            session.close()
+            metrics.gauge('server_connections', -1)
+
+    # Counts work submitted to the pool, returns the time it was queued at
+    def enqueued(self):
+        with self.queued_lock:
+            self.queued += 1
+        metrics.gauge('server_executor_queue_depth', 1)
+        return time.perf_counter()
+
+    # Records how long work submitted at queued_at waited for a thread of the pool, once a thread takes it
+    def dequeued(self, queued_at):
+        with self.queued_lock:
+            self.queued -= 1
+        metrics.gauge('server_executor_queue_depth', -1)
+        metrics.observe('server_executor_wait_seconds', time.perf_counter() - queued_at)
+
+    def overloaded(self):
+        return self.queued >= self.max_queued
+
+    # How long a client turned away should wait before connecting again, longer the further the queue is over its cap
+    def retry_after(self):
+        return Other.BUSY_RETRY_AFTER * (1 + self.queued // max(self.max_queued, 1))
+
+    # Answers a connection the server has no room for with a busy response, without waiting for its first request: the response
+    # fits in any socket's send buffer, and the client reads it once it sent its request. The drainer closes the connection later
+    def reject(self, conn, addr):
+        metrics.count('server_rejected_connections_total')
+        try:
+            conn.setblocking(False)
+            BusyResponse(self.retry_after()).send(conn)
+            conn.shutdown(socket.SHUT_WR)
+        except OSError:
+            conn.close()
+            return
+        self.drainer.add(conn)
+        print(f"Server busy, turned away {addr}")
+
+    # The socket accepting clients, shared with the other worker processes when shared_port is set
+    def listening_socket(self, port):
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)  # IPV4, TCP
+        try:
+            if self.shared_port:
+                s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)  # The kernel spreads incoming connections over the workers' sockets
+            s.bind(('', port))
+            s.listen(Other.LISTEN_BACKLOG)
+        except OSError:
+            s.close()
+            raise
+        return s
+
+    def print_implementations(self):
+        print(f"Using {'native' if cksum.NATIVE else 'pure Python'} cksum and {'native' if aes_cbc_decrypt else 'pycryptodome'} AES")
 
     """
 
@@ -193,15 +175,18 @@ class Server:  # Represents a server hosting multiple clients by generating a th
     
     def run(self):
         try:
-            host, port = '', get_port()
-            with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:  # IPV4, TCP
-                s.bind((host, port))
-                s.listen()
+            port = get_port()
+            with self.listening_socket(port) as s:
                 print(f"Server listening on port {port}")
+                self.print_implementations()
+                self.drainer = ConnectionDrainer()
                 with ThreadPoolExecutor(max_workers=Other.MAX_WORKERS) as executor:  # Use thread pool executor (max workers is the maximum amount of clients running simultaneously)
                     while True:
                         conn, addr = s.accept()
-                        executor.submit(self.handle_client, conn, addr)  # Submit client handling to the pool
+                        if self.overloaded():
+                            self.reject(conn, addr)
+                            continue
+                        executor.submit(self.handle_client, conn, addr, self.enqueued())  # Submit client handling to the pool
 
         except Exception as e:
             print(f"Exception: {e}")
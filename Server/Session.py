@@ -0,0 +1,444 @@
+import struct
+import uuid
+import os
+import cksum
+import time
+import hashlib
+import logging
+from Client import *
+from PacketDecryptor import *
+from Request import *
+from FileAndDBHelper import *
+from Metrics import metrics
+from Constants import *
+
+log = logging.getLogger('server')
+REQUEST_CODES = set(RequestCodes)
+
+
+class Session:  # The state of one client connection, fed one request at a time by whichever server owns the connection
+
+    """
+
+    A session never touches the socket for reading: the server reads every request and hands it over, and the session
+    answers through conn, anything with sendall (the socket itself, or a buffer the server writes out later).
+    This way the threaded server and the event loop server share the whole protocol, and a session can run
+    on any worker thread between two requests.
+
+    """
+
+    def __init__(self, server, conn):
+        self.conn = conn
+        self.client = Client()
+        self.file_locks, self.chunk_locks = server.file_locks, server.chunk_locks
+        self.start_time = time.time()  # For tracking file sending time
+        self.received_bytes = 0  # For tracking the connection's throughput
+        self.unverified_file = None  # Name of the file this session inserted to DB that the client hasn't verified yet
+        self.capture = server.capture
+        self.capture_session = self.capture.open_session() if self.capture else None
+
+    # Handles one request. Returns False once the connection should be closed
+    def handle(self, header, payload):
+        client, conn, start_time = self.client, self.conn, self.start_time
+        clients_db_conn, files_db_conn = thread_db()  # Connections of the worker thread running this request
+        handle_start, code, failed = time.perf_counter(), None, False
+        self.received_bytes += len(header) + len(payload)
+        if self.capture:
+            self.capture.request(self.capture_session, header, payload)
+        try:
+            request = Request(client, header, payload)
+            client_id, code = request.unpack_header()
+            payload = request.unpack_payload()
+            match code:
+                case RequestCodes.REGISTRATION:
+                    # Client registration (one transaction, so two clients can't register the same name)
+                    client.set_name(payload.rstrip(b'\0').decode('utf-8'))
+                    with write_transaction(clients_db_conn) as cursor:
+                        validate_client(cursor, client.get_name())  # Make sure client didn't already register       
+                        client.set_client_id(uuid.uuid4().bytes)
+                        insert_client(clients_db_conn, client)
+                    SuccessfulRegistrationResponse(client.get_client_id()).send(conn)
+                    print(f"Client with id {client.get_client_id().hex()} has signed up")
+
+                case RequestCodes.PUBLIC_KEY:
+                    # Public key exchange
+                    client.set_name(payload[:Other.NAME_SIZE].rstrip(b'\0').decode('utf-8'))
+                    validate_name_and_id(clients_db_conn.cursor(), client.get_client_id(),
+                                         client.get_name())  # Make sure client is registered in DB and that the name client provided is fitting the name in DB
+                    public_key = payload[Other.NAME_SIZE:]  # Make sure client is registered in DB and that the name client provided is fitting the name in DB         
+                    send_and_update_aes(clients_db_conn, client.get_client_id(),
+                                        ResponseCodes.RECEIVED_PUBKEY_SENDING_AES, conn, public_key)
+                    # Generate AES symmetric key, sends it to client and stores in DB
+                    print(f"Client with id {client.get_client_id().hex()} has sent public key: {public_key.hex()}")
+                            
+                case RequestCodes.RECONNECTION:
+                    # AES key resend
+                    client.set_name(payload.rstrip(b'\0').decode('utf-8'))
+                    validate_name_and_id(clients_db_conn.cursor(), client.get_client_id(),
+                                         client.get_name())  # Make sure client is registered in DB and that the name client provided is fitting the name in DB
+                    send_and_update_aes(clients_db_conn, client.get_client_id(),
+                                        ResponseCodes.RECONNECTION_SUCCEEDED_SENDING_AES, conn)
+                    # Generate AES symmetric key, sends it to client and stores in DB
+                    print(f"Client with id {client.get_client_id().hex()} has logged in")
+
+                case RequestCodes.SIGNATURE:
+                    # Update mode: signatures of the stored copy of a file, so the client sends only what changed (block size 0 means the file is new)
+                    set_aes_name(clients_db_conn.cursor(), client)  # Retrieve AES and name to client from DB (aes for decrypting the delta)
+                    client.set_file_name(os.path.basename(
+                        payload.rstrip(b'\0').decode('utf-8')))  # Basename removes characters such as ../ to prevent directory traversal attack
+                    client.end_update()
+                    with self.file_locks(client_file_path(client)):
+                        source = open_stored_file(files_db_conn.cursor(), client)
+                    if source is None:
+                        SignaturesResponse(client.get_client_id(), 0, []).send(conn)
+                    else:
+                        block_size, signatures = block_signatures(source)
+                        client.start_update(block_size, source)
+                        SignaturesResponse(client.get_client_id(), block_size, signatures).send(conn)
+                        print(f"Sent {len(signatures)} block signatures of file {client.get_file_name()} to client with id {client.get_client_id().hex()}")
+
+                case RequestCodes.SENDING_FILE | RequestCodes.DELTA_FILE:
+                    # File transfer (requires locking the file). A delta travels the same way, then the new version is rebuilt from it and the stored copy
+                    offset = Other.CONTENTSIZE_SIZE + Other.FILE_NAME_SIZE + Other.ORIG_FILE_SIZE + Other.PACKET_NUM_TOTAL_PACKETS_SIZE + Other.CKSUM_SIZE
+                    content_size, orig_file_size, total_packets, packet_num, packet_cksum, file_name = struct.unpack(
+                        f'<IIHHI{Other.FILE_NAME_SIZE}s', payload[:offset])
+                    new_transfer = client.get_round_remaining() == 0  # Otherwise it's a packet of the current round or a resent corrupted packet
+
+                    # Only the DB rows of this client and file are touched, a duplicate insert by another connection fails in insert_file
+                    if new_transfer:
+                        if packet_num != 1:
+                            raise Exception(f"Packets sent in wrong order from client with id {client.get_client_id().hex()}")
+                        set_aes_name(clients_db_conn.cursor(), client)  # Retrieve AES and name to client from DB (aes for decrypting file)
+                        file_name = os.path.basename(file_name.rstrip(b'\0').decode('utf-8'))  # Basename removes characters such as ../ to prevent directory traversal attack
+                    if new_transfer and code == RequestCodes.DELTA_FILE:
+                        if client.get_update_source() is None or file_name != client.get_file_name():
+                            raise Exception(f"Delta for file {file_name} without its signatures from client with id {client.get_client_id().hex()}")
+                        client.set_file_path(client_file_path(client) + '.delta.tmp')  # The stored copy stays in place until the client confirms the new version
+                    elif new_transfer:
+                        client.end_update()
+                        client.set_file_name(file_name)
+                        if file_exists(files_db_conn.cursor(), client.get_client_id(), 
+                                       client.get_file_name()):  # Check that a client's file doesn't already exist in DB 
+                                                                 # (the protocol didn't mention but I chose to not allow overwriting existing files)  
+                            raise DuplicateFileError(f'File {client.get_file_name()} for client with id {client.get_client_id().hex()} already exists') 
+                        client.set_file_path(client_file_path(client))
+                        insert_file(client)  # Insert client's file to DB
+                        self.unverified_file = client.get_file_name()
+
+                    # Locking the file (the stored copy of an update and its temporary files share the lock of the stored copy's path)
+                    with self.file_locks(client_file_path(client)):
+
+                        if new_transfer:
+                            os.makedirs(os.path.dirname(client.get_file_path()), exist_ok=True)  # Make the file's fan-out directory
+                            client.open_file('wb')  # Open file to write to it and copy client's file
+                            client.truncate_file(content_size)  # Preallocated, every packet's plaintext is written in place as it arrives
+                            client.set_decryptor(PacketDecryptor(client.get_aes(), content_size, total_packets, client.write_to_file_at))
+                            client.set_round_remaining(total_packets)
+                            client.get_corrupted_packets().clear()
+                        elif packet_num < 1 or packet_num > total_packets:
+                            raise Exception(f"Invalid packet number {packet_num} from client with id {client.get_client_id().hex()}")
+
+                        encrypted_content = payload[offset:]
+                        with metrics.timed('server_phase_seconds', phase='crc'):
+                            packet_ok = cksum.memcrc(encrypted_content) == packet_cksum
+                        if not packet_ok:  # Keeping the rest of the file, only this packet will be requested again
+                            client.get_corrupted_packets().add(packet_num)
+                            log.warning(f"Received corrupted packet number {packet_num} for file {client.get_file_name()} from client with id {client.get_client_id().hex()}")
+                        else:
+                            client.get_corrupted_packets().discard(packet_num)
+                            with metrics.timed('server_phase_seconds', phase='decrypt'):  # Writing the plaintext in place included
+                                client.get_decryptor().add(packet_num, encrypted_content)
+                            # Every packet at DEBUG, one in every PACKET_LOG_INTERVAL at INFO: a line per packet costs more than the packet at high rates
+                            log.log(logging.INFO if packet_num % Other.PACKET_LOG_INTERVAL == 1 else logging.DEBUG,
+                                    f"Received packet number {packet_num} of {total_packets} for file {client.get_file_name()} from client with id {client.get_client_id().hex()}")
+                        ReceivedMessageResponse(client.get_client_id()).send(conn)  # To indicate there was no problem receiving the packet
+                        client.set_round_remaining(client.get_round_remaining() - 1)
+
+                        if client.get_round_remaining() == 0 and client.get_corrupted_packets():  # End of round, asking for the corrupted packets only
+                            corrupted_packets = sorted(client.get_corrupted_packets())
+                            client.set_round_remaining(len(corrupted_packets))
+                            PacketsNackResponse(client.get_client_id(), corrupted_packets).send(conn)
+                            print(f"Asked client with id {client.get_client_id().hex()} to resend {len(corrupted_packets)} corrupted packets")
+
+                        elif client.get_round_remaining() == 0:  # Every packet is already decrypted and cksummed, only the padding is cut off
+                            crc, decrypted_size = client.get_decryptor().finish()
+                            client.truncate_file(decrypted_size)
+                            client.close_file()
+                            client.set_decryptor(None)
+                            if code == RequestCodes.DELTA_FILE:
+                                with open(client.get_file_path(), 'rb') as delta_file:
+                                    delta = delta_file.read()
+                                os.remove(client.get_file_path())  # The delta is only needed to rebuild the new version next to the stored copy
+                                with open(client_file_path(client) + '.new.tmp', 'wb') as new_version, metrics.timed('server_phase_seconds', phase='delta'):
+                                    crc, decrypted_size = apply_delta(delta, client.get_update_source(), new_version, client.get_update_block_size())
+                            if decrypted_size != orig_file_size:
+                                raise Exception(f"Invalid original size from client with id {client.get_client_id().hex()}")
+                            FileReceivedResponse(client.get_client_id(), content_size,
+                                                 client.get_file_name().encode('utf-8'), crc).send(conn)
+
+                case RequestCodes.CHUNK_MANIFEST:
+                    # Deduplicated file transfer: the client describes the file as content defined chunks, in batches, and sends only the chunks the chunk store doesn't have
+                    # (and a few it has, as proof it holds the file rather than just its digest)
+                    offset = Other.ORIG_FILE_SIZE + Other.PACKET_NUM_TOTAL_PACKETS_SIZE + Other.DIGEST_SIZE + Other.FILE_NAME_SIZE
+                    orig_file_size, total_batches, batch_num, file_digest, file_name = struct.unpack(
+                        f'<IHH{Other.DIGEST_SIZE}s{Other.FILE_NAME_SIZE}s', payload[:offset])
+
+                    if batch_num == 1:
+                        set_aes_name(clients_db_conn.cursor(), client)  # Retrieve AES and name to client from DB (aes for decrypting chunks)
+                        client.set_file_name(os.path.basename(
+                            file_name.rstrip(b'\0').decode('utf-8')))  # Basename removes characters such as ../ to prevent directory traversal attack
+                        if file_exists(files_db_conn.cursor(), client.get_client_id(), client.get_file_name()):
+                            raise DuplicateFileError(f'File {client.get_file_name()} for client with id {client.get_client_id().hex()} already exists')
+                        client.set_file_path(None)  # The file lives in the chunk store
+                        insert_file(client)
+                        self.unverified_file = client.get_file_name()
+                        client.start_manifest(file_digest, orig_file_size)
+                        with write_transaction(files_db_conn) as cursor:  # The recipe can't be dropped between finding and linking it
+                            recipe = find_recipe(cursor, client.get_client_id(), file_digest)
+                            if recipe and recipe[0] == orig_file_size:  # The client already sent this exact file under another name
+                                link_recipe(cursor, client, file_digest)
+                        if recipe and recipe[0] == orig_file_size:
+                            FileReceivedResponse(client.get_client_id(), orig_file_size,
+                                                 client.get_file_name().encode('utf-8'), recipe[1]).send(conn)
+                            print(f"File {client.get_file_name()} from client with id {client.get_client_id().hex()} is already in the chunk store as another file of the client")
+                            return True
+                    elif file_digest != client.get_file_digest():
+                        raise Exception(f"Manifest batches of different files from client with id {client.get_client_id().hex()}")
+
+                    entries = payload[offset:]
+                    for i in range(0, len(entries) - len(entries) % (Other.DIGEST_SIZE + Other.CHUNK_SIZE_SIZE), Other.DIGEST_SIZE + Other.CHUNK_SIZE_SIZE):
+                        client.get_manifest().append(struct.unpack_from(f'<{Other.DIGEST_SIZE}sH', entries, i))
+                    if batch_num < total_batches:
+                        ReceivedMessageResponse(client.get_client_id()).send(conn)  # Waiting for the next batch
+                    else:
+                        self.complete_manifest(client, files_db_conn, conn, Other.CHALLENGE_CHUNKS)
+
+                case RequestCodes.CHUNK_DATA:
+                    # A chunk of a deduplicated file the chunk store didn't have
+                    chunk_index = struct.unpack('<I', payload[:Other.CHUNK_INDEX_SIZE])[0]
+                    if chunk_index not in client.get_missing_chunks():
+                        raise Exception(f"Chunk {chunk_index} was not requested from client with id {client.get_client_id().hex()}")
+                    digest, size = client.get_manifest()[chunk_index]
+                    with metrics.timed('server_phase_seconds', phase='decrypt'):
+                        chunk = aes_decrypt(client.get_aes(), payload[Other.CHUNK_INDEX_SIZE:])  # Every chunk is encrypted on its own
+                    if len(chunk) != size or hashlib.sha256(chunk).digest() != digest:  # Never letting a chunk in the store under a wrong digest
+                        raise Exception(f"Chunk {chunk_index} from client with id {client.get_client_id().hex()} does not match its digest")
+                    with self.chunk_locks(digest), metrics.timed('server_phase_seconds', phase='file_io'):  # remove_chunks checks DB under the same lock, so a chunk can't be removed while it's stored again
+                        store_chunk(files_db_conn, digest, chunk, cksum.crc_update(0, chunk))
+                    client.get_stored_chunks().add(digest)
+                    client.get_missing_chunks().discard(chunk_index)
+                    ReceivedMessageResponse(client.get_client_id()).send(conn)
+                    if not client.get_missing_chunks():
+                        self.complete_manifest(client, files_db_conn, conn, 0)  # The chunks just sent answered the challenge
+
+                case RequestCodes.JOIN_PARTS:
+                    # A parallel upload sends a large file in parts, each stored as a file of its own, and joins them once the last part is verified
+                    offset = Other.FILE_NAME_SIZE + Other.PART_COUNT_SIZE + Other.TOTAL_SIZE_SIZE + Other.CKSUM_SIZE
+                    file_name, total_parts, total_size, file_cksum = struct.unpack(f'<{Other.FILE_NAME_SIZE}sIQI', payload[:offset])
+                    set_aes_name(clients_db_conn.cursor(), client)  # Only a registered client's parts are joined, like any file it sends
+                    client.set_file_name(os.path.basename(
+                        file_name.rstrip(b'\0').decode('utf-8')))  # Basename removes characters such as ../ to prevent directory traversal attack
+                    if not 0 < total_parts <= Other.MAX_PARTS:  # The count comes from the wire, and every part is looked up in turn
+                        raise Exception(f"Invalid number of parts {total_parts} of file {client.get_file_name()} from client with id {client.get_client_id().hex()}")
+                    client.set_file_path(client_file_path(client))
+                    joined_path = f'{client.get_file_path()}.{uuid.uuid4().hex}.join.tmp'  # Two joins of the same file don't write over each other
+                    crc, size = self.join_parts(files_db_conn, client, total_parts, joined_path)
+                    try:
+                        if size != total_size or cksum.crc_finalize(crc, size) != file_cksum:
+                            raise Exception(f"Parts of file {client.get_file_name()} from client with id {client.get_client_id().hex()} don't add up to the file")
+                        with self.file_locks(client.get_file_path()):  # Another join or an update of the file waits until the stored copy and its row agree
+                            if file_exists(files_db_conn.cursor(), client.get_client_id(), client.get_file_name()):  # Replacing the stored copy, like an update
+                                orphan_chunks = replace_with_plain_file(files_db_conn, client)
+                            else:
+                                orphan_chunks = None
+                                insert_file(client)
+                            os.replace(joined_path, client.get_file_path())
+                            verify_file(client)
+                    except BaseException:
+                        if os.path.exists(joined_path):
+                            os.remove(joined_path)
+                        raise
+                    if orphan_chunks:
+                        remove_chunks(files_db_conn.cursor(), orphan_chunks, self.chunk_locks)
+                    self.remove_parts(files_db_conn, client, total_parts)
+                    ReceivedMessageResponse(client.get_client_id()).send(conn)
+                    print(f'Joined {total_parts} parts of file {client.get_file_name()} from client {client.get_client_id().hex()}')
+                    return False
+
+                case RequestCodes.VALID_CRC:
+                    # File verification
+                    client.set_file_name(payload.rstrip(b'\0').decode('utf-8'))
+                    if not file_exists(files_db_conn.cursor(), client.get_client_id(), client.get_file_name()):
+                        raise InexistentFileError(
+                            f'File {client.get_file_name()} does not exist in DB. Therefore there is no file to verify.')
+                    if client.get_update_source() is not None:  # Swapping the rebuilt version in for the stored copy
+                        client.end_update()  # Closing the stored copy first, it can't be replaced while open on Windows
+                        client.set_file_path(client_file_path(client))
+                        orphan_chunks = replace_with_plain_file(files_db_conn, client)  # A deduplicated copy is replaced by a plain file
+                        with self.file_locks(client.get_file_path()):
+                            os.replace(client.get_file_path() + '.new.tmp', client.get_file_path())
+                        if orphan_chunks:
+                            remove_chunks(files_db_conn.cursor(), orphan_chunks, self.chunk_locks)
+                    verify_file(client)  # Verifying file after receiving valid crc
+                    self.unverified_file = None
+                    ReceivedMessageResponse(client.get_client_id()).send(conn)
+                    end_time = time.time()
+                    print(f'Successfully received file {client.get_file_name()} from client {client.get_client_id().hex()} in {end_time - start_time} seconds')
+                    if end_time > start_time:
+                        metrics.observe('server_session_throughput_bytes_per_second', self.received_bytes / (end_time - start_time))
+                    return False  # Taking care of client finished because file received successfully
+
+                case RequestCodes.INVALID_CRC_RESENDING | RequestCodes.INVALID_CRC_ABORT:
+                    client.set_file_name(payload.rstrip(b'\0').decode('utf-8'))
+                    client.set_round_remaining(0)  # The client may also abort in the middle of a round, after too many corrupted packets
+                    client.set_decryptor(None)
+                    client.close_file()
+                    if not file_exists(files_db_conn.cursor(), client.get_client_id(), client.get_file_name()):
+                        raise InexistentFileError(
+                            f'File {client.get_file_name()} does not exist in DB. Therefore there is no file to attempt sending again or abort.')
+                    if client.get_update_source() is not None:  # An update that failed keeps the stored copy, only the rebuilt version is dropped
+                        self.remove_update_files(client)
+                        if code == RequestCodes.INVALID_CRC_ABORT:
+                            client.end_update()
+                    else:
+                        # Removing file from DB in order to be able re-adding it during the next attempt, or removing it to abort after 4 attempts
+                        self.remove_unverified_file(files_db_conn, client)  # The protocol did not mention a response to send in the case of resending
+                        self.unverified_file = None
+                    if code == RequestCodes.INVALID_CRC_ABORT:
+                        ReceivedMessageResponse(client.get_client_id()).send(
+                            conn)  # In this case of abort sending this response following the protocol
+                        print(f'Abort. Cannot receive file {client.get_file_name()} from client {client_id.hex()}')
+                        return False  # Taking care of client finished because file cannot be sent after 4 attempts
+                    
+        except UnregisteredClientError as e:
+            failed = True
+            print(f"Client has to sign up exception: {e}")
+            FailedReconnectionResponse(client.get_client_id()).send(conn)
+        except DuplicateClientError as e:
+            failed = True
+            print(f"Client already signed up exception: {e}")
+            FailedRegistrationResponse().send(conn)
+        except (DuplicateFileError,
+                InexistentFileError) as e:  # By the protocol, there are no specific responses for these errors so general failure will be sent
+            failed = True
+            print(f"Exception: {e}")
+            GeneralFailureResponse().send(conn)
+        except (OSError, # Will usually occur after 4 attempts that client sends request after getting error code 1607 from server (following the protocol)
+                ConnectionAbortedError) as e:  
+            failed = True
+            if e.errno == Other.CONNECTION_ABORTED_ERROR:
+                print(f"Connection with client has been aborted: {e}")  # In this case there no connection therefore no response to client
+            return False
+        except Exception as e:
+            failed = True
+            print(f"Exception: {e}")
+            GeneralFailureResponse().send(conn)
+        finally:
+            label = int(code) if code in REQUEST_CODES else 'invalid'  # Not a label per garbage code a client may send
+            metrics.count('server_requests_total', code=label)
+            metrics.count('server_received_bytes_total', len(header) + len(payload))
+            metrics.observe('server_request_seconds', time.perf_counter() - handle_start, code=label)
+            if failed:
+                metrics.count('server_request_failures_total', code=label)
+            for db_conn in (clients_db_conn, files_db_conn):  # A request that failed halfway doesn't leave a transaction open on the thread's connections
+                if db_conn.in_transaction:
+                    db_conn.rollback()
+        return True
+
+    # Releases the files the client left open, once the connection is closed, and drops what the client went away in the middle of sending,
+    # so sending it again on another connection (like a parallel upload retrying a part) doesn't find a duplicate
+    def close(self):
+        client = self.client
+        client.set_decryptor(None)
+        client.close_file()
+        try:
+            if self.unverified_file is not None:
+                unverified = Client()
+                unverified.set_client_id(client.get_client_id())
+                unverified.set_file_name(self.unverified_file)
+                self.remove_unverified_file(thread_db()[1], unverified)
+                print(f"Removed unverified file {self.unverified_file} of client with id {client.get_client_id().hex()}")
+            if client.get_update_source() is not None:  # An update that didn't finish keeps the stored copy
+                self.remove_update_files(client)
+            if client.get_stored_chunks():  # The client went away before the recipe of its deduplicated file was committed
+                remove_uncommitted_chunks(thread_db()[1], client.get_stored_chunks(), self.chunk_locks)
+        except Exception as e:
+            print(f"Error cleaning up after client with id {client.get_client_id().hex()}: {e}")
+        client.end_update()
+        if self.capture:
+            self.capture.close_session(self.capture_session)
+
+    # Removes a file of client that wasn't verified, from DB and from the file system or chunk store
+    def remove_unverified_file(self, files_db_conn, client):
+        remove_file(client)
+        orphan_chunks = unlink_recipe(files_db_conn, client)  # None unless the file was deduplicated
+        if orphan_chunks is not None:
+            remove_chunks(files_db_conn.cursor(), orphan_chunks, self.chunk_locks)
+        else:
+            with self.file_locks(client_file_path(client)):  # Removing file from file system as well (a deduplicated file that wasn't committed has none)
+                if os.path.exists(client_file_path(client)):
+                    os.remove(client_file_path(client))
+
+    # Removes the rebuilt version of an update and the delta it was rebuilt from, the stored copy stays as it is
+    def remove_update_files(self, client):
+        with self.file_locks(client_file_path(client)):
+            for path in (client_file_path(client) + '.delta.tmp', client_file_path(client) + '.new.tmp'):
+                if os.path.exists(path):
+                    os.remove(path)
+
+    # Names of the parts of a file of client, made one at a time as they're looked up
+    @staticmethod
+    def part_names(client, total_parts):
+        return (f'{client.get_file_name()}.part{part}' for part in range(1, total_parts + 1))
+
+    # Copies the verified parts of a file of client into joined_path, in order. Returns the cksum state and size of the joined file
+    def join_parts(self, files_db_conn, client, total_parts, joined_path):
+        part = Client()
+        part.set_client_id(client.get_client_id())
+        crc = size = 0
+        os.makedirs(os.path.dirname(joined_path), exist_ok=True)
+        try:
+            with open(joined_path, 'wb') as joined, metrics.timed('server_phase_seconds', phase='file_io'):
+                for part_name in self.part_names(client, total_parts):
+                    part.set_file_name(part_name)
+                    with self.file_locks(client_file_path(part)):
+                        source = open_stored_file(files_db_conn.cursor(), part)
+                    if source is None:
+                        raise InexistentFileError(f'Part {part_name} from client with id {client.get_client_id().hex()} was not received')
+                    with source:
+                        while data := source.read(1 << 20):
+                            joined.write(data)
+                            crc = cksum.crc_update(crc, data)
+                            size += len(data)
+        except BaseException:
+            os.remove(joined_path)
+            raise
+        return crc, size
+
+    # Removes the parts of a file once they're joined, from DB and from the file system or chunk store
+    def remove_parts(self, files_db_conn, client, total_parts):
+        part = Client()
+        part.set_client_id(client.get_client_id())
+        for part_name in self.part_names(client, total_parts):
+            part.set_file_name(part_name)
+            remove_file(part)
+            orphan_chunks = unlink_recipe(files_db_conn, part)  # None unless the part was deduplicated
+            if orphan_chunks is not None:
+                remove_chunks(files_db_conn.cursor(), orphan_chunks, self.chunk_locks)
+            else:
+                with self.file_locks(client_file_path(part)):
+                    if os.path.exists(client_file_path(part)):
+                        os.remove(client_file_path(part))
+
+    # Commits a deduplicated file once the chunk store has all of its chunks and the client proved it holds the file,
+    # otherwise asks the client for the missing ones and up to challenge of the others
+    def complete_manifest(self, client, files_db_conn, conn, challenge):
+        crc, missing_chunks = commit_recipe(files_db_conn, client, challenge)
+        if missing_chunks:
+            client.get_missing_chunks().update(missing_chunks)
+            ChunksMissingResponse(client.get_client_id(), len(client.get_manifest()), missing_chunks).send(conn)
+            print(f"Asked client with id {client.get_client_id().hex()} for {len(missing_chunks)} of {len(client.get_manifest())} chunks")
+        else:
+            client.get_stored_chunks().clear()  # The recipe references them now
+            FileReceivedResponse(client.get_client_id(), client.get_orig_file_size(),
+                                 client.get_file_name().encode('utf-8'), crc).send(conn)
@@ -0,0 +1,53 @@
+import os
+import threading
+import time
+import zlib
+from contextlib import contextmanager
+from Metrics import metrics
+from Constants import Other
+
+try:
+    import fcntl
+except ImportError:  # Windows, where the server runs in a single process anyway
+    fcntl = None
+
+
+class StripedLock: # A fixed pool of locks that keys are hashed over, so every file or chunk effectively gets its own lock without keeping a lock per key
+
+    """
+
+    Unrelated keys only contend when they happen to share a stripe, and with enough stripes that's rare.
+    Callers never hold two stripes at once, so two keys sharing a stripe can't deadlock.
+    When the server runs as several worker processes, directory holds a lock file per stripe and every stripe also
+    takes a flock on its file, so the stripes exclude the threads of all processes. The system releases those locks
+    when a process dies, so a worker that crashes while holding a stripe can't block the workers replacing it.
+    (Not lockf byte ranges in one file: those belong to the whole process, and the kernel reports a deadlock
+    when two processes' threads merely wait on each other's stripes.)
+    The time every caller waits for its stripe is recorded under the lock's name.
+
+    """
+
+    def __init__(self, name, stripes=Other.LOCK_STRIPES, directory=None):
+        self.__name = name
+        self.__locks = [threading.Lock() for _ in range(stripes)]
+        self.__fds = None
+        if directory:
+            os.makedirs(directory, exist_ok=True)
+            self.__fds = [os.open(os.path.join(directory, f'{stripe}.lock'), os.O_RDWR | os.O_CREAT) for stripe in range(stripes)]
+
+    def __call__(self, key):
+        stripe = zlib.crc32(key if isinstance(key, bytes) else key.encode('utf-8')) % len(self.__locks)  # Not hash(), it differs between processes
+        return self.__locked(stripe)
+
+    @contextmanager
+    def __locked(self, stripe):
+        start = time.perf_counter()
+        with self.__locks[stripe]:  # The process's threads share its descriptors, so they are kept apart by the thread lock
+            if self.__fds:
+                fcntl.flock(self.__fds[stripe], fcntl.LOCK_EX)
+            metrics.observe('server_lock_wait_seconds', time.perf_counter() - start, lock=self.__name)
+            try:
+                yield
+            finally:
+                if self.__fds:
+                    fcntl.flock(self.__fds[stripe], fcntl.LOCK_UN)
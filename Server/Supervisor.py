@@ -0,0 +1,76 @@
+import multiprocessing
+import multiprocessing.connection
+import os
+import signal
+import socket
+import sys
+import threading
+import time
+from StripedLock import fcntl
+from Constants import Other
+
+
+# Entry point of a worker process: a whole server of its own, listening on the port it shares with the other workers.
+# Its metrics (if any) are served on a port of its own, metrics_port, the same for the workers that replace it
+def run_worker(mode, metrics_port, log_level, max_queued, capture):
+    from Server import Server  # Imported in the worker, the supervisor itself never serves clients
+    from AsyncServer import AsyncServer
+    from Metrics import configure_logging
+    configure_logging(log_level)  # A spawned worker starts with a fresh logging configuration
+    print(f"Worker {os.getpid()} started")
+    threading.Thread(target=exit_with_supervisor, daemon=True).start()
+    server_class = AsyncServer if mode == 'async' else Server
+    capture = f'{capture}.{os.getpid()}' if capture else None  # A trace per worker, session_replay merges them by their start times
+    server = server_class(shared_port=True, metrics_port=metrics_port, max_queued=max_queued, capture=capture)
+    server.run()
+
+
+# Ends the worker once the supervisor is gone, however it ended, so no orphaned worker keeps serving the port
+def exit_with_supervisor():
+    multiprocessing.connection.wait([multiprocessing.parent_process().sentinel])
+    os._exit(0)
+
+
+class Supervisor:  # Runs the server as several worker processes sharing one listening port, and restarts the workers that die
+
+    """
+
+    Every worker binds the port with SO_REUSEPORT and the kernel spreads new connections over them, so CRC, decryption
+    and protocol parsing run on as many cores as there are workers instead of on the one core the GIL allows a process.
+    Each worker opens its own SQLite connections, and the file and chunk locks are shared through lock files.
+    A worker that dies takes only its own connections with it: the supervisor starts a new one in its place,
+    waiting a while first if the last one died right after starting, so a worker that can't start doesn't spin.
+
+    """
+
+    def __init__(self, workers, mode, metrics_port=0, log_level='INFO', max_queued=Other.MAX_QUEUED, capture=None):
+        if not hasattr(socket, 'SO_REUSEPORT') or fcntl is None:
+            raise Exception("Worker processes need SO_REUSEPORT and file locks, which this platform doesn't have")
+        self.workers, self.mode, self.metrics_port, self.log_level, self.max_queued, self.capture = workers, mode, metrics_port, log_level, max_queued, capture
+        self.context = multiprocessing.get_context('spawn')  # A fresh interpreter, not a fork of the supervisor
+
+    def start_worker(self, slot):
+        metrics_port = self.metrics_port + slot if self.metrics_port else 0
+        worker = self.context.Process(target=run_worker, args=(self.mode, metrics_port, self.log_level, self.max_queued, self.capture))
+        worker.start()
+        return worker, time.monotonic()
+
+    def run(self):
+        print(f"Supervisor {os.getpid()} starting {self.workers} workers")
+        signal.signal(signal.SIGTERM, lambda *_: sys.exit(0))  # Stopping the supervisor stops its workers too (in the finally below)
+        workers = [self.start_worker(slot) for slot in range(self.workers)]
+        try:
+            while True:
+                multiprocessing.connection.wait([worker.sentinel for worker, _ in workers])
+                for i, (worker, started) in enumerate(workers):
+                    if worker.is_alive():
+                        continue
+                    print(f"Worker {worker.pid} exited with code {worker.exitcode}, restarting it")
+                    if time.monotonic() - started < Other.WORKER_RESTART_DELAY:
+                        time.sleep(Other.WORKER_RESTART_DELAY)
+                    workers[i] = self.start_worker(i)
+        finally:
+            for worker, _ in workers:
+                worker.terminate()
+            for worker, _ in workers:
+                worker.join()
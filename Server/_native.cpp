@@ -0,0 +1,117 @@
+// Native versions of the server's hot paths: the cksum engine shared with the client (Client/cksum.cpp) and AES-CBC decryption.
+// Every function releases the GIL while it crunches bytes, so other handle_client threads keep running meanwhile.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "cksum.h"
+#ifdef NATIVE_HAVE_CRYPTOPP
+#include <aes.h>
+#include <modes.h>
+#endif
+
+
+namespace {
+	// Holds a buffer protocol view (bytes, bytearray, memoryview) for as long as the call uses it
+	struct Buffer {
+		Py_buffer view{};
+		~Buffer() {
+			if (view.obj)
+				PyBuffer_Release(&view);
+		}
+	};
+
+	PyObject* native_crc_update(PyObject*, PyObject* args) {
+		unsigned long crc;
+		Buffer data;
+		if (!PyArg_ParseTuple(args, "ky*:crc_update", &crc, &data.view))
+			return nullptr;
+		Py_BEGIN_ALLOW_THREADS
+		crc = crc_update(static_cast<uint32_t>(crc), data.view.buf, static_cast<size_t>(data.view.len));
+		Py_END_ALLOW_THREADS
+		return PyLong_FromUnsignedLong(crc);
+	}
+
+	PyObject* native_crc_finalize(PyObject*, PyObject* args) {
+		unsigned long crc;
+		unsigned long long n;
+		if (!PyArg_ParseTuple(args, "kK:crc_finalize", &crc, &n))
+			return nullptr;
+		return PyLong_FromUnsignedLong(crc_finalize(static_cast<uint32_t>(crc), static_cast<size_t>(n)));
+	}
+
+	PyObject* native_crc_combine(PyObject*, PyObject* args) {
+		unsigned long crc1, crc2;
+		unsigned long long len2;
+		if (!PyArg_ParseTuple(args, "kkK:crc_combine", &crc1, &crc2, &len2))
+			return nullptr;
+		return PyLong_FromUnsignedLong(crc_combine(static_cast<uint32_t>(crc1), static_cast<uint32_t>(crc2), static_cast<size_t>(len2)));
+	}
+
+	PyObject* native_memcrc(PyObject*, PyObject* args) {
+		Buffer data;
+		if (!PyArg_ParseTuple(args, "y*:memcrc", &data.view))
+			return nullptr;
+		unsigned long crc;
+		Py_BEGIN_ALLOW_THREADS
+		crc = memcrc(static_cast<const char*>(data.view.buf), static_cast<size_t>(data.view.len));
+		Py_END_ALLOW_THREADS
+		return PyLong_FromUnsignedLong(crc);
+	}
+
+#ifdef NATIVE_HAVE_CRYPTOPP
+	// Decrypts AES-CBC, optionally removing the PKCS#7 padding the client's AESWrapper adds (same checks as Crypto.Util.Padding.unpad)
+	PyObject* native_aes_cbc_decrypt(PyObject*, PyObject* args) {
+		Buffer key, iv, data;
+		int unpad = 1;
+		if (!PyArg_ParseTuple(args, "y*y*y*|p:aes_cbc_decrypt", &key.view, &iv.view, &data.view, &unpad))
+			return nullptr;
+		if (iv.view.len != CryptoPP::AES::BLOCKSIZE || data.view.len % CryptoPP::AES::BLOCKSIZE != 0 || (unpad && data.view.len == 0)) {
+			PyErr_SetString(PyExc_ValueError, "Data must be padded to the AES block size");
+			return nullptr;
+		}
+		if (key.view.len != 16 && key.view.len != 24 && key.view.len != 32) {
+			PyErr_SetString(PyExc_ValueError, "Incorrect AES key length");
+			return nullptr;
+		}
+		PyObject* plain = PyBytes_FromStringAndSize(nullptr, data.view.len); // Allocated while holding the GIL, filled without it
+		if (!plain)
+			return nullptr;
+		auto out = reinterpret_cast<CryptoPP::byte*>(PyBytes_AS_STRING(plain));
+		Py_BEGIN_ALLOW_THREADS
+		CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption(static_cast<const CryptoPP::byte*>(key.view.buf), static_cast<size_t>(key.view.len),
+			static_cast<const CryptoPP::byte*>(iv.view.buf));
+		decryption.ProcessData(out, static_cast<const CryptoPP::byte*>(data.view.buf), static_cast<size_t>(data.view.len));
+		Py_END_ALLOW_THREADS
+		if (!unpad)
+			return plain;
+		Py_ssize_t padding = out[data.view.len - 1];
+		bool valid = padding >= 1 && padding <= CryptoPP::AES::BLOCKSIZE;
+		for (Py_ssize_t i = 1; valid && i <= padding; i++)
+			valid = out[data.view.len - i] == padding;
+		if (!valid) {
+			Py_DECREF(plain);
+			PyErr_SetString(PyExc_ValueError, "Padding is incorrect.");
+			return nullptr;
+		}
+		if (_PyBytes_Resize(&plain, data.view.len - padding) < 0)
+			return nullptr;
+		return plain;
+	}
+#endif
+
+	PyMethodDef methods[] = {
+		{"crc_update", native_crc_update, METH_VARARGS, "crc_update(crc, data) -> raw cksum state after data"},
+		{"crc_finalize", native_crc_finalize, METH_VARARGS, "crc_finalize(crc, n) -> cksum of n bytes from the raw state"},
+		{"crc_combine", native_crc_combine, METH_VARARGS, "crc_combine(crc1, crc2, len2) -> raw state of two concatenated blocks"},
+		{"memcrc", native_memcrc, METH_VARARGS, "memcrc(data) -> POSIX cksum of data"},
+#ifdef NATIVE_HAVE_CRYPTOPP
+		{"aes_cbc_decrypt", native_aes_cbc_decrypt, METH_VARARGS, "aes_cbc_decrypt(key, iv, data, unpad=True) -> plaintext"},
+#endif
+		{nullptr, nullptr, 0, nullptr}
+	};
+
+	PyModuleDef module = { PyModuleDef_HEAD_INIT, "_native", "Native cksum and AES for the server", -1, methods };
+}
+
+PyMODINIT_FUNC PyInit__native() {
+	return PyModule_Create(&module);
+}
@@ -5,6 +5,8 @@ python.
 The constants and routine are cribbed from the POSIX man page
 """
 
+import functools
+
 crctab = [ 0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc,
         0x17c56b6b, 0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f,
         0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a,
@@ -59,16 +61,47 @@ crctab = [ 0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc,
         0xb1f740b4 ]
 
 UNSIGNED = lambda n: n & 0xffffffff
+POLY = 0x04c11db7
 
-def memcrc(b):
-    n = len(b)
-    i = c = s = 0
+def crc_update(s, b): # Raw (not yet finalized) state, starts at 0
     for ch in b:
         tabidx = (s>>24)^ch
         s = UNSIGNED((s << 8)) ^ crctab[tabidx]
+    return s
 
+def crc_finalize(s, n): # Appends the total length n and inverts, like the end of memcrc
     while n:
         c = n & 0o377
         n = n >> 8
         s = UNSIGNED(s << 8) ^ crctab[(s >> 24) ^ c]
-    return UNSIGNED(~s)
\ No newline at end of file
+    return UNSIGNED(~s)
+
+def mult_mod_p(a, b): # a*b modulo the cksum polynomial
+    p = 0
+    for i in range(31, -1, -1):
+        p = UNSIGNED(p << 1) ^ POLY if p & 0x80000000 else p << 1
+        if a >> i & 1:
+            p ^= b
+    return p
+
+@functools.lru_cache(maxsize=8192)
+def xpow8n_mod_p(n): # x^(8n) modulo the cksum polynomial, cached since chunks and packets repeat the same few lengths
+    result, power = 1, 0x100 # x^8
+    while n:
+        if n & 1:
+            result = mult_mod_p(result, power)
+        power = mult_mod_p(power, power)
+        n >>= 1
+    return result
+
+def crc_combine(crc1, crc2, len2): # State of piece 1 followed by piece 2 (len2 bytes long), from the states of both
+    return mult_mod_p(crc1, xpow8n_mod_p(len2)) ^ crc2
+
+def memcrc(b):
+    return crc_finalize(crc_update(0, b), len(b))
+
+try: # The native module built by setup.py runs the client's C++ cksum engine (slicing-by-16 / PCLMULQDQ) without holding the GIL
+    from _native import crc_update, crc_finalize, crc_combine, memcrc
+    NATIVE = True
+except ImportError:
+    NATIVE = False
@@ -2,13 +2,42 @@
 # Author: Guni 
 
 
+import argparse
+import os
+from Constants import Other
 from Server import Server
+from AsyncServer import AsyncServer
+from Supervisor import Supervisor
+from Metrics import configure_logging
+from FileAndDBHelper import sweep_unreferenced_chunks
 
 
 def main():
     
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--mode', choices=['async', 'threads'], default='async',
+                        help='async serves every connection from one event loop, threads gives each connection a thread of the pool')
+    parser.add_argument('--workers', type=int, default=1,
+                        help='number of worker processes sharing the port, 0 for one per core (1 runs the server in this process)')
+    parser.add_argument('--metrics-port', type=int, default=0,
+                        help='serves Prometheus metrics at /metrics on this port (worker processes on the ports after it), 0 to disable')
+    parser.add_argument('--max-queued', type=int, default=Other.MAX_QUEUED,
+                        help='work waiting for a thread of the pool beyond which new clients get a busy response (per worker process)')
+    parser.add_argument('--log-level', choices=['DEBUG', 'INFO', 'WARNING'], default='INFO',
+                        help='DEBUG logs every received packet, INFO one packet in every PACKET_LOG_INTERVAL')
+    parser.add_argument('--capture', metavar='TRACE',
+                        help='records every session (requests, sizes and timing, no content) to this file for Benchmarks/session_replay (each worker process to TRACE.<pid>)')
+    args = parser.parse_args()
+    configure_logging(args.log_level)
     try:
-        server = Server()
+        if removed := sweep_unreferenced_chunks():  # Before any worker serves clients
+            print(f"Removed {removed} chunks left unreferenced by interrupted uploads")
+        workers = args.workers or os.cpu_count()
+        if workers > 1:
+            server = Supervisor(workers, args.mode, args.metrics_port, args.log_level, args.max_queued, args.capture)
+        else:
+            server_class = AsyncServer if args.mode == 'async' else Server
+            server = server_class(metrics_port=args.metrics_port, max_queued=args.max_queued, capture=args.capture)
         server.run()
     except Exception as e:
         print(f"Exception: {e}")
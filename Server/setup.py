@@ -0,0 +1,40 @@
+# Builds the _native extension module next to the server sources:
+#     python setup.py build_ext --inplace
+# The cksum engine is always built (from the client's cksum.cpp). AES decryption is built too when Crypto++ is found,
+# in CRYPTOPP_DIR (a directory holding aes.h, with the library in it or in CRYPTOPP_LIB_DIR) or in the usual system locations.
+# The server falls back to the pure Python cksum and to pycryptodome for whatever the module doesn't provide.
+import os
+import sys
+from setuptools import setup, Extension
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CLIENT_DIR = os.path.join(HERE, '..', 'Client')
+
+
+def find_cryptopp():
+    candidates = [os.environ.get('CRYPTOPP_DIR'), '/usr/include/cryptopp', '/usr/local/include/cryptopp', '/opt/homebrew/include/cryptopp']
+    for include_dir in filter(None, candidates):
+        if os.path.exists(os.path.join(include_dir, 'aes.h')):
+            return include_dir, os.environ.get('CRYPTOPP_LIB_DIR', include_dir)
+    return None, None
+
+
+include_dirs, library_dirs, libraries, define_macros = [CLIENT_DIR], [], [], []
+cryptopp_include, cryptopp_lib = find_cryptopp()
+if cryptopp_include:
+    include_dirs.append(cryptopp_include)
+    library_dirs.append(cryptopp_lib)
+    libraries.append('cryptlib' if sys.platform == 'win32' else 'cryptopp')  # The Visual Studio project of Crypto++ names the library cryptlib
+    define_macros.append(('NATIVE_HAVE_CRYPTOPP', '1'))
+else:
+    print('Crypto++ not found, building _native without AES (set CRYPTOPP_DIR to enable it)')
+
+extra_compile_args = ['/O2', '/std:c++17', '/EHsc'] if sys.platform == 'win32' else ['-O3', '-std=c++17']
+
+setup(
+    name='_native',
+    ext_modules=[Extension('_native',
+                           sources=['_native.cpp', os.path.relpath(os.path.join(CLIENT_DIR, 'cksum.cpp'), HERE)],
+                           include_dirs=include_dirs, library_dirs=library_dirs, libraries=libraries,
+                           define_macros=define_macros, extra_compile_args=extra_compile_args, language='c++')],
+)
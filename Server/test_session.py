@@ -0,0 +1,287 @@
+# Tests of what a session leaves behind when the client goes away in the middle of sending a file, of what the chunk store
+# gives away to a client that only names a file, and of a parted upload sent again after its join failed. Each test starts a server of its own in a temporary directory and speaks the protocol
+# to it over raw sockets:
+#     python -m unittest test_session                          (from the Server directory, against main.py)
+#     SERVER=../build/native_server python -m unittest test_session   (against another server serving the same directory layout)
+
+
+import hashlib
+import os
+import shlex
+import shutil
+import socket
+import sqlite3
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+import cksum
+from Crypto.PublicKey import RSA
+from Crypto.Cipher import PKCS1_OAEP, AES
+from Crypto.Util import Padding
+from Constants import RequestCodes, ResponseCodes, Other
+
+PACKET_SIZE = 7888  # The client's packet of encrypted content
+CHUNK_SIZE = 4000
+
+
+class ProtocolClient:  # Sends the requests of a client the way the C++ client does, one connection per instance
+
+    def __init__(self, port, client_id=bytes(16), aes=None):
+        self.conn = socket.create_connection(('127.0.0.1', port))
+        self.client_id, self.aes = client_id, aes
+
+    def request(self, code, payload):
+        self.conn.sendall(struct.pack('<16sBHI', self.client_id, Other.VERSION, code, len(payload)) + payload)
+
+    def response(self):
+        _, code, size = struct.unpack('<BHI', self.receive(7))
+        return code, self.receive(size)
+
+    def receive(self, size):
+        data = b''
+        while len(data) < size:
+            received = self.conn.recv(size - len(data))
+            if not received:
+                raise EOFError('Server closed the connection')
+            data += received
+        return data
+
+    def sign_up(self, name):
+        self.request(RequestCodes.REGISTRATION, name.encode().ljust(Other.NAME_SIZE, b'\0'))
+        code, payload = self.response()
+        assert code == ResponseCodes.REGISTRATION_SUCCEEDED, code
+        self.client_id = payload[:16]
+        key = RSA.generate(1024, e=17)  # The client's key size, so the public key has the protocol's 160 bytes
+        self.request(RequestCodes.PUBLIC_KEY, name.encode().ljust(Other.NAME_SIZE, b'\0') + key.publickey().export_key('DER'))
+        code, payload = self.response()
+        assert code == ResponseCodes.RECEIVED_PUBKEY_SENDING_AES, code
+        self.aes = PKCS1_OAEP.new(key).decrypt(payload[16:])
+
+    def encrypt(self, data):
+        return AES.new(self.aes, AES.MODE_CBC, iv=bytes(Other.IV_SIZE)).encrypt(Padding.pad(data, AES.block_size))
+
+    # Sends the packets of a file (or of a delta with code DELTA_FILE, data then rebuilding to orig_size bytes), the first count of them
+    # only if count is given. Returns the response to the last packet of the round
+    def send_packets(self, file_name, data, count=None, code=RequestCodes.SENDING_FILE, orig_size=None):
+        encrypted = self.encrypt(data)
+        total = (len(encrypted) + PACKET_SIZE - 1) // PACKET_SIZE
+        for packet_num in range(1, (count or total) + 1):
+            packet = encrypted[(packet_num - 1) * PACKET_SIZE:packet_num * PACKET_SIZE]
+            self.request(code, struct.pack(f'<IIHHI{Other.FILE_NAME_SIZE}s', len(encrypted), len(data) if orig_size is None else orig_size, total, packet_num,
+                                                                cksum.memcrc(packet), file_name.encode()) + packet)
+            assert self.response()[0] == ResponseCodes.RECEIVED_MSG
+        return self.response() if count is None else None
+
+    # Sends the manifest of a file as one batch (of chunks, the file's own unless given). Returns the response to it
+    def send_manifest(self, file_name, data, chunks=None):
+        chunks = chunks or [data[i:i + CHUNK_SIZE] for i in range(0, len(data), CHUNK_SIZE)]
+        entries = b''.join(struct.pack(f'<{Other.DIGEST_SIZE}sH', hashlib.sha256(chunk).digest(), len(chunk)) for chunk in chunks)
+        self.request(RequestCodes.CHUNK_MANIFEST, struct.pack(f'<IHH{Other.DIGEST_SIZE}s{Other.FILE_NAME_SIZE}s', len(data), 1, 1,
+                                                              hashlib.sha256(data).digest(), file_name.encode()) + entries)
+        return self.response()
+
+    # Indexes of the chunks a ChunksMissing response asks for
+    @staticmethod
+    def missing_chunks(payload):
+        total = struct.unpack_from('<I', payload, 16)[0]
+        return [i for i in range(total) if payload[20 + i // 8] >> (i % 8) & 1]
+
+    # Sends the manifest of a file and the chunks the server asks for, the first count of them only if count is given.
+    # Returns the response to the last chunk
+    def send_chunks(self, file_name, data, count=None, chunks=None):
+        chunks = chunks or [data[i:i + CHUNK_SIZE] for i in range(0, len(data), CHUNK_SIZE)]
+        code, payload = self.send_manifest(file_name, data, chunks)
+        assert code == ResponseCodes.CHUNKS_MISSING, code
+        for chunk_index in self.missing_chunks(payload)[:count]:
+            self.request(RequestCodes.CHUNK_DATA, struct.pack('<I', chunk_index) + self.encrypt(chunks[chunk_index]))
+            assert self.response()[0] == ResponseCodes.RECEIVED_MSG
+        return self.response() if count is None else None
+
+    # Sends a file the way the C++ client sends a part of a large file: as a delta against the server's copy when it has one. Returns the
+    # response to the last packet and whether it was a delta
+    def send_part(self, file_name, data):
+        self.request(RequestCodes.SIGNATURE, file_name.encode().ljust(Other.FILE_NAME_SIZE, b'\0'))
+        code, payload = self.response()
+        assert code == ResponseCodes.SIGNATURES, code
+        block_size, count = struct.unpack_from('<II', payload, 16)
+        if block_size == 0:
+            return self.send_packets(file_name, data), False
+        assert count == len(data) // block_size, count  # The copy holds the same content, every whole block is copied from it
+        tail = data[count * block_size:]
+        delta = struct.pack('<BII', Other.DELTA_COPY_OP, 0, count) + (struct.pack('<BI', Other.DELTA_LITERAL_OP, len(tail)) + tail if tail else b'')
+        return self.send_packets(file_name, delta, code=RequestCodes.DELTA_FILE, orig_size=len(data)), True
+
+    def join_parts(self, file_name, total_parts, data):
+        self.request(RequestCodes.JOIN_PARTS, struct.pack(f'<{Other.FILE_NAME_SIZE}sIQI', file_name.encode(), total_parts, len(data), cksum.memcrc(data)))
+        return self.response()[0]
+
+    def verify(self, file_name, received, data):
+        code, payload = received
+        assert code == ResponseCodes.VALID_CRC, code
+        assert struct.unpack_from('<I', payload, 16 + 4 + Other.FILE_NAME_SIZE)[0] == cksum.memcrc(data)
+        self.request(RequestCodes.VALID_CRC, file_name.encode().ljust(Other.FILE_NAME_SIZE, b'\0'))
+        assert self.response()[0] == ResponseCodes.RECEIVED_MSG
+
+    def close(self):
+        self.conn.close()
+
+
+class ServerTestCase(unittest.TestCase):  # Starts a server in a temporary directory and signs a client up with it
+
+    def setUp(self):
+        self.directory = tempfile.mkdtemp(prefix='test_session_')
+        with socket.socket() as s:  # A port nothing listens on, for the server to take
+            s.bind(('127.0.0.1', 0))
+            self.port = s.getsockname()[1]
+        with open(os.path.join(self.directory, 'port.info'), 'w') as f:
+            f.write(str(self.port))
+        command = shlex.split(os.environ['SERVER']) if 'SERVER' in os.environ else [sys.executable, os.path.abspath('main.py')]
+        self.server = subprocess.Popen(command, cwd=self.directory, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        for _ in range(100):
+            try:
+                socket.create_connection(('127.0.0.1', self.port)).close()
+                break
+            except OSError:
+                time.sleep(0.1)
+        client = ProtocolClient(self.port)
+        client.sign_up('abandoner' + os.urandom(4).hex())
+        client.close()
+        self.client_id, self.aes = client.client_id, client.aes
+
+    def tearDown(self):
+        self.server.terminate()
+        self.server.wait()
+        shutil.rmtree(self.directory)
+
+    def files_db(self, query):
+        with sqlite3.connect(os.path.join(self.directory, 'files.db')) as db:
+            return db.execute(query).fetchall()
+
+    # Waits until the server has noticed a closed connection and cleaned up after it
+    def wait_for(self, condition):
+        deadline = time.time() + 10
+        while not condition():
+            self.assertLess(time.time(), deadline, 'The server did not clean up after the closed connection')
+            time.sleep(0.05)
+
+
+
+class TestAbandonedTransfer(ServerTestCase):
+
+    def test_packets_sent_again_after_connection_cut(self):
+        data = os.urandom(5 * PACKET_SIZE)
+        client = ProtocolClient(self.port, self.client_id, self.aes)  # Like a session of a parallel upload, without a handshake of its own
+        client.send_packets('big.bin.part1', data, count=2)
+        client.close()
+        self.wait_for(lambda: not self.files_db('SELECT * FROM FilesTable'))
+        self.assertEqual([files for _, _, files in os.walk(os.path.join(self.directory, 'client_files')) if files], [])
+
+        client = ProtocolClient(self.port, self.client_id, self.aes)  # The retry is a new transfer, not a duplicate
+        client.verify('big.bin.part1', client.send_packets('big.bin.part1', data), data)
+        client.close()
+        self.assertEqual(self.files_db('SELECT "File Name", Verified FROM FilesTable'), [('big.bin.part1', 1)])
+
+    def test_chunks_sent_again_after_connection_cut(self):
+        data = os.urandom(10 * CHUNK_SIZE)
+        client = ProtocolClient(self.port, self.client_id, self.aes)
+        client.send_chunks('big.bin.part2', data, count=4)
+        client.close()
+        self.wait_for(lambda: not self.files_db('SELECT * FROM FilesTable') and not self.files_db('SELECT * FROM ChunksTable'))
+        self.assertEqual([files for _, _, files in os.walk(os.path.join(self.directory, 'chunk_store')) if files], [])
+
+        client = ProtocolClient(self.port, self.client_id, self.aes)
+        client.verify('big.bin.part2', client.send_chunks('big.bin.part2', data), data)
+        client.close()
+        self.assertEqual(self.files_db('SELECT "File Name", Verified FROM FilesTable'), [('big.bin.part2', 1)])
+        self.assertEqual(self.files_db('SELECT COUNT(*), MIN(RefCount) FROM ChunksTable'), [(10, 1)])
+
+
+class TestChunkStore(ServerTestCase):
+
+    def sign_up(self):
+        client = ProtocolClient(self.port)
+        client.sign_up('other' + os.urandom(4).hex())
+        return client
+
+    def test_file_of_another_client_needs_its_chunks(self):
+        data = os.urandom(10 * CHUNK_SIZE)
+        client = ProtocolClient(self.port, self.client_id, self.aes)
+        client.verify('shared.bin', client.send_chunks('shared.bin', data), data)
+        client.close()
+
+        other = self.sign_up()  # Naming the file by its digest alone gets no cksum, only a challenge
+        code, payload = other.send_manifest('shared.bin', data)
+        self.assertEqual(code, ResponseCodes.CHUNKS_MISSING)
+        self.assertEqual(len(ProtocolClient.missing_chunks(payload)), Other.CHALLENGE_CHUNKS)
+        other.close()
+
+        other = self.sign_up()  # Holding the file, it sends the chunks it's challenged with and the file is deduplicated
+        other.verify('shared.bin', other.send_chunks('shared.bin', data), data)
+        other.close()
+        self.assertEqual(self.files_db('SELECT COUNT(*), MIN(RefCount) FROM RecipesTable'), [(1, 2)])
+
+        client = ProtocolClient(self.port, self.client_id, self.aes)  # The client's own file again costs a single round trip
+        code, payload = client.send_manifest('copy.bin', data)
+        self.assertEqual(code, ResponseCodes.VALID_CRC)
+        client.verify('copy.bin', (code, payload), data)
+        client.close()
+
+    def test_manifest_not_matching_the_recipe(self):
+        data = os.urandom(10 * CHUNK_SIZE)
+        client = ProtocolClient(self.port, self.client_id, self.aes)
+        client.verify('shared.bin', client.send_chunks('shared.bin', data), data)
+        client.close()
+
+        other = self.sign_up()  # Chunks of its own adding up to the size of the file, under the file's digest
+        forged = [os.urandom(CHUNK_SIZE) for _ in range(10)]
+        code, _ = other.send_chunks('shared.bin', data, chunks=forged)
+        self.assertEqual(code, ResponseCodes.GENERAL_FAILURE)
+        other.close()
+        self.assertEqual(self.files_db('SELECT RefCount FROM RecipesTable'), [(1,)])
+
+
+class TestPartedUpload(ServerTestCase):
+
+    # Sends a part on a connection of its own, like a session of a parallel upload. Returns whether it was sent as a delta
+    def send_part(self, part, data):
+        client = ProtocolClient(self.port, self.client_id, self.aes)
+        received, resumed = client.send_part(f'big.bin.part{part}', data)
+        client.verify(f'big.bin.part{part}', received, data)
+        client.close()
+        return resumed
+
+    def test_upload_sent_again_after_a_part_failed(self):
+        parts = [os.urandom(3 * PACKET_SIZE + 100) for _ in range(3)]
+        for part in range(1, 3):  # The third part failed, so joining the parts fails too
+            self.assertFalse(self.send_part(part, parts[part - 1]))
+        client = ProtocolClient(self.port, self.client_id, self.aes)
+        self.assertEqual(client.join_parts('big.bin', 3, b''.join(parts)), ResponseCodes.GENERAL_FAILURE)
+        client.close()
+
+        for part in range(1, 4):  # Uploading again resumes the parts the server kept, rather than failing on them
+            self.assertEqual(self.send_part(part, parts[part - 1]), part < 3)
+        client = ProtocolClient(self.port, self.client_id, self.aes)
+        self.assertEqual(client.join_parts('big.bin', 3, b''.join(parts)), ResponseCodes.RECEIVED_MSG)
+        client.close()
+        self.assertEqual(self.files_db('SELECT "File Name", Verified FROM FilesTable'), [('big.bin', 1)])
+        (path,), = self.files_db('SELECT "Path Name" FROM FilesTable')
+        with open(os.path.join(self.directory, path), 'rb') as stored:
+            self.assertEqual(stored.read(), b''.join(parts))
+
+    def test_join_of_an_invalid_number_of_parts(self):
+        for total_parts in (0, Other.MAX_PARTS + 1, 0xffffffff):  # Turned away before a single part is looked up
+            client = ProtocolClient(self.port, self.client_id, self.aes)
+            started = time.time()
+            self.assertEqual(client.join_parts('big.bin', total_parts, b''), ResponseCodes.GENERAL_FAILURE)
+            self.assertLess(time.time() - started, 1)
+            client.close()
+        client = ProtocolClient(self.port, os.urandom(16), self.aes)  # Nor are the parts of a client that never signed up joined
+        self.assertEqual(client.join_parts('big.bin', 1, b''), ResponseCodes.GENERAL_FAILURE)
+        client.close()
+
+
+if __name__ == '__main__':
+    unittest.main()